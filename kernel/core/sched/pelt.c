@@ -0,0 +1,207 @@
+#include "../../include/types.h"
+#include "../../include/sched.h"
+#include "../../include/pelt.h"
+
+/*
+ * 按段累计、按段衰减的负载跟踪。每1024us(约1ms)为一段，段数n的衰减
+ * 系数y^n用查表加移位算，不做浮点运算：n按32分成整除部分(每32段
+ * 减半，直接右移)和余数部分(查runnable_avg_yN_inv)。
+ */
+
+/* runnable_avg_yN_inv[n] = y^n * 2^32，y^32 = 1/2 */
+static const u32 runnable_avg_yN_inv[LOAD_AVG_PERIOD] = {
+    0xffffffff, 0xfa83b2da, 0xf5257d14, 0xefe4b99a, 0xeac0c6e6, 0xe5b906e6,
+    0xe0ccdeeb, 0xdbfbb796, 0xd744fcc9, 0xd2a81d91, 0xce248c14, 0xc9b9bd85,
+    0xc5672a10, 0xc12c4cc9, 0xbd08a39e, 0xb8fbaf46, 0xb504f333, 0xb123f581,
+    0xad583ee9, 0xa9a15ab4, 0xa5fed6a9, 0xa2704302, 0x9ef5325f, 0x9b8d39b9,
+    0x9837f050, 0x94f4efa8, 0x91c3d373, 0x8ea4398a, 0x8b95c1e3, 0x88980e80,
+    0x85aac367, 0x82cd8698,
+};
+
+/* val * y^n */
+u64 decay_load(u64 val, u64 n)
+{
+    unsigned int local_n;
+
+    /* 2016段之后连64位值也衰减到0了 */
+    if (unlikely(n > LOAD_AVG_PERIOD * 63))
+        return 0;
+
+    local_n = n;
+    if (unlikely(local_n >= LOAD_AVG_PERIOD)) {
+        val >>= local_n / LOAD_AVG_PERIOD;
+        local_n %= LOAD_AVG_PERIOD;
+    }
+
+    return mul_u64_u32_shr(val, runnable_avg_yN_inv[local_n], 32);
+}
+
+/*
+ * 跨越periods段时新增的贡献，分三块：
+ *   d1 补满上次没过完的那一段，要衰减periods次；
+ *   中间完整的periods-1段，等比数列求和，用LOAD_AVG_MAX的差求出；
+ *   d3 当前这一段已经过去的部分，不衰减。
+ */
+static u32 __accumulate_pelt_segments(u64 periods, u32 d1, u32 d3)
+{
+    u32 c1, c2, c3 = d3;
+
+    c1 = decay_load((u64)d1, periods);
+    c2 = LOAD_AVG_MAX - decay_load(LOAD_AVG_MAX, periods) - 1024;
+
+    return c1 + c2 + c3;
+}
+
+/* delta以us计(1024ns)，返回跨过了几段 */
+static u32 accumulate_sum(u64 delta, struct sched_avg *sa, ulong load,
+                          ulong runnable, int running)
+{
+    u32 contrib = (u32)delta;
+    u64 periods;
+
+    delta += sa->period_contrib;
+    periods = delta / 1024;
+
+    if (periods) {
+        sa->load_sum = decay_load(sa->load_sum, periods);
+        sa->runnable_load_sum = decay_load(sa->runnable_load_sum, periods);
+        sa->util_sum = decay_load((u64)sa->util_sum, periods);
+
+        delta %= 1024;
+        if (load)
+            contrib = __accumulate_pelt_segments(periods,
+                                                 1024 - sa->period_contrib, delta);
+    }
+    sa->period_contrib = delta;
+
+    if (load)
+        sa->load_sum += load * contrib;
+    if (runnable)
+        sa->runnable_load_sum += runnable * contrib;
+    if (running)
+        sa->util_sum += contrib << SCHED_CAPACITY_SHIFT;
+
+    return periods;
+}
+
+/* 返回1表示跨了段，avg需要重算 */
+static int ___update_load_sum(u64 now, struct sched_avg *sa, ulong load,
+                              ulong runnable, int running)
+{
+    u64 delta;
+
+    delta = now - sa->last_update_time;
+    /* 时钟回退(比如刚迁移过来)，从现在重新开始算 */
+    if ((s64)delta < 0) {
+        sa->last_update_time = now;
+        return 0;
+    }
+
+    /* 以1024ns为单位，不足1us的留到下次 */
+    delta >>= 10;
+    if (!delta)
+        return 0;
+
+    sa->last_update_time += delta << 10;
+
+    /* 不可运行时也不可能在运行；先用load判断，运行时间只在可运行时累计 */
+    if (!load)
+        runnable = running = 0;
+
+    return accumulate_sum(delta, sa, load, runnable, running) != 0;
+}
+
+static void ___update_load_avg(struct sched_avg *sa, ulong load, ulong runnable)
+{
+    u32 divider = get_pelt_divider(sa);
+
+    sa->load_avg = load * sa->load_sum / divider;
+    sa->runnable_load_avg = runnable * sa->runnable_load_sum / divider;
+    __atomic_store_n(&sa->util_avg, sa->util_sum / divider, __ATOMIC_RELAXED);
+}
+
+/* 不在队列上的实体，只衰减 */
+int __update_load_avg_blocked_se(u64 now, struct sched_entity *se)
+{
+    if (___update_load_sum(now, &se->avg, 0, 0, 0)) {
+        ___update_load_avg(&se->avg, se->load.weight, se->load.weight);
+        return 1;
+    }
+
+    return 0;
+}
+
+int __update_load_avg_se(u64 now, struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+    if (___update_load_sum(now, &se->avg, !!se->on_rq, !!se->on_rq,
+                           cfs_rq->curr == se)) {
+        ___update_load_avg(&se->avg, se->load.weight, se->load.weight);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* 队列上的权重和已经带在sum里了，avg不再乘权重 */
+int __update_load_avg_cfs_rq(u64 now, struct cfs_rq *cfs_rq)
+{
+    if (___update_load_sum(now, &cfs_rq->avg, cfs_rq->load.weight,
+                           cfs_rq->load.weight, cfs_rq->curr != NULL)) {
+        ___update_load_avg(&cfs_rq->avg, 1, 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * RT、DL、中断和温控只跟踪占用了多少CPU，用来从CPU容量里扣掉，
+ * CFS据此知道自己实际能用多少。
+ */
+int update_rt_rq_load_avg(u64 now, struct rq *rq, int running)
+{
+    if (___update_load_sum(now, &rq->avg_rt, running, running, running)) {
+        ___update_load_avg(&rq->avg_rt, 1, 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+int update_dl_rq_load_avg(u64 now, struct rq *rq, int running)
+{
+    if (___update_load_sum(now, &rq->avg_dl, running, running, running)) {
+        ___update_load_avg(&rq->avg_dl, 1, 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* capacity是被温控压掉的容量，直接作为load累计 */
+int update_thermal_load_avg(u64 now, struct rq *rq, u64 capacity)
+{
+    if (___update_load_sum(now, &rq->avg_thermal, capacity, capacity, 0)) {
+        ___update_load_avg(&rq->avg_thermal, 1, 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * 中断时间从rq->clock_task里扣掉了，不能按clock_task计。先把中断之前
+ * 的一段按不运行累计，再把running这一段按运行累计。
+ */
+int update_irq_load_avg(struct rq *rq, u64 running)
+{
+    int ret;
+
+    ret = ___update_load_sum(rq->clock - running, &rq->avg_irq, 0, 0, 0);
+    ret += ___update_load_sum(rq->clock, &rq->avg_irq, 1, 1, 1);
+
+    if (ret)
+        ___update_load_avg(&rq->avg_irq, 1, 1);
+
+    return ret;
+}
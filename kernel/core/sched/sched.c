@@ -3,13 +3,23 @@
 #include "../../include/list.h"
 #include "../../include/spinlock.h"
 #include "../../include/mm.h"
+#include "../../include/slab.h"
+#include "../../include/mempolicy.h"
+#include "../../include/memcontrol.h"
+#include "../../include/vmalloc.h"
+#include "../../include/pelt.h"
 
 /* 全局变量 */
-static struct task_struct *current_task = NULL;
 static struct list_head task_list;
 static spinlock_t task_list_lock;
 static pid_t next_pid = 1;
 static struct task_struct *init_task = NULL;
+static struct kmem_cache *task_struct_cachep;
+
+/* 每CPU缓存刚退出任务的内核栈，创建新任务时直接复用，不必回到伙伴系统 */
+static void *cached_stacks[NR_CPUS][NR_CACHED_STACKS];
+
+#define STACK_END_MAGIC         0x57AC6E9DUL
 
 static struct rq runqueues[NR_CPUS];
 static struct task_struct *idle_tasks[NR_CPUS];
@@ -31,11 +41,16 @@ static const int prio_to_weight[40] = {
 
 void sched_init(void)
 {
+    struct task_struct *idle;
     int cpu;
 
     INIT_LIST_HEAD(&task_list);
     spin_lock_init(&task_list_lock);
 
+    task_struct_cachep = kmem_cache_create("task_struct", sizeof(struct task_struct),
+                                           L1_CACHE_BYTES,
+                                           SLAB_HWCACHE_ALIGN | SLAB_PANIC, NULL);
+
     for (cpu = 0; cpu < NR_CPUS; cpu++) {
         struct rq *rq = &runqueues[cpu];
 
@@ -72,10 +87,25 @@ void sched_init(void)
         rq->idle_balance = 0;
         rq->active_balance = 0;
         rq->push_cpu = -1;
+        rq->active_balance_work.task = NULL;
+        rq->sd = NULL;
+        rq->rd = NULL;
+        rq->cpu_capacity = SCHED_CAPACITY_SCALE;
+        rq->cpu_capacity_orig = SCHED_CAPACITY_SCALE;
+        memset(&rq->cfs.avg, 0, sizeof(rq->cfs.avg));
+        spin_lock_init(&rq->cfs.removed.lock);
+        rq->cfs.removed.nr = 0;
+        rq->cfs.removed.load_avg = 0;
+        rq->cfs.removed.util_avg = 0;
+        rq->cfs.removed.runnable_sum = 0;
+        memset(&rq->avg_rt, 0, sizeof(rq->avg_rt));
+        memset(&rq->avg_dl, 0, sizeof(rq->avg_dl));
+        memset(&rq->avg_irq, 0, sizeof(rq->avg_irq));
+        memset(&rq->avg_thermal, 0, sizeof(rq->avg_thermal));
 
         rq->nr_switches = 0;
         rq->nr_load_updates = 0;
-        rq->avg_idle = 0;
+        rq->avg_idle = 2 * SCHED_MIGRATION_COST_NS;
         rq->idle_stamp = 0;
         rq->age_stamp = 0;
         rq->rt_avg = 0;
@@ -96,21 +126,29 @@ void sched_init(void)
         rq->balance_cpu = -1;
         rq->ttwu_count = 0;
         rq->ttwu_local = 0;
+        init_llist_head(&rq->wake_list);
 
         memset(&rq->rq_sched_info, 0, sizeof(rq->rq_sched_info));
     }
 
+    /* 从这里起BSP上的执行流就是它的空闲进程，rq->curr不会再是NULL */
+    idle = fork_idle(smp_processor_id());
+    if (!idle)
+        panic("Cannot allocate boot idle task");
+    set_current(idle);
+
     printk("Scheduler initialized\n");
 }
 
+/* 当前进程记在每CPU数据里，切换时由context_switch更新 */
 struct task_struct *get_current(void)
 {
-    return current_task;
+    return this_pcpu()->current_task;
 }
 
 void set_current(struct task_struct *task)
 {
-    current_task = task;
+    this_pcpu()->current_task = task;
 }
 
 static pid_t alloc_pid(void)
@@ -124,23 +162,109 @@ static pid_t alloc_pid(void)
     return pid;
 }
 
+static inline ulong *end_of_stack(struct task_struct *tsk)
+{
+    return (ulong *)tsk->stack;
+}
+
+/* 栈向下增长，最低地址处的魔数被改写说明发生了栈溢出 */
+static void set_task_stack_end_magic(struct task_struct *tsk)
+{
+    *end_of_stack(tsk) = STACK_END_MAGIC;
+}
+
+static bool task_stack_end_corrupted(struct task_struct *tsk)
+{
+    return *end_of_stack(tsk) != STACK_END_MAGIC;
+}
+
+/*
+ * 栈放在vmalloc区时，下方紧邻的是前一个区域尾部的保护页或未映射的空洞，
+ * 越过栈底立即缺页，而不是悄悄改写相邻的物理页。栈底魔数仍然保留，
+ * 用于发现没有越界、但写坏了栈底的情况。
+ */
+static void *__alloc_thread_stack(void)
+{
+#if CONFIG_VMAP_STACK
+    return __vmalloc_node_range(THREAD_SIZE, THREAD_SIZE, VMALLOC_START,
+                                VMALLOC_END, GFP_KERNEL, PAGE_KERNEL, 0,
+                                NUMA_NO_NODE);
+#else
+    struct page *page;
+
+    page = alloc_pages(GFP_KERNEL, THREAD_SIZE_ORDER);
+    if (!page)
+        return NULL;
+
+    return page_address(page);
+#endif
+}
+
+static void __free_thread_stack(void *stack)
+{
+#if CONFIG_VMAP_STACK
+    vfree(stack);
+#else
+    __free_pages(virt_to_page(stack), THREAD_SIZE_ORDER);
+#endif
+}
+
+static void *alloc_thread_stack(void)
+{
+    void *stack;
+    ulong flags;
+    int cpu, i;
+
+    flags = local_irq_save();
+    cpu = smp_processor_id();
+    for (i = 0; i < NR_CACHED_STACKS; i++) {
+        stack = cached_stacks[cpu][i];
+        if (!stack)
+            continue;
+        cached_stacks[cpu][i] = NULL;
+        local_irq_restore(flags);
+        return stack;
+    }
+    local_irq_restore(flags);
+
+    return __alloc_thread_stack();
+}
+
+static void free_thread_stack(void *stack)
+{
+    ulong flags;
+    int cpu, i;
+
+    flags = local_irq_save();
+    cpu = smp_processor_id();
+    for (i = 0; i < NR_CACHED_STACKS; i++) {
+        if (cached_stacks[cpu][i])
+            continue;
+        cached_stacks[cpu][i] = stack;
+        local_irq_restore(flags);
+        return;
+    }
+    local_irq_restore(flags);
+
+    __free_thread_stack(stack);
+}
+
 struct task_struct *alloc_task_struct(void)
 {
     struct task_struct *task;
 
-    task = kmalloc(sizeof(struct task_struct), GFP_KERNEL);
+    task = kmem_cache_zalloc(task_struct_cachep, GFP_KERNEL);
     if (!task)
         return NULL;
 
-    memset(task, 0, sizeof(struct task_struct));
-
-    task->stack = kmalloc(THREAD_SIZE, GFP_KERNEL);
+    task->stack = alloc_thread_stack();
     if (!task->stack) {
-        kfree(task);
+        kmem_cache_free(task_struct_cachep, task);
         return NULL;
     }
 
     task->stack_size = THREAD_SIZE;
+    set_task_stack_end_magic(task);
 
     task->state = TASK_RUNNING;
     task->exit_state = 0;
@@ -186,7 +310,7 @@ struct task_struct *alloc_task_struct(void)
     task->rt.rt_rq = NULL;
     task->rt.my_q = NULL;
 
-    task->cpus_allowed = (1UL << NR_CPUS) - 1;  /* 允许所有CPU */
+    task->cpus_allowed = CPU_MASK_ALL;  /* 允许所有CPU */
     task->nr_cpus_allowed = NR_CPUS;
 
     task->real_parent = NULL;
@@ -237,6 +361,7 @@ struct task_struct *alloc_task_struct(void)
     task->sched_task_group = NULL;
 
     task->cgroups = NULL;
+    task->mem_cgroup = NULL;
 
     INIT_LIST_HEAD(&task->ptraced);
     INIT_LIST_HEAD(&task->ptrace_entry);
@@ -292,6 +417,8 @@ struct task_struct *alloc_task_struct(void)
 
     task->last_cpu = -1;
     task->wake_cpu = -1;
+    task->on_cpu = 0;
+    task->on_rq = 0;
 
     task->migrate_disable = 0;
 
@@ -310,9 +437,18 @@ void free_task_struct(struct task_struct *tsk)
     if (!tsk)
         return;
 
-    if (tsk->stack)
-        kfree(tsk->stack);
-    kfree(tsk);
+    if (tsk->stack) {
+        /* 溢出过的栈不再放回缓存 */
+        if (unlikely(task_stack_end_corrupted(tsk))) {
+            printk("task %d: kernel stack overflow detected\n", tsk->pid);
+            __free_thread_stack(tsk->stack);
+        } else {
+            free_thread_stack(tsk->stack);
+        }
+    }
+    mpol_put(tsk->mempolicy);
+    mem_cgroup_put(tsk->mem_cgroup);
+    kmem_cache_free(task_struct_cachep, tsk);
 }
 
 void get_task_struct(struct task_struct *tsk)
@@ -330,12 +466,21 @@ void put_task_struct(struct task_struct *tsk)
 struct task_struct *dup_task_struct(struct task_struct *orig)
 {
     struct task_struct *tsk;
+    void *stack;
 
     tsk = alloc_task_struct();
     if (!tsk)
         return NULL;
 
+    /* 结构体整体复制会把父进程的栈指针也带过来，要换回自己的栈 */
+    stack = tsk->stack;
     *tsk = *orig;
+    tsk->stack = stack;
+    set_task_stack_end_magic(tsk);
+
+    /* 子进程继承父进程的内存策略 */
+    mpol_get(tsk->mempolicy);
+    mem_cgroup_get(tsk->mem_cgroup);
 
     tsk->pid = alloc_pid();
     tsk->state = TASK_RUNNING;
@@ -392,6 +537,8 @@ void sched_fork(struct task_struct *p)
 
     p->se.load.weight = prio_to_weight[p->static_prio - MAX_RT_PRIO];
     p->se.load.inv_weight = 0;
+    p->se.on_rq = 0;
+    init_entity_runnable_average(&p->se);
 
     p->cpus_allowed = current->cpus_allowed;
     p->nr_cpus_allowed = current->nr_cpus_allowed;
@@ -407,6 +554,9 @@ void sched_fork(struct task_struct *p)
 
     p->last_cpu = cpu;
     p->wake_cpu = cpu;
+    p->last_wakee = NULL;
+    p->wakee_flips = 0;
+    p->wakee_flip_decay_ts = jiffies;
 
     p->preempt_count = FORK_PREEMPT_COUNT;
 
@@ -425,6 +575,10 @@ void wake_up_new_task(struct task_struct *p)
 
     rq = task_rq_lock(p, &flags);
 
+    update_rq_clock(rq);
+    if (p->sched_class == &fair_sched_class)
+        post_init_entity_util_avg(&p->se);
+
     activate_task(rq, p, 0);
 
     check_preempt_curr(rq, p, WF_FORK);
@@ -438,6 +592,11 @@ void activate_task(struct rq *rq, struct task_struct *p, int flags)
         rq->nr_uninterruptible--;
 
     enqueue_task(rq, p, flags);
+    p->on_rq = 1;
+
+    /* 有CPU排着多个任务，别的CPU将要空闲时才值得去拉 */
+    if (rq->nr_running > 1 && rq->rd && !rq->rd->overload)
+        rq->rd->overload = 1;
 }
 
 void deactivate_task(struct rq *rq, struct task_struct *p, int flags)
@@ -446,6 +605,7 @@ void deactivate_task(struct rq *rq, struct task_struct *p, int flags)
         rq->nr_uninterruptible++;
 
     dequeue_task(rq, p, flags);
+    p->on_rq = 0;
 }
 
 static void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
@@ -501,6 +661,10 @@ static void update_rq_clock_task(struct rq *rq, s64 delta)
     delta -= steal;
 
     rq->clock_task += delta;
+
+    /* 中断和被偷走的时间不算任务的，单独记一份平均，从CPU容量里扣掉 */
+    if (irq_delta + steal)
+        update_irq_load_avg(rq, irq_delta + steal);
 }
 
 struct rq *cpu_rq(int cpu)
@@ -536,6 +700,27 @@ static void task_rq_unlock(struct rq *rq, struct task_struct *p, ulong *flags)
     spin_unlock_irqrestore(&rq->lock, *flags);
 }
 
+/* 同时锁两个运行队列，按地址从低到高加锁以免死锁。调用者已关中断 */
+void double_rq_lock(struct rq *rq1, struct rq *rq2)
+{
+    if (rq1 == rq2) {
+        spin_lock(&rq1->lock);
+    } else if (rq1 < rq2) {
+        spin_lock(&rq1->lock);
+        spin_lock(&rq2->lock);
+    } else {
+        spin_lock(&rq2->lock);
+        spin_lock(&rq1->lock);
+    }
+}
+
+void double_rq_unlock(struct rq *rq1, struct rq *rq2)
+{
+    spin_unlock(&rq1->lock);
+    if (rq1 != rq2)
+        spin_unlock(&rq2->lock);
+}
+
 void schedule(void)
 {
     struct task_struct *prev, *next;
@@ -547,13 +732,26 @@ void schedule(void)
     rq = cpu_rq(cpu);
     prev = rq->curr;
 
+    if (unlikely(task_stack_end_corrupted(prev)))
+        panic("corrupted stack end detected inside scheduler\n");
+
     local_irq_save(flags);
 
     spin_lock(&rq->lock);
 
     update_rq_clock(rq);
 
+    /*
+     * 要睡的进程从运行队列上拿下来。设睡眠状态之后、到这里之前被唤醒
+     * 的话，ttwu_remote已经在rq->lock下把状态改回了RUNNING。
+     */
+    if (prev->state != TASK_RUNNING && prev != rq->idle)
+        deactivate_task(rq, prev, DEQUEUE_SLEEP);
+    else if (unlikely(rq->active_balance))
+        prepare_active_balance(rq, prev);
+
     next = pick_next_task(rq, prev);
+    update_idle_cpumask(cpu, next == rq->idle);
 
     clear_tsk_need_resched(prev);
 
@@ -574,6 +772,7 @@ struct task_struct *pick_next_task(struct rq *rq, struct task_struct *prev)
     const struct sched_class *class;
     struct task_struct *p;
 
+again:
     if (likely(rq->nr_running == rq->cfs.h_nr_running)) {
         p = pick_next_task_fair(rq, prev);
         if (likely(p))
@@ -586,6 +785,11 @@ struct task_struct *pick_next_task(struct rq *rq, struct task_struct *prev)
             return p;
     }
 
+    /* 要转入空闲了，先从别的CPU拉任务过来；期间会放开rq->lock */
+    if (idle_balance(rq))
+        goto again;
+
+    rq->idle_stamp = rq->clock;
     return rq->idle;
 }
 
@@ -614,6 +818,8 @@ static void context_switch(struct rq *rq, struct task_struct *prev,
         rq->prev_mm = oldmm;
     }
 
+    this_pcpu()->current_task = next;
+
     switch_to(prev, next, prev);
 
     barrier();
@@ -624,6 +830,7 @@ static void context_switch(struct rq *rq, struct task_struct *prev,
 static void prepare_task_switch(struct rq *rq, struct task_struct *prev,
                                struct task_struct *next)
 {
+    next->on_cpu = 1;
     sched_info_switch(rq, prev, next);
     perf_event_task_sched_out(prev, next);
     fire_sched_out_preempt_notifiers(prev, next);
@@ -643,9 +850,14 @@ static void finish_task_switch(struct task_struct *prev)
 
     perf_event_task_sched_in(prev, current);
     finish_arch_switch(prev);
+    /* 之后prev可以被别的CPU唤醒到别处运行 */
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
     finish_lock_switch(rq, prev);
     fire_sched_in_preempt_notifiers(current);
 
+    if (unlikely(rq->active_balance_work.task))
+        finish_active_balance(rq);
+
     if (mm)
         mmdrop(mm);
 
@@ -675,17 +887,336 @@ long sys_sched_yield(void)
     return 0;
 }
 
+/* 让rq上当前的进程尽快让出CPU；别的CPU上要发IPI，把它从hlt里叫醒 */
+void resched_curr(struct rq *rq)
+{
+    int cpu = cpu_of(rq);
+    u32 old;
+
+    old = __sync_fetch_and_or(&pcpu_hot[cpu].flags, PCPU_NEED_RESCHED);
+    if (cpu != smp_processor_id() && !(old & PCPU_NEED_RESCHED))
+        smp_send_reschedule(cpu);
+}
+
+void resched_cpu(int cpu)
+{
+    struct rq *rq = cpu_rq(cpu);
+    ulong flags;
+
+    spin_lock_irqsave(&rq->lock, &flags);
+    resched_curr(rq);
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/*
+ * 换CPU。CFS的vruntime以所在队列的min_vruntime为基准。在队列上迁移时
+ * dequeue/enqueue已经换算好了；睡眠出队时没减，这里减掉原队列的基准，
+ * 入队时带ENQUEUE_WAKING再加上新队列的。
+ */
+void set_task_cpu(struct task_struct *p, int new_cpu)
+{
+    if (task_cpu(p) == new_cpu)
+        return;
+
+    if (p->state == TASK_WAKING && p->sched_class == &fair_sched_class) {
+        p->se.vruntime -= cpu_rq(task_cpu(p))->cfs.min_vruntime;
+        p->sched_migrated = 1;
+    }
+
+    /* 负载跟踪要在还能找到原队列时把任务的负载从原队列拿走 */
+    if (p->sched_class == &fair_sched_class)
+        migrate_task_rq_fair(p);
+
+    p->se.nr_migrations++;
+    p->last_cpu = new_cpu;
+}
+
+/* 调用者持rq->lock */
+static void ttwu_do_activate(struct rq *rq, struct task_struct *p, int wake_flags)
+{
+    int en_flags = ENQUEUE_WAKEUP;
+
+    if (p->sched_contributes_to_load)
+        rq->nr_uninterruptible--;
+
+    if (p->sched_migrated) {
+        en_flags |= ENQUEUE_WAKING;
+        p->sched_migrated = 0;
+    }
+
+    rq->ttwu_count++;
+    activate_task(rq, p, en_flags);
+    p->state = TASK_RUNNING;
+    check_preempt_curr(rq, p, wake_flags);
+
+    /* 记下这次空闲了多久，空闲均衡据此判断值不值得去拉 */
+    if (rq->idle_stamp) {
+        u64 delta = rq->clock - rq->idle_stamp;
+        u64 max = 2 * rq->max_idle_balance_cost;
+
+        if (delta > rq->avg_idle)
+            rq->avg_idle += (delta - rq->avg_idle) >> 3;
+        else
+            rq->avg_idle -= (rq->avg_idle - delta) >> 3;
+        if (max && rq->avg_idle > max)
+            rq->avg_idle = max;
+
+        rq->idle_stamp = 0;
+    }
+}
+
+/* p还在运行队列上(设了睡眠状态还没切走)，改回RUNNING就算唤醒了 */
+static int ttwu_remote(struct task_struct *p, int wake_flags)
+{
+    struct rq *rq;
+    ulong flags;
+    int ret = 0;
+
+    rq = task_rq_lock(p, &flags);
+    if (p->on_rq) {
+        p->state = TASK_RUNNING;
+        check_preempt_curr(rq, p, wake_flags);
+        ret = 1;
+    }
+    task_rq_unlock(rq, p, &flags);
+
+    return ret;
+}
+
+/*
+ * 不去抢别的CPU的rq->lock，而是挂到它的wake_list上，由它在IPI里自己
+ * 入队。表原来不空说明已经有IPI在路上，不用再发。
+ */
+static void ttwu_queue_remote(struct task_struct *p, int cpu)
+{
+    if (llist_add(&p->wake_entry, &cpu_rq(cpu)->wake_list))
+        smp_send_reschedule(cpu);
+}
+
+static void ttwu_queue(struct task_struct *p, int cpu)
+{
+    struct rq *rq = cpu_rq(cpu);
+
+    if (cpu != smp_processor_id()) {
+        ttwu_queue_remote(p, cpu);
+        return;
+    }
+
+    spin_lock(&rq->lock);
+    rq->ttwu_local++;
+    ttwu_do_activate(rq, p, 0);
+    spin_unlock(&rq->lock);
+}
+
+/* 重新调度IPI里调用，把别的CPU唤醒到这里的任务入队 */
+void sched_ttwu_pending(void)
+{
+    struct rq *rq = cpu_rq(smp_processor_id());
+    struct task_struct *p, *t;
+    struct llist_node *llist;
+
+    llist = llist_del_all(&rq->wake_list);
+    if (!llist)
+        return;
+
+    spin_lock(&rq->lock);
+    update_rq_clock(rq);
+    llist_for_each_entry_safe(p, t, llist, wake_entry)
+        ttwu_do_activate(rq, p, 0);
+    spin_unlock(&rq->lock);
+}
+
+/*
+ * 挑p醒来后在哪个CPU上跑。CFS任务按唤醒亲和和空闲CPU挑；其他类
+ * 放在唤醒者这里。挑出来的CPU不在p允许的范围里或者不在线，退回
+ * 原来的CPU。
+ */
+static int select_task_rq(struct task_struct *p, int prev_cpu, int wake_flags)
+{
+    int cpu;
+
+    if (p->sched_class == &fair_sched_class && p->nr_cpus_allowed > 1)
+        cpu = select_task_rq_fair(p, prev_cpu, wake_flags);
+    else
+        cpu = smp_processor_id();
+
+    if (!(p->cpus_allowed & cpumask_of(cpu)) || !cpu_online(cpu))
+        cpu = prev_cpu;
+
+    return cpu;
+}
+
+static void ttwu_stat(struct task_struct *p, int cpu, int wake_flags)
+{
+    p->se.nr_wakeups++;
+
+    if (wake_flags & WF_SYNC)
+        p->se.nr_wakeups_sync++;
+    if (wake_flags & WF_MIGRATED)
+        p->se.nr_wakeups_migrate++;
+
+    if (cpu == smp_processor_id())
+        p->se.nr_wakeups_local++;
+    else
+        p->se.nr_wakeups_remote++;
+}
+
 void wake_up_process(struct task_struct *p)
 {
     ulong flags;
+    int wake_flags = 0;
+    int cpu;
 
     raw_spin_lock_irqsave(&p->pi_lock, flags);
     if (!(p->state & TASK_NORMAL))
         goto out;
 
-    if (!ttwu_remote(p, 0))
-        ttwu_queue(p, smp_processor_id());
+    if (ttwu_remote(p, 0))
+        goto out;
+
+    /*
+     * 等p在原CPU上彻底切走，那边不再用它的栈。之后状态改成WAKING，
+     * 排队期间别的唤醒者看到就直接返回，不会重复入队。
+     */
+    while (__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE))
+        cpu_relax();
+
+    p->sched_contributes_to_load = task_contributes_to_load(p);
+    p->state = TASK_WAKING;
+
+    cpu = select_task_rq(p, task_cpu(p), wake_flags);
+    if (task_cpu(p) != cpu)
+        wake_flags |= WF_MIGRATED;
+    set_task_cpu(p, cpu);
+
+    ttwu_stat(p, cpu, wake_flags);
+    ttwu_queue(p, cpu);
 
 out:
     raw_spin_unlock_irqrestore(&p->pi_lock, flags);
 }
+
+/*
+ * 主动均衡的源CPU一侧。别的CPU拉不动正在运行的任务时，设好push_cpu
+ * 让这里重新调度；prev只要允许去push_cpu就在这里摘下，切走之后由
+ * finish_active_balance入队到push_cpu。调用者持rq->lock。
+ */
+static void prepare_active_balance(struct rq *rq, struct task_struct *prev)
+{
+    int dest_cpu = rq->push_cpu;
+
+    if (prev != rq->idle && prev->on_rq &&
+        prev->sched_class == &fair_sched_class &&
+        cpu_online(dest_cpu) && (prev->cpus_allowed & cpumask_of(dest_cpu))) {
+        deactivate_task(rq, prev, 0);
+        rq->active_balance_work.task = prev;
+        rq->active_balance_work.dest_cpu = dest_cpu;
+        return;
+    }
+
+    rq->active_balance = 0;
+}
+
+/* prev的on_cpu已经清掉，别的CPU可以运行它了 */
+static void finish_active_balance(struct rq *rq)
+{
+    struct task_struct *p = rq->active_balance_work.task;
+    struct rq *dst_rq = cpu_rq(rq->active_balance_work.dest_cpu);
+    struct sched_domain *sd;
+    ulong flags;
+
+    flags = local_irq_save();
+    double_rq_lock(rq, dst_rq);
+
+    rq->active_balance_work.task = NULL;
+    rq->active_balance = 0;
+
+    set_task_cpu(p, cpu_of(dst_rq));
+    activate_task(dst_rq, p, 0);
+    check_preempt_curr(dst_rq, p, 0);
+    p->se.nr_forced_migrations++;
+
+    for (sd = rq->sd; sd; sd = sd->parent) {
+        if (sd->span & cpumask_of(cpu_of(dst_rq))) {
+            sd->alb_pushed++;
+            break;
+        }
+    }
+
+    double_rq_unlock(rq, dst_rq);
+    local_irq_restore(flags);
+}
+
+/* 时钟中断里调用，中断已关 */
+void scheduler_tick(void)
+{
+    int cpu = smp_processor_id();
+    struct rq *rq = cpu_rq(cpu);
+    struct task_struct *curr = rq->curr;
+
+    spin_lock(&rq->lock);
+    update_rq_clock(rq);
+    if (curr)
+        curr->sched_class->task_tick(rq, curr, 0);
+    update_rt_rq_load_avg(rq->clock_task, rq,
+                          curr && curr->sched_class == &rt_sched_class);
+    update_dl_rq_load_avg(rq->clock_task, rq,
+                          curr && curr->sched_class == &dl_sched_class);
+    update_thermal_load_avg(rq->clock_task, rq, arch_scale_thermal_pressure(cpu));
+    update_cpu_capacity(rq);
+    rq->idle_balance = (curr == rq->idle);
+    /* 被唤醒者从位图里摘走、最后又没来任务的空闲CPU，在这里补回去 */
+    if (rq->idle_balance && !rq->nr_running)
+        update_idle_cpumask(cpu, 1);
+    spin_unlock(&rq->lock);
+
+    trigger_load_balance(rq);
+}
+
+/*
+ * 每个CPU的空闲进程。AP的栈就是AP启动时用的栈，BSP的就是sched_init
+ * 之前一直在跑的启动栈。没有自己的mm，借用init_mm。
+ */
+struct task_struct *fork_idle(int cpu)
+{
+    struct task_struct *idle;
+    struct rq *rq = cpu_rq(cpu);
+
+    idle = alloc_task_struct();
+    if (!idle)
+        return NULL;
+
+    idle->flags |= PF_IDLE | PF_KTHREAD;
+    idle->sched_class = &idle_sched_class;
+    idle->cpus_allowed = cpumask_of(cpu);
+    idle->nr_cpus_allowed = 1;
+    idle->last_cpu = cpu;
+    idle->wake_cpu = cpu;
+    idle->on_cpu = 1;
+    idle->state = TASK_RUNNING;
+    idle->active_mm = &init_mm;
+    atomic_inc(&init_mm.mm_count);
+    strcpy(idle->comm, "swapper");
+
+    idle_tasks[cpu] = idle;
+    rq->idle = idle;
+    rq->curr = idle;
+
+    return idle;
+}
+
+/*
+ * 空闲循环。查标志和hlt之间来的IPI会被hlt错过，一直睡到下一个时钟；
+ * sti要等下一条指令执行完才开中断，sti;hlt连用就没有这个窗口。
+ */
+void cpu_startup_entry(void)
+{
+    for (;;) {
+        local_irq_disable();
+        while (!need_resched())
+            asm volatile("sti; hlt; cli" ::: "memory");
+        local_irq_enable();
+
+        schedule();
+    }
+}
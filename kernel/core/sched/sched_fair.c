@@ -3,6 +3,9 @@
 #include "../../include/list.h"
 #include "../../include/spinlock.h"
 #include "../../include/mm.h"
+#include "../../include/string.h"
+#include "../../include/pelt.h"
+#include "../../include/topology.h"
 
 #define SCHED_LATENCY_NS        (6 * 1000000ULL)
 #define SCHED_MIN_GRANULARITY_NS (750000ULL)
@@ -30,38 +33,6 @@ static const u32 prio_to_wmult[40] = {
     /*  15 */ 119304647, 148102320, 186737708, 238609294, 286331153,
 };
 
-struct cfs_rq {
-    struct load_weight load;
-    unsigned int nr_running;
-    unsigned int h_nr_running;
-
-    u64 exec_clock;
-    u64 min_vruntime;
-
-    struct rb_root tasks_timeline;
-    struct rb_node *rb_leftmost;
-
-    struct sched_entity *curr;
-    struct sched_entity *next;
-    struct sched_entity *last;
-    struct sched_entity *skip;
-
-    unsigned int nr_spread_over;
-
-    struct rq *rq;
-    struct task_group *tg;
-
-    int runtime_enabled;
-    u64 runtime_expires;
-    s64 runtime_remaining;
-
-    u64 throttled_clock;
-    u64 throttled_clock_task;
-    int throttled;
-    int throttle_count;
-    struct list_head throttled_list;
-};
-
 static void update_curr(struct cfs_rq *cfs_rq)
 {
     struct sched_entity *curr = cfs_rq->curr;
@@ -582,6 +553,1366 @@ static void yield_task_fair(struct rq *rq)
     set_skip_buddy(se);
 }
 
+/*
+ * 负载跟踪
+ *
+ * 每个调度实体和每个cfs_rq各带一份sched_avg，按时间衰减累计可运行和
+ * 运行的时长，详见pelt.c。cfs_rq的值是队列上各实体的和：实体入队时
+ * 把自己的值加上(attach)，离开时减掉(detach)。实体在别的CPU上被唤醒
+ * 时拿不到原来队列的锁，只能把要减的量记在removed里，由原CPU下次
+ * 更新时一并减掉。
+ */
+
+#define UPDATE_TG       0x1     /* 同时更新组的负载贡献 */
+#define SKIP_AGE_LOAD   0x2     /* 不衰减实体自己的负载 */
+#define DO_ATTACH       0x4     /* 迁移过来的实体，顺便attach到队列上 */
+
+/* 减到负数时取0，舍入误差不能让无符号数下溢 */
+#define sub_positive(_ptr, _val) do {                       \
+    typeof(_ptr) ptr = (_ptr);                              \
+    typeof(*ptr) val = (_val);                              \
+    typeof(*ptr) res, var = *ptr;                           \
+    res = var - val;                                        \
+    if (res > var)                                          \
+        res = 0;                                            \
+    *ptr = res;                                             \
+} while (0)
+
+#define add_positive(_ptr, _val) do {                       \
+    typeof(_ptr) ptr = (_ptr);                              \
+    typeof(_val) val = (_val);                              \
+    typeof(*ptr) res, var = *ptr;                           \
+    res = var + val;                                        \
+    if (val < 0 && res > var)                               \
+        res = 0;                                            \
+    *ptr = res;                                             \
+} while (0)
+
+static inline u64 cfs_rq_clock_pelt(struct cfs_rq *cfs_rq)
+{
+    return rq_of(cfs_rq)->clock_task;
+}
+
+static inline void enqueue_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+    cfs_rq->avg.load_avg += se->avg.load_avg;
+    cfs_rq->avg.load_sum += se->load.weight * se->avg.load_sum;
+}
+
+static inline void dequeue_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+    sub_positive(&cfs_rq->avg.load_avg, se->avg.load_avg);
+    sub_positive(&cfs_rq->avg.load_sum, se->load.weight * se->avg.load_sum);
+}
+
+static inline void enqueue_runnable_load_avg(struct cfs_rq *cfs_rq,
+                                             struct sched_entity *se)
+{
+    cfs_rq->avg.runnable_load_avg += se->avg.runnable_load_avg;
+    cfs_rq->avg.runnable_load_sum += se->load.weight * se->avg.runnable_load_sum;
+}
+
+static inline void dequeue_runnable_load_avg(struct cfs_rq *cfs_rq,
+                                             struct sched_entity *se)
+{
+    sub_positive(&cfs_rq->avg.runnable_load_avg, se->avg.runnable_load_avg);
+    sub_positive(&cfs_rq->avg.runnable_load_sum,
+                 se->load.weight * se->avg.runnable_load_sum);
+}
+
+#if CONFIG_FAIR_GROUP_SCHED
+
+static inline void add_tg_cfs_propagate(struct cfs_rq *cfs_rq, long runnable_sum)
+{
+    cfs_rq->propagate = 1;
+    cfs_rq->prop_runnable_sum += runnable_sum;
+}
+
+/* 组实体的利用率直接跟随组队列 */
+static inline void update_tg_cfs_util(struct cfs_rq *cfs_rq, struct sched_entity *se,
+                                      struct cfs_rq *gcfs_rq)
+{
+    long delta = gcfs_rq->avg.util_avg - se->avg.util_avg;
+    u32 divider;
+
+    if (!delta)
+        return;
+
+    divider = get_pelt_divider(&cfs_rq->avg);
+
+    se->avg.util_avg = gcfs_rq->avg.util_avg;
+    se->avg.util_sum = se->avg.util_avg * divider;
+
+    add_positive(&cfs_rq->avg.util_avg, delta);
+    cfs_rq->avg.util_sum = cfs_rq->avg.util_avg * divider;
+}
+
+/*
+ * 组队列里有实体加入或离开时，组实体的可运行时间按加入离开的量调整，
+ * 但不能超过一直可运行的上限，也不能少于组里还在运行的部分。
+ */
+static inline void update_tg_cfs_load(struct cfs_rq *cfs_rq, struct sched_entity *se,
+                                      struct cfs_rq *gcfs_rq)
+{
+    long delta_avg, running_sum, runnable_sum = gcfs_rq->prop_runnable_sum;
+    ulong load_avg;
+    u64 load_sum = 0;
+    s64 delta_sum;
+    u32 divider;
+
+    if (!runnable_sum)
+        return;
+
+    gcfs_rq->prop_runnable_sum = 0;
+
+    divider = get_pelt_divider(&cfs_rq->avg);
+
+    if (runnable_sum >= 0) {
+        runnable_sum += se->avg.load_sum;
+        runnable_sum = MIN(runnable_sum, (long)divider);
+    } else {
+        if (gcfs_rq->load.weight)
+            load_sum = gcfs_rq->avg.load_sum / gcfs_rq->load.weight;
+        runnable_sum = MIN(se->avg.load_sum, load_sum);
+    }
+
+    running_sum = se->avg.util_sum >> SCHED_CAPACITY_SHIFT;
+    runnable_sum = MAX(runnable_sum, running_sum);
+
+    load_sum = (s64)se->load.weight * runnable_sum;
+    load_avg = load_sum / divider;
+
+    delta_sum = load_sum - (s64)se->load.weight * se->avg.load_sum;
+    delta_avg = load_avg - se->avg.load_avg;
+
+    se->avg.load_sum = runnable_sum;
+    se->avg.load_avg = load_avg;
+    add_positive(&cfs_rq->avg.load_avg, delta_avg);
+    add_positive(&cfs_rq->avg.load_sum, delta_sum);
+
+    if (se->on_rq) {
+        delta_sum = load_sum - (s64)se->load.weight * se->avg.runnable_load_sum;
+        delta_avg = load_avg - se->avg.runnable_load_avg;
+        se->avg.runnable_load_sum = runnable_sum;
+        se->avg.runnable_load_avg = load_avg;
+        add_positive(&cfs_rq->avg.runnable_load_avg, delta_avg);
+        add_positive(&cfs_rq->avg.runnable_load_sum, delta_sum);
+    }
+}
+
+/* 把组队列上的变化带到父队列上，返回1表示有变化 */
+static inline int propagate_entity_load_avg(struct sched_entity *se)
+{
+    struct cfs_rq *cfs_rq, *gcfs_rq;
+
+    if (entity_is_task(se))
+        return 0;
+
+    gcfs_rq = group_cfs_rq(se);
+    if (!gcfs_rq->propagate)
+        return 0;
+
+    gcfs_rq->propagate = 0;
+
+    cfs_rq = cfs_rq_of(se);
+    add_tg_cfs_propagate(cfs_rq, gcfs_rq->prop_runnable_sum);
+
+    update_tg_cfs_util(cfs_rq, se, gcfs_rq);
+    update_tg_cfs_load(cfs_rq, se, gcfs_rq);
+
+    return 1;
+}
+
+/* 组的总负载是各CPU上组队列之和，变化超过1/64才去碰共享的计数 */
+static inline void update_tg_load_avg(struct cfs_rq *cfs_rq)
+{
+    long delta = cfs_rq->avg.load_avg - cfs_rq->tg_load_avg_contrib;
+
+    if (cfs_rq->tg == &root_task_group)
+        return;
+
+    if ((ulong)(delta < 0 ? -delta : delta) > cfs_rq->tg_load_avg_contrib / 64) {
+        atomic_long_add(delta, &cfs_rq->tg->load_avg);
+        cfs_rq->tg_load_avg_contrib = cfs_rq->avg.load_avg;
+    }
+}
+
+#else /* !CONFIG_FAIR_GROUP_SCHED */
+
+static inline void add_tg_cfs_propagate(struct cfs_rq *cfs_rq, long runnable_sum) { }
+static inline int propagate_entity_load_avg(struct sched_entity *se) { return 0; }
+static inline void update_tg_load_avg(struct cfs_rq *cfs_rq) { }
+
+#endif /* CONFIG_FAIR_GROUP_SCHED */
+
+/*
+ * 先把别的CPU记下的removed减掉，再衰减队列自己的值。返回非0表示
+ * 队列负载有变化。
+ */
+static int update_cfs_rq_load_avg(u64 now, struct cfs_rq *cfs_rq)
+{
+    ulong removed_load = 0, removed_util = 0, removed_runnable = 0;
+    struct sched_avg *sa = &cfs_rq->avg;
+    int decayed = 0;
+
+    if (cfs_rq->removed.nr) {
+        ulong r;
+        u32 divider = get_pelt_divider(&cfs_rq->avg);
+
+        spin_lock(&cfs_rq->removed.lock);
+        removed_load = cfs_rq->removed.load_avg;
+        removed_util = cfs_rq->removed.util_avg;
+        removed_runnable = cfs_rq->removed.runnable_sum;
+        cfs_rq->removed.load_avg = 0;
+        cfs_rq->removed.util_avg = 0;
+        cfs_rq->removed.runnable_sum = 0;
+        cfs_rq->removed.nr = 0;
+        spin_unlock(&cfs_rq->removed.lock);
+
+        r = removed_load;
+        sub_positive(&sa->load_avg, r);
+        sub_positive(&sa->load_sum, (u64)r * divider);
+
+        r = removed_util;
+        sub_positive(&sa->util_avg, r);
+        sub_positive(&sa->util_sum, r * divider);
+
+        add_tg_cfs_propagate(cfs_rq, -(long)removed_runnable);
+
+        decayed = 1;
+    }
+
+    decayed |= __update_load_avg_cfs_rq(now, cfs_rq);
+
+    return decayed;
+}
+
+/*
+ * 迁移过来的实体挂到队列上。实体的时间基准对齐到队列，已经衰减
+ * 过的avg不变，sum按队列当前的除数重新算，免得两边对不上。
+ */
+static void attach_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+    u32 divider = get_pelt_divider(&cfs_rq->avg);
+
+    se->avg.last_update_time = cfs_rq->avg.last_update_time;
+    se->avg.period_contrib = cfs_rq->avg.period_contrib;
+
+    se->avg.util_sum = se->avg.util_avg * divider;
+
+    se->avg.load_sum = divider;
+    if (se->load.weight)
+        se->avg.load_sum = se->avg.load_avg * divider / se->load.weight;
+    se->avg.runnable_load_sum = se->avg.load_sum;
+
+    enqueue_load_avg(cfs_rq, se);
+    cfs_rq->avg.util_avg += se->avg.util_avg;
+    cfs_rq->avg.util_sum += se->avg.util_sum;
+
+    add_tg_cfs_propagate(cfs_rq, se->avg.load_sum);
+}
+
+static void detach_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+    dequeue_load_avg(cfs_rq, se);
+    sub_positive(&cfs_rq->avg.util_avg, se->avg.util_avg);
+    sub_positive(&cfs_rq->avg.util_sum, se->avg.util_sum);
+
+    add_tg_cfs_propagate(cfs_rq, -(long)se->avg.load_sum);
+}
+
+/* 持cfs_rq所在rq的锁 */
+static void update_load_avg(struct sched_entity *se, int flags)
+{
+    struct cfs_rq *cfs_rq = cfs_rq_of(se);
+    u64 now = cfs_rq_clock_pelt(cfs_rq);
+    int decayed;
+
+    /* last_update_time为0说明实体刚迁移过来，还没attach，先不衰减 */
+    if (se->avg.last_update_time && !(flags & SKIP_AGE_LOAD))
+        __update_load_avg_se(now, cfs_rq, se);
+
+    decayed = update_cfs_rq_load_avg(now, cfs_rq);
+    decayed |= propagate_entity_load_avg(se);
+
+    if (!se->avg.last_update_time && (flags & DO_ATTACH)) {
+        attach_entity_load_avg(cfs_rq, se);
+        update_tg_load_avg(cfs_rq);
+    } else if (decayed && (flags & UPDATE_TG)) {
+        update_tg_load_avg(cfs_rq);
+    }
+}
+
+static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+    update_load_avg(se, UPDATE_TG | DO_ATTACH);
+    enqueue_runnable_load_avg(cfs_rq, se);
+}
+
+static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+    update_load_avg(se, UPDATE_TG);
+    dequeue_runnable_load_avg(cfs_rq, se);
+}
+
+/* 不持原队列的锁，把实体衰减到原队列上次更新的时刻 */
+static void sync_entity_load_avg(struct sched_entity *se)
+{
+    struct cfs_rq *cfs_rq = cfs_rq_of(se);
+    u64 last_update_time;
+
+    last_update_time = __atomic_load_n(&cfs_rq->avg.last_update_time,
+                                       __ATOMIC_RELAXED);
+    __update_load_avg_blocked_se(last_update_time, se);
+}
+
+/* 睡眠中被别的CPU唤醒迁走，记到原队列的removed里 */
+static void remove_entity_load_avg(struct sched_entity *se)
+{
+    struct cfs_rq *cfs_rq = cfs_rq_of(se);
+    ulong flags;
+
+    sync_entity_load_avg(se);
+
+    spin_lock_irqsave(&cfs_rq->removed.lock, &flags);
+    ++cfs_rq->removed.nr;
+    cfs_rq->removed.util_avg += se->avg.util_avg;
+    cfs_rq->removed.load_avg += se->avg.load_avg;
+    cfs_rq->removed.runnable_sum += se->avg.load_sum;
+    spin_unlock_irqrestore(&cfs_rq->removed.lock, flags);
+}
+
+/*
+ * set_task_cpu里调用，任务马上要换到别的CPU。唤醒路径上不持原rq的
+ * 锁，只能走removed；均衡路径上持着原rq的锁，直接detach。
+ * last_update_time清0，到新队列入队时再attach。
+ */
+void migrate_task_rq_fair(struct task_struct *p)
+{
+    struct sched_entity *se = &p->se;
+
+    if (p->state == TASK_WAKING) {
+        remove_entity_load_avg(se);
+    } else {
+        update_load_avg(se, 0);
+        detach_entity_load_avg(cfs_rq_of(se), se);
+        update_tg_load_avg(cfs_rq_of(se));
+    }
+
+    se->avg.last_update_time = 0;
+    se->exec_start = 0;
+}
+
+/* 新任务先按满负载算，免得刚创建就被当成空闲的塞到一起 */
+void init_entity_runnable_average(struct sched_entity *se)
+{
+    struct sched_avg *sa = &se->avg;
+
+    memset(sa, 0, sizeof(*sa));
+
+    if (entity_is_task(se))
+        sa->load_avg = sa->runnable_load_avg = se->load.weight;
+}
+
+/*
+ * 新任务的利用率取所在CPU剩余容量的一半，CPU越忙给得越少，
+ * 连续fork也不会把利用率算爆。调用时持rq->lock。
+ */
+void post_init_entity_util_avg(struct sched_entity *se)
+{
+    struct cfs_rq *cfs_rq = cfs_rq_of(se);
+    struct sched_avg *sa = &se->avg;
+    long cpu_scale = rq_of(cfs_rq)->cpu_capacity_orig;
+    long cap = (long)(cpu_scale - cfs_rq->avg.util_avg) / 2;
+
+    if (cap > 0) {
+        if (cfs_rq->avg.util_avg != 0) {
+            sa->util_avg = cfs_rq->avg.util_avg * se->load.weight;
+            sa->util_avg /= (cfs_rq->avg.load_avg + 1);
+
+            if (sa->util_avg > cap)
+                sa->util_avg = cap;
+        } else {
+            sa->util_avg = cap;
+        }
+    }
+}
+
+/*
+ * 时钟中断里更新一次，即使没有入队出队，队列负载也按时间衰减。
+ * 睡着的任务留在队列上的负载靠这里衰减掉。
+ */
+static void entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
+{
+    update_curr(cfs_rq);
+
+    update_load_avg(curr, UPDATE_TG);
+    update_cfs_shares(cfs_rq);
+
+    if (cfs_rq->nr_running > 1)
+        check_preempt_tick(cfs_rq, curr);
+}
+
+static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
+{
+    struct sched_entity *se = &curr->se;
+    struct cfs_rq *cfs_rq;
+
+    for_each_sched_entity(se) {
+        cfs_rq = cfs_rq_of(se);
+        entity_tick(cfs_rq, se, queued);
+    }
+}
+
+/*
+ * 空闲CPU上没有入队出队，也没有时钟节拍走到entity_tick，睡眠任务
+ * 留下的负载要在这里衰减，不然均衡看到的空闲CPU一直是忙的。每个
+ * 节拍最多做一次。
+ */
+void update_blocked_averages(struct rq *rq)
+{
+    struct cfs_rq *cfs_rq = &rq->cfs;
+
+    if (rq->last_blocked_load_update_tick == jiffies)
+        return;
+
+    spin_lock(&rq->lock);
+    update_rq_clock(rq);
+
+    update_cfs_rq_load_avg(cfs_rq_clock_pelt(cfs_rq), cfs_rq);
+    update_rt_rq_load_avg(rq->clock_task, rq, rq->curr->sched_class == &rt_sched_class);
+    update_dl_rq_load_avg(rq->clock_task, rq, rq->curr->sched_class == &dl_sched_class);
+
+    rq->last_blocked_load_update_tick = jiffies;
+    rq->has_blocked_load = cfs_rq->avg.load_avg || cfs_rq->avg.util_avg ||
+                           rq->avg_rt.util_avg || rq->avg_dl.util_avg;
+    spin_unlock(&rq->lock);
+}
+
+/* 中断、RT、DL和温控占掉的部分从容量里扣掉，剩下的才是CFS能用的 */
+static ulong scale_rt_capacity(struct rq *rq)
+{
+    ulong max = rq->cpu_capacity_orig;
+    ulong used, free;
+    ulong irq;
+
+    irq = rq->avg_irq.util_avg;
+    if (unlikely(irq >= max))
+        return 1;
+
+    used = rq->avg_rt.util_avg;
+    used += rq->avg_dl.util_avg;
+    used += rq->avg_thermal.load_avg;
+
+    if (unlikely(used >= max))
+        return 1;
+
+    free = max - used;
+
+    /* 中断时间不在clock_task里，剩下的按非中断时间的比例缩放 */
+    return free * (max - irq) / max;
+}
+
+/* scheduler_tick里调用，持rq->lock */
+void update_cpu_capacity(struct rq *rq)
+{
+    ulong capacity = scale_rt_capacity(rq);
+
+    if (!capacity)
+        capacity = 1;
+
+    rq->cpu_capacity = capacity;
+}
+
+/*
+ * 负载均衡
+ *
+ * 周期均衡：时钟中断里按各层域的间隔，从本CPU所在的最低层往上，每层
+ * 找出最忙的组和组里最忙的CPU，把任务拉到本CPU。同一个组只让一个CPU
+ * (优先空闲的那个)去做，免得大家一起抢同一个队列。
+ * 空闲均衡：pick_next_task没有任务可挑时马上做一次，按各层以往的开销
+ * 和本CPU平均空闲多久决定做到哪一层。
+ * 主动均衡：最忙的CPU上只剩正在运行的任务，拉了几次都拉不动时，让它
+ * 在调度时把任务推过来。
+ */
+
+#define SCHED_NR_MIGRATE            32          /* 一次最多看这么多个任务 */
+#define MAX_LOAD_BALANCE_INTERVAL   (HZ / 10)
+
+struct sg_lb_stats {
+    ulong avg_load;                 /* 按容量归一化的负载 */
+    ulong group_load;
+    ulong group_capacity;
+    unsigned int sum_nr_running;
+    unsigned int idle_cpus;
+    unsigned int group_weight;
+    int group_overloaded;           /* 任务比CPU多 */
+};
+
+struct sd_lb_stats {
+    struct sched_group *busiest;
+    struct sched_group *local;
+    ulong total_load;
+    ulong total_capacity;
+    ulong avg_load;
+    struct sg_lb_stats busiest_stat;
+    struct sg_lb_stats local_stat;
+};
+
+static inline ulong capacity_of(int cpu)
+{
+    return cpu_rq(cpu)->cpu_capacity;
+}
+
+/* CPU上CFS的负载，取队列上可运行实体的衰减平均，睡眠任务不算 */
+static inline ulong cpu_load(struct rq *rq)
+{
+    return rq->cfs.avg.runnable_load_avg;
+}
+
+static inline ulong task_h_load(struct task_struct *p)
+{
+    return p->se.avg.load_avg;
+}
+
+/* CFS实际占用的CPU，不超过CPU本身的容量 */
+static inline ulong cpu_util(int cpu)
+{
+    struct rq *rq = cpu_rq(cpu);
+
+    return MIN(__atomic_load_n(&rq->cfs.avg.util_avg, __ATOMIC_RELAXED),
+               rq->cpu_capacity_orig);
+}
+
+static inline int idle_cpu(int cpu)
+{
+    struct rq *rq = cpu_rq(cpu);
+
+    return rq->curr == rq->idle && !rq->nr_running && llist_empty(&rq->wake_list);
+}
+
+/* 刚跑过不久，缓存里还是它的数据 */
+static int task_hot(struct task_struct *p, struct lb_env *env)
+{
+    s64 delta;
+
+    if (p->policy == SCHED_IDLE)
+        return 0;
+
+    delta = env->src_rq->clock_task - p->se.exec_start;
+
+    return delta < (s64)SCHED_MIGRATION_COST_NS;
+}
+
+/* 两个队列都已锁上 */
+int can_migrate_task(struct task_struct *p, struct lb_env *env)
+{
+    if (!(p->cpus_allowed & cpumask_of(env->dst_cpu))) {
+        p->se.nr_failed_migrations_affine++;
+        return 0;
+    }
+    env->flags &= ~LBF_ALL_PINNED;
+
+    if (p->on_cpu) {
+        p->se.nr_failed_migrations_running++;
+        return 0;
+    }
+
+    /* 失败次数多了就不再顾及缓存 */
+    if (task_hot(p, env)) {
+        if (env->sd->nr_balance_failed <= env->sd->cache_nice_tries) {
+            p->se.nr_failed_migrations_hot++;
+            return 0;
+        }
+        p->se.nr_forced_migrations++;
+    }
+
+    return 1;
+}
+
+static void move_task(struct task_struct *p, struct lb_env *env)
+{
+    deactivate_task(env->src_rq, p, 0);
+    set_task_cpu(p, env->dst_cpu);
+    activate_task(env->dst_rq, p, 0);
+    check_preempt_curr(env->dst_rq, p, 0);
+}
+
+/* 从src_rq往dst_rq搬，直到抵消imbalance，返回搬了几个 */
+static int move_tasks(struct lb_env *env)
+{
+    struct list_head *tasks = &env->src_rq->cfs_tasks;
+    struct task_struct *p;
+    ulong load;
+    int moved = 0;
+
+    if (env->imbalance <= 0)
+        return 0;
+
+    while (!list_empty(tasks)) {
+        /* 要去空闲的CPU不能把对方拉空 */
+        if (env->idle != CPU_NOT_IDLE && env->src_rq->nr_running <= 1)
+            break;
+
+        if (++env->loop > env->loop_max)
+            break;
+
+        /* 从队尾看起，最久没运行的缓存最冷 */
+        p = list_last_entry(tasks, struct task_struct, se.group_node);
+
+        if (!can_migrate_task(p, env))
+            goto next;
+
+        load = task_h_load(p);
+        if (env->migration_type == migrate_load) {
+            /* 一个任务就超过不均衡量的两倍，搬过去只会反过来不均衡 */
+            if (load / 2 > (ulong)env->imbalance &&
+                env->sd->nr_balance_failed <= env->sd->cache_nice_tries)
+                goto next;
+            env->imbalance -= load;
+        } else {
+            env->imbalance--;
+        }
+
+        move_task(p, env);
+        moved++;
+
+        /* 空闲均衡拉到一个就回去跑 */
+        if (env->idle == CPU_NEWLY_IDLE || env->imbalance <= 0)
+            break;
+        continue;
+next:
+        /* 挪到队头，这一轮不再看它 */
+        list_move(&p->se.group_node, tasks);
+    }
+
+    return moved;
+}
+
+static void update_sg_lb_stats(struct lb_env *env, struct sched_group *group,
+                               struct sg_lb_stats *sgs, int *overload)
+{
+    struct rq *rq;
+    int i;
+
+    memset(sgs, 0, sizeof(*sgs));
+
+    for_each_cpu_mask(i, group->cpumask & env->cpus) {
+        rq = cpu_rq(i);
+
+        sgs->group_load += cpu_load(rq);
+        sgs->group_capacity += capacity_of(i);
+        sgs->sum_nr_running += rq->cfs.h_nr_running;
+
+        if (rq->nr_running > 1)
+            *overload = 1;
+        if (idle_cpu(i))
+            sgs->idle_cpus++;
+    }
+
+    sgs->group_weight = group->group_weight;
+    sgs->group_overloaded = sgs->sum_nr_running > sgs->group_weight;
+    if (sgs->group_capacity)
+        sgs->avg_load = sgs->group_load * SCHED_CAPACITY_SCALE / sgs->group_capacity;
+}
+
+/* 过载的组优先，其次比归一化负载 */
+static bool update_sd_pick_busiest(struct sd_lb_stats *sds, struct sg_lb_stats *sgs)
+{
+    struct sg_lb_stats *busiest = &sds->busiest_stat;
+
+    if (!sgs->sum_nr_running)
+        return false;
+    if (!sds->busiest)
+        return true;
+    if (sgs->group_overloaded != busiest->group_overloaded)
+        return sgs->group_overloaded;
+
+    return sgs->avg_load > busiest->avg_load;
+}
+
+static void update_sd_lb_stats(struct lb_env *env, struct sd_lb_stats *sds)
+{
+    struct sched_group *sg = env->sd->groups;
+    struct sg_lb_stats tmp, *sgs;
+    int overload = 0;
+    int local;
+
+    memset(sds, 0, sizeof(*sds));
+
+    do {
+        local = !!(sg->cpumask & cpumask_of(env->dst_cpu));
+        sgs = local ? &sds->local_stat : &tmp;
+
+        update_sg_lb_stats(env, sg, sgs, &overload);
+
+        if (local)
+            sds->local = sg;
+        else if (update_sd_pick_busiest(sds, sgs)) {
+            sds->busiest = sg;
+            sds->busiest_stat = *sgs;
+        }
+
+        sds->total_load += sgs->group_load;
+        sds->total_capacity += sgs->group_capacity;
+
+        sg = sg->next;
+    } while (sg != env->sd->groups);
+
+    /* 最顶层看到了所有CPU，顺便刷新根域的过载标志 */
+    if (!env->sd->parent && env->dst_rq->rd)
+        env->dst_rq->rd->overload = overload;
+}
+
+/* 找出最忙的组并算出要搬多少；已经足够均衡时返回NULL */
+static struct sched_group *find_busiest_group(struct lb_env *env)
+{
+    struct sg_lb_stats *local, *busiest;
+    struct sd_lb_stats sds;
+
+    update_sd_lb_stats(env, &sds);
+    local = &sds.local_stat;
+    busiest = &sds.busiest_stat;
+
+    if (!sds.busiest || !busiest->sum_nr_running)
+        return NULL;
+
+    /*
+     * 本CPU闲着或者本组还有空位，而对方任务比CPU多、或者比本组至少多
+     * 两个：先把任务数摊平，不管权重。
+     */
+    if ((env->idle != CPU_NOT_IDLE || local->sum_nr_running < local->group_weight) &&
+        (busiest->group_overloaded ||
+         busiest->sum_nr_running > local->sum_nr_running + 1)) {
+        long nr_diff = (long)busiest->sum_nr_running - (long)local->sum_nr_running;
+
+        /* 对方超载但本组任务更多，拉过来只会更不均 */
+        if (nr_diff <= 0)
+            return NULL;
+
+        env->migration_type = migrate_task;
+        env->imbalance = MAX(nr_diff / 2, 1L);
+        return sds.busiest;
+    }
+
+    if (!sds.total_capacity || local->avg_load >= busiest->avg_load)
+        return NULL;
+
+    sds.avg_load = sds.total_load * SCHED_CAPACITY_SCALE / sds.total_capacity;
+    if (local->avg_load >= sds.avg_load)
+        return NULL;
+
+    /* 最忙组先按是否超载挑，负载不一定高于平均，下面的无符号减法会绕回 */
+    if (busiest->avg_load <= sds.avg_load)
+        return NULL;
+
+    if (100 * busiest->avg_load <= env->sd->imbalance_pct * local->avg_load)
+        return NULL;
+
+    /* 把最忙组降到平均值，但不把本组抬到平均值以上 */
+    env->migration_type = migrate_load;
+    env->imbalance = MIN((busiest->avg_load - sds.avg_load) * busiest->group_capacity,
+                         (sds.avg_load - local->avg_load) * local->group_capacity) /
+                     SCHED_CAPACITY_SCALE;
+
+    return env->imbalance > 0 ? sds.busiest : NULL;
+}
+
+static struct rq *find_busiest_queue(struct lb_env *env, struct sched_group *group)
+{
+    struct rq *busiest = NULL, *rq;
+    ulong busiest_load = 0, busiest_capacity = 1;
+    ulong load, capacity;
+    unsigned int busiest_nr = 0;
+    int i;
+
+    for_each_cpu_mask(i, group->cpumask & env->cpus) {
+        rq = cpu_rq(i);
+        if (!rq->cfs.h_nr_running)
+            continue;
+
+        if (env->migration_type == migrate_task) {
+            if (rq->cfs.h_nr_running > busiest_nr) {
+                busiest_nr = rq->cfs.h_nr_running;
+                busiest = rq;
+            }
+            continue;
+        }
+
+        load = cpu_load(rq);
+        capacity = capacity_of(i);
+
+        /* 只有一个任务且比不均衡量还重，搬过去也不会更均衡 */
+        if (rq->nr_running == 1 && load > (ulong)env->imbalance)
+            continue;
+
+        /* 比load/capacity，交叉相乘免得做除法 */
+        if (load * busiest_capacity > busiest_load * capacity) {
+            busiest_load = load;
+            busiest_capacity = capacity;
+            busiest = rq;
+        }
+    }
+
+    return busiest;
+}
+
+/* 本组第一个空闲CPU来做；都不空闲就由组里第一个CPU做 */
+static int should_we_balance(struct lb_env *env)
+{
+    ulong mask = env->sd->groups->cpumask & env->cpus;
+    int cpu;
+
+    if (env->idle == CPU_NEWLY_IDLE)
+        return 1;
+
+    for_each_cpu_mask(cpu, mask) {
+        if (idle_cpu(cpu))
+            return cpu == env->dst_cpu;
+    }
+
+    return mask && __builtin_ctzl(mask) == env->dst_cpu;
+}
+
+static int need_active_balance(struct lb_env *env)
+{
+    struct sched_domain *sd = env->sd;
+
+    if (env->idle == CPU_NEWLY_IDLE)
+        return 0;
+
+    /* 本CPU闲着，对方只有正在跑的一个任务，而按任务数对方组更挤 */
+    if (env->idle == CPU_IDLE && env->migration_type == migrate_task &&
+        env->src_rq->cfs.h_nr_running == 1)
+        return 1;
+
+    return sd->nr_balance_failed > sd->cache_nice_tries + 2;
+}
+
+/* 在sd这一层给this_cpu拉任务，返回拉到的个数 */
+int load_balance(int this_cpu, struct rq *this_rq, struct sched_domain *sd,
+                 enum cpu_idle_type idle, int *continue_balancing)
+{
+    struct lb_env env = {
+        .sd         = sd,
+        .dst_cpu    = this_cpu,
+        .dst_rq     = this_rq,
+        .idle       = idle,
+        .cpus       = sd->span & cpu_online_mask,
+        .loop_max   = SCHED_NR_MIGRATE,
+    };
+    struct task_struct *curr;
+    struct sched_group *group;
+    struct rq *busiest;
+    int ld_moved = 0;
+    int active_kicked = 0;
+    ulong flags;
+
+    sd->lb_count[idle]++;
+
+    if (!should_we_balance(&env)) {
+        *continue_balancing = 0;
+        return 0;
+    }
+
+redo:
+    group = find_busiest_group(&env);
+    if (!group)
+        goto out_balanced;
+
+    busiest = find_busiest_queue(&env, group);
+    if (!busiest)
+        goto out_balanced;
+
+    env.src_cpu = cpu_of(busiest);
+    env.src_rq = busiest;
+
+    if (busiest->nr_running > 1) {
+        env.flags = LBF_ALL_PINNED;
+        env.loop = 0;
+        env.loop_max = MIN(SCHED_NR_MIGRATE, busiest->nr_running);
+
+        flags = local_irq_save();
+        double_rq_lock(this_rq, busiest);
+        ld_moved = move_tasks(&env);
+        double_rq_unlock(this_rq, busiest);
+        local_irq_restore(flags);
+
+        /* 全都绑在别处，去掉这个CPU，在组外还有候选时重找 */
+        if (unlikely(env.flags & LBF_ALL_PINNED)) {
+            env.cpus &= ~cpumask_of(env.src_cpu);
+            if (env.cpus & ~sd->groups->cpumask)
+                goto redo;
+            goto out_balanced;
+        }
+    }
+
+    if (ld_moved) {
+        sd->lb_gained[idle] += ld_moved;
+        sd->nr_balance_failed = 0;
+        sd->balance_interval = sd->min_interval;
+        return ld_moved;
+    }
+
+    sd->lb_failed[idle]++;
+    if (idle != CPU_NEWLY_IDLE)
+        sd->nr_balance_failed++;
+
+    if (need_active_balance(&env)) {
+        flags = local_irq_save();
+        spin_lock(&busiest->lock);
+
+        curr = busiest->curr;
+        if (curr && curr != busiest->idle &&
+            curr->sched_class == &fair_sched_class &&
+            (curr->cpus_allowed & cpumask_of(this_cpu)) &&
+            !busiest->active_balance) {
+            busiest->active_balance = 1;
+            busiest->push_cpu = this_cpu;
+            resched_curr(busiest);
+            active_kicked = 1;
+        }
+
+        spin_unlock(&busiest->lock);
+        local_irq_restore(flags);
+
+        if (active_kicked) {
+            /* 不必马上再来，也不要因为这次失败马上又强制迁移 */
+            sd->nr_balance_failed = sd->cache_nice_tries + 1;
+            sd->balance_interval = sd->min_interval;
+            return 0;
+        }
+    }
+
+    goto out_backoff;
+
+out_balanced:
+    sd->nr_balance_failed = 0;
+
+out_backoff:
+    if (idle != CPU_NEWLY_IDLE && sd->balance_interval < sd->max_interval)
+        sd->balance_interval *= 2;
+
+    return 0;
+}
+
+static ulong get_sd_balance_interval(struct sched_domain *sd, int cpu_busy)
+{
+    ulong interval = sd->balance_interval;
+
+    if (cpu_busy)
+        interval *= sd->busy_factor;
+
+    interval = msecs_to_jiffies(interval);
+
+    return CLAMP(interval, 1UL, (ulong)MAX_LOAD_BALANCE_INTERVAL);
+}
+
+static void rebalance_domains(struct rq *rq, enum cpu_idle_type idle)
+{
+    int cpu = cpu_of(rq);
+    ulong interval, next_balance = jiffies + 60 * HZ;
+    int continue_balancing = 1;
+    int update_next_balance = 0;
+    struct sched_domain *sd;
+
+    /* 先让本CPU上睡眠任务留下的负载衰减到现在，各CPU看到的才是新的 */
+    update_blocked_averages(rq);
+
+    for (sd = __atomic_load_n(&rq->sd, __ATOMIC_ACQUIRE); sd; sd = sd->parent) {
+        /* 空闲均衡的开销记录每秒衰减约1%，偶尔一次慢的不会一直挡着 */
+        if (time_after(jiffies, sd->next_decay_max_lb_cost)) {
+            sd->max_newidle_lb_cost = sd->max_newidle_lb_cost * 253 / 256;
+            sd->next_decay_max_lb_cost = jiffies + HZ;
+        }
+
+        if (!(sd->flags & SD_LOAD_BALANCE))
+            continue;
+        if (!continue_balancing)
+            break;
+
+        interval = get_sd_balance_interval(sd, idle != CPU_IDLE);
+        if (time_after_eq(jiffies, sd->last_balance + interval)) {
+            /* 拉到任务之后本CPU就不再算空闲，上层按忙的间隔走 */
+            if (load_balance(cpu, rq, sd, idle, &continue_balancing))
+                idle = idle_cpu(cpu) ? CPU_IDLE : CPU_NOT_IDLE;
+            sd->last_balance = jiffies;
+            interval = get_sd_balance_interval(sd, idle != CPU_IDLE);
+        }
+
+        if (time_after(next_balance, sd->last_balance + interval)) {
+            next_balance = sd->last_balance + interval;
+            update_next_balance = 1;
+        }
+    }
+
+    if (update_next_balance)
+        rq->next_balance = next_balance;
+}
+
+/* scheduler_tick里调用，中断已关 */
+void trigger_load_balance(struct rq *rq)
+{
+    if (!rq->sd || !time_after_eq(jiffies, rq->next_balance))
+        return;
+
+    rebalance_domains(rq, rq->idle_balance ? CPU_IDLE : CPU_NOT_IDLE);
+}
+
+/*
+ * pick_next_task没有可挑的任务时调用，持rq->lock、中断已关。均衡期间
+ * 放开rq->lock，返回非0表示队列上来了任务，要重新挑。
+ */
+int idle_balance(struct rq *this_rq)
+{
+    int this_cpu = cpu_of(this_rq);
+    struct sched_domain *sd;
+    int pulled_task = 0;
+    u64 curr_cost = 0;
+    u64 t0, domain_cost;
+
+    sd = __atomic_load_n(&this_rq->sd, __ATOMIC_ACQUIRE);
+    if (!sd)
+        return 0;
+
+    /* 平均空闲时间还不够一次迁移，或者没有哪个CPU排着多个任务 */
+    if (this_rq->avg_idle < SCHED_MIGRATION_COST_NS ||
+        !this_rq->rd || !this_rq->rd->overload)
+        return 0;
+
+    spin_unlock(&this_rq->lock);
+
+    update_blocked_averages(this_rq);
+
+    for (; sd; sd = sd->parent) {
+        int continue_balancing = 1;
+
+        if (!(sd->flags & SD_LOAD_BALANCE))
+            continue;
+
+        /* 再做这一层的开销要超过预计的空闲时间了 */
+        if (this_rq->avg_idle < curr_cost + sd->max_newidle_lb_cost)
+            break;
+
+        if (sd->flags & SD_BALANCE_NEWIDLE) {
+            t0 = sched_clock_cpu(this_cpu);
+            pulled_task = load_balance(this_cpu, this_rq, sd, CPU_NEWLY_IDLE,
+                                       &continue_balancing);
+            domain_cost = sched_clock_cpu(this_cpu) - t0;
+
+            if (domain_cost > sd->max_newidle_lb_cost)
+                sd->max_newidle_lb_cost = domain_cost;
+            curr_cost += domain_cost;
+        }
+
+        /* 拉到了，或者放锁期间有任务入队 */
+        if (pulled_task || this_rq->nr_running)
+            break;
+    }
+
+    spin_lock(&this_rq->lock);
+
+    if (curr_cost > this_rq->max_idle_balance_cost)
+        this_rq->max_idle_balance_cost = curr_cost;
+
+    return pulled_task || this_rq->nr_running;
+}
+
+/*
+ * 唤醒选核
+ *
+ * 先在唤醒者所在CPU和任务上次运行的CPU之间选一个(wake_affine)：共享
+ * 缓存、唤醒者马上要睡或者这边更闲时拉到唤醒者身边，数据还在缓存里。
+ * 再以选中的CPU为目标，在它的LLC里找空闲的核或CPU，找到就放过去，
+ * 不在目标CPU上排队。一对多的唤醒(服务端线程唤醒大量客户端)不做
+ * affine，免得全堆到服务端所在的LLC。
+ */
+
+/* 记录current唤醒对象的切换次数，大约每秒减半 */
+static void record_wakee(struct task_struct *p)
+{
+    struct task_struct *curr = current;
+
+    if (time_after(jiffies, curr->wakee_flip_decay_ts + HZ)) {
+        curr->wakee_flips >>= 1;
+        curr->wakee_flip_decay_ts = jiffies;
+    }
+
+    if (curr->last_wakee != p) {
+        curr->last_wakee = p;
+        curr->wakee_flips++;
+    }
+}
+
+/*
+ * 唤醒者和被唤醒者一方频繁换对象、另一方也不止一个对象，而且都超过
+ * LLC的CPU数时，是一对多的关系，一个LLC放不下，返回1。
+ */
+static int wake_wide(struct task_struct *p)
+{
+    unsigned int master = current->wakee_flips;
+    unsigned int slave = p->wakee_flips;
+    int factor = sd_llc_size[smp_processor_id()];
+
+    if (master < slave) {
+        unsigned int tmp = master;
+
+        master = slave;
+        slave = tmp;
+    }
+    if (slave < factor || master < slave * factor)
+        return 0;
+
+    return 1;
+}
+
+/*
+ * 有一边空闲时直接定。this_cpu空闲且共享缓存，prev也空闲就留在prev，
+ * 免得白白迁移；同步唤醒且唤醒者是this_cpu上唯一的任务，它马上要睡，
+ * 选this_cpu。返回-1表示定不下来。
+ */
+static int wake_affine_idle(int this_cpu, int prev_cpu, int sync)
+{
+    if (idle_cpu(this_cpu) && cpus_share_cache(this_cpu, prev_cpu))
+        return idle_cpu(prev_cpu) ? prev_cpu : this_cpu;
+
+    if (sync && cpu_rq(this_cpu)->nr_running == 1)
+        return this_cpu;
+
+    if (idle_cpu(prev_cpu))
+        return prev_cpu;
+
+    return -1;
+}
+
+/*
+ * 按容量归一化比两边的负载：任务放到this_cpu之后，this_cpu的负载仍
+ * 不超过prev_cpu才拉过来。prev_cpu一侧按imbalance_pct打个折扣，留一点
+ * 偏向缓存热的一方。睡眠任务不在runnable_load_avg里，prev一侧不用减。
+ */
+static int wake_affine_weight(struct sched_domain *sd, struct task_struct *p,
+                              int this_cpu, int prev_cpu, int sync)
+{
+    s64 this_eff_load, prev_eff_load;
+    ulong task_load;
+
+    this_eff_load = cpu_load(cpu_rq(this_cpu));
+
+    if (sync) {
+        ulong current_load = task_h_load(current);
+
+        if ((s64)current_load > this_eff_load)
+            return this_cpu;
+
+        this_eff_load -= current_load;
+    }
+
+    task_load = task_h_load(p);
+
+    this_eff_load += task_load;
+    this_eff_load *= 100;
+    this_eff_load *= capacity_of(prev_cpu);
+
+    prev_eff_load = cpu_load(cpu_rq(prev_cpu));
+    prev_eff_load *= 100 + (sd->imbalance_pct - 100) / 2;
+    prev_eff_load *= capacity_of(this_cpu);
+
+    /* 同步唤醒时两边持平也拉过来 */
+    if (sync)
+        prev_eff_load += 1;
+
+    return this_eff_load < prev_eff_load ? this_cpu : -1;
+}
+
+static int wake_affine(struct sched_domain *sd, struct task_struct *p,
+                       int this_cpu, int prev_cpu, int sync)
+{
+    int target;
+
+    p->se.nr_wakeups_affine_attempts++;
+
+    target = wake_affine_idle(this_cpu, prev_cpu, sync);
+    if (target < 0)
+        target = wake_affine_weight(sd, p, this_cpu, prev_cpu, sync);
+
+    if (target != this_cpu) {
+        p->se.nr_wakeups_passive++;
+        return prev_cpu;
+    }
+
+    p->se.nr_wakeups_affine++;
+    return target;
+}
+
+/*
+ * CPU进出空闲时调用，维护所在LLC的空闲位图。位没变就只读一下，
+ * 不去写共享的缓存行。
+ */
+void update_idle_cpumask(int cpu, int idle)
+{
+    struct sched_domain_shared *sds = sd_llc_shared[cpu];
+    ulong bit = cpumask_of(cpu);
+    ulong smt;
+
+    if (!sds)
+        return;
+
+    if (!!(__atomic_load_n(&sds->idle_cpus, __ATOMIC_RELAXED) & bit) == !!idle)
+        return;
+
+    if (!idle) {
+        __atomic_fetch_and(&sds->idle_cpus, ~bit, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_or(&sds->idle_cpus, bit, __ATOMIC_RELAXED);
+
+    /* 同一个核的兄弟都空闲了，这个核整个空着 */
+    smt = cpu_smt_mask(cpu) & cpu_online_mask;
+    if ((__atomic_load_n(&sds->idle_cpus, __ATOMIC_RELAXED) & smt) == smt &&
+        !__atomic_load_n(&sds->has_idle_cores, __ATOMIC_RELAXED))
+        __atomic_store_n(&sds->has_idle_cores, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * 把cpu从位图里摘掉，摘到了才算挑中。几个CPU同时唤醒任务时不会都
+ * 挑到同一个空闲CPU上。
+ */
+static int claim_idle_cpu(struct sched_domain_shared *sds, int cpu)
+{
+    ulong bit = cpumask_of(cpu);
+
+    if (!(__atomic_fetch_and(&sds->idle_cpus, ~bit, __ATOMIC_RELAXED) & bit))
+        return 0;
+
+    return idle_cpu(cpu);
+}
+
+/* 从target的下一个CPU起轮着找，各CPU唤醒时不都从同一个CPU开始 */
+static int next_cpu_wrap(ulong mask, int target)
+{
+    ulong hi = mask & ~((cpumask_of(target) << 1) - 1);
+
+    if (hi)
+        return __builtin_ctzl(hi);
+    if (mask)
+        return __builtin_ctzl(mask);
+    return -1;
+}
+
+/*
+ * 找一个SMT兄弟全空闲的核。has_idle_cores为0就不找；找了一遍没有，
+ * 把它清掉，等下一个核空下来再置上。
+ */
+static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int target)
+{
+    struct sched_domain_shared *sds = sd->shared;
+    ulong idle, cpus, smt;
+    int core, cpu;
+
+    if (!__atomic_load_n(&sds->has_idle_cores, __ATOMIC_RELAXED))
+        return -1;
+
+    idle = __atomic_load_n(&sds->idle_cpus, __ATOMIC_RELAXED);
+    cpus = idle & sd->span & p->cpus_allowed;
+
+    while ((core = next_cpu_wrap(cpus, target)) >= 0) {
+        smt = cpu_smt_mask(core) & cpu_online_mask;
+        cpus &= ~smt;
+
+        if ((idle & smt) != smt)
+            continue;
+
+        for_each_cpu_mask(cpu, smt & p->cpus_allowed) {
+            if (claim_idle_cpu(sds, cpu))
+                return cpu;
+        }
+    }
+
+    __atomic_store_n(&sds->has_idle_cores, 0, __ATOMIC_RELAXED);
+    return -1;
+}
+
+/* 没有整个空闲的核，找任意一个空闲CPU */
+static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int target)
+{
+    struct sched_domain_shared *sds = sd->shared;
+    ulong cpus;
+    int cpu;
+
+    cpus = __atomic_load_n(&sds->idle_cpus, __ATOMIC_RELAXED) &
+           sd->span & p->cpus_allowed;
+
+    while ((cpu = next_cpu_wrap(cpus, target)) >= 0) {
+        cpus &= ~cpumask_of(cpu);
+        if (claim_idle_cpu(sds, cpu))
+            return cpu;
+    }
+
+    return -1;
+}
+
+static int select_idle_sibling(struct task_struct *p, int prev, int target)
+{
+    struct sched_domain *sd;
+    int i;
+
+    if (idle_cpu(target))
+        return target;
+
+    /* prev和target共享缓存，prev空闲就回prev，缓存更热 */
+    if (prev != target && cpus_share_cache(prev, target) && idle_cpu(prev) &&
+        (p->cpus_allowed & cpumask_of(prev)))
+        return prev;
+
+    sd = sd_llc[target];
+    if (!sd || !sd->shared)
+        return target;
+
+    i = select_idle_core(p, sd, target);
+    if (i >= 0)
+        return i;
+
+    i = select_idle_cpu(p, sd, target);
+    if (i >= 0)
+        return i;
+
+    return target;
+}
+
+/*
+ * wake_up_process里调用，持p->pi_lock，p不在任何运行队列上。返回的
+ * CPU在p->cpus_allowed里。
+ */
+int select_task_rq_fair(struct task_struct *p, int prev_cpu, int wake_flags)
+{
+    int cpu = smp_processor_id();
+    int sync = wake_flags & WF_SYNC;
+    int new_cpu = prev_cpu;
+    int want_affine;
+    struct sched_domain *sd;
+
+    record_wakee(p);
+
+    want_affine = !wake_wide(p) && (p->cpus_allowed & cpumask_of(cpu));
+
+    /* 找到同时包含两个CPU的最低一层，在这一层上比 */
+    for (sd = __atomic_load_n(&cpu_rq(cpu)->sd, __ATOMIC_ACQUIRE); sd; sd = sd->parent) {
+        if (want_affine && (sd->flags & SD_WAKE_AFFINE) &&
+            (sd->span & cpumask_of(prev_cpu))) {
+            if (cpu != prev_cpu)
+                new_cpu = wake_affine(sd, p, cpu, prev_cpu, sync);
+            break;
+        }
+    }
+
+    new_cpu = select_idle_sibling(p, prev_cpu, new_cpu);
+    if (idle_cpu(new_cpu))
+        p->se.nr_wakeups_idle++;
+
+    return new_cpu;
+}
+
 const struct sched_class fair_sched_class = {
     .next                   = &idle_sched_class,
     .enqueue_task           = enqueue_task_fair,
@@ -595,3 +1926,4 @@ const struct sched_class fair_sched_class = {
     .put_prev_task          = put_prev_task_fair,
 
     .set_curr_task          = set_curr_task_fair,
+    .task_tick              = task_tick_fair,
@@ -0,0 +1,422 @@
+#include "../../include/types.h"
+#include "../../include/string.h"
+#include "../../include/sched.h"
+#include "../../include/numa.h"
+#include "../../include/smp.h"
+#include "../../include/topology.h"
+
+/*
+ * CPU拓扑和调度域。
+ *
+ * APIC ID从低位起依次是SMT编号、核编号，剩下的高位是封装编号，各段
+ * 位宽由CPUID给出；共享LLC的CPU同样是APIC ID右移若干位后相等。这里
+ * 假定所有CPU一样，只在BSP上读一次CPUID。
+ *
+ * 封装以上按NUMA距离分层：先是本节点，再按SLIT里出现过的距离从近
+ * 到远，每层包含距离不超过该值的所有节点上的CPU。组按范围的首CPU
+ * 共用，要求每层各节点的范围要么相同要么不相交；距离不满足传递性时
+ * 做不到，从那一层起直接放宽到整机。
+ *
+ * 域和组都是静态数组，在所有AP上线后建一次，之后不再变化。
+ */
+
+#define SD_FIXED_LEVELS     3       /* SMT、MC、PKG */
+#define SD_MAX_NUMA_LEVELS  4       /* 本节点加上最多3种远端距离 */
+#define SD_LEVELS           (SD_FIXED_LEVELS + SD_MAX_NUMA_LEVELS)
+
+ulong cpu_sibling_map[NR_CPUS];
+ulong cpu_llc_shared_map[NR_CPUS];
+ulong cpu_core_map[NR_CPUS];
+int cpu_llc_id[NR_CPUS];
+
+static unsigned int smt_shift, core_shift, llc_shift;
+
+static struct root_domain def_root_domain;
+
+static struct sched_domain sd_data[NR_CPUS][SD_LEVELS];
+
+/* 同一范围的组被范围内所有CPU的域共用，放在范围里首个CPU的槽上 */
+static struct sched_group sg_data[NR_CPUS][SD_LEVELS];
+
+/* 按cpu_llc_id存放，同一个LLC的CPU共用一份 */
+static struct sched_domain_shared sds_data[NR_CPUS];
+
+/* 各CPU共享LLC的最高一层域，唤醒选核从这里开始找 */
+struct sched_domain *sd_llc[NR_CPUS];
+int sd_llc_size[NR_CPUS];
+struct sched_domain_shared *sd_llc_shared[NR_CPUS];
+
+/* NUMA层没有mask函数，按numa_level查sched_numa_masks */
+struct sched_domain_topology_level {
+    ulong (*mask)(int cpu);
+    u32 flags;
+    const char *name;
+    int numa_level;
+};
+
+static struct sched_domain_topology_level sched_topology[SD_LEVELS] = {
+    { cpu_smt_mask,     SD_SHARE_CPUCAPACITY | SD_SHARE_PKG_RESOURCES, "SMT", -1 },
+    { cpu_llc_mask,     SD_SHARE_PKG_RESOURCES,                        "MC",  -1 },
+    { cpu_pkg_mask,     0,                                             "PKG", -1 },
+};
+static int sched_nr_levels = SD_FIXED_LEVELS;
+
+/* sched_numa_masks[i][node]：和node距离不超过sched_numa_distance[i]的CPU */
+static int sched_numa_distance[SD_MAX_NUMA_LEVELS];
+static ulong sched_numa_masks[SD_MAX_NUMA_LEVELS][MAX_NUMNODES];
+
+static ulong tl_mask(struct sched_domain_topology_level *tl, int cpu)
+{
+    if (tl->mask)
+        return tl->mask(cpu);
+
+    return sched_numa_masks[tl->numa_level][cpu_to_node(cpu)];
+}
+
+static inline void cpuid_count(u32 op, u32 count, u32 *eax, u32 *ebx,
+                               u32 *ecx, u32 *edx)
+{
+    asm volatile("cpuid"
+                 : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                 : "0" (op), "2" (count));
+}
+
+/* 容纳n个编号要几位 */
+static unsigned int count_order(u32 n)
+{
+    return n > 1 ? 32 - __builtin_clz(n - 1) : 0;
+}
+
+static void detect_topology_shifts(void)
+{
+    u32 eax, ebx, ecx, edx, max_leaf, sub, type;
+    u32 logical, cores, level, llc_level = 0;
+
+    cpuid_count(0, 0, &max_leaf, &ebx, &ecx, &edx);
+
+    ebx = 0;
+    if (max_leaf >= 0xb)
+        cpuid_count(0xb, 0, &eax, &ebx, &ecx, &edx);
+
+    if (ebx) {
+        /* 0xb叶逐层给出到下一层要右移的位数 */
+        for (sub = 0; ; sub++) {
+            cpuid_count(0xb, sub, &eax, &ebx, &ecx, &edx);
+            type = (ecx >> 8) & 0xff;
+            if (!type)
+                break;
+            if (type == 1)
+                smt_shift = eax & 0x1f;
+            else if (type == 2)
+                core_shift = eax & 0x1f;
+        }
+        if (core_shift < smt_shift)
+            core_shift = smt_shift;
+    } else {
+        /* 老处理器：1号叶给出封装内的逻辑CPU数，4号叶给出核数 */
+        cpuid_count(1, 0, &eax, &ebx, &ecx, &edx);
+        logical = (edx & (1 << 28)) ? (ebx >> 16) & 0xff : 1;
+        cores = 1;
+        if (max_leaf >= 4) {
+            cpuid_count(4, 0, &eax, &ebx, &ecx, &edx);
+            if (eax & 0x1f)
+                cores = ((eax >> 26) & 0x3f) + 1;
+        }
+        core_shift = count_order(logical);
+        smt_shift = count_order(MAX(logical / cores, 1U));
+    }
+
+    /* 4号叶里级别最高的缓存就是LLC，没有时按整个封装算 */
+    llc_shift = core_shift;
+    if (max_leaf >= 4) {
+        for (sub = 0; ; sub++) {
+            cpuid_count(4, sub, &eax, &ebx, &ecx, &edx);
+            if (!(eax & 0x1f))
+                break;
+            level = (eax >> 5) & 0x7;
+            if (level > llc_level) {
+                llc_level = level;
+                llc_shift = count_order(((eax >> 14) & 0xfff) + 1);
+            }
+        }
+    }
+}
+
+static void build_cpu_topology(void)
+{
+    u32 id, oid;
+    int cpu, other;
+
+    for_each_online_cpu(cpu) {
+        id = cpu_to_apicid[cpu];
+
+        cpu_sibling_map[cpu] = 0;
+        cpu_llc_shared_map[cpu] = 0;
+        cpu_core_map[cpu] = 0;
+
+        for_each_online_cpu(other) {
+            oid = cpu_to_apicid[other];
+
+            if ((id >> smt_shift) == (oid >> smt_shift))
+                cpu_sibling_map[cpu] |= cpumask_of(other);
+            if ((id >> llc_shift) == (oid >> llc_shift))
+                cpu_llc_shared_map[cpu] |= cpumask_of(other);
+            if ((id >> core_shift) == (oid >> core_shift))
+                cpu_core_map[cpu] |= cpumask_of(other);
+        }
+
+        cpu_llc_id[cpu] = __builtin_ctzl(cpu_llc_shared_map[cpu]);
+    }
+}
+
+/* 第level层的范围，把下面各层并进来，保证逐层包含 */
+static ulong level_span(int cpu, int level)
+{
+    ulong span = cpumask_of(cpu);
+    int l;
+
+    for (l = 0; l <= level; l++)
+        span |= tl_mask(&sched_topology[l], cpu) & cpu_online_mask;
+
+    return span;
+}
+
+/* level层上包含cpu的组，即cpu在下一层的范围 */
+static struct sched_group *get_group(int cpu, int level)
+{
+    ulong span = level ? level_span(cpu, level - 1) : cpumask_of(cpu);
+    struct sched_group *sg = &sg_data[__builtin_ctzl(span)][level];
+
+    sg->cpumask = span;
+    sg->group_weight = __builtin_popcountl(span);
+
+    return sg;
+}
+
+/*
+ * 组环按首CPU排序，范围内每个CPU建出来的环都一样，共用的组可以
+ * 重复写。返回本CPU所在的组。
+ */
+static struct sched_group *build_sched_groups(struct sched_domain *sd, int cpu)
+{
+    struct sched_group *first = NULL, *last = NULL, *sg;
+    ulong covered = 0;
+    int i;
+
+    for_each_cpu_mask(i, sd->span) {
+        if (covered & cpumask_of(i))
+            continue;
+
+        sg = get_group(i, sd->level);
+        covered |= sg->cpumask;
+
+        if (first)
+            last->next = sg;
+        else
+            first = sg;
+        last = sg;
+    }
+    last->next = first;
+
+    return get_group(cpu, sd->level);
+}
+
+static void sd_init(struct sched_domain *sd, int level, ulong span)
+{
+    struct sched_domain_topology_level *tl = &sched_topology[level];
+    unsigned int weight = __builtin_popcountl(span);
+
+    memset(sd, 0, sizeof(*sd));
+
+    sd->span = span;
+    sd->span_weight = weight;
+    sd->level = level;
+    sd->name = tl->name;
+    sd->flags = SD_LOAD_BALANCE | SD_BALANCE_NEWIDLE | SD_WAKE_AFFINE | tl->flags;
+
+    /* 范围越大均衡越慢，每个CPU约1ms */
+    sd->min_interval = weight;
+    sd->max_interval = 2 * weight;
+    sd->balance_interval = weight;
+    sd->busy_factor = 16;
+
+    sd->imbalance_pct = 117;
+    sd->cache_nice_tries = 1;
+
+    if (sd->flags & SD_SHARE_CPUCAPACITY) {
+        sd->imbalance_pct = 110;
+        sd->cache_nice_tries = 0;
+    }
+
+    /* 跨节点迁移代价大，要更不均衡才动，缓存热的任务多等几次 */
+    if (sd->flags & SD_NUMA) {
+        sd->imbalance_pct = 125;
+        sd->cache_nice_tries = 2;
+    }
+
+    sd->last_balance = jiffies;
+}
+
+/* 第k层各有CPU的节点的范围两两相同或不相交，组才不会重叠 */
+static bool numa_level_is_partition(int k, const ulong *node_cpus)
+{
+    ulong a, b;
+    int i, j;
+
+    for_each_online_node(i) {
+        if (!node_cpus[i])
+            continue;
+        for_each_online_node(j) {
+            if (!node_cpus[j])
+                continue;
+            a = sched_numa_masks[k][i];
+            b = sched_numa_masks[k][j];
+            if (a != b && (a & b))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * 从SLIT建NUMA层。距离从小到大去重，第0层是本节点(LOCAL_DISTANCE)，
+ * 不带SD_NUMA；之后每种距离一层。距离种类超过上限，或某一层的范围
+ * 互相交叠(A近B、B近C而A远C)时，那一层就是最后一层，放宽到所有在线
+ * CPU，保证最顶层覆盖整机。
+ */
+static void sched_init_numa(void)
+{
+    ulong node_cpus[MAX_NUMNODES];
+    int nr_levels = 0;
+    int i, j, k, cpu, d, next;
+
+    memset(node_cpus, 0, sizeof(node_cpus));
+    for_each_online_cpu(cpu)
+        node_cpus[cpu_to_node(cpu)] |= cpumask_of(cpu);
+
+    /* 依次找比上一层大的最小距离 */
+    d = 0;
+    for (;;) {
+        next = -1;
+        for_each_online_node(i) {
+            for_each_online_node(j) {
+                k = node_distance(i, j);
+                if (k > d && (next < 0 || k < next))
+                    next = k;
+            }
+        }
+        if (next < 0 || nr_levels == SD_MAX_NUMA_LEVELS)
+            break;
+        sched_numa_distance[nr_levels++] = next;
+        d = next;
+    }
+
+    /* 没有节点信息时也要有一层覆盖整机 */
+    if (!nr_levels)
+        sched_numa_distance[nr_levels++] = LOCAL_DISTANCE;
+
+    for (k = 0; k < nr_levels; k++) {
+        for_each_online_node(i) {
+            sched_numa_masks[k][i] = 0;
+            for_each_online_node(j) {
+                if (node_distance(i, j) <= sched_numa_distance[k])
+                    sched_numa_masks[k][i] |= node_cpus[j];
+            }
+        }
+
+        if (k < nr_levels - 1 && !numa_level_is_partition(k, node_cpus)) {
+            printk("sched: NUMA distance %d not transitive, flattening\n",
+                   sched_numa_distance[k]);
+            nr_levels = k + 1;
+        }
+
+        sched_topology[SD_FIXED_LEVELS + k] = (struct sched_domain_topology_level) {
+            .mask       = NULL,
+            .flags      = k ? SD_NUMA : 0,
+            .name       = k ? "NUMA" : "NODE",
+            .numa_level = k,
+        };
+    }
+
+    for (i = 0; i < MAX_NUMNODES; i++)
+        sched_numa_masks[nr_levels - 1][i] = cpu_online_mask;
+
+    sched_nr_levels = SD_FIXED_LEVELS + nr_levels;
+}
+
+/*
+ * 记下cpu的LLC域。LLC只有这一个CPU时没有这一层的域，sd_llc留空，
+ * 唤醒时只看目标CPU本身。
+ */
+static void update_top_cache_domain(int cpu, struct sched_domain *bottom)
+{
+    struct sched_domain *sd, *llc = NULL;
+
+    for (sd = bottom; sd; sd = sd->parent) {
+        if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
+            break;
+        llc = sd;
+    }
+
+    sd_llc[cpu] = llc;
+    sd_llc_size[cpu] = llc ? llc->span_weight : 1;
+    sd_llc_shared[cpu] = NULL;
+    if (llc) {
+        llc->shared = &sds_data[cpu_llc_id[cpu]];
+        sd_llc_shared[cpu] = llc->shared;
+    }
+}
+
+/* AP全部上线之后调用 */
+void sched_init_domains(void)
+{
+    struct sched_domain *sd, *top, *bottom;
+    ulong span, prev_span;
+    int cpu, level;
+
+    detect_topology_shifts();
+    build_cpu_topology();
+    sched_init_numa();
+
+    def_root_domain.span = cpu_online_mask;
+    def_root_domain.overload = 0;
+    memset(sds_data, 0, sizeof(sds_data));
+
+    for_each_online_cpu(cpu) {
+        top = bottom = NULL;
+        prev_span = cpumask_of(cpu);
+
+        for (level = 0; level < sched_nr_levels; level++) {
+            span = level_span(cpu, level);
+            /* 和下一层一样大的层级没有可均衡的，不建 */
+            if (span == prev_span)
+                continue;
+
+            sd = &sd_data[cpu][level];
+            sd_init(sd, level, span);
+            sd->child = top;
+            if (top)
+                top->parent = sd;
+            else
+                bottom = sd;
+            top = sd;
+            prev_span = span;
+        }
+
+        for (sd = bottom; sd; sd = sd->parent)
+            sd->groups = build_sched_groups(sd, cpu);
+
+        update_top_cache_domain(cpu, bottom);
+
+        cpu_rq(cpu)->rd = &def_root_domain;
+        cpu_rq(cpu)->next_balance = jiffies;
+        /* 最后挂上，挂上之后时钟中断就开始按域均衡 */
+        __atomic_store_n(&cpu_rq(cpu)->sd, bottom, __ATOMIC_RELEASE);
+    }
+
+    printk("sched: topology smt_shift=%u core_shift=%u llc_shift=%u\n",
+           smt_shift, core_shift, llc_shift);
+    for (sd = cpu_rq(0)->sd; sd; sd = sd->parent)
+        printk("sched: CPU0 domain %s spans %u CPUs\n", sd->name, sd->span_weight);
+}
@@ -0,0 +1,372 @@
+#include "../../include/types.h"
+#include "../../include/mm.h"
+#include "../../include/sched.h"
+#include "../../include/string.h"
+#include "../../include/pgtable.h"
+#include "../../include/numa.h"
+#include "../../include/acpi.h"
+#include "../../include/smp.h"
+#include "../../include/apic.h"
+
+/*
+ * 多处理器启动和跨CPU调用。
+ *
+ * BSP在MADT里找到所有CPU，把跳板复制到低端内存，逐个INIT/SIPI唤醒。
+ * AP从跳板进入长模式后落到start_secondary，装好自己的GS基址和APIC，
+ * 置上在线位，然后进入自己的空闲循环，从此由调度器往它的队列上放进程。
+ *
+ * 跨CPU调用用每CPU一条无锁链表：发起方挂上请求，只有链表原来是空的
+ * 才发IPI，目标CPU在中断里把整条链摘下来依次执行。
+ */
+
+struct pcpu_hot pcpu_hot[NR_CPUS];
+
+ulong cpu_possible_mask;
+ulong cpu_online_mask;
+int nr_cpu_ids = 1;
+int cpu_to_apicid[NR_CPUS];
+
+static struct llist_head call_single_queue[NR_CPUS];
+
+/* 不等待的smp_call_function_single用的请求，每个发起CPU一个 */
+static struct call_single_data csd_data[NR_CPUS];
+
+/* trampoline.S */
+extern char trampoline_start[], trampoline_header[], trampoline_end[];
+
+struct trampoline_header {
+    u64 cr3;
+    u64 stack;
+    u64 entry;
+};
+
+/* 正在启动的CPU号，AP在start_secondary里按它认领自己的每CPU数据 */
+static volatile int smp_booting_cpu;
+
+static void setup_percpu_area(int cpu)
+{
+    struct pcpu_hot *p = &pcpu_hot[cpu];
+
+    p->self = p;
+    p->cpu_number = cpu;
+    p->apicid = cpu_to_apicid[cpu];
+
+    /*
+     * 内核态的GS基址指向这里，KERNEL_GS_BASE放用户态的，进出用户态时
+     * swapgs交换两者。用户进程还不能设自己的GS基址，一律是0。
+     */
+    native_write_msr(MSR_GS_BASE, (u64)p);
+    native_write_msr(MSR_KERNEL_GS_BASE, 0);
+}
+
+/* 最先调用，之后get_current和smp_processor_id才能用；这时还不能打印 */
+void smp_setup_boot_cpu(void)
+{
+    u32 eax, ebx, ecx, edx;
+
+    asm volatile("cpuid"
+                 : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                 : "0" (1), "2" (0));
+
+    cpu_to_apicid[0] = ebx >> 24;
+    setup_percpu_area(0);
+
+    cpu_possible_mask = cpumask_of(0);
+    cpu_online_mask = cpumask_of(0);
+}
+
+/* 解析MADT时每找到一个启用的本地APIC调用一次，返回分到的CPU号 */
+int smp_register_cpu(u32 apicid)
+{
+    int cpu;
+
+    if (apicid == (u32)cpu_to_apicid[0])
+        return 0;
+
+    if (nr_cpu_ids >= NR_CPUS) {
+        printk("SMP: APIC %u ignored, NR_CPUS=%d reached\n", apicid, NR_CPUS);
+        return -ENOSPC;
+    }
+
+    cpu = nr_cpu_ids++;
+    cpu_to_apicid[cpu] = apicid;
+    cpu_possible_mask |= cpumask_of(cpu);
+
+    return cpu;
+}
+
+void start_secondary(void)
+{
+    int cpu = smp_booting_cpu;
+
+    setup_percpu_area(cpu);
+    load_idt();
+
+    lapic_init();
+    setup_apic_timer();
+
+    __atomic_fetch_or(&cpu_online_mask, cpumask_of(cpu), __ATOMIC_RELEASE);
+
+    printk("SMP: CPU%d (APIC %u) online\n", cpu, cpu_to_apicid[cpu]);
+
+    local_irq_enable();
+    cpu_startup_entry();
+}
+
+static int do_boot_cpu(int cpu)
+{
+    struct trampoline_header *th;
+    struct task_struct *idle;
+    int timeout;
+
+    idle = fork_idle(cpu);
+    if (!idle)
+        return -ENOMEM;
+
+    numa_add_cpu(cpu, cpu_to_apicid[cpu]);
+
+    pcpu_hot[cpu].current_task = idle;
+    pcpu_hot[cpu].top_of_stack = (ulong)idle->stack + THREAD_SIZE;
+
+    th = __va(SMP_TRAMPOLINE_BASE + (trampoline_header - trampoline_start));
+    th->cr3 = read_cr3();
+    th->stack = pcpu_hot[cpu].top_of_stack;
+    th->entry = (u64)start_secondary;
+
+    smp_booting_cpu = cpu;
+    __sync_synchronize();
+
+    if (wakeup_secondary_cpu_via_init(cpu_to_apicid[cpu], SMP_TRAMPOLINE_BASE))
+        printk("SMP: APIC error while waking CPU%d\n", cpu);
+
+    /* AP一个一个启动，共用跳板和smp_booting_cpu，等它上线再启动下一个 */
+    for (timeout = 0; timeout < 10000; timeout++) {
+        if (cpu_online(cpu))
+            return 0;
+        apic_udelay(100);
+    }
+
+    printk("SMP: CPU%d (APIC %u) did not respond\n", cpu, cpu_to_apicid[cpu]);
+    cpu_possible_mask &= ~cpumask_of(cpu);
+    return -EIO;
+}
+
+/* 在sched_init之后调用，AP一上线就要用运行队列 */
+void smp_init(void)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        init_llist_head(&call_single_queue[cpu]);
+
+    set_intr_gate(RESCHEDULE_VECTOR, reschedule_interrupt);
+    set_intr_gate(CALL_FUNCTION_SINGLE_VECTOR, call_function_single_interrupt);
+    set_intr_gate(LOCAL_TIMER_VECTOR, apic_timer_interrupt);
+    set_intr_gate(ERROR_APIC_VECTOR, error_interrupt);
+    set_intr_gate(SPURIOUS_APIC_VECTOR, spurious_interrupt);
+
+    if (acpi_madt_init() < 0)
+        printk("SMP: no MADT, running on the boot CPU only\n");
+
+    if (nr_cpu_ids > 1)
+        memcpy(__va(SMP_TRAMPOLINE_BASE), trampoline_start,
+               trampoline_end - trampoline_start);
+
+    for_each_possible_cpu(cpu) {
+        if (cpu == 0)
+            continue;
+        do_boot_cpu(cpu);
+    }
+
+    printk("SMP: %d of %d CPUs online\n", num_online_cpus(), nr_cpu_ids);
+}
+
+void smp_send_reschedule(int cpu)
+{
+    apic_send_ipi(cpu_to_apicid[cpu], RESCHEDULE_VECTOR);
+}
+
+static inline void csd_lock_wait(struct call_single_data *csd)
+{
+    while (__atomic_load_n(&csd->flags, __ATOMIC_ACQUIRE) & CSD_FLAG_LOCK)
+        cpu_relax();
+}
+
+static inline void csd_unlock(struct call_single_data *csd)
+{
+    __atomic_store_n(&csd->flags, 0, __ATOMIC_RELEASE);
+}
+
+static int generic_exec_single(int cpu, struct call_single_data *csd)
+{
+    ulong flags;
+
+    if (cpu == (int)smp_processor_id()) {
+        smp_call_func_t func = csd->func;
+        void *info = csd->info;
+
+        flags = local_irq_save();
+        csd_unlock(csd);
+        func(info);
+        local_irq_restore(flags);
+        return 0;
+    }
+
+    if (!cpu_online(cpu)) {
+        csd_unlock(csd);
+        return -ENODEV;
+    }
+
+    /* 链表原来非空说明IPI已经发过、对方还没处理，不用再发 */
+    if (llist_add(&csd->llist, &call_single_queue[cpu]))
+        apic_send_ipi(cpu_to_apicid[cpu], CALL_FUNCTION_SINGLE_VECTOR);
+
+    return 0;
+}
+
+/* 在cpu上执行func(info)；wait为真时等它执行完再返回，不能在关中断时等 */
+int smp_call_function_single(int cpu, smp_call_func_t func, void *info,
+                             int wait)
+{
+    struct call_single_data csd_stack = { .flags = CSD_FLAG_LOCK };
+    struct call_single_data *csd;
+    int ret;
+
+    if (cpu < 0 || cpu >= NR_CPUS)
+        return -EINVAL;
+
+    if (wait) {
+        csd = &csd_stack;
+    } else {
+        csd = &csd_data[smp_processor_id()];
+        csd_lock_wait(csd);
+        csd->flags = CSD_FLAG_LOCK;
+    }
+
+    csd->func = func;
+    csd->info = info;
+
+    ret = generic_exec_single(cpu, csd);
+    if (!ret && wait)
+        csd_lock_wait(csd);
+
+    return ret;
+}
+
+/* csd由调用者管理，上一次请求还没执行完时返回-EBUSY */
+int smp_call_function_single_async(int cpu, struct call_single_data *csd)
+{
+    if (cpu < 0 || cpu >= NR_CPUS)
+        return -EINVAL;
+
+    if (__atomic_fetch_or(&csd->flags, CSD_FLAG_LOCK, __ATOMIC_ACQUIRE) &
+        CSD_FLAG_LOCK)
+        return -EBUSY;
+
+    return generic_exec_single(cpu, csd);
+}
+
+/*
+ * 在mask里除本CPU以外的在线CPU上执行func(info)，等全部执行完才返回。
+ * 先把请求都挂出去再一起等，各CPU并行处理。请求放在栈上。
+ *
+ * 不能在关中断时调用：两个CPU同时在关中断的情况下互相发请求，谁都
+ * 收不到对方的IPI。
+ */
+void smp_call_function_many(ulong mask, smp_call_func_t func, void *info)
+{
+    struct call_single_data csd[NR_CPUS];
+    int this_cpu = smp_processor_id();
+    ulong sent = 0;
+    int cpu;
+
+    mask &= cpu_online_mask & ~cpumask_of(this_cpu);
+    if (!mask)
+        return;
+
+    for_each_cpu_mask(cpu, mask) {
+        csd[cpu].flags = CSD_FLAG_LOCK;
+        csd[cpu].func = func;
+        csd[cpu].info = info;
+        if (!generic_exec_single(cpu, &csd[cpu]))
+            sent |= cpumask_of(cpu);
+    }
+
+    for_each_cpu_mask(cpu, sent)
+        csd_lock_wait(&csd[cpu]);
+}
+
+/* 所有在线CPU(包括本CPU)上执行func(info)，本CPU上关中断执行 */
+void on_each_cpu(smp_call_func_t func, void *info)
+{
+    ulong flags;
+
+    smp_call_function_many(cpu_online_mask, func, info);
+
+    flags = local_irq_save();
+    func(info);
+    local_irq_restore(flags);
+}
+
+/*
+ * TLB shootdown。vunmap、vmalloc的延迟回收和释放vmap栈之后，别的CPU
+ * 的TLB里可能还留着这段内核地址的旧映射，地址重新分配出去之后就会
+ * 访问到已经释放的页，所以每个在线CPU都要冲一遍。
+ */
+struct flush_tlb_info {
+    ulong start;
+    ulong end;
+};
+
+static void do_flush_tlb_all(void *info)
+{
+    __flush_tlb_all();
+}
+
+static void do_kernel_range_flush(void *info)
+{
+    struct flush_tlb_info *f = info;
+
+    __flush_tlb_kernel_range(f->start, f->end);
+}
+
+void flush_tlb_all(void)
+{
+    on_each_cpu(do_flush_tlb_all, NULL);
+}
+
+void flush_tlb_kernel_range(ulong start, ulong end)
+{
+    struct flush_tlb_info info = { .start = start, .end = end };
+
+    on_each_cpu(do_kernel_range_flush, &info);
+}
+
+/*
+ * 拆掉用户页的映射之后调用。没有记录mm在哪些CPU上跑过，每个CPU都冲；
+ * 用户页不带_PAGE_GLOBAL，没在跑这个mm的CPU冲一下也没有坏处。
+ */
+void flush_tlb_page(struct vm_area_struct *vma, ulong addr)
+{
+    flush_tlb_kernel_range(addr, addr + PAGE_SIZE);
+}
+
+/* 在CALL_FUNCTION_SINGLE_VECTOR中断里调用，中断已关 */
+void flush_smp_call_function_queue(void)
+{
+    struct call_single_data *csd, *next;
+    struct llist_node *entry;
+    smp_call_func_t func;
+    void *info;
+
+    entry = llist_del_all(&call_single_queue[smp_processor_id()]);
+    entry = llist_reverse_order(entry);
+
+    llist_for_each_entry_safe(csd, next, entry, llist) {
+        func = csd->func;
+        info = csd->info;
+        /* 同步调用要等func执行完才能解锁，发起方的栈上csd才能释放 */
+        func(info);
+        csd_unlock(csd);
+    }
+}
@@ -0,0 +1,294 @@
+#include "../../include/types.h"
+#include "../../include/mm.h"
+#include "../../include/string.h"
+#include "../../include/acpi.h"
+#include "../../include/numa.h"
+#include "../../include/smp.h"
+
+/*
+ * 启动早期只需要读几张静态表(SRAT/SLIT/MADT)，不解释AML。
+ * 表都在低端物理内存里，通过直接映射访问。
+ */
+
+#define EBDA_SEG_PTR        0x40E       /* BDA中EBDA段地址的位置 */
+#define BIOS_ROM_START      0xE0000
+#define BIOS_ROM_END        0x100000
+
+#define MAX_PXM_DOMAINS     256
+
+static struct acpi_table_rsdp *acpi_rsdp;
+
+static int pxm_to_node_map[MAX_PXM_DOMAINS];
+static int nr_pxm_nodes;
+
+static u8 acpi_checksum(const void *buf, u32 len)
+{
+    const u8 *p = buf;
+    u8 sum = 0;
+
+    while (len--)
+        sum += *p++;
+
+    return sum;
+}
+
+static struct acpi_table_rsdp *acpi_scan_rsdp(phys_addr_t start, phys_addr_t end)
+{
+    struct acpi_table_rsdp *rsdp;
+    phys_addr_t addr;
+
+    /* RSDP按16字节对齐 */
+    for (addr = start; addr + sizeof(*rsdp) <= end; addr += 16) {
+        rsdp = __va(addr);
+        if (memcmp(rsdp->signature, ACPI_SIG_RSDP, 8))
+            continue;
+        if (acpi_checksum(rsdp, 20))
+            continue;
+        if (rsdp->revision >= 2 && acpi_checksum(rsdp, rsdp->length))
+            continue;
+        return rsdp;
+    }
+
+    return NULL;
+}
+
+static struct acpi_table_rsdp *acpi_find_rsdp(void)
+{
+    phys_addr_t ebda;
+
+    if (acpi_rsdp)
+        return acpi_rsdp;
+
+    /* 先找EBDA的前1KB，再找BIOS只读区 */
+    ebda = (phys_addr_t)(*(u16 *)__va(EBDA_SEG_PTR)) << 4;
+    if (ebda)
+        acpi_rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+    if (!acpi_rsdp)
+        acpi_rsdp = acpi_scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+
+    return acpi_rsdp;
+}
+
+struct acpi_table_header *acpi_get_table(const char *signature)
+{
+    struct acpi_table_rsdp *rsdp = acpi_find_rsdp();
+    struct acpi_table_header *root, *table;
+    phys_addr_t addr;
+    int entry_size, count, i;
+
+    if (!rsdp)
+        return NULL;
+
+    /* ACPI 2.0以后优先用64位的XSDT */
+    if (rsdp->revision >= 2 && rsdp->xsdt_physical_address) {
+        root = __va(rsdp->xsdt_physical_address);
+        entry_size = sizeof(u64);
+    } else {
+        root = __va((phys_addr_t)rsdp->rsdt_physical_address);
+        entry_size = sizeof(u32);
+    }
+
+    if (acpi_checksum(root, root->length))
+        return NULL;
+
+    count = (root->length - sizeof(*root)) / entry_size;
+    for (i = 0; i < count; i++) {
+        if (entry_size == sizeof(u64))
+            addr = ((u64 *)(root + 1))[i];
+        else
+            addr = ((u32 *)(root + 1))[i];
+
+        table = __va(addr);
+        if (memcmp(table->signature, signature, 4))
+            continue;
+        if (acpi_checksum(table, table->length)) {
+            printk("ACPI: %.4s checksum error\n", signature);
+            continue;
+        }
+        return table;
+    }
+
+    return NULL;
+}
+
+/* 邻近域编号可以是稀疏的，按出现顺序分配节点号 */
+static int acpi_map_pxm_to_node(u32 pxm)
+{
+    if (pxm >= MAX_PXM_DOMAINS)
+        return NUMA_NO_NODE;
+
+    if (pxm_to_node_map[pxm] == NUMA_NO_NODE) {
+        if (nr_pxm_nodes >= MAX_NUMNODES)
+            return NUMA_NO_NODE;
+        pxm_to_node_map[pxm] = nr_pxm_nodes++;
+    }
+
+    return pxm_to_node_map[pxm];
+}
+
+static int acpi_parse_srat(struct acpi_table_srat *srat)
+{
+    struct acpi_subtable_header *entry;
+    struct acpi_srat_cpu_affinity *cpu;
+    struct acpi_srat_x2apic_cpu_affinity *x2apic;
+    struct acpi_srat_mem_affinity *mem;
+    u8 *p = (u8 *)(srat + 1);
+    u8 *end = (u8 *)srat + srat->header.length;
+    int nr_memblks = 0;
+    u32 pxm;
+    int node;
+
+    for (; p + sizeof(*entry) <= end; p += entry->length) {
+        entry = (struct acpi_subtable_header *)p;
+        if (!entry->length)
+            break;
+
+        switch (entry->type) {
+        case ACPI_SRAT_TYPE_CPU_AFFINITY:
+            cpu = (struct acpi_srat_cpu_affinity *)entry;
+            if (!(cpu->flags & ACPI_SRAT_CPU_ENABLED))
+                break;
+            pxm = cpu->proximity_domain_lo;
+            if (srat->header.revision >= 2)
+                pxm |= cpu->proximity_domain_hi[0] << 8 |
+                       cpu->proximity_domain_hi[1] << 16 |
+                       cpu->proximity_domain_hi[2] << 24;
+            node = acpi_map_pxm_to_node(pxm);
+            if (node != NUMA_NO_NODE)
+                set_apicid_to_node(cpu->apic_id, node);
+            break;
+
+        case ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY:
+            x2apic = (struct acpi_srat_x2apic_cpu_affinity *)entry;
+            if (!(x2apic->flags & ACPI_SRAT_CPU_ENABLED))
+                break;
+            node = acpi_map_pxm_to_node(x2apic->proximity_domain);
+            if (node != NUMA_NO_NODE)
+                set_apicid_to_node(x2apic->apic_id, node);
+            break;
+
+        case ACPI_SRAT_TYPE_MEMORY_AFFINITY:
+            mem = (struct acpi_srat_mem_affinity *)entry;
+            if (!(mem->flags & ACPI_SRAT_MEM_ENABLED) || !mem->length)
+                break;
+            /* 热插拔内存此时还不存在 */
+            if (mem->flags & ACPI_SRAT_MEM_HOT_PLUGGABLE)
+                break;
+            pxm = mem->proximity_domain;
+            if (srat->header.revision < 2)
+                pxm &= 0xff;
+            node = acpi_map_pxm_to_node(pxm);
+            if (node == NUMA_NO_NODE) {
+                printk("SRAT: too many proximity domains, ignoring PXM %u\n", pxm);
+                break;
+            }
+            if (numa_add_memblk(node, mem->base_address,
+                                mem->base_address + mem->length) == 0)
+                nr_memblks++;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return nr_memblks ? 0 : -EINVAL;
+}
+
+static void acpi_parse_slit(struct acpi_table_slit *slit)
+{
+    u64 n = slit->locality_count;
+    u32 i, j;
+    int from, to;
+
+    if (sizeof(*slit) + n * n > slit->header.length)
+        return;
+
+    for (i = 0; i < n && i < MAX_PXM_DOMAINS; i++) {
+        from = pxm_to_node_map[i];
+        if (from == NUMA_NO_NODE)
+            continue;
+        for (j = 0; j < n && j < MAX_PXM_DOMAINS; j++) {
+            to = pxm_to_node_map[j];
+            if (to == NUMA_NO_NODE)
+                continue;
+            numa_set_distance(from, to, slit->entry[i * n + j]);
+        }
+    }
+}
+
+int acpi_numa_init(void)
+{
+    struct acpi_table_header *table;
+    int i;
+
+    for (i = 0; i < MAX_PXM_DOMAINS; i++)
+        pxm_to_node_map[i] = NUMA_NO_NODE;
+    nr_pxm_nodes = 0;
+
+    table = acpi_get_table(ACPI_SIG_SRAT);
+    if (!table)
+        return -ENOENT;
+
+    if (acpi_parse_srat((struct acpi_table_srat *)table))
+        return -EINVAL;
+
+    /* 没有SLIT时沿用numa.c里的默认距离 */
+    table = acpi_get_table(ACPI_SIG_SLIT);
+    if (table)
+        acpi_parse_slit((struct acpi_table_slit *)table);
+
+    return 0;
+}
+
+/* 按MADT登记所有启用的CPU，BSP也在表里，由smp_register_cpu认出来 */
+int acpi_madt_init(void)
+{
+    struct acpi_table_header *table;
+    struct acpi_subtable_header *entry;
+    struct acpi_madt_local_apic *lapic;
+    struct acpi_madt_local_x2apic *x2apic;
+    u8 *p, *end;
+    int nr_cpus = 0;
+
+    table = acpi_get_table(ACPI_SIG_MADT);
+    if (!table)
+        return -ENOENT;
+
+    p = (u8 *)table + sizeof(struct acpi_table_madt);
+    end = (u8 *)table + table->length;
+
+    for (; p + sizeof(*entry) <= end; p += entry->length) {
+        entry = (struct acpi_subtable_header *)p;
+        if (!entry->length)
+            break;
+
+        switch (entry->type) {
+        case ACPI_MADT_TYPE_LOCAL_APIC:
+            lapic = (struct acpi_madt_local_apic *)entry;
+            if (!(lapic->lapic_flags & ACPI_MADT_ENABLED))
+                break;
+            if (smp_register_cpu(lapic->id) >= 0)
+                nr_cpus++;
+            break;
+
+        case ACPI_MADT_TYPE_LOCAL_X2APIC:
+            x2apic = (struct acpi_madt_local_x2apic *)entry;
+            if (!(x2apic->lapic_flags & ACPI_MADT_ENABLED))
+                break;
+            /* xAPIC模式下ICR只能寻址8位的APIC ID */
+            if (x2apic->local_apic_id > 0xff) {
+                printk("MADT: ignoring x2APIC %u\n", x2apic->local_apic_id);
+                break;
+            }
+            if (smp_register_cpu(x2apic->local_apic_id) >= 0)
+                nr_cpus++;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return nr_cpus;
+}
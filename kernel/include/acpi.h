@@ -0,0 +1,130 @@
+#ifndef __ACPI_H__
+#define __ACPI_H__
+
+#include "types.h"
+
+#define ACPI_SIG_RSDP       "RSD PTR "
+#define ACPI_SIG_RSDT       "RSDT"
+#define ACPI_SIG_XSDT       "XSDT"
+#define ACPI_SIG_SRAT       "SRAT"
+#define ACPI_SIG_SLIT       "SLIT"
+#define ACPI_SIG_MADT       "APIC"
+
+struct acpi_table_rsdp {
+    char signature[8];          /* "RSD PTR " */
+    u8 checksum;                /* 前20字节校验和 */
+    char oem_id[6];
+    u8 revision;                /* 0为ACPI 1.0，2及以上有XSDT */
+    u32 rsdt_physical_address;
+    u32 length;
+    u64 xsdt_physical_address;
+    u8 extended_checksum;       /* 整个结构的校验和 */
+    u8 reserved[3];
+} __attribute__((__packed__));
+
+struct acpi_table_header {
+    char signature[4];
+    u32 length;                 /* 含表头的整表长度 */
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    char asl_compiler_id[4];
+    u32 asl_compiler_revision;
+} __attribute__((__packed__));
+
+/* SRAT：CPU和内存的亲和性 */
+struct acpi_table_srat {
+    struct acpi_table_header header;
+    u32 table_revision;
+    u64 reserved;
+} __attribute__((__packed__));
+
+enum acpi_srat_type {
+    ACPI_SRAT_TYPE_CPU_AFFINITY = 0,
+    ACPI_SRAT_TYPE_MEMORY_AFFINITY = 1,
+    ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY = 2,
+};
+
+struct acpi_subtable_header {
+    u8 type;
+    u8 length;
+} __attribute__((__packed__));
+
+struct acpi_srat_cpu_affinity {
+    struct acpi_subtable_header header;
+    u8 proximity_domain_lo;
+    u8 apic_id;
+    u32 flags;
+    u8 local_sapic_eid;
+    u8 proximity_domain_hi[3];
+    u32 clock_domain;
+} __attribute__((__packed__));
+
+struct acpi_srat_mem_affinity {
+    struct acpi_subtable_header header;
+    u32 proximity_domain;
+    u16 reserved;
+    u64 base_address;
+    u64 length;
+    u32 reserved1;
+    u32 flags;
+    u64 reserved2;
+} __attribute__((__packed__));
+
+struct acpi_srat_x2apic_cpu_affinity {
+    struct acpi_subtable_header header;
+    u16 reserved;
+    u32 proximity_domain;
+    u32 apic_id;
+    u32 flags;
+    u32 clock_domain;
+    u32 reserved2;
+} __attribute__((__packed__));
+
+#define ACPI_SRAT_CPU_ENABLED       (1 << 0)
+#define ACPI_SRAT_MEM_ENABLED       (1 << 0)
+#define ACPI_SRAT_MEM_HOT_PLUGGABLE (1 << 1)
+
+/* SLIT：节点间相对距离矩阵 */
+struct acpi_table_slit {
+    struct acpi_table_header header;
+    u64 locality_count;
+    u8 entry[];                 /* locality_count * locality_count */
+} __attribute__((__packed__));
+
+/* MADT：中断控制器，每个CPU一项本地APIC */
+struct acpi_table_madt {
+    struct acpi_table_header header;
+    u32 address;                /* 本地APIC寄存器的物理地址 */
+    u32 flags;
+} __attribute__((__packed__));
+
+enum acpi_madt_type {
+    ACPI_MADT_TYPE_LOCAL_APIC = 0,
+    ACPI_MADT_TYPE_LOCAL_X2APIC = 9,
+};
+
+struct acpi_madt_local_apic {
+    struct acpi_subtable_header header;
+    u8 processor_id;
+    u8 id;
+    u32 lapic_flags;
+} __attribute__((__packed__));
+
+struct acpi_madt_local_x2apic {
+    struct acpi_subtable_header header;
+    u16 reserved;
+    u32 local_apic_id;
+    u32 lapic_flags;
+    u32 uid;
+} __attribute__((__packed__));
+
+#define ACPI_MADT_ENABLED           (1 << 0)
+
+struct acpi_table_header *acpi_get_table(const char *signature);
+int acpi_numa_init(void);
+int acpi_madt_init(void);
+
+#endif /* __ACPI_H__ */
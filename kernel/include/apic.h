@@ -0,0 +1,92 @@
+#ifndef __APIC_H__
+#define __APIC_H__
+
+#include "types.h"
+
+/* 本地APIC，xAPIC模式，寄存器按MMIO访问 */
+
+#define MSR_IA32_APICBASE           0x0000001b
+#define MSR_IA32_APICBASE_BSP       (1 << 8)
+#define MSR_IA32_APICBASE_ENABLE    (1 << 11)
+#define MSR_IA32_APICBASE_BASE      0xfffff000UL
+
+#define MSR_GS_BASE                 0xc0000101
+#define MSR_KERNEL_GS_BASE          0xc0000102
+
+#define APIC_DEFAULT_PHYS_BASE      0xfee00000UL
+
+#define APIC_ID         0x020
+#define APIC_LVR        0x030
+#define APIC_TASKPRI    0x080
+#define APIC_EOI        0x0b0
+#define APIC_LDR        0x0d0
+#define APIC_DFR        0x0e0
+#define APIC_SPIV       0x0f0
+#define     APIC_SPIV_APIC_ENABLED  (1 << 8)
+#define APIC_ESR        0x280
+#define APIC_ICR        0x300
+#define     APIC_DEST_NOSHORT       0x00000
+#define     APIC_DEST_ALLBUT        0xc0000
+#define     APIC_ICR_BUSY           0x01000
+#define     APIC_INT_LEVELTRIG      0x08000
+#define     APIC_INT_ASSERT         0x04000
+#define     APIC_DM_FIXED           0x00000
+#define     APIC_DM_INIT            0x00500
+#define     APIC_DM_STARTUP         0x00600
+#define APIC_ICR2       0x310
+#define APIC_LVTT       0x320
+#define     APIC_LVT_TIMER_PERIODIC (1 << 17)
+#define     APIC_LVT_MASKED         (1 << 16)
+#define APIC_LVT0       0x350
+#define APIC_LVT1       0x360
+#define APIC_LVTERR     0x370
+#define APIC_TMICT      0x380
+#define APIC_TMCCT      0x390
+#define APIC_TDCR       0x3e0
+#define     APIC_TDR_DIV_16         0x3
+
+/*
+ * 向量号。IPI放在最高一段，优先级高于设备中断；本地时钟低一档。
+ * 0x20-0x2f留给8259。
+ */
+#define SPURIOUS_APIC_VECTOR        0xff
+#define ERROR_APIC_VECTOR           0xfe
+#define RESCHEDULE_VECTOR           0xfd
+#define CALL_FUNCTION_SINGLE_VECTOR 0xfb
+#define LOCAL_TIMER_VECTOR          0xef
+
+static inline u64 native_read_msr(u32 msr)
+{
+    u32 low, high;
+
+    asm volatile("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+    return ((u64)high << 32) | low;
+}
+
+static inline void native_write_msr(u32 msr, u64 val)
+{
+    asm volatile("wrmsr" : : "c" (msr), "a" ((u32)val), "d" ((u32)(val >> 32))
+                 : "memory");
+}
+
+extern void lapic_init(void);
+extern u32 read_apic_id(void);
+extern void apic_eoi(void);
+extern void apic_send_ipi(u32 apicid, int vector);
+extern int wakeup_secondary_cpu_via_init(u32 apicid, ulong start_eip);
+extern void setup_apic_timer(void);
+extern void apic_udelay(u32 usecs);
+
+/* IDT，见idt.c */
+extern void idt_setup(void);
+extern void set_intr_gate(unsigned int n, void *addr);
+extern void load_idt(void);
+
+/* interrupt.S里的入口 */
+extern void reschedule_interrupt(void);
+extern void call_function_single_interrupt(void);
+extern void apic_timer_interrupt(void);
+extern void error_interrupt(void);
+extern void spurious_interrupt(void);
+
+#endif /* __APIC_H__ */
@@ -0,0 +1,49 @@
+#ifndef __BITOPS_H__
+#define __BITOPS_H__
+
+#include "types.h"
+
+#define BITS_TO_LONGS(nr)   (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/* 最低置位位的下标 (tzcnt/bsf)，word为0时结果未定义 */
+static inline ulong __ffs(ulong word)
+{
+    asm("rep; bsf %1, %0" : "=r" (word) : "rm" (word));
+    return word;
+}
+
+/* 最高置位位的下标 (bsr)，word为0时结果未定义 */
+static inline ulong __fls(ulong word)
+{
+    asm("bsr %1, %0" : "=r" (word) : "rm" (word));
+    return word;
+}
+
+/* 最高置位位的序号(从1开始)，x为0时返回0 */
+static inline int fls(unsigned int x)
+{
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline int fls64(u64 x)
+{
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+/*
+ * 带释放语义清掉低字节里的nr位，同时返回该字节最高位(第7位)是否置位。
+ * 解锁页面时借此一条指令既放锁又得知有无等待者。
+ */
+static inline int clear_bit_unlock_is_negative_byte(int nr, volatile ulong *addr)
+{
+    u8 negative;
+
+    asm volatile("lock; andb %2, %1\n\t"
+                 "sets %0"
+                 : "=qm" (negative), "+m" (*(volatile u8 *)addr)
+                 : "iq" ((u8)~(1 << nr))
+                 : "memory");
+    return negative;
+}
+
+#endif /* __BITOPS_H__ */
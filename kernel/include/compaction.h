@@ -0,0 +1,31 @@
+#ifndef __COMPACTION_H__
+#define __COMPACTION_H__
+
+#include "types.h"
+#include "mm.h"
+
+enum compact_result {
+    COMPACT_SKIPPED,        /* 条件不满足，没有进行压缩 */
+    COMPACT_DEFERRED,       /* 近期在此阶数失败过，推迟压缩 */
+    COMPACT_CONTINUE,       /* 继续压缩 */
+    COMPACT_COMPLETE,       /* 两个扫描器相遇，整个区域已扫描 */
+    COMPACT_SUCCESS,        /* 已有满足阶数的空闲块 */
+};
+
+/* 连续失败后最多推迟 1 << COMPACT_MAX_DEFER_SHIFT 次尝试 */
+#define COMPACT_MAX_DEFER_SHIFT 6
+
+/* 每次隔离的最大页面数 */
+#define COMPACT_CLUSTER_MAX     32
+
+extern enum compact_result try_to_compact_pages(struct zone *zone, gfp_t gfp_mask,
+                                                unsigned int order, int migratetype);
+extern bool compaction_deferred(struct zone *zone, int order);
+extern void defer_compaction(struct zone *zone, int order);
+extern void compaction_defer_reset(struct zone *zone, int order, bool alloc_success);
+
+extern void wakeup_kcompactd(struct pglist_data *pgdat, int order, int classzone_idx);
+extern int kcompactd_run(int nid);
+extern void kcompactd_init(void);
+
+#endif /* __COMPACTION_H__ */
@@ -8,16 +8,18 @@
 
 #define CONFIG_x86_64    1
 #define CONFIG_64BIT    1
-#define CONFIG_SMP    0
+#define CONFIG_SMP    1
 #define CINFIG_PREEMPT    1
 
 
 #define CONFIG_MMU    1
 #define CONFIG_HIGHMEM    1
-#define CONFIG_SWAP    0
-#define CONFIG_SLAB    1
-#define CONFIG_SLUB    0
+#define CONFIG_SWAP    1
+#define CONFIG_ZSWAP    1
+#define CONFIG_SLAB    0
+#define CONFIG_SLUB    1
 #define CONFIG_SLOB    0
+#define CONFIG_DEFERRED_STRUCT_PAGE_INIT 1
 
 #define CONFIG_SCHED_DEBUG  1
 #define CONFIG_FAIR_GROUP_SCHED 0
@@ -80,7 +82,8 @@
 
 
 #define CONFIG_NAMESPACES  0
-#define CONFIG_CGROUPS    0
+#define CONFIG_CGROUPS    1
+#define CONFIG_MEMCG    1
 #define CONFIG_CHECKPOINT_RESTORE 0
 
 
@@ -132,8 +135,8 @@
 
 
 
-#define CONFIG_NUMA    0
-#define CONFIG_NODES_SHIFT  0
+#define CONFIG_NUMA    1
+#define CONFIG_NODES_SHIFT  3
 #define CONFIG_HOTPLUG_CPU  0
 #define CONFIG_MEMORY_HOTPLUG  0
 #define CONFIG_MEMORY_HOTREMOVE  0
@@ -148,8 +151,11 @@
 #define CONFIG_MODULE_SRCVERSION_ALL  0
 
 
-#define NR_CPUS      1
+#define NR_CPUS      64
+#define THREAD_SIZE_ORDER  2
 #define THREAD_SIZE    16384
+#define NR_CACHED_STACKS  4
+#define CONFIG_VMAP_STACK  1
 #define PAGE_SIZE    4096
 #define PAGE_SHIFT    12
 #define MAX_ORDER    11
@@ -185,7 +191,7 @@
 #define NICE_0_SHIFT    10
 
 
-#define MAX_NUMNODES    1
+#define MAX_NUMNODES    (1 << CONFIG_NODES_SHIFT)
 #define MAX_NR_ZONES    4
 #define NR_LRU_LISTS    5
 #define MIGRATE_TYPES    6
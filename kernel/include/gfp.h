@@ -0,0 +1,44 @@
+#ifndef __GFP_H__
+#define __GFP_H__
+
+#include "types.h"
+#include "list.h"
+#include "mm.h"
+#include "numa.h"
+
+/* 伙伴分配器对外接口 */
+
+struct page *__alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
+                                    int preferred_nid, nodemask_t *nodemask);
+
+/* 从nid开始按距离分配，不经过内存策略 */
+static inline struct page *alloc_pages_node(int nid, gfp_t gfp_mask,
+                                            unsigned int order)
+{
+    if (nid == NUMA_NO_NODE)
+        nid = numa_node_id();
+
+    return __alloc_pages_nodemask(gfp_mask, order, nid, NULL);
+}
+
+/* 按当前任务的内存策略选节点，见mempolicy.c */
+struct page *alloc_pages(gfp_t gfp_mask, unsigned int order);
+struct page *alloc_page(gfp_t gfp_mask);
+int alloc_pages_bulk(gfp_t gfp_mask, int nr_pages, struct page **page_array);
+ulong __get_free_pages(gfp_t gfp_mask, unsigned int order);
+ulong __get_free_page(gfp_t gfp_mask);
+ulong get_zeroed_page(gfp_t gfp_mask);
+
+void __free_pages(struct page *page, unsigned int order);
+void free_pages(ulong addr, unsigned int order);
+void free_page(ulong addr);
+
+/* 批量释放：list上的页面引用计数已归零，阶数记在page_private中 */
+void free_pages_list(struct list_head *list);
+void release_pages(struct page **pages, int nr);
+
+void drain_local_pages(struct zone *zone);
+
+void kzerod_init(void);
+
+#endif /* __GFP_H__ */
@@ -0,0 +1,21 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include "types.h"
+
+/* 乘法散列：乘黄金分割常数后取高位，高位受所有输入位影响 */
+#define GOLDEN_RATIO_64     0x61C8864680B583EBull
+
+static inline u32 hash_64(u64 val, unsigned int bits)
+{
+    return (u32)((val * GOLDEN_RATIO_64) >> (64 - bits));
+}
+
+#define hash_long(val, bits)    hash_64((u64)(val), bits)
+
+static inline u32 hash_ptr(const void *ptr, unsigned int bits)
+{
+    return hash_long((unsigned long)ptr, bits);
+}
+
+#endif /* __HASH_H__ */
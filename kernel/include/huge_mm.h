@@ -0,0 +1,21 @@
+#ifndef __HUGE_MM_H__
+#define __HUGE_MM_H__
+
+#include "types.h"
+#include "mm.h"
+#include "pgtable.h"
+
+/* 透明大页策略 */
+enum transparent_hugepage_mode {
+    TRANSPARENT_HUGEPAGE_NEVER,     /* 不使用 */
+    TRANSPARENT_HUGEPAGE_MADVISE,   /* 仅VM_HUGEPAGE区域 */
+    TRANSPARENT_HUGEPAGE_ALWAYS,    /* 所有合适的匿名区域 */
+};
+
+extern enum transparent_hugepage_mode transparent_hugepage_mode;
+
+bool transparent_hugepage_enabled(struct vm_area_struct *vma);
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+                               ulong address, pmd_t *pmd, unsigned int flags);
+
+#endif /* __HUGE_MM_H__ */
@@ -0,0 +1,79 @@
+#ifndef __LLIST_H__
+#define __LLIST_H__
+
+#include "types.h"
+
+/*
+ * 无锁单链表。任意多个CPU可以同时往表头加节点，只有一个消费者用
+ * llist_del_all一次把整张表摘走再慢慢处理，加和摘都只是一条原子
+ * 指令，不需要锁。摘下来的链是后进先出的，要按加入顺序处理就先
+ * llist_reverse_order。
+ */
+
+struct llist_node {
+    struct llist_node *next;
+};
+
+struct llist_head {
+    struct llist_node *first;
+};
+
+#define LLIST_HEAD_INIT(name)   { NULL }
+
+static inline void init_llist_head(struct llist_head *list)
+{
+    list->first = NULL;
+}
+
+static inline bool llist_empty(const struct llist_head *head)
+{
+    return *(struct llist_node * volatile *)&head->first == NULL;
+}
+
+/* 返回true表示加之前表是空的，调用者据此决定要不要通知消费者 */
+static inline bool llist_add(struct llist_node *new, struct llist_head *head)
+{
+    struct llist_node *first, *old;
+
+    first = *(struct llist_node * volatile *)&head->first;
+    for (;;) {
+        new->next = first;
+        old = __sync_val_compare_and_swap(&head->first, first, new);
+        if (old == first)
+            break;
+        first = old;
+    }
+
+    return first == NULL;
+}
+
+static inline struct llist_node *llist_del_all(struct llist_head *head)
+{
+    return __atomic_exchange_n(&head->first, NULL, __ATOMIC_ACQ_REL);
+}
+
+static inline struct llist_node *llist_reverse_order(struct llist_node *head)
+{
+    struct llist_node *new_head = NULL;
+    struct llist_node *tmp;
+
+    while (head) {
+        tmp = head;
+        head = head->next;
+        tmp->next = new_head;
+        new_head = tmp;
+    }
+
+    return new_head;
+}
+
+#define llist_entry(ptr, type, member)  container_of(ptr, type, member)
+
+/* 遍历时可以释放或重新入队当前节点 */
+#define llist_for_each_entry_safe(pos, n, node, member)                     \
+    for (pos = llist_entry((node), typeof(*pos), member);                   \
+         &pos->member != NULL &&                                            \
+         (n = llist_entry(pos->member.next, typeof(*n), member), 1);        \
+         pos = n)
+
+#endif /* __LLIST_H__ */
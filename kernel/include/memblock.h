@@ -0,0 +1,101 @@
+#ifndef __MEMBLOCK_H__
+#define __MEMBLOCK_H__
+
+#include "types.h"
+#include "mm.h"
+
+/*
+ * 启动早期的物理内存管理。伙伴系统建好之前，内存只是两张按地址排序
+ * 的区间表：memory记录存在的内存，reserved记录已被占用的部分，分配
+ * 就是在前者减后者的空隙里找一段再记进reserved。伙伴系统就绪后，
+ * 剩下的空隙按尽可能大的对齐块一次性交给伙伴系统。
+ */
+
+#define INIT_MEMBLOCK_REGIONS       128
+
+/* 启动页表映射的低端内存大小，直接映射建好之前分配只能落在这里面 */
+#define MEMBLOCK_LOW_LIMIT          (1UL << 30)
+
+#define MEMBLOCK_ITER_END           (~(u64)0)
+
+struct memblock_region {
+    phys_addr_t base;
+    phys_addr_t size;
+    int nid;                        /* 所属节点，NUMA初始化后才有意义 */
+};
+
+struct memblock_type {
+    ulong cnt;                      /* 区间数，空表保留一个size为0的哑区间 */
+    ulong max;
+    phys_addr_t total_size;
+    struct memblock_region *regions;
+    const char *name;
+};
+
+struct memblock {
+    phys_addr_t current_limit;      /* 分配不超过该地址 */
+    struct memblock_type memory;
+    struct memblock_type reserved;
+};
+
+extern struct memblock memblock;
+
+#define for_each_memblock(memblock_type, region) \
+    for (region = memblock.memblock_type.regions; \
+         region < (memblock.memblock_type.regions + memblock.memblock_type.cnt); \
+         region++)
+
+/* 遍历memory减reserved后的空闲区间，nid为NUMA_NO_NODE时不限节点 */
+#define for_each_free_mem_range(i, nid, p_start, p_end) \
+    for (i = 0, __next_free_mem_range(&i, nid, p_start, p_end); \
+         i != MEMBLOCK_ITER_END; \
+         __next_free_mem_range(&i, nid, p_start, p_end))
+
+static inline ulong memblock_region_memory_base_pfn(const struct memblock_region *reg)
+{
+    return PFN_UP(reg->base);
+}
+
+static inline ulong memblock_region_memory_end_pfn(const struct memblock_region *reg)
+{
+    return PFN_DOWN(reg->base + reg->size);
+}
+
+/* memblock.c */
+int memblock_add(phys_addr_t base, phys_addr_t size);
+int memblock_add_node(phys_addr_t base, phys_addr_t size, int nid);
+int memblock_remove(phys_addr_t base, phys_addr_t size);
+int memblock_reserve(phys_addr_t base, phys_addr_t size);
+int memblock_free(phys_addr_t base, phys_addr_t size);
+int memblock_set_node(phys_addr_t base, phys_addr_t size, int nid);
+
+phys_addr_t memblock_phys_alloc_range(phys_addr_t size, phys_addr_t align,
+                                      phys_addr_t start, phys_addr_t end, int nid);
+phys_addr_t memblock_phys_alloc(phys_addr_t size, phys_addr_t align);
+void *memblock_alloc_try_nid_raw(phys_addr_t size, phys_addr_t align, int nid);
+void *memblock_alloc_try_nid(phys_addr_t size, phys_addr_t align, int nid);
+void *memblock_alloc_raw(phys_addr_t size, phys_addr_t align);
+void *memblock_alloc(phys_addr_t size, phys_addr_t align);
+void *memblock_alloc_node(phys_addr_t size, phys_addr_t align, int nid);
+
+void __next_free_mem_range(u64 *idx, int nid, phys_addr_t *out_start,
+                           phys_addr_t *out_end);
+
+phys_addr_t memblock_start_of_DRAM(void);
+phys_addr_t memblock_end_of_DRAM(void);
+phys_addr_t memblock_phys_mem_size(void);
+phys_addr_t memblock_reserved_size(void);
+ulong memblock_present_pages(ulong start_pfn, ulong end_pfn);
+bool memblock_is_memory(phys_addr_t addr);
+void memblock_set_current_limit(phys_addr_t limit);
+
+ulong memblock_free_all(void);
+void memblock_dump_all(void);
+
+/* mm_init.c */
+void mm_init(u32 magic, ulong mbi_phys);
+void map_direct_mmio(phys_addr_t start, phys_addr_t end);
+void mem_init(void);
+void page_alloc_init_late(void);
+
+#endif /* __MEMBLOCK_H__ */
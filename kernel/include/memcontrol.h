@@ -0,0 +1,139 @@
+#ifndef __MEMCONTROL_H__
+#define __MEMCONTROL_H__
+
+#include "types.h"
+#include "mm.h"
+#include "sched.h"
+#include "config.h"
+
+/*
+ * 内存控制组。带__GFP_ACCOUNT的分配记到分配进程所在的组上，组的
+ * 用量超过上限时先在组内回收，回收不动才让分配失败。
+ *
+ * 组按层级组织，记账沿祖先一路累加，任何一级超限都算超限。根组不
+ * 限制也不记账，没有加入任何组的进程分配时不多花一条指令。
+ *
+ * 用量计数是组内所有CPU共享的原子量，为了不在每次缺页时都去碰它，
+ * 每个CPU先从组里批发一批页的额度(stock)，记账和撤账都先在本CPU
+ * 的额度里扣减、归还，额度用完或攒多了才去动共享计数。
+ */
+
+/* 每CPU额度一次批发的页数 */
+#define MEMCG_CHARGE_BATCH      32U
+
+/* 超限时组内回收的重试次数 */
+#define MEM_CGROUP_RECLAIM_RETRIES  5
+
+#define PAGE_COUNTER_MAX        (~0UL >> (PAGE_SHIFT + 1))
+
+struct page_counter {
+    atomic_long_t usage;            /* 当前用量(页) */
+    ulong max;                      /* 上限(页) */
+    ulong watermark;                /* 历史最高用量 */
+    ulong failcnt;                  /* 超限次数 */
+    struct page_counter *parent;
+};
+
+/* sys_memcg_ctl的命令 */
+#define MEMCG_CTL_CREATE        0
+#define MEMCG_CTL_DESTROY       1
+#define MEMCG_CTL_ATTACH        2
+#define MEMCG_CTL_SET_MAX       3
+
+enum memcg_event_item {
+    MEMCG_PGPGIN,                   /* 记账的页数 */
+    MEMCG_PGPGOUT,                  /* 撤账的页数 */
+    MEMCG_MAX,                      /* 记账撞到上限的次数 */
+    MEMCG_RECLAIM,                  /* 组内回收回来的页数 */
+    MEMCG_OOM,                      /* 回收后仍超限、分配失败的次数 */
+    MEMCG_NR_EVENTS
+};
+
+struct memcg_events_cpu {
+    ulong events[MEMCG_NR_EVENTS];
+};
+
+struct mem_cgroup {
+    struct page_counter memory;
+    atomic_t refcnt;                /* 进程、子组、记账的页和CPU额度各持一个引用 */
+    int id;
+    bool dead;                      /* 已经删掉，按id查不到 */
+
+    struct mem_cgroup *parent;
+    struct list_head children;
+    struct list_head sibling;
+
+    struct memcg_events_cpu events_cpu[NR_CPUS];
+};
+
+extern struct mem_cgroup root_mem_cgroup;
+
+static inline bool mem_cgroup_is_root(struct mem_cgroup *memcg)
+{
+    return memcg == &root_mem_cgroup;
+}
+
+static inline ulong page_counter_read(struct page_counter *counter)
+{
+    return atomic_long_read(&counter->usage);
+}
+
+#if CONFIG_MEMCG
+
+/* memcontrol.c */
+void mem_cgroup_init(void);
+struct mem_cgroup *mem_cgroup_create(struct mem_cgroup *parent);
+void mem_cgroup_get(struct mem_cgroup *memcg);
+void mem_cgroup_put(struct mem_cgroup *memcg);
+long mem_cgroup_attach_current(struct mem_cgroup *memcg);
+int mem_cgroup_set_max(struct mem_cgroup *memcg, ulong nr_pages);
+ulong mem_cgroup_usage(struct mem_cgroup *memcg);
+ulong mem_cgroup_events(struct mem_cgroup *memcg, enum memcg_event_item item);
+bool mem_cgroup_is_descendant(struct mem_cgroup *memcg, struct mem_cgroup *root);
+void mem_cgroup_print_info(struct mem_cgroup *memcg);
+long sys_memcg_ctl(int cmd, int id, ulong arg);
+
+int __memcg_charge_page(struct page *page, gfp_t gfp_mask, unsigned int order);
+void __memcg_uncharge_page(struct page *page, unsigned int order);
+
+static inline int memcg_charge_page(struct page *page, gfp_t gfp_mask,
+                                    unsigned int order)
+{
+    if (!(gfp_mask & __GFP_ACCOUNT))
+        return 0;
+    return __memcg_charge_page(page, gfp_mask, order);
+}
+
+static inline void memcg_uncharge_page(struct page *page, unsigned int order)
+{
+    if (page->mem_cgroup)
+        __memcg_uncharge_page(page, order);
+}
+
+/* vmscan.c */
+ulong try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg, ulong nr_pages,
+                                   gfp_t gfp_mask);
+
+#else
+
+static inline void mem_cgroup_init(void) {}
+static inline void mem_cgroup_get(struct mem_cgroup *memcg) {}
+static inline void mem_cgroup_put(struct mem_cgroup *memcg) {}
+
+static inline bool mem_cgroup_is_descendant(struct mem_cgroup *memcg,
+                                            struct mem_cgroup *root)
+{
+    return true;
+}
+
+static inline int memcg_charge_page(struct page *page, gfp_t gfp_mask,
+                                    unsigned int order)
+{
+    return 0;
+}
+
+static inline void memcg_uncharge_page(struct page *page, unsigned int order) {}
+
+#endif /* CONFIG_MEMCG */
+
+#endif /* __MEMCONTROL_H__ */
@@ -0,0 +1,39 @@
+#ifndef __MEMPOLICY_H__
+#define __MEMPOLICY_H__
+
+#include "types.h"
+#include "mm.h"
+#include "numa.h"
+
+/* 内存策略模式 */
+enum {
+    MPOL_DEFAULT,       /* 跟随上一级(VMA→任务→系统默认) */
+    MPOL_PREFERRED,     /* 优先指定节点，不够时按距离退让 */
+    MPOL_BIND,          /* 只在指定节点集合内分配 */
+    MPOL_INTERLEAVE,    /* 在节点集合内逐页轮转 */
+    MPOL_LOCAL,         /* 分配时所在CPU的节点 */
+    MPOL_MAX
+};
+
+struct mempolicy {
+    atomic_t refcnt;
+    unsigned short mode;
+    union {
+        short preferred_node;   /* MPOL_PREFERRED */
+        nodemask_t nodes;       /* MPOL_BIND、MPOL_INTERLEAVE */
+    } v;
+};
+
+struct mempolicy *get_task_policy(struct task_struct *p);
+int policy_node(gfp_t gfp, struct mempolicy *pol, int nd);
+nodemask_t *policy_nodemask(gfp_t gfp, struct mempolicy *pol);
+
+struct page *alloc_pages_vma(gfp_t gfp, unsigned int order,
+                             struct vm_area_struct *vma, ulong addr);
+
+struct mempolicy *mpol_new(unsigned short mode, const nodemask_t *nodes);
+void mpol_put(struct mempolicy *pol);
+void mpol_get(struct mempolicy *pol);
+long do_set_mempolicy(unsigned short mode, const nodemask_t *nodes);
+
+#endif /* __MEMPOLICY_H__ */
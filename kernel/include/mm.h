@@ -3,6 +3,7 @@
 #include "types.h"
 #include "list.h"
 #include "spinlock.h"
+#include "bitops.h"
 
 /* 页面大小和位移 */
 #define PAGE_SIZE           4096
@@ -17,7 +18,7 @@
 #define PG_dirty            4   /* 页面是脏的 */
 #define PG_lru              5   /* 页面在LRU链表中 */
 #define PG_active           6   /* 页面在活跃链表中 */
-#define PG_slab             7   /* 页面被slab分配器使用 */
+#define PG_waiters          7   /* 等待表上有进程在等本页，须与PG_locked同字节 */
 #define PG_owner_priv_1     8   /* 所有者私有标志1 */
 #define PG_arch_1           9   /* 架构相关标志1 */
 #define PG_reserved         10  /* 保留页面 */
@@ -37,6 +38,35 @@
 #define PG_hwpoison         24  /* 硬件中毒 */
 #define PG_young            25  /* 年轻页面 */
 #define PG_idle             26  /* 空闲页面 */
+#define PG_zeroed           27  /* 空闲页内容已清零 */
+#define PG_slab             28  /* 页面被slab分配器使用 */
+#define NR_PAGEFLAGS        29
+
+/*
+ * flags高位存放节点号和区域类型，struct page里不再放zone/pgdat指针：
+ * | NODE | ZONE | ... | 页面标志 |
+ */
+#define ZONES_SHIFT         2   /* MAX_NR_ZONES <= 4 */
+#define NODES_SHIFT         CONFIG_NODES_SHIFT
+
+#define NODES_PGOFF         (BITS_PER_LONG - NODES_SHIFT)
+#define ZONES_PGOFF         (NODES_PGOFF - ZONES_SHIFT)
+#define ZONEID_PGOFF        ZONES_PGOFF
+#define ZONEID_SHIFT        (NODES_SHIFT + ZONES_SHIFT)
+
+#define NODES_MASK          ((1UL << NODES_SHIFT) - 1)
+#define ZONES_MASK          ((1UL << ZONES_SHIFT) - 1)
+#define ZONEID_MASK         ((1UL << ZONEID_SHIFT) - 1)
+
+/* 分配时要清掉的标志，不含高位的节点/区域号 */
+#define PAGE_FLAGS_CHECK_AT_PREP    ((1UL << NR_PAGEFLAGS) - 1)
+
+/* 释放时不应还置着的标志 */
+#define PAGE_FLAGS_CHECK_AT_FREE \
+    (1UL << PG_lru | 1UL << PG_locked | 1UL << PG_private | \
+     1UL << PG_private_2 | 1UL << PG_writeback | 1UL << PG_reserved | \
+     1UL << PG_slab | 1UL << PG_active | 1UL << PG_unevictable | \
+     1UL << PG_mlocked)
 
 /* 页面状态操作宏 */
 #define PageLocked(page)        test_bit(PG_locked, &(page)->flags)
@@ -63,6 +93,8 @@
 #define PageHWPoison(page)      test_bit(PG_hwpoison, &(page)->flags)
 #define PageYoung(page)         test_bit(PG_young, &(page)->flags)
 #define PageIdle(page)          test_bit(PG_idle, &(page)->flags)
+#define PageZeroed(page)        test_bit(PG_zeroed, &(page)->flags)
+#define PageWaiters(page)       test_bit(PG_waiters, &(page)->flags)
 
 /* 设置页面状态 */
 #define SetPageLocked(page)     set_bit(PG_locked, &(page)->flags)
@@ -89,6 +121,8 @@
 #define SetPageHWPoison(page)   set_bit(PG_hwpoison, &(page)->flags)
 #define SetPageYoung(page)      set_bit(PG_young, &(page)->flags)
 #define SetPageIdle(page)       set_bit(PG_idle, &(page)->flags)
+#define SetPageZeroed(page)     set_bit(PG_zeroed, &(page)->flags)
+#define SetPageWaiters(page)    set_bit(PG_waiters, &(page)->flags)
 
 /* 清除页面状态 */
 #define ClearPageLocked(page)   clear_bit(PG_locked, &(page)->flags)
@@ -115,6 +149,8 @@
 #define ClearPageHWPoison(page) clear_bit(PG_hwpoison, &(page)->flags)
 #define ClearPageYoung(page)    clear_bit(PG_young, &(page)->flags)
 #define ClearPageIdle(page)     clear_bit(PG_idle, &(page)->flags)
+#define ClearPageZeroed(page)   clear_bit(PG_zeroed, &(page)->flags)
+#define ClearPageWaiters(page)  clear_bit(PG_waiters, &(page)->flags)
 
 enum zone_type {
     ZONE_DMA,           /* 直接内存访问区域 */
@@ -126,6 +162,10 @@ enum zone_type {
     __MAX_NR_ZONES
 };
 
+/* ISA DMA只能访问16MB以下，32位设备只能访问4GB以下 */
+#define MAX_DMA_PFN         ((16UL << 20) >> PAGE_SHIFT)
+#define MAX_DMA32_PFN       ((4UL << 30) >> PAGE_SHIFT)
+
 enum zone_watermarks {
     WMARK_MIN,          /* 最小水位 */
     WMARK_LOW,          /* 低水位 */
@@ -171,6 +211,7 @@ enum migratetype {
 #define __GFP_RECLAIM       (__GFP_DIRECT_RECLAIM | __GFP_KSWAPD_RECLAIM)
 
 #define GFP_KERNEL          (__GFP_RECLAIM | __GFP_IO | __GFP_FS)
+#define GFP_KERNEL_ACCOUNT  (GFP_KERNEL | __GFP_ACCOUNT)
 #define GFP_ATOMIC          (__GFP_HIGH | __GFP_ATOMIC | __GFP_KSWAPD_RECLAIM)
 #define GFP_USER            (__GFP_RECLAIM | __GFP_IO | __GFP_FS | __GFP_HARDWALL)
 #define GFP_HIGHUSER        (GFP_USER | __GFP_HIGHMEM)
@@ -180,9 +221,15 @@ enum migratetype {
 #define GFP_NOFS            (__GFP_RECLAIM | __GFP_IO)
 #define GFP_NOIO            (__GFP_RECLAIM)
 #define GFP_NOWAIT          (__GFP_KSWAPD_RECLAIM)
-#define GFP_TRANSHUGE       ((GFP_HIGHUSER_MOVABLE | __GFP_COMP | __GFP_NOWARN) & ~__GFP_RECLAIM)
-#define GFP_TRANSHUGE_LIGHT (GFP_HIGHUSER_MOVABLE | __GFP_COMP | __GFP_NOWARN)
-
+#define GFP_TRANSHUGE_LIGHT ((GFP_HIGHUSER_MOVABLE | __GFP_COMP | __GFP_NOMEMALLOC | \
+                              __GFP_NOWARN) & ~__GFP_RECLAIM)
+#define GFP_TRANSHUGE       (GFP_TRANSHUGE_LIGHT | __GFP_DIRECT_RECLAIM)
+
+/*
+ * 每4KB一个struct page，必须控制在一条缓存行内：所属区域和节点编码在
+ * flags高位，虚拟地址由pfn经直接映射算出，等页面解锁的进程挂在区域的
+ * 哈希等待表上。
+ */
 struct page {
     ulong flags;        /* 页面标志 */
 
@@ -205,9 +252,10 @@ struct page {
         };
 
         struct {
-            struct list_head list;  /* 通用链表 */
+            struct list_head list;  /* 通用链表(slab部分链表) */
             void *s_mem;            /* slab内存 */
-            struct slab *slab_page; /* slab页面 */
+            struct kmem_cache *slab_cache; /* 所属slab缓存 */
+            void *freelist;         /* slab内第一个空闲对象 */
         };
     };
 
@@ -223,26 +271,145 @@ struct page {
     union {
         atomic_t _refcount;         /* 引用计数 */
         unsigned int active;        /* 活跃对象数量 */
-        struct {
-            ulong counters;
-        };
     };
 
     struct mem_cgroup *mem_cgroup;  /* 内存控制组 */
-
-    void *virtual;                  /* 虚拟地址 */
-
-    wait_queue_head_t *waiters;     /* 等待队列 */
-
-    struct zone *zone;              /* 内存区域 */
-
-    struct pglist_data *pgdat;      /* 节点数据 */
 };
 
+/* 复合页：尾页的first_page指向首页，阶数记在第一个尾页的private中 */
+static inline struct page *compound_head(struct page *page)
+{
+    if (unlikely(PageTail(page)))
+        return page->first_page;
+    return page;
+}
+
+static inline unsigned int compound_order(struct page *page)
+{
+    if (!PageHead(page))
+        return 0;
+    return (unsigned int)(ulong)page[1].private;
+}
+
+/* _mapcount从-1起计，映射它的PTE数 */
+static inline int page_mapcount(struct page *page)
+{
+    return atomic_read(&page->_mapcount) + 1;
+}
+
+static inline bool page_mapped(struct page *page)
+{
+    return atomic_read(&page->_mapcount) >= 0;
+}
+
+/*
+ * 引用数正好是count时原子地置0，之后get_page_unless_zero都拿不到，
+ * 迁移靠它确认没有别人还在用这一页
+ */
+static inline bool page_ref_freeze(struct page *page, int count)
+{
+    return atomic_cmpxchg(&page->_refcount, count, 0) == count;
+}
+
+static inline void page_ref_unfreeze(struct page *page, int count)
+{
+    /* 冻结期间对页的修改要先于解冻被看到 */
+    __sync_synchronize();
+    atomic_set(&page->_refcount, count);
+}
+
+/* 匿名页的mapping不是address_space，低位打这个标记，见rmap.h */
+#define PAGE_MAPPING_ANON   0x1UL
+
+static inline bool PageAnon(struct page *page)
+{
+    return ((ulong)page->mapping & PAGE_MAPPING_ANON) != 0;
+}
+
 typedef ulong pgoff_t;
 
 typedef ulong pfn_t;
 
+#define PFN_UP(x)           (((x) + PAGE_SIZE - 1) >> PAGE_SHIFT)
+#define PFN_DOWN(x)         ((x) >> PAGE_SHIFT)
+#define PFN_PHYS(x)         ((phys_addr_t)(x) << PAGE_SHIFT)
+
+/* 平坦内存模型：所有物理页的struct page连续存放，下标就是pfn */
+extern struct page *mem_map;
+extern ulong max_pfn;
+
+#define pfn_to_page(pfn)    (mem_map + (pfn))
+#define page_to_pfn(page)   ((ulong)((page) - mem_map))
+#define pfn_valid(pfn)      ((pfn) < max_pfn)
+#define virt_to_page(addr)  pfn_to_page(PFN_DOWN(__pa(addr)))
+
+static inline enum zone_type page_zonenum(const struct page *page)
+{
+    return (page->flags >> ZONES_PGOFF) & ZONES_MASK;
+}
+
+static inline int page_to_nid(const struct page *page)
+{
+    return (page->flags >> NODES_PGOFF) & NODES_MASK;
+}
+
+/* 节点号和区域类型合在一起，比较两页是否同区域时只需一次移位 */
+static inline int page_zone_id(const struct page *page)
+{
+    return (page->flags >> ZONEID_PGOFF) & ZONEID_MASK;
+}
+
+static inline void set_page_links(struct page *page, enum zone_type zone, int nid)
+{
+    page->flags &= ~((NODES_MASK << NODES_PGOFF) | (ZONES_MASK << ZONES_PGOFF));
+    page->flags |= ((ulong)nid & NODES_MASK) << NODES_PGOFF;
+    page->flags |= ((ulong)zone & ZONES_MASK) << ZONES_PGOFF;
+}
+
+/* pglist_data在后面定义，这两个只能用宏 */
+#define page_pgdat(page)    NODE_DATA(page_to_nid(page))
+#define page_zone(page)     (&page_pgdat(page)->node_zones[page_zonenum(page)])
+
+#define zone_idx(zone)      ((zone) - (zone)->zone_pgdat->node_zones)
+
+static inline void *page_address(const struct page *page)
+{
+    return __va(PFN_PHYS(page_to_pfn(page)));
+}
+
+/* buddy.c */
+wait_queue_head_t *page_waitqueue(struct page *page);
+
+/* filemap.c */
+void __lock_page(struct page *page);
+void unlock_page(struct page *page);
+void wait_on_page_bit(struct page *page, int bit_nr);
+void end_page_writeback(struct page *page);
+
+static inline int trylock_page(struct page *page)
+{
+    return !test_and_set_bit_lock(PG_locked, &page->flags);
+}
+
+/* 无竞争时只有一次原子操作，拿不到锁才去查等待表 */
+static inline void lock_page(struct page *page)
+{
+    if (!trylock_page(page))
+        __lock_page(page);
+}
+
+static inline void wait_on_page_locked(struct page *page)
+{
+    if (PageLocked(page))
+        wait_on_page_bit(page, PG_locked);
+}
+
+static inline void wait_on_page_writeback(struct page *page)
+{
+    if (PageWriteback(page))
+        wait_on_page_bit(page, PG_writeback);
+}
+
 struct address_space {
     struct inode *host;             /* 宿主inode */
     struct radix_tree_root page_tree; /* 页面基数树 */
@@ -329,6 +496,69 @@ typedef struct {
     ulong pgprot;
 } pgprot_t;
 
+/* 区域统计项，NR_FREE_PAGES等按区域计数 */
+enum zone_stat_item {
+    NR_FREE_PAGES,              /* 伙伴系统中的空闲页 */
+    NR_ZONE_LRU_BASE,
+    NR_ZONE_INACTIVE_ANON = NR_ZONE_LRU_BASE, /* 顺序须与lru_list一致 */
+    NR_ZONE_ACTIVE_ANON,
+    NR_ZONE_INACTIVE_FILE,
+    NR_ZONE_ACTIVE_FILE,
+    NR_ZONE_UNEVICTABLE,
+    NR_ZONE_WRITE_PENDING,      /* 脏页、回写中的页 */
+    NR_MLOCK,                   /* mlock锁住的页 */
+    NR_PAGETABLE,               /* 页表页 */
+    NR_KERNEL_STACK_KB,         /* 内核栈(KB) */
+    NR_SLAB_RECLAIMABLE,        /* 可回收slab页 */
+    NR_SLAB_UNRECLAIMABLE,      /* 不可回收slab页 */
+    NR_BOUNCE,                  /* 回弹缓冲页 */
+    NR_VM_ZONE_STAT_ITEMS
+};
+
+/* NUMA命中统计，以分配到的区域为准 */
+enum numa_stat_item {
+    NUMA_HIT,                   /* 在首选节点上分配成功 */
+    NUMA_MISS,                  /* 首选节点不够，落到了本区域 */
+    NUMA_FOREIGN,               /* 首选本区域却落到了别的节点 */
+    NUMA_INTERLEAVE_HIT,        /* 交错策略命中目标节点 */
+    NUMA_LOCAL,                 /* 分配到本CPU所在节点 */
+    NUMA_OTHER,                 /* 分配到远端节点 */
+    NR_VM_NUMA_STAT_ITEMS
+};
+
+/* 节点统计项，与具体区域无关的按节点计数 */
+enum node_stat_item {
+    NR_LRU_BASE,
+    NR_INACTIVE_ANON = NR_LRU_BASE,
+    NR_ACTIVE_ANON,
+    NR_INACTIVE_FILE,
+    NR_ACTIVE_FILE,
+    NR_UNEVICTABLE,
+    NR_ISOLATED_ANON,           /* 回收/压缩临时隔离的匿名页 */
+    NR_ISOLATED_FILE,           /* 回收/压缩临时隔离的文件页 */
+    NR_ANON_MAPPED,             /* 已映射的匿名页 */
+    NR_FILE_PAGES,              /* 页缓存页 */
+    NR_FILE_DIRTY,              /* 脏页 */
+    NR_WRITEBACK,               /* 回写中的页 */
+    NR_ANON_THPS,               /* 匿名透明大页 */
+    NR_VM_NODE_STAT_ITEMS
+};
+
+/*
+ * 每CPU差值：更新只改本CPU的差值，超过阈值才折叠进区域/节点的原子总数，
+ * 其余的由refresh_cpu_vm_stats定期折叠。
+ */
+struct per_cpu_zonestat {
+    s8 stat_threshold;
+    s8 vm_stat_diff[NR_VM_ZONE_STAT_ITEMS];
+    u16 vm_numa_stat_diff[NR_VM_NUMA_STAT_ITEMS];
+};
+
+struct per_cpu_nodestat {
+    s8 stat_threshold;
+    s8 vm_node_stat_diff[NR_VM_NODE_STAT_ITEMS];
+};
+
 struct zone {
     ulong watermark[NR_WMARK]; /* 水位标记 */
     ulong nr_reserved_highatomic; /* 高原子保留页面数 */
@@ -339,11 +569,16 @@ struct zone {
 
     spinlock_t lock;                /* 区域锁 */
 
-    ulong free_pages;       /* 空闲页面数 */
     ulong min_unmapped_pages; /* 最小未映射页面数 */
     ulong min_slab_pages;   /* 最小slab页面数 */
 
     struct free_area free_area[MAX_ORDER]; /* 空闲区域 */
+    ulong free_area_map[MIGRATE_TYPES]; /* 各迁移类型非空阶位图 */
+    ulong *pageblock_flags;         /* 页块标志位图(每页块4位) */
+
+    spinlock_t zero_lock;           /* 预清零页池锁 */
+    struct list_head zero_list[MIGRATE_PCPTYPES]; /* 预清零页池 */
+    ulong nr_zeroed[MIGRATE_PCPTYPES]; /* 池中页数 */
 
     ulong pages_scanned;    /* 扫描的页面数 */
     spinlock_t lru_lock;           /* LRU锁 */
@@ -362,6 +597,8 @@ struct zone {
 
     atomic_long_t vm_stat[NR_VM_ZONE_STAT_ITEMS]; /* 虚拟内存统计 */
     atomic_long_t vm_numa_stat[NR_VM_NUMA_STAT_ITEMS]; /* NUMA统计 */
+    struct per_cpu_zonestat per_cpu_zonestats[NR_CPUS]; /* 每CPU统计差值 */
+    ulong percpu_drift_mark;       /* 空闲页低于此值时读数需带上每CPU差值 */
 
     ulong zone_start_pfn;   /* 区域起始pfn */
     ulong managed_pages;    /* 管理的页面数 */
@@ -383,6 +620,10 @@ struct zone {
 
 #define MAX_ORDER 11
 
+/* 页块是反碎片分组的单位，与2MB大页对齐 */
+#define pageblock_order     9
+#define pageblock_nr_pages  (1UL << pageblock_order)
+
 struct free_area {
     struct list_head free_list[MIGRATE_TYPES]; /* 空闲链表 */
     ulong nr_free;          /* 空闲页面数 */
@@ -397,6 +638,7 @@ struct per_cpu_pages {
 
 struct lruvec {
     struct list_head lists[NR_LRU_LISTS]; /* LRU链表 */
+    ulong nr_pages[NR_LRU_LISTS];   /* 各链表页数(大页按小页计) */
     struct zone_reclaim_stat reclaim_stat; /* 回收统计 */
     struct mem_cgroup_per_zone *mem_cgroup_zone; /* 内存控制组区域 */
 };
@@ -414,6 +656,27 @@ enum lru_list {
 #define LRU_ACTIVE 1
 #define LRU_FILE 2
 
+/* 区域列表：按节点距离排好的候选区域，分配时依次尝试 */
+#define MAX_ZONES_PER_ZONELIST (MAX_NUMNODES * MAX_NR_ZONES)
+
+enum {
+    ZONELIST_FALLBACK,      /* 允许退到其它节点 */
+    ZONELIST_NOFALLBACK,    /* 仅本节点(__GFP_THISNODE) */
+    MAX_ZONELISTS
+};
+
+struct zoneref {
+    struct zone *zone;      /* 区域，NULL表示列表结束 */
+    int zone_idx;           /* 区域类型，免得遍历时再解引用zone */
+};
+
+struct zonelist {
+    struct zoneref _zonerefs[MAX_ZONES_PER_ZONELIST + 1];
+};
+
+extern struct pglist_data *node_data[MAX_NUMNODES];
+#define NODE_DATA(nid)      (node_data[(nid)])
+
 struct pglist_data {
     struct zone node_zones[MAX_NR_ZONES]; /* 节点区域 */
     struct zonelist node_zonelists[MAX_ZONELISTS]; /* 区域列表 */
@@ -441,4 +704,11 @@ struct pglist_data {
 
     spinlock_t numabalancing_migrate_lock; /* NUMA平衡迁移锁 */
 
+    atomic_long_t vm_stat[NR_VM_NODE_STAT_ITEMS]; /* 节点统计 */
+    struct per_cpu_nodestat per_cpu_nodestats[NR_CPUS]; /* 每CPU统计差值 */
+
+    /* 从此pfn起节点最后一个区域的struct page尚未初始化，0表示没有 */
+    ulong first_deferred_pfn;
+    spinlock_t node_size_lock;      /* 推迟初始化与按需扩展互斥 */
+
     ulong totalreserve_pages
@@ -0,0 +1,53 @@
+#ifndef __MULTIBOOT2_H__
+#define __MULTIBOOT2_H__
+
+#include "types.h"
+
+/* 引导器跳到内核时放在eax里的魔数 */
+#define MULTIBOOT2_BOOTLOADER_MAGIC     0x36d76289
+
+/* 信息结构中的标签，每个标签8字节对齐 */
+#define MULTIBOOT_TAG_ALIGN             8
+#define MULTIBOOT_TAG_TYPE_END          0
+#define MULTIBOOT_TAG_TYPE_CMDLINE      1
+#define MULTIBOOT_TAG_TYPE_BASIC_MEMINFO 4
+#define MULTIBOOT_TAG_TYPE_MMAP         6
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD     14
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW     15
+
+/* 内存映射条目类型 */
+#define MULTIBOOT_MEMORY_AVAILABLE          1
+#define MULTIBOOT_MEMORY_RESERVED           2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE   3
+#define MULTIBOOT_MEMORY_NVS                4
+#define MULTIBOOT_MEMORY_BADRAM             5
+
+struct multiboot_info {
+    u32 total_size;             /* 含本头部的总长度 */
+    u32 reserved;
+} __attribute__((packed));
+
+struct multiboot_tag {
+    u32 type;
+    u32 size;                   /* 含标签头，不含对齐填充 */
+} __attribute__((packed));
+
+struct multiboot_mmap_entry {
+    u64 addr;
+    u64 len;
+    u32 type;
+    u32 zero;
+} __attribute__((packed));
+
+struct multiboot_tag_mmap {
+    u32 type;
+    u32 size;
+    u32 entry_size;             /* 以此为步长遍历，条目将来可能变长 */
+    u32 entry_version;
+    struct multiboot_mmap_entry entries[0];
+} __attribute__((packed));
+
+#define multiboot_next_tag(tag) \
+    ((struct multiboot_tag *)((u8 *)(tag) + ALIGN_UP((tag)->size, MULTIBOOT_TAG_ALIGN)))
+
+#endif /* __MULTIBOOT2_H__ */
@@ -0,0 +1,175 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include "types.h"
+#include "config.h"
+#include "spinlock.h"
+#include "mm.h"
+
+#define NUMA_NO_NODE        (-1)
+
+/* SLIT距离：本节点为10，未给出SLIT时远端一律按20算 */
+#define LOCAL_DISTANCE      10
+#define REMOTE_DISTANCE     20
+
+/* 节点位图 */
+typedef struct {
+    ulong bits[BITS_TO_LONGS(MAX_NUMNODES)];
+} nodemask_t;
+
+static inline void node_set(int node, nodemask_t *mask)
+{
+    mask->bits[node / BITS_PER_LONG] |= 1UL << (node % BITS_PER_LONG);
+}
+
+static inline void node_clear(int node, nodemask_t *mask)
+{
+    mask->bits[node / BITS_PER_LONG] &= ~(1UL << (node % BITS_PER_LONG));
+}
+
+static inline bool node_isset(int node, const nodemask_t *mask)
+{
+    return (mask->bits[node / BITS_PER_LONG] >> (node % BITS_PER_LONG)) & 1;
+}
+
+static inline void nodes_clear(nodemask_t *mask)
+{
+    int i;
+
+    for (i = 0; i < (int)ARRAY_SIZE(mask->bits); i++)
+        mask->bits[i] = 0;
+}
+
+/* 下一个置位的节点，没有时返回MAX_NUMNODES */
+static inline int next_node(int node, const nodemask_t *mask)
+{
+    for (node++; node < MAX_NUMNODES; node++) {
+        if (node_isset(node, mask))
+            return node;
+    }
+
+    return MAX_NUMNODES;
+}
+
+static inline int first_node(const nodemask_t *mask)
+{
+    return next_node(-1, mask);
+}
+
+/* 同next_node，但到末尾后从头绕回 */
+static inline int next_node_in(int node, const nodemask_t *mask)
+{
+    int next = next_node(node, mask);
+
+    if (next == MAX_NUMNODES)
+        next = first_node(mask);
+
+    return next;
+}
+
+static inline bool nodes_empty(const nodemask_t *mask)
+{
+    return first_node(mask) == MAX_NUMNODES;
+}
+
+static inline int nodes_weight(const nodemask_t *mask)
+{
+    int node, weight = 0;
+
+    for (node = 0; node < MAX_NUMNODES; node++)
+        weight += node_isset(node, mask);
+
+    return weight;
+}
+
+#define for_each_node_mask(node, mask) \
+    for ((node) = first_node(&(mask)); (node) < MAX_NUMNODES; \
+         (node) = next_node((node), &(mask)))
+
+extern nodemask_t node_online_map;
+
+#define node_online(node)           node_isset((node), &node_online_map)
+#define for_each_online_node(node)  for_each_node_mask((node), node_online_map)
+
+/* CPU所在节点 */
+extern int cpu_to_node_map[NR_CPUS];
+
+static inline int cpu_to_node(int cpu)
+{
+    return cpu_to_node_map[cpu];
+}
+
+static inline int numa_node_id(void)
+{
+    return cpu_to_node(smp_processor_id());
+}
+
+extern u8 numa_distance[MAX_NUMNODES][MAX_NUMNODES];
+
+static inline int node_distance(int from, int to)
+{
+    return numa_distance[from][to];
+}
+
+/* 区域列表遍历 */
+static inline int zone_to_nid(struct zone *zone)
+{
+    return zone->zone_pgdat->node_id;
+}
+
+static inline enum zone_type gfp_zone(gfp_t flags)
+{
+    if (flags & __GFP_DMA)
+        return ZONE_DMA;
+    if (flags & __GFP_DMA32)
+        return ZONE_DMA32;
+
+    return ZONE_NORMAL;
+}
+
+static inline struct zonelist *node_zonelist(int nid, gfp_t flags)
+{
+    int idx = (flags & __GFP_THISNODE) ? ZONELIST_NOFALLBACK : ZONELIST_FALLBACK;
+
+    return &NODE_DATA(nid)->node_zonelists[idx];
+}
+
+/* 跳过高于highest_zoneidx或不在nodes中的区域 */
+static inline struct zoneref *next_zones_zonelist(struct zoneref *z,
+                                                  enum zone_type highest_zoneidx,
+                                                  const nodemask_t *nodes)
+{
+    while (z->zone) {
+        if (z->zone_idx <= highest_zoneidx &&
+            (!nodes || node_isset(zone_to_nid(z->zone), nodes)))
+            break;
+        z++;
+    }
+
+    return z;
+}
+
+static inline struct zoneref *first_zones_zonelist(struct zonelist *zonelist,
+                                                   enum zone_type highest_zoneidx,
+                                                   const nodemask_t *nodes)
+{
+    return next_zones_zonelist(zonelist->_zonerefs, highest_zoneidx, nodes);
+}
+
+#define for_each_zone_zonelist_nodemask(zone, z, zlist, highidx, nodemask) \
+    for (z = first_zones_zonelist(zlist, highidx, nodemask), zone = z->zone; \
+         zone; \
+         z = next_zones_zonelist(++z, highidx, nodemask), zone = z->zone)
+
+#define for_each_zone_zonelist(zone, z, zlist, highidx) \
+    for_each_zone_zonelist_nodemask(zone, z, zlist, highidx, NULL)
+
+/* numa.c */
+int numa_add_memblk(int nid, u64 start, u64 end);
+void numa_set_distance(int from, int to, int distance);
+void set_apicid_to_node(int apicid, int node);
+void numa_add_cpu(int cpu, int apicid);
+void numa_init(void);
+void build_all_zonelists(void);
+
+#endif /* __NUMA_H__ */
@@ -0,0 +1,35 @@
+#ifndef __PAGE_H__
+#define __PAGE_H__
+
+#include "types.h"
+
+/* arch/x86_64/cpu/page.S */
+extern void clear_page_rep(void *page);
+extern void clear_page_erms(void *page);
+extern void clear_page_nt(void *page);
+extern void copy_page_rep(void *to, void *from);
+extern void copy_page_erms(void *to, void *from);
+
+/* 启动时由init_page_ops按CPU特性选定 */
+extern void (*clear_page_fn)(void *page);
+extern void (*copy_page_fn)(void *to, void *from);
+
+void init_page_ops(void);
+
+static inline void clear_page(void *page)
+{
+    clear_page_fn(page);
+}
+
+static inline void copy_page(void *to, void *from)
+{
+    copy_page_fn(to, from);
+}
+
+/* 清零后短期内不会访问的页用非临时存储，不污染缓存 */
+static inline void clear_page_nocache(void *page)
+{
+    clear_page_nt(page);
+}
+
+#endif /* __PAGE_H__ */
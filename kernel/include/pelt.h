@@ -0,0 +1,43 @@
+#ifndef __PELT_H__
+#define __PELT_H__
+
+#include "types.h"
+#include "sched.h"
+
+/*
+ * PELT的常数。y^LOAD_AVG_PERIOD = 1/2；一直可运行时load_sum收敛到
+ * LOAD_AVG_MAX。当前这一段还没过完，实际能达到的上限是
+ * LOAD_AVG_MAX - 1024 + period_contrib，算平均值时用它做除数。
+ */
+#define LOAD_AVG_PERIOD     32
+#define LOAD_AVG_MAX        47742
+#define PELT_MIN_DIVIDER    (LOAD_AVG_MAX - 1024)
+
+static inline u32 get_pelt_divider(struct sched_avg *avg)
+{
+    return PELT_MIN_DIVIDER + avg->period_contrib;
+}
+
+static inline u64 mul_u64_u32_shr(u64 a, u32 mul, unsigned int shift)
+{
+    return (u64)(((unsigned __int128)a * mul) >> shift);
+}
+
+/* 还没有温控驱动上报降频，热压力恒为0 */
+static inline ulong arch_scale_thermal_pressure(int cpu)
+{
+    return 0;
+}
+
+extern u64 decay_load(u64 val, u64 n);
+
+extern int __update_load_avg_blocked_se(u64 now, struct sched_entity *se);
+extern int __update_load_avg_se(u64 now, struct cfs_rq *cfs_rq,
+                                struct sched_entity *se);
+extern int __update_load_avg_cfs_rq(u64 now, struct cfs_rq *cfs_rq);
+extern int update_rt_rq_load_avg(u64 now, struct rq *rq, int running);
+extern int update_dl_rq_load_avg(u64 now, struct rq *rq, int running);
+extern int update_irq_load_avg(struct rq *rq, u64 running);
+extern int update_thermal_load_avg(u64 now, struct rq *rq, u64 capacity);
+
+#endif /* __PELT_H__ */
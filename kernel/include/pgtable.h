@@ -0,0 +1,245 @@
+#ifndef __PGTABLE_H__
+#define __PGTABLE_H__
+
+#include "types.h"
+#include "mm.h"
+#include "sched.h"
+
+/* x86_64 四级页表 */
+#define PGDIR_SHIFT         39
+#define PUD_SHIFT           30
+#define PMD_SHIFT           21
+
+#define PTRS_PER_PGD        512
+#define PTRS_PER_PUD        512
+#define PTRS_PER_PMD        512
+#define PTRS_PER_PTE        512
+
+#define PGDIR_SIZE          (1UL << PGDIR_SHIFT)
+#define PGDIR_MASK          (~(PGDIR_SIZE - 1))
+#define PUD_SIZE            (1UL << PUD_SHIFT)
+#define PUD_MASK            (~(PUD_SIZE - 1))
+#define PMD_SIZE            (1UL << PMD_SHIFT)
+#define PMD_MASK            (~(PMD_SIZE - 1))
+
+/* [addr, end)在本级一个表项内的结束位置，按表项遍历时用 */
+#define pgd_addr_end(addr, end) \
+    ({ ulong __boundary = ((addr) + PGDIR_SIZE) & PGDIR_MASK; \
+       (__boundary - 1 < (end) - 1) ? __boundary : (end); })
+#define pud_addr_end(addr, end) \
+    ({ ulong __boundary = ((addr) + PUD_SIZE) & PUD_MASK; \
+       (__boundary - 1 < (end) - 1) ? __boundary : (end); })
+#define pmd_addr_end(addr, end) \
+    ({ ulong __boundary = ((addr) + PMD_SIZE) & PMD_MASK; \
+       (__boundary - 1 < (end) - 1) ? __boundary : (end); })
+
+/* PMD级大页(2MB)，对应伙伴系统的9阶块 */
+#define HPAGE_PMD_SHIFT     PMD_SHIFT
+#define HPAGE_PMD_ORDER     (HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR        (1UL << HPAGE_PMD_ORDER)
+#define HPAGE_PMD_SIZE      (1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK      (~(HPAGE_PMD_SIZE - 1))
+
+/* 页表项标志 */
+#define _PAGE_PRESENT       (1UL << 0)  /* 存在 */
+#define _PAGE_RW            (1UL << 1)  /* 可写 */
+#define _PAGE_USER          (1UL << 2)  /* 用户可访问 */
+#define _PAGE_PWT           (1UL << 3)  /* 写透 */
+#define _PAGE_PCD           (1UL << 4)  /* 禁用缓存 */
+#define _PAGE_ACCESSED      (1UL << 5)  /* 已访问 */
+#define _PAGE_DIRTY         (1UL << 6)  /* 脏 */
+#define _PAGE_PSE           (1UL << 7)  /* PMD/PUD级大页 */
+#define _PAGE_GLOBAL        (1UL << 8)  /* 全局 */
+#define _PAGE_NX            (1UL << 63) /* 不可执行 */
+
+#define PTE_PFN_MASK        0x000ffffffffff000UL
+
+/* 中间级页表项：权限放在叶子项上控制 */
+#define _PAGE_TABLE         (_PAGE_PRESENT | _PAGE_RW | _PAGE_USER | \
+                             _PAGE_ACCESSED | _PAGE_DIRTY)
+
+/* 内核映射：全局、不可被用户访问 */
+#define PAGE_KERNEL         ((pgprot_t) { _PAGE_PRESENT | _PAGE_RW | _PAGE_ACCESSED | \
+                                          _PAGE_DIRTY | _PAGE_GLOBAL | _PAGE_NX })
+#define PAGE_KERNEL_EXEC    ((pgprot_t) { _PAGE_PRESENT | _PAGE_RW | _PAGE_ACCESSED | \
+                                          _PAGE_DIRTY | _PAGE_GLOBAL })
+/* 设备寄存器：不缓存 */
+#define PAGE_KERNEL_NOCACHE ((pgprot_t) { _PAGE_PRESENT | _PAGE_RW | _PAGE_ACCESSED | \
+                                          _PAGE_DIRTY | _PAGE_GLOBAL | _PAGE_NX | \
+                                          _PAGE_PCD | _PAGE_PWT })
+
+typedef struct { ulong pgd; } pgd_t;
+typedef struct { ulong pud; } pud_t;
+typedef struct { ulong pmd; } pmd_t;
+typedef struct { ulong pte; } pte_t;
+
+#define pgd_val(x)          ((x).pgd)
+#define pud_val(x)          ((x).pud)
+#define pmd_val(x)          ((x).pmd)
+#define pte_val(x)          ((x).pte)
+
+#define __pgd(x)            ((pgd_t) { (x) })
+#define __pud(x)            ((pud_t) { (x) })
+#define __pmd(x)            ((pmd_t) { (x) })
+#define __pte(x)            ((pte_t) { (x) })
+
+#define pgd_index(addr)     (((addr) >> PGDIR_SHIFT) & (PTRS_PER_PGD - 1))
+#define pud_index(addr)     (((addr) >> PUD_SHIFT) & (PTRS_PER_PUD - 1))
+#define pmd_index(addr)     (((addr) >> PMD_SHIFT) & (PTRS_PER_PMD - 1))
+#define pte_index(addr)     (((addr) >> PAGE_SHIFT) & (PTRS_PER_PTE - 1))
+
+static inline int pgd_none(pgd_t pgd) { return !pgd_val(pgd); }
+static inline int pud_none(pud_t pud) { return !pud_val(pud); }
+static inline int pmd_none(pmd_t pmd) { return !pmd_val(pmd); }
+static inline int pte_none(pte_t pte) { return !pte_val(pte); }
+static inline int pte_present(pte_t pte) { return pte_val(pte) & _PAGE_PRESENT; }
+
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+    return (pmd_val(pmd) & (_PAGE_PRESENT | _PAGE_PSE)) ==
+           (_PAGE_PRESENT | _PAGE_PSE);
+}
+
+static inline pgd_t *pgd_offset(struct mm_struct *mm, ulong addr)
+{
+    return (pgd_t *)__va(mm->pgd) + pgd_index(addr);
+}
+
+static inline pud_t *pud_offset(pgd_t *pgd, ulong addr)
+{
+    return (pud_t *)__va(pgd_val(*pgd) & PTE_PFN_MASK) + pud_index(addr);
+}
+
+static inline pmd_t *pmd_offset(pud_t *pud, ulong addr)
+{
+    return (pmd_t *)__va(pud_val(*pud) & PTE_PFN_MASK) + pmd_index(addr);
+}
+
+static inline pte_t *pte_offset(pmd_t *pmd, ulong addr)
+{
+    return (pte_t *)__va(pmd_val(*pmd) & PTE_PFN_MASK) + pte_index(addr);
+}
+
+static inline void set_pgd(pgd_t *pgdp, pgd_t pgd) { WRITE_ONCE(*pgdp, pgd); }
+static inline void set_pud(pud_t *pudp, pud_t pud) { WRITE_ONCE(*pudp, pud); }
+static inline void set_pmd(pmd_t *pmdp, pmd_t pmd) { WRITE_ONCE(*pmdp, pmd); }
+static inline void set_pte(pte_t *ptep, pte_t pte) { WRITE_ONCE(*ptep, pte); }
+
+static inline void pte_clear(pte_t *ptep) { WRITE_ONCE(*ptep, __pte(0)); }
+
+/*
+ * 别的CPU可能正通过TLB写这一页，硬件会回写页表项里的A/D位，
+ * 读出和清除必须是一次原子操作，否则中间置上的脏位会丢。
+ */
+static inline pte_t ptep_get_and_clear(pte_t *ptep)
+{
+    return __pte(__atomic_exchange_n(&ptep->pte, 0UL, __ATOMIC_SEQ_CST));
+}
+
+static inline int ptep_test_and_clear_young(pte_t *ptep)
+{
+    return (__atomic_fetch_and(&ptep->pte, ~_PAGE_ACCESSED, __ATOMIC_SEQ_CST) &
+            _PAGE_ACCESSED) != 0;
+}
+
+static inline struct page *pte_page(pte_t pte)
+{
+    return pfn_to_page((pte_val(pte) & PTE_PFN_MASK) >> PAGE_SHIFT);
+}
+
+static inline pte_t pfn_pte(ulong pfn, pgprot_t prot)
+{
+    return __pte((pfn << PAGE_SHIFT) | prot.pgprot);
+}
+
+static inline pmd_t pfn_pmd(ulong pfn, pgprot_t prot)
+{
+    return __pmd((pfn << PAGE_SHIFT) | prot.pgprot);
+}
+
+static inline pmd_t mk_huge_pmd(struct page *page, pgprot_t prot)
+{
+    return __pmd(pmd_val(pfn_pmd(page_to_pfn(page), prot)) | _PAGE_PSE);
+}
+
+static inline pte_t pte_mkwrite(pte_t pte) { return __pte(pte_val(pte) | _PAGE_RW); }
+static inline pte_t pte_mkdirty(pte_t pte) { return __pte(pte_val(pte) | _PAGE_DIRTY); }
+static inline pmd_t pmd_mkwrite(pmd_t pmd) { return __pmd(pmd_val(pmd) | _PAGE_RW); }
+static inline pmd_t pmd_mkdirty(pmd_t pmd) { return __pmd(pmd_val(pmd) | _PAGE_DIRTY); }
+
+static inline ulong read_cr3(void)
+{
+    ulong cr3;
+
+    asm volatile("movq %%cr3, %0" : "=r" (cr3));
+    return cr3;
+}
+
+static inline void __flush_tlb_one(ulong addr)
+{
+    asm volatile("invlpg (%0)" :: "r" (addr) : "memory");
+}
+
+#define X86_CR4_PGE         (1UL << 7)  /* 全局页 */
+
+/* 只冲本CPU。内核映射带_PAGE_GLOBAL，重载CR3冲不掉，要翻转CR4.PGE */
+static inline void __flush_tlb_all(void)
+{
+    ulong cr4;
+
+    asm volatile("movq %%cr4, %0" : "=r" (cr4));
+    asm volatile("movq %0, %%cr4" :: "r" (cr4 & ~X86_CR4_PGE) : "memory");
+    asm volatile("movq %0, %%cr4" :: "r" (cr4) : "memory");
+}
+
+/* 超过这么多页逐页invlpg不如整个冲掉 */
+#define TLB_FLUSH_ALL_CEILING   33
+
+static inline void __flush_tlb_kernel_range(ulong start, ulong end)
+{
+    ulong addr;
+
+    if ((end - start) >> PAGE_SHIFT > TLB_FLUSH_ALL_CEILING) {
+        __flush_tlb_all();
+        return;
+    }
+
+    for (addr = start; addr < end; addr += PAGE_SIZE)
+        __flush_tlb_one(addr);
+}
+
+/*
+ * 内核页表是所有CPU共用的，改了之后每个在线CPU都要冲，见smp.c。
+ * 要等别的CPU冲完才返回，不能在关中断时调用。
+ */
+extern void flush_tlb_all(void);
+extern void flush_tlb_kernel_range(ulong start, ulong end);
+extern void flush_tlb_page(struct vm_area_struct *vma, ulong addr);
+
+/* 缺页处理结果 */
+#define VM_FAULT_OOM        0x0001  /* 内存不足 */
+#define VM_FAULT_SIGBUS     0x0002  /* 总线错误 */
+#define VM_FAULT_SIGSEGV    0x0040  /* 段错误 */
+#define VM_FAULT_FALLBACK   0x0800  /* 大页不可用，退回小页 */
+
+#define FAULT_FLAG_WRITE    0x01    /* 写缺页 */
+#define FAULT_FLAG_USER     0x02    /* 用户态缺页 */
+
+/* 内核自己的地址空间，vmalloc等内核映射都建在它的页表里 */
+extern struct mm_struct init_mm;
+
+/* memory.c */
+pgprot_t vm_get_page_prot(ulong vm_flags);
+pud_t *pud_alloc(struct mm_struct *mm, pgd_t *pgd, ulong address);
+pmd_t *pmd_alloc(struct mm_struct *mm, pud_t *pud, ulong address);
+pte_t *pte_alloc(struct mm_struct *mm, pmd_t *pmd, ulong address);
+struct vm_area_struct *find_vma(struct mm_struct *mm, ulong addr);
+int handle_mm_fault(struct vm_area_struct *vma, ulong address, unsigned int flags);
+void do_page_fault(ulong address, ulong error_code);
+
+static inline bool vma_is_anonymous(struct vm_area_struct *vma)
+{
+    return !vma->vm_ops && !vma->vm_file;
+}
+
+#endif /* __PGTABLE_H__ */
@@ -0,0 +1,42 @@
+#ifndef __RMAP_H__
+#define __RMAP_H__
+
+#include "types.h"
+#include "mm.h"
+#include "pgtable.h"
+
+/*
+ * 匿名页的反向映射。还没有fork，匿名页只会被一个VMA里的一个地址映射，
+ * 所以mapping直接记VMA(低位打PAGE_MAPPING_ANON标记)，index记虚拟页号，
+ * 不需要anon_vma链。文件页没有反向映射。
+ */
+
+enum ttu_flags {
+    TTU_UNMAP = 1,          /* 回收：页表项换成交换槽位 */
+    TTU_MIGRATION = 2,      /* 压缩：页表项换成迁移项 */
+};
+
+/* try_to_unmap的返回值 */
+#define SWAP_SUCCESS    0   /* 映射都拆掉了 */
+#define SWAP_AGAIN      1   /* 页表项已经变了，稍后再试 */
+#define SWAP_FAIL       2   /* 拆不掉 */
+
+static inline struct vm_area_struct *page_anon_vma(struct page *page)
+{
+    if (!PageAnon(page))
+        return NULL;
+    return (struct vm_area_struct *)((ulong)page->mapping & ~PAGE_MAPPING_ANON);
+}
+
+void page_add_new_anon_rmap(struct page *page, struct vm_area_struct *vma,
+                            ulong address);
+void page_add_anon_rmap(struct page *page, struct vm_area_struct *vma,
+                        ulong address);
+void page_remove_rmap(struct page *page);
+int page_referenced(struct page *page, int is_locked,
+                    struct mem_cgroup *memcg, ulong *vm_flags);
+int try_to_unmap(struct page *page, enum ttu_flags flags);
+void remove_migration_ptes(struct page *old, struct page *new);
+void migration_entry_wait(struct mm_struct *mm, pte_t *ptep);
+
+#endif /* __RMAP_H__ */
@@ -3,6 +3,8 @@
 #include "types.h"
 #include "list.h"
 #include "config.h"
+#include "llist.h"
+#include "smp.h"
 
 #define TASK_RUNNING            0
 #define TASK_INTERRUPTIBLE      1
@@ -10,6 +12,9 @@
 #define TASK_ZOMBIE             4
 #define TASK_STOPPED            8
 #define TASK_TRACED            16
+#define TASK_WAKING           256     /* 已决定唤醒，正排队等目标CPU入队 */
+
+#define TASK_NORMAL             (TASK_INTERRUPTIBLE | TASK_UNINTERRUPRIBLE)
 
 
 #define MAX_NICE    19
@@ -46,6 +51,7 @@
 #define PF_NOFREEZE                  0x00008000
 #define PF_FROZEN                    0x00010000
 #define PF_FREEZER_SKIP              0x00020000
+#define PF_KSWAPD                    0x00040000
 
 
 #define CLONE_VM                     0x00000100
@@ -154,11 +160,31 @@ struct signal_struct{
     struct rlimit rlim[16];
 };
 
+/*
+ * PELT负载跟踪。时间按1024us分段，每过一段旧的累计值乘一次y
+ * (y^32 = 1/2)，32ms前的贡献只剩一半。*_sum是衰减后的累计值，
+ * *_avg是除以累计上限、按权重或容量换算后的平均值。
+ *
+ * 实体的load_sum/runnable_load_sum只记时间，权重在算avg时乘上；
+ * cfs_rq的记的是带权重的值，等于挂在上面的各实体之和。
+ */
+struct sched_avg {
+    u64 last_update_time;       /* ns；0表示还没挂到cfs_rq上(新建或刚迁移) */
+    u64 load_sum;
+    u64 runnable_load_sum;
+    u32 util_sum;
+    u32 period_contrib;         /* 当前未满的一段已经过了多少us */
+    ulong load_avg;             /* 可运行(含排队)的负载，睡眠后逐渐衰减 */
+    ulong runnable_load_avg;    /* 只算还在队列上的 */
+    ulong util_avg;             /* 实际运行的比例，满为SCHED_CAPACITY_SCALE */
+};
+
 struct sched_entity
 {
     struct load_weight load;
     struct rb_node run_node;
     struct list_head group_node;
+    unsigned int on_rq;
     u64 exec_start;
     u64 sum_exec_runtime;
     u64 vruntime;
@@ -191,7 +217,15 @@ u64 nr_migrations_cold;
     u64 nr_wakeups_affine_attempts;
     u64 nr_wakeups_passive;
     u64 nr_wakeups_idle;
-    /* data */
+
+    struct sched_avg avg;
+
+#if CONFIG_FAIR_GROUP_SCHED
+    int depth;
+    struct sched_entity *parent;
+    struct cfs_rq *cfs_rq;          /* 所在的队列 */
+    struct cfs_rq *my_q;            /* 组实体自己的队列，任务为NULL */
+#endif
 };
 
 
@@ -336,6 +370,7 @@ struct task_struct{
 
     struct task_group *sched_task_group;
     struct cgoup_subsys_staten  *cgroups;
+    struct mem_cgroup *mem_cgroup;  /* 内存控制组，NULL为根组 */
 
 
 
@@ -441,6 +476,15 @@ struct task_struct{
 
     int wake_cpu;
 
+    /* 唤醒的对象换得越频繁，越像一对多的服务端，不宜都拉到自己身边 */
+    struct task_struct *last_wakee;
+    unsigned int wakee_flips;
+    ulong wakee_flip_decay_ts;
+
+    int on_cpu;                     /* 正在某个CPU上运行(含切换途中) */
+    int on_rq;                      /* 在运行队列上 */
+    struct llist_node wake_entry;   /* 挂在目标CPU的rq->wake_list上 */
+
 
     int migrate_disable;
 
@@ -613,18 +657,47 @@ typedef struct wait_queue_head {
     struct list_head task_list;
 } wait_queue_head_t;
 
-typedef struct wait_queue_entry {
+typedef struct wait_queue_entry wait_queue_entry_t;
+
+/* 唤醒回调：key由唤醒方传入，返回非0表示确实唤醒了等待者 */
+typedef int (*wait_queue_func_t)(wait_queue_entry_t *wait, unsigned int mode,
+                                 int sync, void *key);
+
+/* 独占等待者排在队尾，唤醒一个就停 */
+#define WQ_FLAG_EXCLUSIVE   0x01
+#define WQ_FLAG_WOKEN       0x02
+
+struct wait_queue_entry {
     struct list_head task_list;
     int flags;
     int private;
-    void (*func)(wait_queue_entry_t *, unsigned int, int);
-    void *data;
-} wait_queue_entry_t;
+    wait_queue_func_t func;
+    void *data;                     /* 等待的进程 */
+};
 
 
 extern struct task_struct *current;
 #define current get_current()
 
+/*
+ * 需要重新调度的标志放在每CPU数据里(PCPU_FLAGS)，ret_from_sys_call直接
+ * 测它。一个CPU同一时刻只跑一个进程，问某个进程就是问它所在的CPU。
+ */
+static inline bool test_tsk_need_resched(struct task_struct *p)
+{
+    return *(volatile u32 *)&pcpu_hot[p->last_cpu].flags & PCPU_NEED_RESCHED;
+}
+
+static inline void clear_tsk_need_resched(struct task_struct *p)
+{
+    __sync_fetch_and_and(&pcpu_hot[p->last_cpu].flags, ~PCPU_NEED_RESCHED);
+}
+
+static inline bool need_resched(void)
+{
+    return *(volatile u32 *)&this_pcpu()->flags & PCPU_NEED_RESCHED;
+}
+
 #define task_is_running(p) ((p)->state == TASK_RUNNING)
 #define task_is_stopped(p) ((p)->state == TASK_STOPPED)
 #define task_is_zombie(p) ((p)->state == TASK_ZOMBIE)
@@ -636,6 +709,123 @@ extern struct task_struct *current;
 extern struct task_struct *get_current(void);
 
 
+/* 时钟节拍，只在BSP的时钟中断里加 */
+extern volatile u64 jiffies;
+extern u64 get_jiffies_64(void);
+
+#define time_after(a, b)        ((s64)((b) - (a)) < 0)
+#define time_after_eq(a, b)     ((s64)((a) - (b)) >= 0)
+#define msecs_to_jiffies(m)     ((u64)(m) * HZ / 1000)
+
+/*
+ * 调度域。每个CPU从下往上挂一串域：SMT兄弟、共享LLC的核、同一封装、
+ * 整机(多节点时就是NUMA)。每个域的组是下一层域的范围，均衡时在组之间
+ * 比负载，从最忙组里最忙的CPU往本CPU拉任务。跨度和下一层相同的层级
+ * 在建域时直接去掉。
+ */
+#define SCHED_CAPACITY_SHIFT    10
+#define SCHED_CAPACITY_SCALE    (1UL << SCHED_CAPACITY_SHIFT)
+
+/* 刚跑过的任务在这段时间内算缓存热，尽量不迁移 */
+#define SCHED_MIGRATION_COST_NS (500000ULL)
+
+#define SD_LOAD_BALANCE         0x0001  /* 在这一层做负载均衡 */
+#define SD_BALANCE_NEWIDLE      0x0002  /* 将要空闲时均衡 */
+#define SD_BALANCE_WAKE         0x0004  /* 唤醒时在这一层挑CPU */
+#define SD_WAKE_AFFINE          0x0008  /* 唤醒时可以拉到唤醒者附近 */
+#define SD_SHARE_CPUCAPACITY    0x0010  /* SMT兄弟，共享执行单元 */
+#define SD_SHARE_PKG_RESOURCES  0x0020  /* 共享LLC */
+#define SD_NUMA                 0x0040  /* 跨NUMA节点 */
+
+enum cpu_idle_type {
+    CPU_IDLE,               /* 周期均衡时本CPU空闲 */
+    CPU_NOT_IDLE,
+    CPU_NEWLY_IDLE,         /* 马上要进空闲 */
+    CPU_MAX_IDLE_TYPES
+};
+
+struct sched_group {
+    struct sched_group *next;       /* 同一个域的组连成环，按首CPU排序 */
+    ulong cpumask;
+    unsigned int group_weight;
+};
+
+/*
+ * 同一个LLC里各CPU共用的状态，唤醒选核时用。idle_cpus是空闲CPU的位图，
+ * CPU转入空闲时置位、挑到任务时清掉，唤醒时只在位图里找，不用挨个看
+ * 各CPU的运行队列。位图会稍稍过时，挑中之后还要再确认一次。
+ */
+struct sched_domain_shared {
+    ulong idle_cpus;
+    int has_idle_cores;             /* 可能有SMT兄弟全空闲的核；找不到时清掉 */
+} __attribute__((__aligned__(64)));
+
+struct sched_domain {
+    struct sched_domain *parent;
+    struct sched_domain *child;
+    struct sched_group *groups;     /* 本CPU所在的组 */
+    struct sched_domain_shared *shared; /* 只有LLC那一层有 */
+    ulong span;
+    unsigned int span_weight;
+    int level;
+    const char *name;
+    u32 flags;
+
+    ulong min_interval;             /* 均衡间隔(ms) */
+    ulong max_interval;
+    ulong balance_interval;         /* 当前间隔，均衡失败时翻倍 */
+    unsigned int busy_factor;       /* 本CPU忙时间隔乘上它 */
+    unsigned int imbalance_pct;     /* 超过这个百分比才算不均衡 */
+    unsigned int cache_nice_tries;  /* 失败几次之后不再顾及缓存热 */
+    unsigned int nr_balance_failed;
+    ulong last_balance;             /* jiffies */
+    u64 max_newidle_lb_cost;        /* 空闲均衡在这一层的最大开销(ns)，逐渐衰减 */
+    ulong next_decay_max_lb_cost;
+
+    /* 统计 */
+    unsigned int lb_count[CPU_MAX_IDLE_TYPES];
+    unsigned int lb_failed[CPU_MAX_IDLE_TYPES];
+    unsigned int lb_gained[CPU_MAX_IDLE_TYPES];
+    unsigned int alb_pushed;
+};
+
+struct root_domain {
+    ulong span;
+    int overload;                   /* 有CPU上排着不止一个任务 */
+};
+
+enum migration_type {
+    migrate_load,                   /* imbalance是要搬的负载 */
+    migrate_task,                   /* imbalance是要搬的任务数 */
+};
+
+#define LBF_ALL_PINNED  0x01        /* 候选任务都不能去dst_cpu */
+
+struct lb_env {
+    struct sched_domain *sd;
+
+    struct rq *src_rq;
+    int src_cpu;
+
+    int dst_cpu;
+    struct rq *dst_rq;
+
+    enum cpu_idle_type idle;
+    enum migration_type migration_type;
+    long imbalance;
+    ulong cpus;                     /* 还可以从中找最忙CPU的范围 */
+
+    unsigned int flags;
+    unsigned int loop;
+    unsigned int loop_max;
+};
+
+/* 主动均衡：源CPU在schedule里把正在运行的任务摘下，切走之后再推给dest_cpu */
+struct cpu_stop_work {
+    struct task_struct *task;
+    int dest_cpu;
+};
+
 /* 调度器函数声明 */
 extern void sched_init(void);
 extern void scheduler_tick(void);
@@ -649,9 +839,40 @@ extern void put_prev_task(struct rq *rq, struct task_struct *prev);
 extern void set_next_task(struct rq *rq, struct task_struct *next);
 extern void resched_curr(struct rq *rq);
 extern void resched_cpu(int cpu);
+extern void sched_ttwu_pending(void);
+extern struct task_struct *fork_idle(int cpu);
+extern void cpu_startup_entry(void);
+extern void set_task_cpu(struct task_struct *p, int new_cpu);
+extern void double_rq_lock(struct rq *rq1, struct rq *rq2);
+extern void double_rq_unlock(struct rq *rq1, struct rq *rq2);
+
+/* 负载均衡，见sched_fair.c */
 extern int can_migrate_task(struct task_struct *p, struct lb_env *env);
-extern struct task_struct *load_balance(struct rq *this_rq, int idle,
-                                       struct rq *busiest, ulong *nr_moved);
+extern int load_balance(int this_cpu, struct rq *this_rq,
+                        struct sched_domain *sd, enum cpu_idle_type idle,
+                        int *continue_balancing);
+extern int idle_balance(struct rq *this_rq);
+extern void update_cpu_capacity(struct rq *rq);
+extern void update_blocked_averages(struct rq *rq);
+extern void trigger_load_balance(struct rq *rq);
+extern void sched_init_domains(void);
+
+/* PELT，见pelt.c和sched_fair.c */
+extern void init_entity_runnable_average(struct sched_entity *se);
+extern void post_init_entity_util_avg(struct sched_entity *se);
+extern void migrate_task_rq_fair(struct task_struct *p);
+
+/* 唤醒选核，见sched_fair.c */
+#define WF_SYNC         0x01        /* 唤醒者唤醒之后马上要睡 */
+#define WF_FORK         0x02        /* 新建任务第一次唤醒 */
+#define WF_MIGRATED     0x04        /* 唤醒时换了CPU */
+
+extern struct sched_domain *sd_llc[NR_CPUS];
+extern int sd_llc_size[NR_CPUS];
+extern struct sched_domain_shared *sd_llc_shared[NR_CPUS];
+
+extern int select_task_rq_fair(struct task_struct *p, int prev_cpu, int wake_flags);
+extern void update_idle_cpumask(int cpu, int idle);
 
 /* 任务创建和销毁 */
 extern struct task_struct *alloc_task_struct(void);
@@ -674,6 +895,56 @@ extern const struct sched_class rt_sched_class;
 extern const struct sched_class fair_sched_class;
 extern const struct sched_class idle_sched_class;
 
+struct cfs_rq {
+    struct load_weight load;
+    unsigned int nr_running;
+    unsigned int h_nr_running;
+
+    u64 exec_clock;
+    u64 min_vruntime;
+
+    struct rb_root tasks_timeline;
+    struct rb_node *rb_leftmost;
+
+    struct sched_entity *curr;
+    struct sched_entity *next;
+    struct sched_entity *last;
+    struct sched_entity *skip;
+
+    unsigned int nr_spread_over;
+
+    /* 所有挂在这里的实体的PELT之和，睡眠中的也在，逐渐衰减 */
+    struct sched_avg avg;
+
+    /* 迁走时没持这边的锁，先记下来，下次更新时再从avg里扣 */
+    struct {
+        spinlock_t lock;
+        int nr;
+        ulong load_avg;
+        ulong util_avg;
+        ulong runnable_sum;
+    } removed;
+
+#if CONFIG_FAIR_GROUP_SCHED
+    ulong tg_load_avg_contrib;      /* 上次计入tg->load_avg的值 */
+    long propagate;                 /* 下层有变化，要同步到组实体 */
+    long prop_runnable_sum;
+#endif
+
+    struct rq *rq;
+    struct task_group *tg;
+
+    int runtime_enabled;
+    u64 runtime_expires;
+    s64 runtime_remaining;
+
+    u64 throttled_clock;
+    u64 throttled_clock_task;
+    int throttled;
+    int throttle_count;
+    struct list_head throttled_list;
+};
+
 /* 运行队列 */
 struct rq {
     spinlock_t lock;                /* 运行队列锁 */
@@ -774,6 +1045,8 @@ struct rq {
     unsigned int ttwu_count;       /* 尝试唤醒计数 */
     unsigned int ttwu_local;       /* 本地唤醒计数 */
 
+    struct llist_head wake_list;   /* 其它CPU唤醒到这里、等本CPU入队的任务 */
+
     struct hrtimer hrtick_timer;   /* 高分辨率时钟定时器 */
     ktime_t hrtick_time;           /* 高分辨率时钟时间 */
 
@@ -0,0 +1,70 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "types.h"
+#include "config.h"
+#include "list.h"
+#include "spinlock.h"
+#include "mm.h"
+
+/* kmem_cache_create 标志 */
+#define SLAB_HWCACHE_ALIGN  0x00002000UL    /* 对象按缓存行对齐 */
+#define SLAB_PANIC          0x00040000UL    /* 创建失败时panic */
+
+#define L1_CACHE_BYTES          64
+#define ARCH_KMALLOC_MINALIGN   sizeof(void *)
+
+/* kmalloc 大小类：8字节到8KB，更大的请求直接从伙伴系统取复合页 */
+#define KMALLOC_SHIFT_LOW   3
+#define KMALLOC_SHIFT_HIGH  (PAGE_SHIFT + 1)
+#define KMALLOC_MIN_SIZE    (1UL << KMALLOC_SHIFT_LOW)
+#define KMALLOC_MAX_CACHE_SIZE (1UL << KMALLOC_SHIFT_HIGH)
+
+/* slab页最大阶数 */
+#define SLUB_MAX_ORDER      3
+
+struct kmem_cache_cpu {
+    void **freelist;                /* 本CPU下一个可用对象 */
+    struct page *page;              /* 本CPU正在分配的slab(冻结) */
+};
+
+struct kmem_cache_node {
+    spinlock_t list_lock;           /* 保护partial链表和非冻结slab的freelist */
+    ulong nr_partial;               /* 部分空闲slab数 */
+    struct list_head partial;       /* 部分空闲slab链表 */
+};
+
+struct kmem_cache {
+    struct kmem_cache_cpu cpu_slab[NR_CPUS]; /* 每CPU空闲链表 */
+    ulong flags;                    /* SLAB_*标志 */
+    ulong min_partial;              /* 每节点至少保留的部分空闲slab数 */
+    int size;                       /* 对象实际占用大小(含元数据和对齐) */
+    int object_size;                /* 对象大小 */
+    int offset;                     /* 空闲指针在对象内的偏移 */
+    int align;                      /* 对齐 */
+    int order;                      /* slab页阶数 */
+    int objects;                    /* 每个slab的对象数 */
+    gfp_t allocflags;               /* 分配slab页时附加的标志 */
+    void (*ctor)(void *);           /* 构造函数 */
+    const char *name;               /* 缓存名 */
+    struct list_head list;          /* 全局缓存链表 */
+    struct kmem_cache_node node[MAX_NUMNODES]; /* 每节点部分链表 */
+};
+
+extern struct kmem_cache *kmalloc_caches[KMALLOC_SHIFT_HIGH + 1];
+
+void kmem_cache_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     ulong flags, void (*ctor)(void *));
+void kmem_cache_destroy(struct kmem_cache *s);
+void *kmem_cache_alloc(struct kmem_cache *s, gfp_t flags);
+void *kmem_cache_zalloc(struct kmem_cache *s, gfp_t flags);
+void kmem_cache_free(struct kmem_cache *s, void *x);
+int kmem_cache_shrink(struct kmem_cache *s);
+
+void *kmalloc(size_t size, gfp_t flags);
+void *kzalloc(size_t size, gfp_t flags);
+void kfree(const void *x);
+size_t ksize(const void *x);
+
+#endif /* __SLAB_H__ */
@@ -0,0 +1,110 @@
+#ifndef __SMP_H__
+#define __SMP_H__
+
+#include "types.h"
+#include "config.h"
+#include "llist.h"
+
+/*
+ * 每CPU热数据。每个CPU的GS基址指向自己的那一份，取当前CPU号、当前
+ * 进程只要一条%gs前缀的mov，不用先算CPU号再查表。
+ *
+ * 前几个字段的偏移是给汇编用的，ret_from_sys_call直接测%gs:0x18上
+ * 的标志位，改布局时两边要一起改。
+ */
+
+#define PCPU_SELF           0x00
+#define PCPU_CURRENT_TASK   0x08
+#define PCPU_CPU_NUMBER     0x10
+#define PCPU_FLAGS          0x18
+
+/* PCPU_FLAGS里的位，和switch.S一致 */
+#define PCPU_NEED_RESCHED   0x1
+#define PCPU_SIGPENDING     0x2
+
+struct task_struct;
+
+struct pcpu_hot {
+    struct pcpu_hot *self;              /* 0x00 本结构的线性地址 */
+    struct task_struct *current_task;   /* 0x08 */
+    u32 cpu_number;                     /* 0x10 */
+    u32 apicid;                         /* 0x14 */
+    u32 flags;                          /* 0x18 */
+    u32 irq_count;                      /* 0x1c 中断嵌套深度 */
+    ulong top_of_stack;                 /* 0x20 本CPU空闲进程的栈顶 */
+} __attribute__((__aligned__(64)));  /* 各占一个缓存行 */
+
+_Static_assert(offsetof(struct pcpu_hot, current_task) == PCPU_CURRENT_TASK,
+               "pcpu_hot layout");
+_Static_assert(offsetof(struct pcpu_hot, cpu_number) == PCPU_CPU_NUMBER,
+               "pcpu_hot layout");
+_Static_assert(offsetof(struct pcpu_hot, flags) == PCPU_FLAGS,
+               "ret_from_sys_call tests %gs:0x18");
+
+extern struct pcpu_hot pcpu_hot[NR_CPUS];
+
+static inline struct pcpu_hot *this_pcpu(void)
+{
+    struct pcpu_hot *p;
+
+    asm volatile("movq %%gs:%c1, %0" : "=r" (p) : "i" (PCPU_SELF));
+    return p;
+}
+
+/* CPU位图，和task_struct的cpus_allowed一样是一个u64 */
+#define CPU_MASK_ALL        (~0UL >> (BITS_PER_LONG - NR_CPUS))
+#define cpumask_of(cpu)     (1UL << (cpu))
+
+extern ulong cpu_possible_mask;
+extern ulong cpu_online_mask;
+extern int nr_cpu_ids;
+extern int cpu_to_apicid[NR_CPUS];
+
+static inline bool cpu_online(int cpu)
+{
+    return (*(volatile ulong *)&cpu_online_mask) & cpumask_of(cpu);
+}
+
+static inline int num_online_cpus(void)
+{
+    return __builtin_popcountl(cpu_online_mask);
+}
+
+#define for_each_cpu_mask(cpu, mask)                                        \
+    for ((cpu) = 0; (cpu) < NR_CPUS; (cpu)++)                               \
+        if ((mask) & cpumask_of(cpu))
+
+#define for_each_possible_cpu(cpu)  for_each_cpu_mask(cpu, cpu_possible_mask)
+#define for_each_online_cpu(cpu)    for_each_cpu_mask(cpu, cpu_online_mask)
+
+/* AP启动跳板在低端内存的位置，SIPI只能给出4K对齐的实模式页 */
+#define SMP_TRAMPOLINE_BASE 0x8000
+
+/* 跨CPU函数调用 */
+typedef void (*smp_call_func_t)(void *info);
+
+#define CSD_FLAG_LOCK       0x01    /* 已入队还没执行完，不能再用 */
+
+struct call_single_data {
+    struct llist_node llist;
+    smp_call_func_t func;
+    void *info;
+    unsigned int flags;
+};
+
+extern u32 smp_processor_id(void);
+
+extern void smp_setup_boot_cpu(void);
+extern int smp_register_cpu(u32 apicid);
+extern void smp_init(void);
+extern void start_secondary(void);
+
+extern void smp_send_reschedule(int cpu);
+extern int smp_call_function_single(int cpu, smp_call_func_t func, void *info,
+                                    int wait);
+extern int smp_call_function_single_async(int cpu, struct call_single_data *csd);
+extern void smp_call_function_many(ulong mask, smp_call_func_t func, void *info);
+extern void on_each_cpu(smp_call_func_t func, void *info);
+extern void flush_smp_call_function_queue(void);
+
+#endif /* __SMP_H__ */
@@ -0,0 +1,235 @@
+#ifndef __SWAP_H__
+#define __SWAP_H__
+
+#include "types.h"
+#include "mm.h"
+#include "numa.h"
+#include "pgtable.h"
+#include "config.h"
+
+/* 每CPU攒够这么多页才拿一次lru_lock加入LRU */
+#define PAGEVEC_SIZE        15
+
+struct pagevec {
+    unsigned int nr;
+    struct page *pages[PAGEVEC_SIZE];
+};
+
+/* 一次回收扫描的批量 */
+#define SWAP_CLUSTER_MAX    32UL
+
+/* 扫描优先级：每轮扫描LRU长度的1/2^priority，压力越大优先级越低 */
+#define DEF_PRIORITY        12
+
+/* kswapd连续这么多轮一页都回收不了，就认为节点已无可回收内存 */
+#define MAX_RECLAIM_RETRIES 16
+
+extern atomic_long_t nr_swap_pages;
+
+static inline long get_nr_swap_pages(void)
+{
+    return atomic_long_read(&nr_swap_pages);
+}
+
+/*
+ * 交换。匿名页回收时先在交换区分一个槽位，页放进交换缓存(以槽位为
+ * 索引)，页表项换成记着槽位的非存在项，再把页写出去。写出先交给zswap
+ * 压缩后留在内存里，压不下或池满了才落到交换设备上。缺页时按页表项
+ * 里的槽位先查交换缓存，再依次从zswap和设备读回。
+ *
+ * 槽位号：低SWP_TYPE_BITS位是交换区编号，其余是区内页偏移。
+ * 最后两个编号留给压缩迁移：页表项里记正在迁移的页的页框号。
+ */
+#define SWP_TYPE_BITS       5
+#define MAX_SWAPFILES       ((1 << SWP_TYPE_BITS) - 2)
+#define SWP_MIGRATION_READ  MAX_SWAPFILES
+#define SWP_MIGRATION_WRITE (MAX_SWAPFILES + 1)
+
+typedef struct {
+    ulong val;
+} swp_entry_t;
+
+static inline swp_entry_t swp_entry(ulong type, pgoff_t offset)
+{
+    swp_entry_t entry;
+
+    entry.val = (offset << SWP_TYPE_BITS) | type;
+    return entry;
+}
+
+static inline unsigned int swp_type(swp_entry_t entry)
+{
+    return entry.val & ((1 << SWP_TYPE_BITS) - 1);
+}
+
+static inline pgoff_t swp_offset(swp_entry_t entry)
+{
+    return entry.val >> SWP_TYPE_BITS;
+}
+
+static inline swp_entry_t make_migration_entry(struct page *page, int write)
+{
+    return swp_entry(write ? SWP_MIGRATION_WRITE : SWP_MIGRATION_READ,
+                     page_to_pfn(page));
+}
+
+static inline int is_migration_entry(swp_entry_t entry)
+{
+    return swp_type(entry) == SWP_MIGRATION_READ ||
+           swp_type(entry) == SWP_MIGRATION_WRITE;
+}
+
+static inline int is_write_migration_entry(swp_entry_t entry)
+{
+    return swp_type(entry) == SWP_MIGRATION_WRITE;
+}
+
+static inline struct page *migration_entry_to_page(swp_entry_t entry)
+{
+    return pfn_to_page(swp_offset(entry));
+}
+
+/* 换出页的页表项：P位为0，槽位号左移一位避开P位，非零以区别于空项 */
+static inline int is_swap_pte(pte_t pte)
+{
+    return !pte_none(pte) && !pte_present(pte);
+}
+
+static inline swp_entry_t pte_to_swp_entry(pte_t pte)
+{
+    swp_entry_t entry;
+
+    entry.val = pte_val(pte) >> 1;
+    return entry;
+}
+
+static inline pte_t swp_entry_to_pte(swp_entry_t entry)
+{
+    return __pte(entry.val << 1);
+}
+
+/* swap_map里每个槽位一个字节：引用数加交换缓存标志 */
+#define SWAP_HAS_CACHE      0x40    /* 槽位的页在交换缓存里 */
+#define SWAP_MAP_MAX        0x3e    /* 页表引用数上限 */
+#define SWAP_MAP_BAD        0x3f    /* 坏槽或头部，不分配 */
+
+/* 每CPU槽位缓存一次批发的槽位数 */
+#define SWAP_SLOTS_CACHE_SIZE   64
+
+/* 偏移0留给交换区头部 */
+#define SWAP_HEADER_PAGES   1
+
+/* 交换区用量超过一半时，换入的页就把槽位放掉，不留两份 */
+#define vm_swap_full()      (get_nr_swap_pages() * 2 < total_swap_pages)
+
+enum {
+    SWP_USED        = (1 << 0),     /* 交换区槽位已占用 */
+    SWP_WRITEOK     = (1 << 1),     /* 可以分配槽位 */
+};
+
+struct block_device;
+
+struct swap_info_struct {
+    ulong flags;
+    int prio;                       /* 优先级高的交换区先分配 */
+    int type;                       /* 在swap_info[]中的下标 */
+    unsigned int max;               /* 槽位总数，含头部 */
+    unsigned char *swap_map;        /* 每槽位的引用数 */
+    unsigned int lowest_bit;        /* 空闲槽位的下界 */
+    unsigned int highest_bit;       /* 空闲槽位的上界 */
+    unsigned int cluster_next;      /* 下次从这里往后找，让连续换出的页挨着 */
+    unsigned int pages;             /* 可用槽位数 */
+    unsigned int inuse_pages;       /* 已分配槽位数 */
+    struct block_device *bdev;      /* NULL表示只有zswap一层 */
+    spinlock_t lock;
+};
+
+extern struct swap_info_struct *swap_info[MAX_SWAPFILES];
+extern long total_swap_pages;
+extern struct address_space swapper_spaces[MAX_SWAPFILES];
+
+static inline struct address_space *swap_address_space(swp_entry_t entry)
+{
+    return &swapper_spaces[swp_type(entry)];
+}
+
+static inline swp_entry_t page_swap_entry(struct page *page)
+{
+    swp_entry_t entry;
+
+    entry.val = page_private(page);
+    return entry;
+}
+
+/* swap.c */
+void lru_cache_add(struct page *page);
+void lru_add_drain(void);
+void putback_lru_page(struct page *page);
+int isolate_lru_page(struct page *page);
+void mark_page_accessed(struct page *page);
+
+/* swapfile.c */
+int swapon(struct block_device *bdev, unsigned int nr_pages, int prio);
+int get_swap_pages(int n, swp_entry_t *slots);
+void swapcache_free_entries(swp_entry_t *entries, int n);
+int swap_duplicate(swp_entry_t entry);
+void swap_free(swp_entry_t entry);
+void swapcache_free(swp_entry_t entry);
+int swapcache_prepare(swp_entry_t entry);
+int page_swapcount(struct page *page);
+int try_to_free_swap(struct page *page);
+struct swap_info_struct *swp_swap_info(swp_entry_t entry);
+void si_swapinfo(struct sysinfo *val);
+
+/* swap_slots.c */
+swp_entry_t get_swap_page(void);
+void free_swap_slot(swp_entry_t entry);
+void drain_swap_slots_cache(void);
+
+/* swap_state.c */
+int add_to_swap(struct page *page);
+int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask);
+void __delete_from_swap_cache(struct page *page);
+void delete_from_swap_cache(struct page *page);
+struct page *lookup_swap_cache(swp_entry_t entry);
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+                                   struct vm_area_struct *vma, ulong addr);
+void swap_cache_init(void);
+
+/* page_io.c */
+int swap_writepage(struct page *page);
+int swap_readpage(struct page *page);
+
+/* zswap.c */
+#if CONFIG_ZSWAP
+int zswap_store(unsigned int type, pgoff_t offset, struct page *page);
+int zswap_load(unsigned int type, pgoff_t offset, struct page *page);
+void zswap_invalidate(unsigned int type, pgoff_t offset);
+void zswap_swapon(unsigned int type);
+void zswap_init(void);
+#else
+static inline int zswap_store(unsigned int type, pgoff_t offset,
+                              struct page *page)
+{
+    return -ENODEV;
+}
+
+static inline int zswap_load(unsigned int type, pgoff_t offset,
+                             struct page *page)
+{
+    return -ENOENT;
+}
+
+static inline void zswap_invalidate(unsigned int type, pgoff_t offset) {}
+static inline void zswap_swapon(unsigned int type) {}
+static inline void zswap_init(void) {}
+#endif
+
+/* vmscan.c */
+void wakeup_kswapd(struct zone *zone, int order, enum zone_type classzone_idx);
+ulong try_to_free_pages(struct zonelist *zonelist, int order, gfp_t gfp_mask,
+                        nodemask_t *nodemask);
+int kswapd_run(int nid);
+void kswapd_init(void);
+
+#endif /* __SWAP_H__ */
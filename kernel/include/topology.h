@@ -0,0 +1,36 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include "types.h"
+#include "config.h"
+
+/*
+ * CPU拓扑，由APIC ID按CPUID给出的位宽拆出SMT兄弟、共享LLC的核和
+ * 封装，建调度域时填好。位图格式同cpu_online_mask。
+ */
+extern ulong cpu_sibling_map[NR_CPUS];      /* 同一个物理核上的SMT兄弟 */
+extern ulong cpu_llc_shared_map[NR_CPUS];   /* 共享最后一级缓存 */
+extern ulong cpu_core_map[NR_CPUS];         /* 同一个封装 */
+extern int cpu_llc_id[NR_CPUS];             /* 所在LLC里编号最小的CPU */
+
+static inline ulong cpu_smt_mask(int cpu)
+{
+    return cpu_sibling_map[cpu];
+}
+
+static inline ulong cpu_llc_mask(int cpu)
+{
+    return cpu_llc_shared_map[cpu];
+}
+
+static inline ulong cpu_pkg_mask(int cpu)
+{
+    return cpu_core_map[cpu];
+}
+
+static inline bool cpus_share_cache(int this_cpu, int that_cpu)
+{
+    return cpu_llc_id[this_cpu] == cpu_llc_id[that_cpu];
+}
+
+#endif /* __TOPOLOGY_H__ */
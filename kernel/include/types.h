@@ -119,7 +119,7 @@ typedef enum
 #define offsetof(type, member) ((size_t)&((type *)0)->member)
 
 #define __pa(x) ((phys_addr_t)(x) - KERNEL_VIRTUAL_BASE)
-#define __va(x) ((void *)(phys_addr_t + KERNEL_VIRTUAL_BASE))
+#define __va(x) ((void *)((phys_addr_t)(x) + KERNEL_VIRTUAL_BASE))
 
 #define KERNEL_VIRTUAL_BASE 0xFFFF800000000000UL
 #define USER_VIRTUAL_BASE 0x0000000000000000UL
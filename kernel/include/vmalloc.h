@@ -0,0 +1,84 @@
+#ifndef __VMALLOC_H__
+#define __VMALLOC_H__
+
+#include "types.h"
+#include "list.h"
+#include "mm.h"
+#include "pgtable.h"
+
+/* vm_struct标志 */
+#define VM_IOREMAP          0x00000001  /* ioremap映射 */
+#define VM_ALLOC            0x00000002  /* vmalloc分配 */
+#define VM_MAP              0x00000004  /* vmap映射现成的页 */
+#define VM_NO_GUARD         0x00000040  /* 不要尾部保护页 */
+
+/* 每个区域尾部留一个不映射的保护页，越界访问立即缺页 */
+#define VMALLOC_GUARD_SIZE  PAGE_SIZE
+
+struct vm_struct {
+    void *addr;                     /* 起始地址 */
+    ulong size;                     /* 大小(含保护页) */
+    ulong flags;                    /* VM_*标志 */
+    struct page **pages;            /* 映射的物理页 */
+    unsigned int nr_pages;          /* 物理页数 */
+};
+
+/* vmap_area标志 */
+#define VMAP_RAM            0x1     /* vm_map_ram直接分配的区域 */
+#define VMAP_BLOCK          0x2     /* 每CPU vmap块 */
+
+struct vmap_block;
+
+struct vmap_area {
+    ulong va_start;
+    ulong va_end;
+    ulong flags;                    /* VMAP_*标志 */
+
+    struct rb_node rb_node;         /* 按地址排序的树节点 */
+    struct list_head list;          /* 按地址排序的链表，延迟释放时挂在清理链表上 */
+
+    /*
+     * 空闲树里的节点记录子树中最大的空闲块，找空闲区时可以整棵子树
+     * 跳过；已用树里的节点指向所属的vm_struct或vmap块。
+     */
+    union {
+        ulong subtree_max_size;
+        struct vm_struct *vm;
+        struct vmap_block *vb;
+    };
+};
+
+static inline ulong get_vm_area_size(const struct vm_struct *area)
+{
+    if (!(area->flags & VM_NO_GUARD))
+        return area->size - VMALLOC_GUARD_SIZE;
+    return area->size;
+}
+
+/* vmalloc.c */
+void *vmalloc(ulong size);
+void *vzalloc(ulong size);
+void *vmalloc_node(ulong size, int node);
+void *__vmalloc_node_range(ulong size, ulong align, ulong start, ulong end,
+                           gfp_t gfp_mask, pgprot_t prot, ulong vm_flags,
+                           int node);
+void vfree(const void *addr);
+
+void *vmap(struct page **pages, unsigned int count, ulong flags, pgprot_t prot);
+void vunmap(const void *addr);
+
+void *vm_map_ram(struct page **pages, unsigned int count, int node);
+void vm_unmap_ram(const void *mem, unsigned int count);
+
+struct vm_struct *get_vm_area(ulong size, ulong flags);
+struct vm_struct *find_vm_area(const void *addr);
+struct page *vmalloc_to_page(const void *addr);
+bool is_vmalloc_addr(const void *addr);
+
+void *module_alloc(ulong size);
+void module_memfree(void *addr);
+
+void vm_unmap_aliases(void);
+void vmalloc_init(void);
+
+#endif /* __VMALLOC_H__ */
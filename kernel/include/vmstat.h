@@ -0,0 +1,168 @@
+#ifndef __VMSTAT_H__
+#define __VMSTAT_H__
+
+#include "types.h"
+#include "mm.h"
+#include "numa.h"
+#include "spinlock.h"
+
+/*
+ * 内存统计。计数更新只改本CPU的差值，不碰共享缓存行也不加锁；
+ * 差值超过阈值时才折叠进区域/节点和全局的原子总数。总数因此会
+ * 落后最多 NR_CPUS * 阈值，需要准确值时用 *_snapshot 把差值一起加上。
+ */
+
+enum vm_event_item {
+    PGALLOC,                    /* 分配的页数 */
+    PGFREE,                     /* 释放的页数 */
+    PGFAULT,                    /* 缺页次数 */
+    PGACTIVATE,                 /* 提到活跃链表的页 */
+    PGDEACTIVATE,               /* 降到不活跃链表的页 */
+    PGSCAN_KSWAPD,              /* kswapd扫描的页 */
+    PGSCAN_DIRECT,              /* 直接回收扫描的页 */
+    PGSTEAL_KSWAPD,             /* kswapd回收的页 */
+    PGSTEAL_DIRECT,             /* 直接回收回收的页 */
+    PAGEOUTRUN,                 /* kswapd平衡轮数 */
+    ALLOCSTALL,                 /* 进入直接回收的次数 */
+    COMPACTSTALL,               /* 进入直接压缩的次数 */
+    COMPACTFAIL,                /* 直接压缩失败 */
+    COMPACTSUCCESS,             /* 直接压缩成功 */
+    THP_FAULT_ALLOC,            /* 缺页时分到透明大页 */
+    THP_FAULT_FALLBACK,         /* 缺页时大页分配失败退回小页 */
+    PSWPIN,                     /* 从交换设备读入的页 */
+    PSWPOUT,                    /* 写到交换设备的页 */
+    ZSWPIN,                     /* 从zswap解压换入的页 */
+    ZSWPOUT,                    /* 压缩存进zswap的页 */
+    NR_VM_EVENT_ITEMS
+};
+
+/* 事件只增不减、不需要按区域读，干脆只留每CPU计数，读时求和 */
+struct vm_event_state {
+    ulong event[NR_VM_EVENT_ITEMS];
+};
+
+extern struct vm_event_state vm_event_states[NR_CPUS];
+
+extern atomic_long_t vm_zone_stat[NR_VM_ZONE_STAT_ITEMS];
+extern atomic_long_t vm_numa_stat[NR_VM_NUMA_STAT_ITEMS];
+extern atomic_long_t vm_node_stat[NR_VM_NODE_STAT_ITEMS];
+
+/* 双下划线版本要求调用者已关中断 */
+static inline void __count_vm_event(enum vm_event_item item)
+{
+    vm_event_states[smp_processor_id()].event[item]++;
+}
+
+static inline void __count_vm_events(enum vm_event_item item, long delta)
+{
+    vm_event_states[smp_processor_id()].event[item] += delta;
+}
+
+static inline void count_vm_events(enum vm_event_item item, long delta)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    __count_vm_events(item, delta);
+    local_irq_restore(flags);
+}
+
+static inline void count_vm_event(enum vm_event_item item)
+{
+    count_vm_events(item, 1);
+}
+
+/* 折叠过程中总数可能短暂为负，读出时截到0 */
+static inline ulong global_zone_page_state(enum zone_stat_item item)
+{
+    long x = atomic_long_read(&vm_zone_stat[item]);
+
+    return x < 0 ? 0 : x;
+}
+
+static inline ulong global_node_page_state(enum node_stat_item item)
+{
+    long x = atomic_long_read(&vm_node_stat[item]);
+
+    return x < 0 ? 0 : x;
+}
+
+static inline ulong zone_page_state(struct zone *zone,
+                                    enum zone_stat_item item)
+{
+    long x = atomic_long_read(&zone->vm_stat[item]);
+
+    return x < 0 ? 0 : x;
+}
+
+static inline ulong node_page_state(struct pglist_data *pgdat,
+                                    enum node_stat_item item)
+{
+    long x = atomic_long_read(&pgdat->vm_stat[item]);
+
+    return x < 0 ? 0 : x;
+}
+
+static inline ulong zone_numa_state(struct zone *zone,
+                                    enum numa_stat_item item)
+{
+    return atomic_long_read(&zone->vm_numa_stat[item]);
+}
+
+/*
+ * 带上各CPU尚未折叠的差值，代价是遍历所有CPU。只在接近水位、
+ * 误差会影响判断时使用。
+ */
+static inline ulong zone_page_state_snapshot(struct zone *zone,
+                                             enum zone_stat_item item)
+{
+    long x = atomic_long_read(&zone->vm_stat[item]);
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        x += zone->per_cpu_zonestats[cpu].vm_stat_diff[item];
+
+    return x < 0 ? 0 : x;
+}
+
+static inline ulong node_page_state_snapshot(struct pglist_data *pgdat,
+                                             enum node_stat_item item)
+{
+    long x = atomic_long_read(&pgdat->vm_stat[item]);
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        x += pgdat->per_cpu_nodestats[cpu].vm_node_stat_diff[item];
+
+    return x < 0 ? 0 : x;
+}
+
+/* vmstat.c */
+void __mod_zone_page_state(struct zone *zone, enum zone_stat_item item,
+                           long delta);
+void __inc_zone_page_state(struct page *page, enum zone_stat_item item);
+void __dec_zone_page_state(struct page *page, enum zone_stat_item item);
+void mod_zone_page_state(struct zone *zone, enum zone_stat_item item,
+                         long delta);
+void inc_zone_page_state(struct page *page, enum zone_stat_item item);
+void dec_zone_page_state(struct page *page, enum zone_stat_item item);
+
+void __mod_node_page_state(struct pglist_data *pgdat,
+                           enum node_stat_item item, long delta);
+void __inc_node_page_state(struct page *page, enum node_stat_item item);
+void __dec_node_page_state(struct page *page, enum node_stat_item item);
+void mod_node_page_state(struct pglist_data *pgdat,
+                         enum node_stat_item item, long delta);
+
+void __inc_numa_state(struct zone *zone, enum numa_stat_item item);
+void inc_numa_state(struct zone *zone, enum numa_stat_item item);
+
+ulong global_zone_page_state_snapshot(enum zone_stat_item item);
+void all_vm_events(ulong *ret);
+
+void refresh_cpu_vm_stats(int cpu);
+void refresh_zone_stat_thresholds(void);
+void vmstat_tick(void);
+void vmstat_init(void);
+
+#endif /* __VMSTAT_H__ */
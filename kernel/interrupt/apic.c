@@ -0,0 +1,238 @@
+#include "../../include/types.h"
+#include "../../include/mm.h"
+#include "../../include/sched.h"
+#include "../../include/memblock.h"
+#include "../../include/vmstat.h"
+#include "../../include/smp.h"
+#include "../../include/apic.h"
+
+/*
+ * 本地APIC：IPI的收发、启动AP用的INIT/SIPI，以及AP上的时钟中断。
+ * 每个CPU在同一个物理地址上看到的都是自己的APIC，所以寄存器窗口
+ * 只映射一次，所有CPU共用。
+ *
+ * 8259的时钟和键盘中断仍然只送到BSP，AP靠本地APIC时钟驱动调度。
+ */
+
+#define PIT_TICK_RATE       1193182     /* 8254的输入时钟(Hz) */
+#define PIT_MAX_TICKS       0xffff
+
+/* 校准本地时钟时用PIT数10ms */
+#define APIC_CALIBRATE_MS   10
+
+static volatile u32 *lapic_base;
+
+/* 一个时钟节拍对应的APIC计数，在BSP上校准一次，AP直接用 */
+static u32 lapic_timer_period;
+
+static inline unsigned char inb(unsigned short port)
+{
+    unsigned char result;
+    asm volatile("inb %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static inline void outb(unsigned short port, unsigned char value)
+{
+    asm volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline u32 apic_read(u32 reg)
+{
+    return lapic_base[reg >> 2];
+}
+
+static inline void apic_write(u32 reg, u32 val)
+{
+    lapic_base[reg >> 2] = val;
+}
+
+/*
+ * 用8254的2号通道单次计数忙等，一次最多约55ms。只在BSP启动阶段用，
+ * 那时没有别人碰PIT的2号通道。
+ */
+static void pit_wait_ticks(u16 ticks)
+{
+    u8 val;
+
+    /* 打开2号通道的门控，关掉扬声器输出 */
+    val = inb(0x61);
+    outb(0x61, (val & ~0x02) | 0x01);
+
+    outb(0x43, 0xb0);               /* 2号通道，先低后高字节，模式0 */
+    outb(0x42, ticks & 0xff);
+    outb(0x42, ticks >> 8);
+
+    while (!(inb(0x61) & 0x20))
+        cpu_relax();
+}
+
+void apic_udelay(u32 usecs)
+{
+    u64 ticks = (u64)usecs * PIT_TICK_RATE / 1000000 + 1;
+    u16 n;
+
+    while (ticks) {
+        n = MIN(ticks, (u64)PIT_MAX_TICKS);
+        pit_wait_ticks(n);
+        ticks -= n;
+    }
+}
+
+u32 read_apic_id(void)
+{
+    return apic_read(APIC_ID) >> 24;
+}
+
+void apic_eoi(void)
+{
+    apic_write(APIC_EOI, 0);
+}
+
+static void apic_wait_icr_idle(void)
+{
+    while (apic_read(APIC_ICR) & APIC_ICR_BUSY)
+        cpu_relax();
+}
+
+/* 写ICR低32位才真正发出，高32位的目标要先写；中间不能被本CPU的中断打断 */
+static void __apic_send_ipi(u32 apicid, u32 cfg)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    apic_wait_icr_idle();
+    apic_write(APIC_ICR2, apicid << 24);
+    apic_write(APIC_ICR, cfg);
+    local_irq_restore(flags);
+}
+
+void apic_send_ipi(u32 apicid, int vector)
+{
+    __apic_send_ipi(apicid, APIC_DEST_NOSHORT | APIC_DM_FIXED | vector);
+}
+
+/*
+ * INIT-SIPI-SIPI：INIT让AP复位后等待，SIPI给出实模式入口页号。第二次
+ * SIPI是给第一次被丢掉的老处理器准备的，已经在跑的AP会忽略它。
+ */
+int wakeup_secondary_cpu_via_init(u32 apicid, ulong start_eip)
+{
+    int i;
+
+    apic_write(APIC_ESR, 0);
+
+    __apic_send_ipi(apicid, APIC_INT_LEVELTRIG | APIC_INT_ASSERT | APIC_DM_INIT);
+    apic_udelay(10000);
+    __apic_send_ipi(apicid, APIC_INT_LEVELTRIG | APIC_DM_INIT);
+    apic_wait_icr_idle();
+
+    for (i = 0; i < 2; i++) {
+        apic_write(APIC_ESR, 0);
+        __apic_send_ipi(apicid, APIC_DM_STARTUP | (start_eip >> 12));
+        apic_udelay(200);
+        apic_wait_icr_idle();
+    }
+
+    apic_write(APIC_ESR, 0);
+    return (apic_read(APIC_ESR) & 0xef) ? -EIO : 0;
+}
+
+/* BSP上第一次调用时映射寄存器窗口；每个CPU启动时都要调用一次 */
+void lapic_init(void)
+{
+    u64 base = native_read_msr(MSR_IA32_APICBASE);
+    phys_addr_t phys = base & MSR_IA32_APICBASE_BASE;
+
+    if (!(base & MSR_IA32_APICBASE_ENABLE))
+        native_write_msr(MSR_IA32_APICBASE, base | MSR_IA32_APICBASE_ENABLE);
+
+    if (!lapic_base) {
+        map_direct_mmio(phys, phys + PAGE_SIZE);
+        lapic_base = __va(phys);
+    }
+
+    apic_write(APIC_TASKPRI, 0);
+
+    /* BSP的LINT0接着8259(虚拟线模式)，保持BIOS的设置；AP上全部屏蔽 */
+    if (!(base & MSR_IA32_APICBASE_BSP)) {
+        apic_write(APIC_LVT0, APIC_LVT_MASKED);
+        apic_write(APIC_LVT1, APIC_LVT_MASKED);
+    }
+
+    apic_write(APIC_LVTERR, ERROR_APIC_VECTOR);
+    apic_write(APIC_ESR, 0);
+    apic_write(APIC_ESR, 0);
+
+    apic_write(APIC_SPIV, APIC_SPIV_APIC_ENABLED | SPURIOUS_APIC_VECTOR);
+    apic_eoi();
+}
+
+/* 在BSP上用PIT量出一个时钟节拍有多少APIC计数 */
+static void calibrate_apic_timer(void)
+{
+    u32 elapsed;
+
+    apic_write(APIC_TDCR, APIC_TDR_DIV_16);
+    apic_write(APIC_LVTT, APIC_LVT_MASKED | LOCAL_TIMER_VECTOR);
+    apic_write(APIC_TMICT, 0xffffffff);
+
+    apic_udelay(APIC_CALIBRATE_MS * 1000);
+
+    elapsed = 0xffffffff - apic_read(APIC_TMCCT);
+    apic_write(APIC_TMICT, 0);
+
+    lapic_timer_period = (u64)elapsed * 1000 / APIC_CALIBRATE_MS / HZ;
+    if (!lapic_timer_period)
+        lapic_timer_period = 1;
+
+    printk("APIC: timer %u counts per tick\n", lapic_timer_period);
+}
+
+void setup_apic_timer(void)
+{
+    if (!lapic_timer_period)
+        calibrate_apic_timer();
+
+    apic_write(APIC_TDCR, APIC_TDR_DIV_16);
+    apic_write(APIC_LVTT, APIC_LVT_TIMER_PERIODIC | LOCAL_TIMER_VECTOR);
+    apic_write(APIC_TMICT, lapic_timer_period);
+}
+
+/* 以下由interrupt.S的入口调用，进来时中断已关 */
+
+void smp_reschedule_interrupt(void)
+{
+    apic_eoi();
+    sched_ttwu_pending();
+}
+
+void smp_call_function_single_interrupt(void)
+{
+    apic_eoi();
+    flush_smp_call_function_queue();
+}
+
+void smp_apic_timer_interrupt(void)
+{
+    apic_eoi();
+
+    scheduler_tick();
+    vmstat_tick();
+}
+
+void smp_error_interrupt(void)
+{
+    u32 esr;
+
+    apic_write(APIC_ESR, 0);
+    esr = apic_read(APIC_ESR);
+    apic_eoi();
+
+    printk("APIC: error on CPU%u: %02x\n", smp_processor_id(), esr);
+}
+
+/* 伪中断不用发EOI */
+void smp_spurious_interrupt(void)
+{
+}
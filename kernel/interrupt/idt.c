@@ -0,0 +1,154 @@
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/pgtable.h"
+#include "../../include/smp.h"
+#include "../../include/apic.h"
+
+/*
+ * 中断描述符表。所有CPU共用一张表，BSP在启动早期填好异常和8259的
+ * 入口，本地APIC的向量由smp_init补上；每个CPU(包括AP)各自lidt一次。
+ */
+
+#define IDT_ENTRIES         256
+#define KERNEL_CS           0x08    /* boot.S里GDT的64位代码段 */
+#define GATE_INTERRUPT      0x8e    /* 存在、DPL0、64位中断门 */
+
+#define X86_EFLAGS_IF       0x200
+#define X86_TRAP_PF         14
+
+struct idt_gate {
+    u16 offset_low;
+    u16 selector;
+    u8 ist;
+    u8 type_attr;
+    u16 offset_mid;
+    u32 offset_high;
+    u32 reserved;
+} __attribute__((__packed__));
+
+struct idt_ptr {
+    u16 limit;
+    u64 base;
+} __attribute__((__packed__));
+
+static struct idt_gate idt_table[IDT_ENTRIES] __attribute__((__aligned__(4096)));
+
+static struct idt_ptr idt_descr = {
+    .limit = sizeof(idt_table) - 1,
+};
+
+/* isr_common_stub压的现场，从低地址往高 */
+struct interrupt_frame {
+    ulong gs, fs, es, ds;
+    ulong r15, r14, r13, r12, r11, r10, r9, r8;
+    ulong rdi, rsi, rbp, rdx, rcx, rbx, rax;
+    ulong vector;
+    ulong error_code;
+    /* CPU压的 */
+    ulong rip, cs, rflags, rsp, ss;
+};
+
+/* interrupt.S */
+extern void idt_flush(u64 idt_ptr);
+
+/* main.c */
+extern void handle_exception(int exception, ulong error_code);
+
+#define DECLARE_STUB(name)  extern void name(void)
+DECLARE_STUB(isr0);  DECLARE_STUB(isr1);  DECLARE_STUB(isr2);  DECLARE_STUB(isr3);
+DECLARE_STUB(isr4);  DECLARE_STUB(isr5);  DECLARE_STUB(isr6);  DECLARE_STUB(isr7);
+DECLARE_STUB(isr8);  DECLARE_STUB(isr9);  DECLARE_STUB(isr10); DECLARE_STUB(isr11);
+DECLARE_STUB(isr12); DECLARE_STUB(isr13); DECLARE_STUB(isr14); DECLARE_STUB(isr15);
+DECLARE_STUB(isr16); DECLARE_STUB(isr17); DECLARE_STUB(isr18); DECLARE_STUB(isr19);
+DECLARE_STUB(isr20); DECLARE_STUB(isr21); DECLARE_STUB(isr22); DECLARE_STUB(isr23);
+DECLARE_STUB(isr24); DECLARE_STUB(isr25); DECLARE_STUB(isr26); DECLARE_STUB(isr27);
+DECLARE_STUB(isr28); DECLARE_STUB(isr29); DECLARE_STUB(isr30); DECLARE_STUB(isr31);
+DECLARE_STUB(irq0);  DECLARE_STUB(irq1);  DECLARE_STUB(irq2);  DECLARE_STUB(irq3);
+DECLARE_STUB(irq4);  DECLARE_STUB(irq5);  DECLARE_STUB(irq6);  DECLARE_STUB(irq7);
+DECLARE_STUB(irq8);  DECLARE_STUB(irq9);  DECLARE_STUB(irq10); DECLARE_STUB(irq11);
+DECLARE_STUB(irq12); DECLARE_STUB(irq13); DECLARE_STUB(irq14); DECLARE_STUB(irq15);
+
+static void (*const exception_stubs[32])(void) = {
+    isr0,  isr1,  isr2,  isr3,  isr4,  isr5,  isr6,  isr7,
+    isr8,  isr9,  isr10, isr11, isr12, isr13, isr14, isr15,
+    isr16, isr17, isr18, isr19, isr20, isr21, isr22, isr23,
+    isr24, isr25, isr26, isr27, isr28, isr29, isr30, isr31,
+};
+
+/* 8259重映射到0x20-0x2f */
+static void (*const irq_stubs[16])(void) = {
+    irq0,  irq1,  irq2,  irq3,  irq4,  irq5,  irq6,  irq7,
+    irq8,  irq9,  irq10, irq11, irq12, irq13, irq14, irq15,
+};
+
+#define FIRST_EXTERNAL_VECTOR   0x20
+
+/*
+ * 只改表项，不用重新lidt。AP上线之前填好；上线之后再改的话，别的CPU
+ * 可能正在用这一项，调用者要保证那时这个向量还不会来。
+ */
+void set_intr_gate(unsigned int n, void *addr)
+{
+    struct idt_gate *gate = &idt_table[n];
+    ulong offset = (ulong)addr;
+
+    gate->offset_low = offset & 0xffff;
+    gate->selector = KERNEL_CS;
+    gate->ist = 0;
+    gate->type_attr = GATE_INTERRUPT;
+    gate->offset_mid = (offset >> 16) & 0xffff;
+    gate->offset_high = offset >> 32;
+    gate->reserved = 0;
+}
+
+/* 每个CPU启动时调用一次 */
+void load_idt(void)
+{
+    idt_flush((u64)&idt_descr);
+}
+
+/* BSP上在开中断之前调用 */
+void idt_setup(void)
+{
+    int i;
+
+    for (i = 0; i < 32; i++)
+        set_intr_gate(i, exception_stubs[i]);
+
+    for (i = 0; i < 16; i++)
+        set_intr_gate(FIRST_EXTERNAL_VECTOR + i, irq_stubs[i]);
+
+    idt_descr.base = (u64)idt_table;
+    load_idt();
+}
+
+/*
+ * 所有异常都走中断门，进来时中断是关的。缺页可能要等页锁、做回收，
+ * 刷TLB的on_each_cpu也不能关中断调用，所以出错处本来开着中断就重新
+ * 打开。cr2要在开中断之前读，嵌套的缺页会覆盖它。返回路径上有swapgs，
+ * 回到汇编之前再关上。
+ */
+static void page_fault(struct interrupt_frame *frame)
+{
+    ulong address;
+
+    asm volatile("movq %%cr2, %0" : "=r" (address));
+
+    if (frame->rflags & X86_EFLAGS_IF)
+        local_irq_enable();
+
+    do_page_fault(address, frame->error_code);
+
+    local_irq_disable();
+}
+
+/* isr_common_stub调用 */
+void isr_handler(struct interrupt_frame *frame)
+{
+    if (frame->vector == X86_TRAP_PF) {
+        page_fault(frame);
+        return;
+    }
+
+    handle_exception(frame->vector, frame->error_code);
+}
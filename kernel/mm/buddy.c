@@ -2,6 +2,20 @@
 #include "../../include/types.h"
 #include "../../include/list.h"
 #include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/bitops.h"
+#include "../../include/gfp.h"
+#include "../../include/page.h"
+#include "../../include/string.h"
+#include "../../include/compaction.h"
+#include "../../include/numa.h"
+#include "../../include/mempolicy.h"
+#include "../../include/swap.h"
+#include "../../include/vmstat.h"
+#include "../../include/memblock.h"
+#include "../../include/hash.h"
+#include "../../include/memcontrol.h"
+#include "internal.h"
 
 #define MAX_ORDER               11
 #define MIGRATE_UNMOVABLE       0
@@ -13,19 +27,29 @@
 #define MIGRATE_ISOLATE         5
 #define MIGRATE_TYPES           6
 
+#define PB_migrate              0
 #define PB_migrate_end          (PB_migrate + 3 - 1)
 #define PB_migrate_mask         ((1UL << (PB_migrate_end + 1)) - (1UL << PB_migrate))
 #define PB_migrate_skip         (PB_migrate + 3)
+#define NR_PAGEBLOCK_BITS       4
 
-static struct zone *zones[MAX_NR_ZONES];
+static int fallbacks[MIGRATE_TYPES][4] = {
+    [MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,   MIGRATE_TYPES },
+    [MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,   MIGRATE_TYPES },
+    [MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_TYPES },
+    [MIGRATE_CMA]         = { MIGRATE_TYPES }, /* Never used */
+    [MIGRATE_RESERVE]     = { MIGRATE_RESERVE }, /* Never used */
+    [MIGRATE_ISOLATE]     = { MIGRATE_TYPES }, /* Never used */
+};
+
+/* 每个节点最多MAX_NR_ZONES个区域 */
+#define MAX_ZONES           (MAX_NUMNODES * MAX_NR_ZONES)
+
+static struct zone *zones[MAX_ZONES];
 static int nr_zones = 0;
-static struct pglist_data *node_data[MAX_NUMNODES];
+struct pglist_data *node_data[MAX_NUMNODES];
 static int nr_nodes = 0;
 
-static ulong total_pages = 0;
-static ulong free_pages = 0;
-static ulong reserved_pages = 0;
-
 static spinlock_t zone_lock;
 
 void buddy_init(void)
@@ -34,7 +58,7 @@ void buddy_init(void)
 
     spin_lock_init(&zone_lock);
 
-    for (i = 0; i < MAX_NR_ZONES; i++) {
+    for (i = 0; i < MAX_ZONES; i++) {
         zones[i] = NULL;
     }
 
@@ -45,7 +69,87 @@ void buddy_init(void)
     printk("Buddy system initialized\n");
 }
 
-int init_zone(struct zone *zone, ulong start_pfn, ulong size)
+static ulong usemap_size(ulong zone_start_pfn, ulong zonesize)
+{
+    ulong nr_blocks;
+
+    zonesize += zone_start_pfn & (pageblock_nr_pages - 1);
+    nr_blocks = (zonesize + pageblock_nr_pages - 1) >> pageblock_order;
+
+    return BITS_TO_LONGS(nr_blocks * NR_PAGEBLOCK_BITS);
+}
+
+/* 区域在伙伴系统接管内存之前建立，页块位图从memblock分配 */
+static int setup_usemap(struct zone *zone)
+{
+    ulong longs = usemap_size(zone->zone_start_pfn, zone->spanned_pages);
+    ulong pfn;
+
+    zone->pageblock_flags = memblock_alloc_node(longs * sizeof(ulong),
+                                                sizeof(ulong),
+                                                zone->zone_pgdat->node_id);
+    if (!zone->pageblock_flags)
+        return -ENOMEM;
+
+    /* 初始内存全部按可移动分组，不可移动的分配再从中窃取页块 */
+    for (pfn = zone->zone_start_pfn; pfn < zone_end_pfn(zone);
+         pfn += pageblock_nr_pages)
+        __set_pfnblock_flags_mask(zone, pfn, MIGRATE_MOVABLE,
+                                  PB_migrate_mask);
+
+    return 0;
+}
+
+/*
+ * 页面等待表：等某页解锁或回写完成的进程按页地址散列到区域的一组
+ * 等待队列上，冲突的只是多唤醒几个进程，换来struct page省掉一个指针。
+ */
+#define PAGES_PER_WAITQUEUE     256
+#define WAIT_TABLE_MIN          4
+#define WAIT_TABLE_MAX          4096
+
+static ulong wait_table_hash_nr_entries(ulong pages)
+{
+    ulong size = 1;
+
+    pages /= PAGES_PER_WAITQUEUE;
+    while (size < pages)
+        size <<= 1;
+
+    return CLAMP(size, WAIT_TABLE_MIN, WAIT_TABLE_MAX);
+}
+
+static int zone_wait_table_init(struct zone *zone)
+{
+    ulong i;
+
+    zone->wait_table_hash_nr_entries = wait_table_hash_nr_entries(zone->spanned_pages);
+    zone->wait_table_bits = __ffs(zone->wait_table_hash_nr_entries);
+    zone->wait_table = memblock_alloc_node(zone->wait_table_hash_nr_entries *
+                                           sizeof(wait_queue_head_t),
+                                           sizeof(ulong),
+                                           zone->zone_pgdat->node_id);
+    if (!zone->wait_table)
+        return -ENOMEM;
+
+    for (i = 0; i < zone->wait_table_hash_nr_entries; i++)
+        init_waitqueue_head(&zone->wait_table[i]);
+
+    return 0;
+}
+
+wait_queue_head_t *page_waitqueue(struct page *page)
+{
+    struct zone *zone = page_zone(page);
+
+    return &zone->wait_table[hash_ptr(page, zone->wait_table_bits)];
+}
+
+/*
+ * managed_pages从0开始，由memblock_free_all交出内存时累加；水位和
+ * 每CPU批量都依赖它，交完后由setup_per_zone_wmarks重新计算。
+ */
+int init_zone(struct zone *zone, ulong start_pfn, ulong size, ulong present)
 {
     int order, migratetype;
     ulong flags;
@@ -55,8 +159,11 @@ int init_zone(struct zone *zone, ulong start_pfn, ulong size)
 
     zone->zone_start_pfn = start_pfn;
     zone->spanned_pages = size;
-    zone->present_pages = size;
-    zone->managed_pages = size;
+    zone->present_pages = present;
+    zone->managed_pages = 0;
+
+    if (setup_usemap(zone))
+        return -ENOMEM;
 
     spin_lock_init(&zone->lock);
     spin_lock_init(&zone->lru_lock);
@@ -68,18 +175,28 @@ int init_zone(struct zone *zone, ulong start_pfn, ulong size)
         zone->free_area[order].nr_free = 0;
     }
 
-    zone->watermark[WMARK_MIN] = size / 256;    /* 0.39% */
-    zone->watermark[WMARK_LOW] = size / 128;    /* 0.78% */
-    zone->watermark[WMARK_HIGH] = size / 64;    /* 1.56% */
+    for (migratetype = 0; migratetype < MIGRATE_TYPES; migratetype++)
+        zone->free_area_map[migratetype] = 0;
+
+    spin_lock_init(&zone->zero_lock);
+    for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++) {
+        INIT_LIST_HEAD(&zone->zero_list[migratetype]);
+        zone->nr_zeroed[migratetype] = 0;
+    }
+
+    zone->watermark[WMARK_MIN] = 0;
+    zone->watermark[WMARK_LOW] = 0;
+    zone->watermark[WMARK_HIGH] = 0;
 
-    zone->free_pages = 0;
     zone->pages_scanned = 0;
+    zone->percpu_drift_mark = 0;
 
     for (migratetype = 0; migratetype < NR_LRU_LISTS; migratetype++) {
         INIT_LIST_HEAD(&zone->lruvec.lists[migratetype]);
+        zone->lruvec.nr_pages[migratetype] = 0;
     }
 
-    zone->compact_cached_free_pfn = start_pfn;
+    zone->compact_cached_free_pfn = (start_pfn + size - 1) & ~(pageblock_nr_pages - 1);
     zone->compact_cached_migrate_pfn[0] = start_pfn;
     zone->compact_cached_migrate_pfn[1] = start_pfn;
     zone->compact_init_migrate_pfn = start_pfn;
@@ -89,12 +206,13 @@ int init_zone(struct zone *zone, ulong start_pfn, ulong size)
     zone->compact_defer_shift = 0;
     zone->compact_order_failed = -1;
 
-    zone->wait_table = NULL;
-    zone->wait_table_hash_nr_entries = 0;
-    zone->wait_table_bits = 0;
+    if (zone_wait_table_init(zone))
+        return -ENOMEM;
+
+    setup_zone_pageset(zone);
 
     spin_lock_irqsave(&zone_lock, flags);
-    if (nr_zones < MAX_NR_ZONES) {
+    if (nr_zones < MAX_ZONES) {
         zones[nr_zones++] = zone;
     }
     spin_unlock_irqrestore(&zone_lock, flags);
@@ -102,7 +220,74 @@ int init_zone(struct zone *zone, ulong start_pfn, ulong size)
     return 0;
 }
 
-static int get_order(ulong size)
+static int zone_batchsize(struct zone *zone)
+{
+    int batch;
+
+    /* 每批约为区域的千分之一，但不超过512KB */
+    batch = zone->managed_pages / 1024;
+    if (batch * PAGE_SIZE > 512 * 1024)
+        batch = (512 * 1024) / PAGE_SIZE;
+    batch /= 4;
+    if (batch < 1)
+        batch = 1;
+
+    return batch;
+}
+
+static void pageset_init(struct per_cpu_pages *pcp, int batch)
+{
+    int migratetype;
+
+    pcp->count = 0;
+    pcp->high = 6 * batch;
+    pcp->batch = batch;
+
+    for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
+        INIT_LIST_HEAD(&pcp->lists[migratetype]);
+}
+
+static void setup_zone_pageset(struct zone *zone)
+{
+    int batch = zone_batchsize(zone);
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        pageset_init(&zone->per_cpu_pageset[cpu], batch);
+}
+
+/* 只改批量和上限，链表上已缓存的页不动 */
+static void zone_pcp_update(struct zone *zone)
+{
+    int batch = zone_batchsize(zone);
+    struct per_cpu_pages *pcp;
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        pcp = &zone->per_cpu_pageset[cpu];
+        WRITE_ONCE(pcp->batch, batch);
+        WRITE_ONCE(pcp->high, 6 * batch);
+    }
+}
+
+/* 按交给伙伴系统的页数计算水位，内存交接完成或变化后调用 */
+void setup_per_zone_wmarks(void)
+{
+    struct zone *zone;
+    ulong managed;
+
+    for_each_zone(zone) {
+        managed = zone->managed_pages;
+
+        zone->watermark[WMARK_MIN] = managed / 256;    /* 0.39% */
+        zone->watermark[WMARK_LOW] = managed / 128;    /* 0.78% */
+        zone->watermark[WMARK_HIGH] = managed / 64;    /* 1.56% */
+
+        zone_pcp_update(zone);
+    }
+}
+
+int get_order(ulong size)
 {
     int order = 0;
 
@@ -115,12 +300,62 @@ static int get_order(ulong size)
     return order;
 }
 
-static int get_pageblock_migratetype(struct page *page)
+static inline ulong pfn_to_bitidx(struct zone *zone, ulong pfn)
+{
+    pfn -= zone->zone_start_pfn & ~(pageblock_nr_pages - 1);
+    return (pfn >> pageblock_order) * NR_PAGEBLOCK_BITS;
+}
+
+static ulong __get_pfnblock_flags_mask(struct zone *zone, ulong pfn,
+                                       ulong mask)
+{
+    ulong bitidx, word_bitidx;
+    ulong word;
+
+    bitidx = pfn_to_bitidx(zone, pfn);
+    word_bitidx = bitidx / BITS_PER_LONG;
+    bitidx &= (BITS_PER_LONG - 1);
+
+    word = READ_ONCE(zone->pageblock_flags[word_bitidx]);
+    return (word >> bitidx) & mask;
+}
+
+static void __set_pfnblock_flags_mask(struct zone *zone, ulong pfn,
+                                      ulong flags, ulong mask)
+{
+    ulong bitidx, word_bitidx;
+    ulong word, old_word;
+    ulong *bitmap = zone->pageblock_flags;
+
+    bitidx = pfn_to_bitidx(zone, pfn);
+    word_bitidx = bitidx / BITS_PER_LONG;
+    bitidx &= (BITS_PER_LONG - 1);
+
+    mask <<= bitidx;
+    flags <<= bitidx;
+
+    /* 同一个字里有其它页块的位，可能被无锁地修改(如压缩的skip位) */
+    word = READ_ONCE(bitmap[word_bitidx]);
+    for (;;) {
+        old_word = __sync_val_compare_and_swap(&bitmap[word_bitidx], word,
+                                               (word & ~mask) | flags);
+        if (word == old_word)
+            break;
+        word = old_word;
+    }
+}
+
+static int get_pfnblock_migratetype(struct page *page, ulong pfn)
+{
+    return __get_pfnblock_flags_mask(page_zone(page), pfn, PB_migrate_mask);
+}
+
+int get_pageblock_migratetype(struct page *page)
 {
     if (!page)
         return MIGRATE_UNMOVABLE;
 
-    return MIGRATE_UNMOVABLE;
+    return get_pfnblock_migratetype(page, page_to_pfn(page));
 }
 
 static void set_pageblock_migratetype(struct page *page, int migratetype)
@@ -128,6 +363,60 @@ static void set_pageblock_migratetype(struct page *page, int migratetype)
     if (!page)
         return;
 
+    if (unlikely(migratetype >= MIGRATE_TYPES))
+        migratetype = MIGRATE_UNMOVABLE;
+
+    __set_pfnblock_flags_mask(page_zone(page), page_to_pfn(page),
+                              migratetype, PB_migrate_mask);
+}
+
+bool get_pageblock_skip(struct page *page)
+{
+    return __get_pfnblock_flags_mask(page_zone(page), page_to_pfn(page),
+                                     1UL << PB_migrate_skip) != 0;
+}
+
+void set_pageblock_skip(struct page *page)
+{
+    __set_pfnblock_flags_mask(page_zone(page), page_to_pfn(page),
+                              1UL << PB_migrate_skip, 1UL << PB_migrate_skip);
+}
+
+void clear_pageblock_skip(struct page *page)
+{
+    __set_pfnblock_flags_mask(page_zone(page), page_to_pfn(page),
+                              0, 1UL << PB_migrate_skip);
+}
+
+static void change_pageblock_range(struct page *pageblock_page,
+                                   int start_order, int migratetype)
+{
+    int nr_pageblocks = 1 << (start_order - pageblock_order);
+
+    while (nr_pageblocks--) {
+        set_pageblock_migratetype(pageblock_page, migratetype);
+        pageblock_page += pageblock_nr_pages;
+    }
+}
+
+static inline int get_freepage_migratetype(struct page *page)
+{
+    return page->index;
+}
+
+static inline void set_freepage_migratetype(struct page *page, int migratetype)
+{
+    page->index = migratetype;
+}
+
+static inline int allocflags_to_migratetype(gfp_t gfp_flags)
+{
+    if (gfp_flags & __GFP_MOVABLE)
+        return MIGRATE_MOVABLE;
+    if (gfp_flags & __GFP_RECLAIMABLE)
+        return MIGRATE_RECLAIMABLE;
+
+    return MIGRATE_UNMOVABLE;
 }
 
 static struct page *get_buddy_page(struct page *page, unsigned int order)
@@ -168,9 +457,10 @@ static void __del_page_from_free_list(struct page *page, struct zone *zone,
     set_page_private(page, 0);
 
     list_del(&page->lru);
+    if (list_empty(&zone->free_area[order].free_list[migratetype]))
+        zone->free_area_map[migratetype] &= ~(1UL << order);
 
     zone->free_area[order].nr_free--;
-    zone->free_pages -= 1UL << order;
 }
 
 static void __add_page_to_free_list(struct page *page, struct zone *zone,
@@ -179,12 +469,13 @@ static void __add_page_to_free_list(struct page *page, struct zone *zone,
     struct free_area *area = &zone->free_area[order];
 
     list_add(&page->lru, &area->free_list[migratetype]);
+    zone->free_area_map[migratetype] |= 1UL << order;
+    set_freepage_migratetype(page, migratetype);
 
     __SetPageBuddy(page);
     set_page_private(page, order);
 
     area->nr_free++;
-    zone->free_pages += 1UL << order;
 }
 
 static void expand(struct zone *zone, struct page *page,
@@ -228,49 +519,121 @@ static struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
     unsigned int current_order;
     struct free_area *area;
     struct page *page;
+    ulong mask;
 
-    for (current_order = order; current_order < MAX_ORDER; current_order++) {
-        area = &zone->free_area[current_order];
+    /* 位图中 >= order 的最低置位位就是第一个可用的阶 */
+    mask = zone->free_area_map[migratetype] & ~((1UL << order) - 1);
+    if (!mask)
+        return NULL;
 
-        if (list_empty(&area->free_list[migratetype]))
-            continue;
+    current_order = __ffs(mask);
+    area = &zone->free_area[current_order];
 
-        page = list_first_entry(&area->free_list[migratetype],
-                               struct page, lru);
+    page = list_first_entry(&area->free_list[migratetype],
+                           struct page, lru);
 
-        __del_page_from_free_list(page, zone, current_order, migratetype);
+    __del_page_from_free_list(page, zone, current_order, migratetype);
 
-        expand(zone, page, order, current_order, area, migratetype);
+    expand(zone, page, order, current_order, area, migratetype);
 
-        set_freepage_migratetype(page, migratetype);
+    set_freepage_migratetype(page, migratetype);
 
-        return page;
+    return page;
+}
+
+static struct page *__rmqueue(struct zone *zone, unsigned int order,
+                              int migratetype)
+{
+    struct page *page;
+
+    page = __rmqueue_smallest(zone, order, migratetype);
+    if (unlikely(!page))
+        page = __rmqueue_fallback(zone, order, migratetype);
+
+    return page;
+}
+
+static int rmqueue_bulk(struct zone *zone, unsigned int order,
+                        ulong count, struct list_head *list,
+                        int migratetype)
+{
+    struct page *page;
+    ulong i;
+
+    spin_lock(&zone->lock);
+    for (i = 0; i < count; i++) {
+        page = __rmqueue(zone, order, migratetype);
+        if (unlikely(!page))
+            break;
+
+        list_add_tail(&page->lru, list);
     }
+    __mod_zone_page_state(zone, NR_FREE_PAGES, -(long)(i << order));
+    spin_unlock(&zone->lock);
 
-    return NULL;
+    return i;
 }
 
-static struct page *rmqueue(struct zone *zone, unsigned int order,
-                           gfp_t gfp_flags, int migratetype)
+static struct page *__rmqueue_pcplist(struct zone *zone, int migratetype,
+                                      struct per_cpu_pages *pcp,
+                                      struct list_head *list)
+{
+    struct page *page;
+
+    if (list_empty(list)) {
+        pcp->count += rmqueue_bulk(zone, 0, READ_ONCE(pcp->batch),
+                                   list, migratetype);
+        if (unlikely(list_empty(list)))
+            return NULL;
+    }
+
+    page = list_first_entry(list, struct page, lru);
+    list_del(&page->lru);
+    pcp->count--;
+
+    return page;
+}
+
+static struct page *rmqueue_pcplist(struct zone *zone, int migratetype)
 {
+    struct per_cpu_pages *pcp;
     struct page *page;
     ulong flags;
 
-    spin_lock_irqsave(&zone->lock, flags);
+    flags = local_irq_save();
+    pcp = &zone->per_cpu_pageset[smp_processor_id()];
+    page = __rmqueue_pcplist(zone, migratetype, pcp,
+                             &pcp->lists[migratetype]);
+    local_irq_restore(flags);
 
-    page = __rmqueue_smallest(zone, order, migratetype);
+    return page;
+}
 
-    if (!page) {
-        page = __rmqueue_fallback(zone, order, migratetype);
+static struct page *rmqueue(struct zone *zone, unsigned int order,
+                           gfp_t gfp_flags, int migratetype)
+{
+    struct page *page;
+    ulong flags;
+
+    /* 0阶请求优先走每CPU页面链表，不需要获取zone->lock */
+    if (likely(order == 0) && migratetype < MIGRATE_PCPTYPES) {
+        page = rmqueue_pcplist(zone, migratetype);
+        if (!page)
+            return NULL;
+        goto out;
     }
 
+    spin_lock_irqsave(&zone->lock, &flags);
+    page = __rmqueue(zone, order, migratetype);
+    if (page)
+        __mod_zone_page_state(zone, NR_FREE_PAGES, -(1 << order));
     spin_unlock_irqrestore(&zone->lock, flags);
 
-    if (page) {
-        prep_new_page(page, order, gfp_flags);
+    if (!page)
+        return NULL;
 
-        __mod_zone_page_state(zone, NR_FREE_PAGES, -(1 << order));
-    }
+out:
+    prep_new_page(page, order, gfp_flags);
 
     return page;
 }
@@ -283,17 +646,23 @@ static struct page *__rmqueue_fallback(struct zone *zone, unsigned int order,
     struct page *page;
     int fallback_mt;
     bool can_steal;
+    ulong mask = 0;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(fallbacks[0]); i++) {
+        fallback_mt = fallbacks[start_migratetype][i];
+        if (fallback_mt == MIGRATE_TYPES)
+            break;
+        mask |= zone->free_area_map[fallback_mt];
+    }
 
-    int fallbacks[MIGRATE_TYPES][4] = {
-        [MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,   MIGRATE_TYPES },
-        [MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,   MIGRATE_TYPES },
-        [MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_TYPES },
-        [MIGRATE_CMA]         = { MIGRATE_TYPES }, /* Never used */
-        [MIGRATE_RESERVE]     = { MIGRATE_RESERVE }, /* Never used */
-        [MIGRATE_ISOLATE]     = { MIGRATE_TYPES }, /* Never used */
-    };
+    mask &= ~((1UL << order) - 1);
+
+    /* 从最高阶开始窃取，尽量整块拿走以减少碎片 */
+    while (mask) {
+        current_order = __fls(mask);
+        mask &= ~(1UL << current_order);
 
-    for (current_order = MAX_ORDER - 1; current_order >= order; current_order--) {
         area = &zone->free_area[current_order];
         fallback_mt = find_suitable_fallback(area, current_order,
                                             start_migratetype, false, &can_steal);
@@ -305,13 +674,19 @@ static struct page *__rmqueue_fallback(struct zone *zone, unsigned int order,
 
         __del_page_from_free_list(page, zone, current_order, fallback_mt);
 
+        /*
+         * 窃取成功时剩余部分归入新类型；否则拆分出的伙伴留在
+         * 原页块类型的链表里，不污染其它页块。
+         */
         if (can_steal) {
-            steal_suitable_fallback(zone, page, start_migratetype);
+            steal_suitable_fallback(zone, page, current_order,
+                                    start_migratetype);
+            fallback_mt = start_migratetype;
         }
 
-        expand(zone, page, order, current_order, area, start_migratetype);
+        expand(zone, page, order, current_order, area, fallback_mt);
 
-        set_freepage_migratetype(page, start_migratetype);
+        set_freepage_migratetype(page, fallback_mt);
 
         return page;
     }
@@ -356,25 +731,63 @@ static bool can_steal_fallback(unsigned int order, int start_mt)
     if (order >= pageblock_order)
         return true;
 
-    if (start_mt == MIGRATE_MOVABLE)
+    /*
+     * 不可移动/可回收的分配积极地整块窃取，让它们集中在尽量少的
+     * 页块里；可移动分配只在拿到大块时才改换页块类型。
+     */
+    if (order >= pageblock_order / 2 ||
+        start_mt == MIGRATE_RECLAIMABLE ||
+        start_mt == MIGRATE_UNMOVABLE)
         return true;
 
     return false;
 }
 
 static void steal_suitable_fallback(struct zone *zone, struct page *page,
-                                   int start_type)
+                                   unsigned int current_order, int start_type)
 {
-    unsigned int current_order = page_order(page);
-    struct free_area *area;
+    int free_pages;
 
-    if (current_order < pageblock_order)
+    if (current_order >= pageblock_order) {
+        change_pageblock_range(page, current_order, start_type);
         return;
+    }
 
-    set_pageblock_migratetype(page, start_type);
+    free_pages = move_freepages_block(zone, page, start_type);
 
-    area = &zone->free_area[current_order];
-    move_freepages_block(zone, page, start_type);
+    /* 页块中一半以上已经空闲时，才把整个页块划给新类型 */
+    if (free_pages >= (1 << (pageblock_order - 1)))
+        set_pageblock_migratetype(page, start_type);
+}
+
+/*
+ * 把一个空闲块从伙伴系统中摘下来交给压缩做迁移目标，调用者持有zone->lock。
+ * 摘走后区域会低于最低水位时拒绝，以免压缩本身耗尽内存。
+ */
+ulong __isolate_free_page(struct page *page, unsigned int order)
+{
+    struct zone *zone = page_zone(page);
+    int mt;
+    struct page *endpage;
+
+    if (zone_page_state(zone, NR_FREE_PAGES) <
+        zone->watermark[WMARK_MIN] + (1UL << order))
+        return 0;
+
+    __del_page_from_free_list(page, zone, order, get_freepage_migratetype(page));
+    __mod_zone_page_state(zone, NR_FREE_PAGES, -(1 << order));
+
+    /* 整块拿走的页块迁入的是可移动页，页块类型随之改为可移动 */
+    if (order >= pageblock_order - 1) {
+        endpage = page + (1 << order) - 1;
+        for (; page < endpage; page += pageblock_nr_pages) {
+            mt = get_pageblock_migratetype(page);
+            if (mt != MIGRATE_ISOLATE && mt != MIGRATE_CMA)
+                set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+        }
+    }
+
+    return 1UL << order;
 }
 
 static int move_freepages_block(struct zone *zone, struct page *page,
@@ -427,7 +840,7 @@ static int move_freepages(struct zone *zone, struct page *start_page,
     return pages_moved;
 }
 
-static void prep_new_page(struct page *page, unsigned int order, gfp_t gfp_flags)
+void prep_new_page(struct page *page, unsigned int order, gfp_t gfp_flags)
 {
     int i;
 
@@ -438,13 +851,52 @@ static void prep_new_page(struct page *page, unsigned int order, gfp_t gfp_flags
 
         set_page_count(p, 1);
 
-        if (gfp_flags & __GFP_ZERO)
-            clear_page(p);
+        /* 来自预清零池的页面已经是零，不必再清 */
+        if ((gfp_flags & __GFP_ZERO) && !PageZeroed(p))
+            clear_page(page_address(p));
+        ClearPageZeroed(p);
 
         set_page_private(p, 0);
+    }
+
+    if (order && (gfp_flags & __GFP_COMP))
+        prep_compound_page(page, order);
+}
+
+static void prep_compound_page(struct page *page, unsigned int order)
+{
+    int i;
+    int nr_pages = 1 << order;
+
+    SetPageCompound(page);
+    SetPageHead(page);
+    page[1].private = (void *)(ulong)order;
+
+    for (i = 1; i < nr_pages; i++) {
+        struct page *p = page + i;
+
+        SetPageCompound(p);
+        SetPageTail(p);
+        p->first_page = page;
+    }
+}
+
+static void destroy_compound_page(struct page *page, unsigned int order)
+{
+    int i;
+    int nr_pages = 1 << order;
 
-        init_page_waiters(p);
+    for (i = 1; i < nr_pages; i++) {
+        struct page *p = page + i;
+
+        ClearPageTail(p);
+        ClearPageCompound(p);
+        p->first_page = NULL;
     }
+
+    page[1].private = NULL;
+    ClearPageHead(page);
+    ClearPageCompound(page);
 }
 
 static void clear_page_flags(struct page *page)
@@ -474,11 +926,21 @@ static void free_hot_cold_page(struct page *page, bool cold)
     if (!free_page_prepare(page, 0))
         return;
 
-    migratetype = get_freepage_migratetype(page);
+    migratetype = get_pfnblock_migratetype(page, page_to_pfn(page));
+    set_freepage_migratetype(page, migratetype);
 
     local_irq_save(flags);
     __count_vm_event(PGFREE);
 
+    /* 每CPU链表只缓存前MIGRATE_PCPTYPES种类型，其余直接还给伙伴系统 */
+    if (migratetype >= MIGRATE_PCPTYPES) {
+        if (unlikely(migratetype == MIGRATE_ISOLATE)) {
+            free_one_page(zone, page, page_to_pfn(page), 0, migratetype);
+            goto out;
+        }
+        migratetype = MIGRATE_MOVABLE;
+    }
+
     pcp = &zone->per_cpu_pageset[smp_processor_id()];
 
     if (cold)
@@ -488,15 +950,103 @@ static void free_hot_cold_page(struct page *page, bool cold)
 
     pcp->count++;
 
-    if (pcp->count >= pcp->high) {
-        ulong batch = READ_ONCE(pcp->batch);
-        free_pcppages_bulk(zone, batch, pcp);
-        pcp->count -= batch;
+    if (pcp->count >= pcp->high)
+        free_pcppages_bulk(zone, READ_ONCE(pcp->batch), pcp);
+
+out:
+    local_irq_restore(flags);
+}
+
+static void free_pcppages_bulk(struct zone *zone, int count,
+                               struct per_cpu_pages *pcp)
+{
+    int migratetype = 0;
+    int batch_free = 0;
+    int nr_freed = 0;
+    struct list_head *list;
+    struct page *page;
+
+    if (count > pcp->count)
+        count = pcp->count;
+
+    spin_lock(&zone->lock);
+
+    while (count) {
+        /* 在各迁移类型链表之间轮转，避免某一种类型被一次性清空 */
+        do {
+            batch_free++;
+            if (++migratetype == MIGRATE_PCPTYPES)
+                migratetype = 0;
+            list = &pcp->lists[migratetype];
+        } while (list_empty(list));
+
+        if (batch_free == MIGRATE_PCPTYPES)
+            batch_free = count;
+
+        do {
+            page = list_last_entry(list, struct page, lru);
+            list_del(&page->lru);
+            pcp->count--;
+
+            __free_one_page(page, page_to_pfn(page), zone, 0,
+                            get_freepage_migratetype(page));
+            nr_freed++;
+        } while (--count && --batch_free && !list_empty(list));
     }
 
+    __mod_zone_page_state(zone, NR_FREE_PAGES, nr_freed);
+
+    spin_unlock(&zone->lock);
+}
+
+static void drain_pages_zone(unsigned int cpu, struct zone *zone)
+{
+    struct per_cpu_pages *pcp;
+    ulong flags;
+
+    flags = local_irq_save();
+    pcp = &zone->per_cpu_pageset[cpu];
+    if (pcp->count)
+        free_pcppages_bulk(zone, pcp->count, pcp);
     local_irq_restore(flags);
 }
 
+void drain_local_pages(struct zone *zone)
+{
+    int cpu = smp_processor_id();
+    int i;
+
+    if (zone) {
+        drain_pages_zone(cpu, zone);
+        return;
+    }
+
+    for (i = 0; i < nr_zones; i++) {
+        if (zones[i])
+            drain_pages_zone(cpu, zones[i]);
+    }
+}
+
+/*
+ * 启动时把memblock中的空闲块交给伙伴系统。块内各页还是保留页、
+ * 引用计数为1，清掉之后按整块释放，一次就落到正确的阶上。
+ */
+void __free_pages_core(struct page *page, unsigned int order)
+{
+    ulong nr_pages = 1UL << order;
+    struct page *p = page;
+    ulong i;
+
+    for (i = 0; i < nr_pages; i++, p++) {
+        p->flags &= ~(1UL << PG_reserved);
+        set_page_count(p, 0);
+    }
+
+    page_zone(page)->managed_pages += nr_pages;
+    set_page_count(page, 1);
+    __free_pages(page, order);
+}
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
     ulong flags;
@@ -505,7 +1055,7 @@ static void __free_pages_ok(struct page *page, unsigned int order)
     if (!free_page_prepare(page, order))
         return;
 
-    migratetype = get_freepage_migratetype(page);
+    migratetype = get_pfnblock_migratetype(page, page_to_pfn(page));
 
     local_irq_save(flags);
     __count_vm_events(PGFREE, 1 << order);
@@ -519,7 +1069,126 @@ static void free_one_page(struct zone *zone, struct page *page,
 {
     spin_lock(&zone->lock);
     __free_one_page(page, pfn, zone, order, migratetype);
+    /* 隔离页块里的页分配不出去，不算空闲 */
+    if (migratetype != MIGRATE_ISOLATE)
+        __mod_zone_page_state(zone, NR_FREE_PAGES, 1 << order);
+    spin_unlock(&zone->lock);
+}
+
+static void free_zone_batch(struct zone *zone, struct list_head *list)
+{
+    struct page *page;
+    unsigned int order;
+    ulong flags;
+    ulong nr = 0;
+    ulong pfn;
+
+    flags = local_irq_save();
+    spin_lock(&zone->lock);
+
+    while (!list_empty(list)) {
+        page = list_first_entry(list, struct page, lru);
+        list_del(&page->lru);
+
+        order = page_private(page);
+        set_page_private(page, 0);
+
+        pfn = page_to_pfn(page);
+        __free_one_page(page, pfn, zone, order,
+                        get_pfnblock_migratetype(page, pfn));
+        nr += 1UL << order;
+    }
+
+    __mod_zone_page_state(zone, NR_FREE_PAGES, nr);
     spin_unlock(&zone->lock);
+
+    __count_vm_events(PGFREE, nr);
+    local_irq_restore(flags);
+}
+
+/*
+ * 批量释放引用计数已经归零的页面。先按区域分桶，每个区域只获取一次
+ * zone->lock，在同一次持锁中逐个与伙伴合并。页面不经过每CPU链表，
+ * 大批量释放时那只会反复触发free_pcppages_bulk。
+ */
+void free_pages_list(struct list_head *list)
+{
+    struct list_head batch[MAX_NR_ZONES];
+    struct zone *batch_zone[MAX_NR_ZONES];
+    struct page *page;
+    struct zone *zone;
+    int idx;
+
+    for (idx = 0; idx < MAX_NR_ZONES; idx++) {
+        INIT_LIST_HEAD(&batch[idx]);
+        batch_zone[idx] = NULL;
+    }
+
+    while (!list_empty(list)) {
+        page = list_first_entry(list, struct page, lru);
+        list_del(&page->lru);
+
+        if (!free_page_prepare(page, page_private(page)))
+            continue;
+
+        zone = page_zone(page);
+        idx = zone_idx(zone);
+
+        /* 同一下标的桶里是另一个节点的区域，先把它放掉 */
+        if (batch_zone[idx] && batch_zone[idx] != zone)
+            free_zone_batch(batch_zone[idx], &batch[idx]);
+
+        batch_zone[idx] = zone;
+        list_add_tail(&page->lru, &batch[idx]);
+    }
+
+    for (idx = 0; idx < MAX_NR_ZONES; idx++) {
+        if (batch_zone[idx])
+            free_zone_batch(batch_zone[idx], &batch[idx]);
+    }
+}
+
+/*
+ * 放掉一组页面的引用，归零的页面统一交给free_pages_list。
+ * 仍在LRU上的页面需要先摘下来，连续同区域的页面共用一次lru_lock。
+ */
+void release_pages(struct page **pages, int nr)
+{
+    struct list_head pages_to_free;
+    struct zone *lru_zone = NULL;
+    struct zone *zone;
+    struct page *page;
+    ulong flags;
+    int i;
+
+    INIT_LIST_HEAD(&pages_to_free);
+
+    for (i = 0; i < nr; i++) {
+        page = compound_head(pages[i]);
+
+        if (!put_page_testzero(page))
+            continue;
+
+        if (PageLRU(page)) {
+            zone = page_zone(page);
+            if (zone != lru_zone) {
+                if (lru_zone)
+                    spin_unlock_irqrestore(&lru_zone->lru_lock, flags);
+                lru_zone = zone;
+                spin_lock_irqsave(&zone->lru_lock, &flags);
+            }
+            del_page_from_lru_list(page, &zone->lruvec, page_lru(page));
+            ClearPageLRU(page);
+        }
+
+        set_page_private(page, compound_order(page));
+        list_add_tail(&page->lru, &pages_to_free);
+    }
+
+    if (lru_zone)
+        spin_unlock_irqrestore(&lru_zone->lru_lock, flags);
+
+    free_pages_list(&pages_to_free);
 }
 
 static void __free_one_page(struct page *page, ulong pfn,
@@ -569,6 +1238,11 @@ static bool free_page_prepare(struct page *page, unsigned int order)
 
     trace_mm_page_free(page, order);
 
+    if (compound)
+        destroy_compound_page(page, order);
+
+    memcg_uncharge_page(page, order);
+
     for (i = 0; i < (1 << order); i++) {
         struct page *pg = page + i;
 
@@ -624,29 +1298,420 @@ static int free_page_check(struct page *page)
     return 0;
 }
 
-struct page *alloc_pages(gfp_t gfp_mask, unsigned int order)
+/*
+ * 分配后区域空闲页仍高于水位加低端保留才算通过。高阶请求还要求
+ * order及以上的阶里确有空闲块，低阶的零碎页再多也拼不出来。
+ */
+static bool __zone_watermark_ok(struct zone *z, unsigned int order, ulong mark,
+                                int classzone_idx, long free_pages)
+{
+    long free = free_pages - (1 << order) + 1;
+    unsigned int o;
+
+    if (free <= (long)(mark + z->lowmem_reserve[classzone_idx]))
+        return false;
+
+    if (!order)
+        return true;
+
+    for (o = order; o < MAX_ORDER; o++) {
+        if (z->free_area[o].nr_free)
+            return true;
+    }
+
+    return false;
+}
+
+bool zone_watermark_ok(struct zone *z, unsigned int order, ulong mark,
+                       int classzone_idx)
+{
+    return __zone_watermark_ok(z, order, mark, classzone_idx,
+                               zone_page_state(z, NR_FREE_PAGES));
+}
+
+/*
+ * 空闲页低于percpu_drift_mark时，各CPU未折叠的差值可能足以让计数
+ * 越过水位，kswapd据此判断是否平衡时改用快照值。
+ */
+bool zone_watermark_ok_safe(struct zone *z, unsigned int order, ulong mark,
+                            int classzone_idx)
+{
+    long free_pages = zone_page_state(z, NR_FREE_PAGES);
+
+    if (z->percpu_drift_mark && free_pages < z->percpu_drift_mark)
+        free_pages = zone_page_state_snapshot(z, NR_FREE_PAGES);
+
+    return __zone_watermark_ok(z, order, mark, classzone_idx, free_pages);
+}
+
+/*
+ * 按首选区域记NUMA命中/未命中，按当前CPU所在节点记本地/远端。
+ * 由分配路径在关中断的上下文之外调用，用可重入的版本。
+ */
+static void zone_statistics(struct zone *preferred_zone, struct zone *z)
+{
+    int local_nid = numa_node_id();
+
+    if (zone_to_nid(z) == zone_to_nid(preferred_zone)) {
+        inc_numa_state(z, NUMA_HIT);
+    } else {
+        inc_numa_state(z, NUMA_MISS);
+        inc_numa_state(preferred_zone, NUMA_FOREIGN);
+    }
+
+    if (zone_to_nid(z) == local_nid)
+        inc_numa_state(z, NUMA_LOCAL);
+    else
+        inc_numa_state(z, NUMA_OTHER);
+}
+
+static struct page *zone_alloc_page(struct zone *zone, unsigned int order,
+                                    gfp_t gfp_mask, int migratetype)
+{
+    struct page *page;
+
+    /* 0阶清零请求优先从预清零页池取，分配路径上就不用再清页 */
+    if (order == 0 && (gfp_mask & __GFP_ZERO)) {
+        page = take_zeroed_page(zone, migratetype);
+        if (page) {
+            prep_new_page(page, 0, gfp_mask);
+            goto got_pg;
+        }
+    }
+
+    page = rmqueue(zone, order, gfp_mask, migratetype);
+    if (!page)
+        return NULL;
+
+got_pg:
+    count_vm_events(PGALLOC, 1 << order);
+
+    return page;
+}
+
+/* 按区域列表顺序(本节点在前，远端按距离在后)取第一个水位够的区域 */
+static struct page *get_page_from_freelist(gfp_t gfp_mask, unsigned int order,
+                                           int alloc_flags,
+                                           const struct alloc_context *ac)
 {
+    struct zoneref *z;
     struct zone *zone;
     struct page *page;
-    int migratetype = allocflags_to_migratetype(gfp_mask);
+    ulong mark;
+
+    for_each_zone_zonelist_nodemask(zone, z, ac->zonelist, ac->high_zoneidx,
+                                    ac->nodemask) {
+        mark = zone->watermark[alloc_flags & ALLOC_WMARK_MASK];
+        if (!zone_watermark_ok(zone, order, mark, ac->high_zoneidx)) {
+            /* 区域里还有没初始化的struct page，先就地扩展一段 */
+            if (deferred_grow_zone(zone, order))
+                goto try_this_zone;
+            continue;
+        }
 
-    zone = first_zones_zonelist(node_zonelist(0, gfp_mask),
-                               high_zoneidx(gfp_mask), NULL);
-    if (!zone)
+try_this_zone:
+        page = zone_alloc_page(zone, order, gfp_mask, ac->migratetype);
+        if (page) {
+            zone_statistics(ac->preferred_zoneref->zone, zone);
+            return page;
+        }
+
+        /* 水位够但凑不出这个阶，推迟的部分里有整块的空闲内存 */
+        if (deferred_grow_zone(zone, order))
+            goto try_this_zone;
+    }
+
+    return NULL;
+}
+
+/* 区域列表上每个节点的kswapd各唤醒一次 */
+static void wake_all_kswapds(unsigned int order, const struct alloc_context *ac)
+{
+    struct pglist_data *last_pgdat = NULL;
+    struct zoneref *z;
+    struct zone *zone;
+
+    for_each_zone_zonelist_nodemask(zone, z, ac->zonelist, ac->high_zoneidx,
+                                    ac->nodemask) {
+        if (zone->zone_pgdat == last_pgdat)
+            continue;
+        wakeup_kswapd(zone, order, ac->high_zoneidx);
+        last_pgdat = zone->zone_pgdat;
+    }
+}
+
+static struct page *__alloc_pages_slowpath(gfp_t gfp_mask, unsigned int order,
+                                           const struct alloc_context *ac)
+{
+    struct zoneref *z;
+    struct zone *zone;
+    struct page *page;
+    ulong drained = 0;
+
+    /* 已经低于低水位，让kswapd在后台回收到高水位 */
+    if (gfp_mask & __GFP_KSWAPD_RECLAIM)
+        wake_all_kswapds(order, ac);
+
+    /* 所有区域都低于低水位时，允许用到最低水位 */
+    page = get_page_from_freelist(gfp_mask, order, ALLOC_WMARK_MIN, ac);
+    if (page)
+        return page;
+
+    /*
+     * 高阶分配失败时，每CPU链表里的0阶页面可能正好挡住了合并；
+     * 预清零池里的页面同样是空闲内存，都先还给伙伴系统
+     */
+    for_each_zone_zonelist_nodemask(zone, z, ac->zonelist, ac->high_zoneidx,
+                                    ac->nodemask) {
+        if (order > 0)
+            drain_local_pages(zone);
+        drained += drain_zeroed_pages(zone);
+    }
+
+    if (order > 0 || drained) {
+        page = get_page_from_freelist(gfp_mask, order, ALLOC_WMARK_MIN, ac);
+        if (page)
+            return page;
+    }
+
+    /* kswapd跟不上时自己回收一批；回收路径里的分配不能再递归回收 */
+    if ((gfp_mask & __GFP_DIRECT_RECLAIM) && !(current->flags & PF_MEMALLOC)) {
+        count_vm_event(ALLOCSTALL);
+        if (try_to_free_pages(ac->zonelist, order, gfp_mask, ac->nodemask)) {
+            page = get_page_from_freelist(gfp_mask, order, ALLOC_WMARK_MIN, ac);
+            if (page)
+                return page;
+        }
+    }
+
+    if (!order)
         return NULL;
 
-    page = rmqueue(zone, order, gfp_mask, migratetype);
+    /* 仍然失败说明内存已碎片化，按距离逐个区域直接压缩后再试 */
+    for_each_zone_zonelist_nodemask(zone, z, ac->zonelist, ac->high_zoneidx,
+                                    ac->nodemask) {
+        if (try_to_compact_pages(zone, gfp_mask, order, ac->migratetype) != COMPACT_SUCCESS)
+            continue;
 
-    if (page) {
-        free_pages -= (1 << order);
+        page = zone_alloc_page(zone, order, gfp_mask, ac->migratetype);
+        if (page) {
+            compaction_defer_reset(zone, order, true);
+            count_vm_event(COMPACTSUCCESS);
+            return page;
+        }
+        count_vm_event(COMPACTFAIL);
+    }
+
+    /* 不能等待的分配交给首选节点的kcompactd在后台整理 */
+    z = first_zones_zonelist(ac->zonelist, ac->high_zoneidx, ac->nodemask);
+    if (z->zone)
+        wakeup_kcompactd(z->zone->zone_pgdat, order, zone_idx(z->zone));
+
+    return NULL;
+}
 
-        set_page_zone(page, zone_idx(zone));
-        set_page_node(page, zone_to_nid(zone));
+/*
+ * 页面从伙伴系统拿到之后的收尾，单页和批量分配共用。按__GFP_ACCOUNT
+ * 给当前组记账，组超限又回收不动时把页还回去，返回非0。
+ */
+static int post_alloc_hook(struct page *page, unsigned int order, gfp_t gfp_mask)
+{
+    if (unlikely(memcg_charge_page(page, gfp_mask, order))) {
+        __free_pages(page, order);
+        return -ENOMEM;
     }
 
+    return 0;
+}
+
+/*
+ * 分配的核心入口：从preferred_nid的区域列表开始，只用nodemask中的节点。
+ * 先按低水位走快速路径，失败后进入慢速路径。
+ */
+struct page *__alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
+                                    int preferred_nid, nodemask_t *nodemask)
+{
+    struct alloc_context ac;
+    struct page *page;
+
+    if (unlikely(order >= MAX_ORDER))
+        return NULL;
+
+    if (preferred_nid < 0 || preferred_nid >= MAX_NUMNODES ||
+        !NODE_DATA(preferred_nid))
+        preferred_nid = numa_node_id();
+
+    ac.zonelist = node_zonelist(preferred_nid, gfp_mask);
+    ac.nodemask = nodemask;
+    ac.high_zoneidx = gfp_zone(gfp_mask);
+    ac.migratetype = allocflags_to_migratetype(gfp_mask);
+    ac.preferred_zoneref = first_zones_zonelist(ac.zonelist, ac.high_zoneidx,
+                                                ac.nodemask);
+    if (!ac.preferred_zoneref->zone)
+        return NULL;
+
+    page = get_page_from_freelist(gfp_mask, order, ALLOC_WMARK_LOW, &ac);
+    if (unlikely(!page))
+        page = __alloc_pages_slowpath(gfp_mask, order, &ac);
+
+    if (page && post_alloc_hook(page, order, gfp_mask))
+        page = NULL;
+
+    return page;
+}
+
+/* 从指定区域分配，供需要按区域补充页面的后台线程使用 */
+struct page *alloc_pages_zone(struct zone *zone, gfp_t gfp_mask, unsigned int order)
+{
+    struct page *page;
+
+    page = rmqueue(zone, order, gfp_mask, allocflags_to_migratetype(gfp_mask));
+    if (!page)
+        return NULL;
+
+    count_vm_events(PGALLOC, 1 << order);
     return page;
 }
 
+struct zone *first_zone(void)
+{
+    return next_zone(NULL);
+}
+
+struct zone *next_zone(struct zone *zone)
+{
+    int i = 0;
+
+    if (zone) {
+        while (i < nr_zones && zones[i] != zone)
+            i++;
+        i++;
+    }
+
+    for (; i < nr_zones; i++) {
+        if (zones[i])
+            return zones[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * 一次分配nr_pages个0阶页面填入page_array，返回实际分配的个数。
+ * 要清零的页先从预清零池取，再取本CPU的每CPU链表，不够的部分在一次
+ * zone->lock持锁内从伙伴系统取。统计和记账和单页分配走同样的收尾，
+ * 记账失败时后面的页全部还回去，返回已记账的个数。
+ * 没有区域能在低水位之上放下整批时退回alloc_pages，由它负责压缩等
+ * 慢速路径，这种情况下至多返回一个页面。
+ */
+int alloc_pages_bulk(gfp_t gfp_mask, int nr_pages, struct page **page_array)
+{
+    struct mempolicy *pol;
+    struct zoneref *z;
+    struct zone *zone, *preferred_zone = NULL;
+    enum zone_type high_zoneidx;
+    int nid;
+    struct per_cpu_pages *pcp;
+    struct list_head *list;
+    struct page *page;
+    ulong flags;
+    int migratetype = allocflags_to_migratetype(gfp_mask);
+    int nr = 0;
+    int taken = 0;
+    int i;
+
+    if (nr_pages <= 0)
+        return 0;
+
+    /* 交错策略要求逐页轮转节点，只能一页一页地分 */
+    pol = get_task_policy(current);
+    if (pol->mode == MPOL_INTERLEAVE)
+        goto failed;
+
+    /* 整批都从区域列表中第一个低水位之上还放得下的区域取 */
+    nid = policy_node(gfp_mask, pol, numa_node_id());
+    high_zoneidx = gfp_zone(gfp_mask);
+    for_each_zone_zonelist_nodemask(zone, z, node_zonelist(nid, gfp_mask),
+                                    high_zoneidx, policy_nodemask(gfp_mask, pol)) {
+        if (!preferred_zone)
+            preferred_zone = zone;
+        if (zone_watermark_ok(zone, 0, zone->watermark[WMARK_LOW] + nr_pages,
+                              high_zoneidx))
+            break;
+    }
+    if (!zone)
+        goto failed;
+
+    /* 预清零池里的页已经是零，先用掉，后面就少清几页 */
+    if (gfp_mask & __GFP_ZERO) {
+        while (nr < nr_pages) {
+            page = take_zeroed_page(zone, migratetype);
+            if (!page)
+                break;
+            page_array[nr++] = page;
+        }
+    }
+
+    flags = local_irq_save();
+
+    if (migratetype < MIGRATE_PCPTYPES) {
+        pcp = &zone->per_cpu_pageset[smp_processor_id()];
+        list = &pcp->lists[migratetype];
+
+        while (nr < nr_pages && !list_empty(list)) {
+            page = list_first_entry(list, struct page, lru);
+            list_del(&page->lru);
+            pcp->count--;
+            page_array[nr++] = page;
+        }
+    }
+
+    if (nr < nr_pages) {
+        spin_lock(&zone->lock);
+        while (nr < nr_pages) {
+            page = __rmqueue(zone, 0, migratetype);
+            if (!page)
+                break;
+            page_array[nr++] = page;
+            taken++;
+        }
+        __mod_zone_page_state(zone, NR_FREE_PAGES, -taken);
+        spin_unlock(&zone->lock);
+    }
+
+    local_irq_restore(flags);
+
+    for (i = 0; i < nr; i++)
+        prep_new_page(page_array[i], 0, gfp_mask);
+    count_vm_events(PGALLOC, nr);
+
+    for (i = 0; i < nr; i++) {
+        zone_statistics(preferred_zone, zone);
+        if (post_alloc_hook(page_array[i], 0, gfp_mask))
+            break;
+    }
+
+    /* 第i页记账失败已经还掉了，后面还没记账的直接还 */
+    if (i < nr) {
+        int j;
+
+        for (j = i + 1; j < nr; j++)
+            __free_pages(page_array[j], 0);
+        return i;
+    }
+
+    if (nr)
+        return nr;
+
+failed:
+    page = alloc_pages(gfp_mask, 0);
+    if (!page)
+        return 0;
+
+    page_array[0] = page;
+    return 1;
+}
+
 struct page *alloc_page(gfp_t gfp_mask)
 {
     return alloc_pages(gfp_mask, 0);
@@ -686,10 +1751,17 @@ void free_page(ulong addr)
     free_pages(addr, 0);
 }
 
+/* sysinfo要的是准确数字，把各CPU未折叠的差值一并算上 */
 void si_meminfo(struct sysinfo *val)
 {
-    val->totalram = total_pages;
-    val->freeram = free_pages;
+    struct zone *zone;
+    ulong totalram = 0;
+
+    for_each_zone(zone)
+        totalram += zone->managed_pages;
+
+    val->totalram = totalram;
+    val->freeram = global_zone_page_state_snapshot(NR_FREE_PAGES);
     val->sharedram = 0;
     val->bufferram = 0;
     val->totalswap = 0;
@@ -713,10 +1785,11 @@ void show_mem(unsigned int filter)
             continue;
 
         total += zone->present_pages;
-        free += zone->free_pages;
+        free += zone_page_state_snapshot(zone, NR_FREE_PAGES);
         reserved += zone->present_pages - zone->managed_pages;
 
         printk("Zone %d: %lu pages, %lu free, %lu reserved\n",
-               i, zone->present_pages, zone->free_pages,
+               i, zone->present_pages,
+               zone_page_state_snapshot(zone, NR_FREE_PAGES),
                zone->present_pages - zone->managed_pages);
     }
@@ -0,0 +1,786 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/compaction.h"
+#include "../../include/page.h"
+#include "../../include/swap.h"
+#include "../../include/rmap.h"
+#include "internal.h"
+
+/*
+ * 内存压缩：迁移扫描器从区域起点向上收集可移动页，空闲扫描器从区域
+ * 末尾向下收集空闲页，把前者的内容搬到后者，从而在低地址处腾出连续的
+ * 空闲块。两个扫描器相遇时本轮结束，位置缓存在zone->compact_cached_*
+ * 中，下一次从上次停下的地方继续。
+ */
+
+void defer_compaction(struct zone *zone, int order)
+{
+    zone->compact_considered = 0;
+    zone->compact_defer_shift++;
+
+    if (order < zone->compact_order_failed)
+        zone->compact_order_failed = order;
+
+    if (zone->compact_defer_shift > COMPACT_MAX_DEFER_SHIFT)
+        zone->compact_defer_shift = COMPACT_MAX_DEFER_SHIFT;
+}
+
+bool compaction_deferred(struct zone *zone, int order)
+{
+    ulong defer_limit = 1UL << zone->compact_defer_shift;
+
+    if (order < zone->compact_order_failed)
+        return false;
+
+    if (++zone->compact_considered >= defer_limit) {
+        zone->compact_considered = defer_limit;
+        return false;
+    }
+
+    return true;
+}
+
+void compaction_defer_reset(struct zone *zone, int order, bool alloc_success)
+{
+    if (alloc_success) {
+        zone->compact_considered = 0;
+        zone->compact_defer_shift = 0;
+    }
+
+    if (order >= zone->compact_order_failed)
+        zone->compact_order_failed = order + 1;
+}
+
+/* 推迟已达上限且又到了该尝试的时候，说明skip位已经过时 */
+static bool compaction_restarting(struct zone *zone, int order)
+{
+    if (order < zone->compact_order_failed)
+        return false;
+
+    return zone->compact_defer_shift == COMPACT_MAX_DEFER_SHIFT &&
+           zone->compact_considered >= 1UL << zone->compact_defer_shift;
+}
+
+static void reset_cached_positions(struct zone *zone)
+{
+    zone->compact_cached_migrate_pfn[0] = zone->compact_init_migrate_pfn;
+    zone->compact_cached_migrate_pfn[1] = zone->compact_init_migrate_pfn;
+    zone->compact_cached_free_pfn =
+        pageblock_start_pfn(zone->compact_init_free_pfn - 1);
+}
+
+/*
+ * 推迟初始化还没做完时，first_deferred_pfn之后的struct page是垃圾，
+ * 按pfn扫描的地方都只能扫到这里为止
+ */
+static ulong compact_end_pfn(struct zone *zone)
+{
+    ulong first = READ_ONCE(zone->zone_pgdat->first_deferred_pfn);
+    ulong end = zone_end_pfn(zone);
+
+    if (first && first < end)
+        end = MAX(first, zone->zone_start_pfn);
+
+    return end;
+}
+
+/* 节点的struct page还没全部初始化，直接压缩和kcompactd都先不碰它 */
+static bool pgdat_deferred_pending(struct pglist_data *pgdat)
+{
+    return READ_ONCE(pgdat->first_deferred_pfn) != 0;
+}
+
+static void __reset_isolation_suitable(struct zone *zone)
+{
+    ulong end_pfn = compact_end_pfn(zone);
+    ulong pfn;
+
+    for (pfn = zone->zone_start_pfn; pfn < end_pfn;
+         pfn += pageblock_nr_pages)
+        clear_pageblock_skip(pfn_to_page(pfn));
+
+    reset_cached_positions(zone);
+}
+
+static void update_cached_migrate(struct compact_control *cc, ulong pfn)
+{
+    struct zone *zone = cc->zone;
+
+    if (pfn > zone->compact_cached_migrate_pfn[cc->sync])
+        zone->compact_cached_migrate_pfn[cc->sync] = pfn;
+    if (!cc->sync && pfn > zone->compact_cached_migrate_pfn[1])
+        zone->compact_cached_migrate_pfn[1] = pfn;
+}
+
+static void update_cached_free(struct compact_control *cc, ulong pfn)
+{
+    struct zone *zone = cc->zone;
+
+    if (pfn < zone->compact_cached_free_pfn)
+        zone->compact_cached_free_pfn = pfn;
+}
+
+static void putback_movable_pages(struct compact_control *cc)
+{
+    struct page *page;
+
+    while (!list_empty(&cc->migratepages)) {
+        page = list_entry(cc->migratepages.next, struct page, lru);
+        list_del(&page->lru);
+        putback_lru_page(page);
+    }
+    cc->nr_migratepages = 0;
+}
+
+static void release_freepages(struct compact_control *cc)
+{
+    struct page *page;
+
+    while (!list_empty(&cc->freepages)) {
+        page = list_entry(cc->freepages.next, struct page, lru);
+        list_del(&page->lru);
+        __free_pages(page, 0);
+    }
+    cc->nr_freepages = 0;
+}
+
+/* 异步压缩只从可移动页块中搬页，避免为此等待页锁 */
+static bool migrate_async_suitable(int migratetype)
+{
+    return migratetype == MIGRATE_MOVABLE;
+}
+
+/*
+ * 空闲页只从可移动(和CMA)页块中取，否则会把可移动页又撒进不可移动页块。
+ * 整个页块以上的空闲块正是压缩要凑出来的，不能拆了当目标。
+ */
+static bool suitable_migration_target(struct page *page)
+{
+    int mt;
+
+    if (PageBuddy(page) && page_order(page) >= pageblock_order)
+        return false;
+
+    mt = get_pageblock_migratetype(page);
+    return mt == MIGRATE_MOVABLE || mt == MIGRATE_CMA;
+}
+
+static ulong isolate_migratepages_block(struct compact_control *cc,
+                                        ulong low_pfn, ulong end_pfn)
+{
+    struct zone *zone = cc->zone;
+    struct page *page;
+    ulong flags;
+    ulong order;
+
+    spin_lock_irqsave(&zone->lru_lock, &flags);
+
+    for (; low_pfn < end_pfn; low_pfn++) {
+        if (cc->nr_migratepages >= COMPACT_CLUSTER_MAX)
+            break;
+
+        page = pfn_to_page(low_pfn);
+
+        /* 空闲块整体跳过；没有持zone->lock，阶数只作提示并做范围检查 */
+        if (PageBuddy(page)) {
+            order = page_order(page);
+            if (order > 0 && order < MAX_ORDER)
+                low_pfn += (1UL << order) - 1;
+            continue;
+        }
+
+        if (!PageLRU(page) || PageUnevictable(page))
+            continue;
+
+        /* 复合页(透明大页等)不在这里拆分迁移 */
+        if (PageCompound(page)) {
+            if (PageHead(page))
+                low_pfn += (1UL << compound_order(page)) - 1;
+            continue;
+        }
+
+        if (!get_page_unless_zero(page))
+            continue;
+
+        ClearPageLRU(page);
+        del_page_from_lru_list(page, &zone->lruvec, page_lru(page));
+        list_add(&page->lru, &cc->migratepages);
+        cc->nr_migratepages++;
+    }
+
+    spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+    return low_pfn;
+}
+
+static ulong isolate_migratepages(struct compact_control *cc)
+{
+    ulong end_pfn = compact_end_pfn(cc->zone);
+    ulong low_pfn, block_end_pfn;
+    struct page *page;
+
+    for (low_pfn = cc->migrate_pfn; low_pfn < cc->free_pfn;
+         low_pfn = block_end_pfn) {
+        block_end_pfn = pageblock_end_pfn(low_pfn);
+        if (block_end_pfn > end_pfn)
+            block_end_pfn = end_pfn;
+
+        page = pfn_to_page(pageblock_start_pfn(low_pfn));
+        if (get_pageblock_skip(page))
+            continue;
+
+        if (!cc->sync &&
+            !migrate_async_suitable(get_pageblock_migratetype(page)))
+            continue;
+
+        low_pfn = isolate_migratepages_block(cc, low_pfn, block_end_pfn);
+
+        /* 整个页块都没有可迁移的页，下次直接跳过 */
+        if (low_pfn == block_end_pfn && !cc->nr_migratepages)
+            set_pageblock_skip(page);
+
+        if (cc->nr_migratepages)
+            break;
+    }
+
+    cc->migrate_pfn = low_pfn;
+    update_cached_migrate(cc, low_pfn);
+
+    return cc->nr_migratepages;
+}
+
+static ulong isolate_freepages_block(struct compact_control *cc,
+                                     ulong start_pfn, ulong end_pfn)
+{
+    struct zone *zone = cc->zone;
+    struct page *page;
+    ulong flags;
+    ulong pfn, isolated, i;
+    ulong total = 0;
+    unsigned int order;
+
+    spin_lock_irqsave(&zone->lock, &flags);
+
+    for (pfn = start_pfn; pfn < end_pfn; pfn++) {
+        page = pfn_to_page(pfn);
+        if (!PageBuddy(page))
+            continue;
+
+        order = page_order(page);
+        isolated = __isolate_free_page(page, order);
+        if (!isolated)
+            break;
+
+        /* 拆成0阶页作为迁移目标 */
+        prep_new_page(page, order, 0);
+        for (i = 0; i < isolated; i++)
+            list_add_tail(&page[i].lru, &cc->freepages);
+
+        cc->nr_freepages += isolated;
+        total += isolated;
+        pfn += isolated - 1;
+    }
+
+    spin_unlock_irqrestore(&zone->lock, flags);
+
+    return total;
+}
+
+static void isolate_freepages(struct compact_control *cc)
+{
+    struct zone *zone = cc->zone;
+    ulong block_start_pfn = cc->free_pfn;
+    ulong block_end_pfn;
+    ulong low_pfn = pageblock_end_pfn(cc->migrate_pfn);
+    ulong end_pfn = compact_end_pfn(zone);
+    struct page *page;
+
+    while (block_start_pfn >= low_pfn) {
+        block_end_pfn = block_start_pfn + pageblock_nr_pages;
+        if (block_end_pfn > end_pfn)
+            block_end_pfn = end_pfn;
+
+        page = pfn_to_page(block_start_pfn);
+        if (!get_pageblock_skip(page) && suitable_migration_target(page)) {
+            if (!isolate_freepages_block(cc, block_start_pfn, block_end_pfn))
+                set_pageblock_skip(page);
+        }
+
+        /* 够用了就停在当前页块，下次从这里继续 */
+        if (cc->nr_freepages >= cc->nr_migratepages)
+            break;
+
+        /* 扫到区域起点，让compact_finished看到两个扫描器相遇 */
+        if (block_start_pfn < zone->zone_start_pfn + pageblock_nr_pages) {
+            block_start_pfn = zone->zone_start_pfn;
+            break;
+        }
+        block_start_pfn -= pageblock_nr_pages;
+    }
+
+    cc->free_pfn = block_start_pfn;
+    update_cached_free(cc, block_start_pfn);
+}
+
+static struct page *compaction_alloc(struct compact_control *cc)
+{
+    struct page *page;
+
+    if (list_empty(&cc->freepages)) {
+        isolate_freepages(cc);
+        if (list_empty(&cc->freepages))
+            return NULL;
+    }
+
+    page = list_entry(cc->freepages.next, struct page, lru);
+    list_del(&page->lru);
+    cc->nr_freepages--;
+
+    return page;
+}
+
+static void compaction_free(struct compact_control *cc, struct page *page)
+{
+    list_add(&page->lru, &cc->freepages);
+    cc->nr_freepages++;
+}
+
+/* 脏、活跃和不可回收状态转给新页，旧页释放时不能还带着 */
+static void migrate_page_states(struct page *newpage, struct page *page)
+{
+    if (PageUptodate(page))
+        SetPageUptodate(newpage);
+    if (PageDirty(page)) {
+        ClearPageDirty(page);
+        SetPageDirty(newpage);
+    }
+    if (PageReferenced(page))
+        SetPageReferenced(newpage);
+    if (PageActive(page)) {
+        ClearPageActive(page);
+        SetPageActive(newpage);
+    }
+    if (PageSwapBacked(page))
+        SetPageSwapBacked(newpage);
+    if (PageUnevictable(page)) {
+        ClearPageUnevictable(page);
+        SetPageUnevictable(newpage);
+    }
+
+    /* 账和账持的组引用跟着内容走，旧页释放时就不会再撤一次 */
+    newpage->mem_cgroup = page->mem_cgroup;
+    page->mem_cgroup = NULL;
+}
+
+/*
+ * 旧页的映射已经拆掉，这时只剩隔离时拿的引用，在交换缓存里的话再加
+ * 缓存的一个。引用数对得上就冻结成0，别人拿不到新引用，交换缓存里
+ * 换成新页；对不上说明还有人在用，放弃。调用者持两页的页锁。
+ */
+static int migrate_page_move_mapping(struct page *newpage, struct page *page)
+{
+    struct address_space *address_space;
+    swp_entry_t entry;
+    void **slot;
+    ulong flags;
+
+    /* 这里的LRU页都是匿名页，没有别的页缓存 */
+    if (page->mapping && !PageAnon(page))
+        return -EBUSY;
+
+    if (!PageSwapCache(page)) {
+        if (!page_ref_freeze(page, 1))
+            return -EAGAIN;
+        newpage->index = page->index;
+        newpage->mapping = page->mapping;
+        page_ref_unfreeze(page, 1);
+        return 0;
+    }
+
+    entry = page_swap_entry(page);
+    address_space = swap_address_space(entry);
+
+    spin_lock_irqsave(&address_space->tree_lock, &flags);
+
+    slot = radix_tree_lookup_slot(&address_space->page_tree, swp_offset(entry));
+    if (!slot || *slot != page || !page_ref_freeze(page, 2)) {
+        spin_unlock_irqrestore(&address_space->tree_lock, flags);
+        return -EAGAIN;
+    }
+
+    newpage->index = page->index;
+    newpage->mapping = page->mapping;
+
+    /* 交换缓存的引用和槽位转给新页 */
+    get_page(newpage);
+    SetPageSwapCache(newpage);
+    set_page_private(newpage, entry.val);
+    radix_tree_replace_slot(&address_space->page_tree, slot, newpage);
+
+    ClearPageSwapCache(page);
+    set_page_private(page, 0);
+    page_ref_unfreeze(page, 1);
+
+    spin_unlock_irqrestore(&address_space->tree_lock, flags);
+
+    return 0;
+}
+
+/*
+ * 先把映射旧页的页表项换成迁移项，访问者在缺页里等旧页的页锁；
+ * 冻结引用确认没人在用后转移交换缓存、拷贝内容，再把迁移项换成新页。
+ * 中途放弃时迁移项换回旧页。
+ */
+static int migrate_one_page(struct compact_control *cc,
+                            struct page *newpage, struct page *page)
+{
+    int rc = -EAGAIN;
+
+    if (!trylock_page(page)) {
+        if (!cc->sync)
+            return -EAGAIN;
+        lock_page(page);
+    }
+
+    if (PageWriteback(page))
+        goto out_unlock;
+
+    /* 新页刚分配，别人还看不到，直接加锁；放进交换缓存后要等拷贝完才能用 */
+    SetPageLocked(newpage);
+
+    if (page_mapped(page)) {
+        try_to_unmap(page, TTU_MIGRATION);
+        if (page_mapped(page)) {
+            remove_migration_ptes(page, page);
+            goto out_unlock_new;
+        }
+    }
+
+    rc = migrate_page_move_mapping(newpage, page);
+    if (rc) {
+        remove_migration_ptes(page, page);
+        goto out_unlock_new;
+    }
+
+    copy_page(page_address(newpage), page_address(page));
+    migrate_page_states(newpage, page);
+    remove_migration_ptes(page, newpage);
+
+out_unlock_new:
+    unlock_page(newpage);
+out_unlock:
+    unlock_page(page);
+    return rc;
+}
+
+static int compact_migrate_pages(struct compact_control *cc)
+{
+    struct page *page, *newpage;
+    int nr_failed = 0;
+
+    while (!list_empty(&cc->migratepages)) {
+        newpage = compaction_alloc(cc);
+        if (!newpage)
+            return -ENOMEM;
+
+        page = list_entry(cc->migratepages.next, struct page, lru);
+        list_del(&page->lru);
+        cc->nr_migratepages--;
+
+        if (migrate_one_page(cc, newpage, page) == 0) {
+            /*
+             * 页表项和交换缓存的引用已经转到新页，新页放回LRU时放掉
+             * 分配时的引用；旧页只剩隔离引用，放掉后回到伙伴系统
+             */
+            putback_lru_page(newpage);
+            put_page(page);
+        } else {
+            compaction_free(cc, newpage);
+            putback_lru_page(page);
+            nr_failed++;
+        }
+    }
+
+    return nr_failed;
+}
+
+static enum compact_result compact_finished(struct compact_control *cc)
+{
+    struct zone *zone = cc->zone;
+    ulong mask;
+    int mt;
+
+    if (cc->free_pfn <= cc->migrate_pfn) {
+        reset_cached_positions(zone);
+        return COMPACT_COMPLETE;
+    }
+
+    /* kcompactd的整区压缩一直做到扫描器相遇 */
+    if (cc->order == -1)
+        return COMPACT_CONTINUE;
+
+    if (zone_page_state(zone, NR_FREE_PAGES) <
+        zone->watermark[WMARK_LOW] + (1UL << cc->order))
+        return COMPACT_CONTINUE;
+
+    mask = ~((1UL << cc->order) - 1);
+    if (zone->free_area_map[cc->migratetype] & mask)
+        return COMPACT_SUCCESS;
+
+    /* 整个页块大小的空闲块可以被__rmqueue_fallback整块认领 */
+    mask = ~((1UL << pageblock_order) - 1);
+    for (mt = 0; mt < MIGRATE_PCPTYPES; mt++) {
+        if (zone->free_area_map[mt] & mask)
+            return COMPACT_SUCCESS;
+    }
+
+    return COMPACT_CONTINUE;
+}
+
+static bool compaction_suitable(struct zone *zone, int order)
+{
+    ulong mask = ~((1UL << order) - 1);
+    int mt;
+
+    for (mt = 0; mt < MIGRATE_PCPTYPES; mt++) {
+        if (zone->free_area_map[mt] & mask)
+            return false;
+    }
+
+    /* 迁移需要临时占用目标页，空闲页太少时压缩没有意义 */
+    return zone_page_state(zone, NR_FREE_PAGES) >=
+           zone->watermark[WMARK_LOW] + (2UL << order);
+}
+
+static enum compact_result compact_zone(struct compact_control *cc)
+{
+    struct zone *zone = cc->zone;
+    ulong start_pfn = zone->zone_start_pfn;
+    ulong end_pfn = compact_end_pfn(zone);
+    enum compact_result ret;
+
+    if (end_pfn <= start_pfn)
+        return COMPACT_SKIPPED;
+
+    if (compaction_restarting(zone, cc->order))
+        __reset_isolation_suitable(zone);
+
+    cc->migrate_pfn = zone->compact_cached_migrate_pfn[cc->sync];
+    cc->free_pfn = zone->compact_cached_free_pfn;
+    if (cc->free_pfn < start_pfn || cc->free_pfn >= end_pfn) {
+        cc->free_pfn = pageblock_start_pfn(end_pfn - 1);
+        zone->compact_cached_free_pfn = cc->free_pfn;
+    }
+    if (cc->migrate_pfn < start_pfn || cc->migrate_pfn >= end_pfn) {
+        cc->migrate_pfn = start_pfn;
+        zone->compact_cached_migrate_pfn[0] = start_pfn;
+        zone->compact_cached_migrate_pfn[1] = start_pfn;
+    }
+    cc->whole_zone = cc->migrate_pfn == start_pfn;
+
+    while ((ret = compact_finished(cc)) == COMPACT_CONTINUE) {
+        if (!isolate_migratepages(cc))
+            continue;
+
+        /* 找不到目标页说明空闲扫描器已经追上迁移扫描器 */
+        if (compact_migrate_pages(cc) < 0) {
+            putback_movable_pages(cc);
+            ret = COMPACT_COMPLETE;
+            reset_cached_positions(zone);
+            break;
+        }
+        putback_movable_pages(cc);
+    }
+
+    release_freepages(cc);
+
+    return ret;
+}
+
+enum compact_result try_to_compact_pages(struct zone *zone, gfp_t gfp_mask,
+                                         unsigned int order, int migratetype)
+{
+    struct compact_control cc;
+    enum compact_result ret;
+
+    if (!order || !(gfp_mask & __GFP_DIRECT_RECLAIM) || !(gfp_mask & __GFP_IO))
+        return COMPACT_SKIPPED;
+
+    if (pgdat_deferred_pending(zone->zone_pgdat))
+        return COMPACT_SKIPPED;
+
+    if (compaction_deferred(zone, order))
+        return COMPACT_DEFERRED;
+
+    if (!compaction_suitable(zone, order))
+        return COMPACT_SKIPPED;
+
+    count_vm_event(COMPACTSTALL);
+
+    INIT_LIST_HEAD(&cc.freepages);
+    INIT_LIST_HEAD(&cc.migratepages);
+    cc.nr_freepages = 0;
+    cc.nr_migratepages = 0;
+    cc.zone = zone;
+    cc.gfp_mask = gfp_mask;
+    cc.order = order;
+    cc.migratetype = migratetype;
+
+    /* 先做不等页锁的异步压缩，不够再同步压缩 */
+    cc.sync = false;
+    ret = compact_zone(&cc);
+    if (ret != COMPACT_SUCCESS && !(gfp_mask & __GFP_NORETRY)) {
+        cc.sync = true;
+        ret = compact_zone(&cc);
+    }
+
+    if (ret == COMPACT_COMPLETE)
+        defer_compaction(zone, order);
+
+    return ret;
+}
+
+static bool kcompactd_node_suitable(struct pglist_data *pgdat)
+{
+    struct zone *zone;
+    int zoneid;
+
+    if (pgdat_deferred_pending(pgdat))
+        return false;
+
+    for (zoneid = 0; zoneid <= pgdat->kcompactd_classzone_idx; zoneid++) {
+        zone = &pgdat->node_zones[zoneid];
+        if (!zone->present_pages)
+            continue;
+
+        if (compaction_suitable(zone, pgdat->kcompactd_max_order))
+            return true;
+    }
+
+    return false;
+}
+
+static bool kcompactd_work_requested(struct pglist_data *pgdat)
+{
+    return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+static void kcompactd_do_work(struct pglist_data *pgdat)
+{
+    struct compact_control cc;
+    struct zone *zone;
+    enum compact_result status;
+    int classzone_idx = pgdat->kcompactd_classzone_idx;
+    int zoneid;
+
+    /*
+     * 唤醒时推迟初始化可能还没做完。请求要清掉，否则kcompactd会一直
+     * 空转；做完之后分配再失败会重新唤醒。
+     */
+    if (pgdat_deferred_pending(pgdat)) {
+        pgdat->kcompactd_max_order = 0;
+        pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+        return;
+    }
+
+    INIT_LIST_HEAD(&cc.freepages);
+    INIT_LIST_HEAD(&cc.migratepages);
+    cc.nr_freepages = 0;
+    cc.nr_migratepages = 0;
+    cc.gfp_mask = GFP_KERNEL;
+    cc.order = pgdat->kcompactd_max_order;
+    cc.migratetype = MIGRATE_MOVABLE;
+    cc.sync = true;
+
+    for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+        zone = &pgdat->node_zones[zoneid];
+        if (!zone->present_pages)
+            continue;
+
+        if (compaction_deferred(zone, cc.order))
+            continue;
+
+        if (!compaction_suitable(zone, cc.order))
+            continue;
+
+        cc.zone = zone;
+        status = compact_zone(&cc);
+
+        if (status == COMPACT_SUCCESS)
+            compaction_defer_reset(zone, cc.order, false);
+        else if (status == COMPACT_COMPLETE)
+            defer_compaction(zone, cc.order);
+
+        if (kthread_should_stop())
+            return;
+    }
+
+    /* 处理期间有更高阶的唤醒则保留，否则清零等待下一次唤醒 */
+    if (pgdat->kcompactd_max_order <= cc.order)
+        pgdat->kcompactd_max_order = 0;
+    if (pgdat->kcompactd_classzone_idx >= classzone_idx)
+        pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+}
+
+void wakeup_kcompactd(struct pglist_data *pgdat, int order, int classzone_idx)
+{
+    if (!order || !pgdat)
+        return;
+
+    if (pgdat->kcompactd_max_order < order)
+        pgdat->kcompactd_max_order = order;
+
+    if (pgdat->kcompactd_classzone_idx > classzone_idx)
+        pgdat->kcompactd_classzone_idx = classzone_idx;
+
+    if (!waitqueue_active(&pgdat->kcompactd_wait))
+        return;
+
+    if (!kcompactd_node_suitable(pgdat))
+        return;
+
+    wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+static int kcompactd(void *p)
+{
+    struct pglist_data *pgdat = p;
+
+    pgdat->kcompactd_max_order = 0;
+    pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(pgdat->kcompactd_wait,
+                                 kcompactd_work_requested(pgdat));
+        kcompactd_do_work(pgdat);
+    }
+
+    return 0;
+}
+
+int kcompactd_run(int nid)
+{
+    struct pglist_data *pgdat = NODE_DATA(nid);
+
+    if (!pgdat || pgdat->kcompactd)
+        return 0;
+
+    pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+    if (IS_ERR(pgdat->kcompactd)) {
+        pgdat->kcompactd = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+void kcompactd_init(void)
+{
+    int nid;
+
+    for_each_online_node(nid)
+        kcompactd_run(nid);
+}
@@ -0,0 +1,172 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/bitops.h"
+#include "internal.h"
+
+/*
+ * 页面位等待：等PG_locked或PG_writeback清除的进程挂在page_waitqueue()
+ * 散列出的区域等待队列上，同一队列里可能混着别的页、别的位的等待者，
+ * 所以唤醒时带上(页, 位)作key逐个比对。
+ *
+ * 有人等待时页面置PG_waiters，解锁和回写结束只在该位置位时才去查表；
+ * 唤醒后队列里已没有本页的等待者时再把它清掉。
+ *
+ * 等锁的进程是独占等待者，一次解锁只唤醒一个，避免惊群；等回写的
+ * 进程不需要持有什么，全部唤醒。
+ */
+
+struct wait_page_key {
+    struct page *page;
+    int bit_nr;
+    int page_match;                 /* 队列里还有本页的等待者 */
+};
+
+struct wait_page_queue {
+    struct page *page;
+    int bit_nr;
+    wait_queue_entry_t wait;
+};
+
+static int wake_page_function(wait_queue_entry_t *wait, unsigned int mode,
+                              int sync, void *arg)
+{
+    struct wait_page_key *key = arg;
+    struct wait_page_queue *wait_page =
+        container_of(wait, struct wait_page_queue, wait);
+
+    if (wait_page->page != key->page)
+        return 0;
+    key->page_match = 1;
+
+    if (wait_page->bit_nr != key->bit_nr)
+        return 0;
+
+    /* 唤醒前位又被别人置上了，独占等待者醒来也拿不到，换下一个 */
+    if (test_bit(key->bit_nr, &key->page->flags))
+        return 0;
+
+    wait->flags |= WQ_FLAG_WOKEN;
+    wake_up_process(wait->data);
+    list_del_init(&wait->task_list);
+
+    return 1;
+}
+
+static void wake_up_page_bit(struct page *page, int bit_nr)
+{
+    wait_queue_head_t *q = page_waitqueue(page);
+    struct wait_page_key key;
+    wait_queue_entry_t *curr, *next;
+    ulong flags;
+
+    key.page = page;
+    key.bit_nr = bit_nr;
+    key.page_match = 0;
+
+    spin_lock_irqsave(&q->lock, &flags);
+    list_for_each_entry_safe(curr, next, &q->task_list, task_list) {
+        int exclusive = curr->flags & WQ_FLAG_EXCLUSIVE;
+
+        if (curr->func(curr, TASK_NORMAL, 0, &key) && exclusive)
+            break;
+    }
+
+    /*
+     * 没遇到本页的其它等待者才能清PG_waiters。提前break时后面可能还有，
+     * page_match已经置上，保守地留着，代价只是下次解锁多查一次表。
+     */
+    if (list_empty(&q->task_list) || !key.page_match)
+        ClearPageWaiters(page);
+    spin_unlock_irqrestore(&q->lock, flags);
+}
+
+static void wake_up_page(struct page *page, int bit)
+{
+    if (!PageWaiters(page))
+        return;
+    wake_up_page_bit(page, bit);
+}
+
+static void wait_on_page_bit_common(struct page *page, int bit_nr, int lock)
+{
+    wait_queue_head_t *q = page_waitqueue(page);
+    struct wait_page_queue wait_page;
+    wait_queue_entry_t *wait = &wait_page.wait;
+
+    wait_page.page = page;
+    wait_page.bit_nr = bit_nr;
+    wait->flags = lock ? WQ_FLAG_EXCLUSIVE : 0;
+    wait->private = 0;
+    wait->func = wake_page_function;
+    wait->data = current;
+    INIT_LIST_HEAD(&wait->task_list);
+
+    for (;;) {
+        spin_lock_irq(&q->lock);
+
+        if (list_empty(&wait->task_list)) {
+            if (lock)
+                list_add_tail(&wait->task_list, &q->task_list);
+            else
+                list_add(&wait->task_list, &q->task_list);
+            /* 在队列锁内置位，唤醒方看到位清了就一定能在队列里找到我们 */
+            SetPageWaiters(page);
+        }
+
+        current->state = TASK_UNINTERRUPRIBLE;
+        spin_unlock_irq(&q->lock);
+
+        if (test_bit(bit_nr, &page->flags))
+            schedule();
+
+        if (lock) {
+            if (!test_and_set_bit_lock(bit_nr, &page->flags))
+                break;
+        } else {
+            if (!test_bit(bit_nr, &page->flags))
+                break;
+        }
+    }
+
+    current->state = TASK_RUNNING;
+
+    spin_lock_irq(&q->lock);
+    if (!list_empty(&wait->task_list))
+        list_del_init(&wait->task_list);
+    spin_unlock_irq(&q->lock);
+}
+
+void wait_on_page_bit(struct page *page, int bit_nr)
+{
+    wait_on_page_bit_common(page, bit_nr, 0);
+}
+
+void __lock_page(struct page *page)
+{
+    wait_on_page_bit_common(compound_head(page), PG_locked, 1);
+}
+
+/*
+ * PG_waiters与PG_locked在同一字节且是该字节最高位，一条lock andb
+ * 清锁的同时就知道有没有等待者，无竞争的解锁不碰等待表。
+ */
+void unlock_page(struct page *page)
+{
+    page = compound_head(page);
+    VM_BUG_ON_PAGE(!PageLocked(page), page);
+    if (clear_bit_unlock_is_negative_byte(PG_locked, &page->flags))
+        wake_up_page_bit(page, PG_locked);
+}
+
+void end_page_writeback(struct page *page)
+{
+    if (PageReclaim(page))
+        ClearPageReclaim(page);
+
+    ClearPageWriteback(page);
+    smp_mb__after_atomic();
+    wake_up_page(page, PG_writeback);
+}
@@ -0,0 +1,103 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/gfp.h"
+#include "../../include/page.h"
+#include "../../include/pgtable.h"
+#include "../../include/huge_mm.h"
+#include "../../include/mempolicy.h"
+#include "../../include/swap.h"
+#include "../../include/rmap.h"
+#include "internal.h"
+
+/*
+ * 透明大页：匿名区域在PMD为空时直接分配9阶复合页并装一个2MB的PMD，
+ * 一次缺页就覆盖512个小页，也只占一个TLB项。拿不到9阶块或区域边界
+ * 没有按2MB对齐时返回VM_FAULT_FALLBACK，由调用者按4KB处理。
+ */
+
+enum transparent_hugepage_mode transparent_hugepage_mode = TRANSPARENT_HUGEPAGE_ALWAYS;
+
+bool transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_NOHUGEPAGE)
+        return false;
+
+    if (!vma_is_anonymous(vma))
+        return false;
+
+    if (vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_IO | VM_MIXEDMAP | VM_SHARED))
+        return false;
+
+    switch (transparent_hugepage_mode) {
+    case TRANSPARENT_HUGEPAGE_ALWAYS:
+        return true;
+    case TRANSPARENT_HUGEPAGE_MADVISE:
+        return (vma->vm_flags & VM_HUGEPAGE) != 0;
+    default:
+        return false;
+    }
+}
+
+/*
+ * 明确要求大页的区域允许直接压缩，其它区域只拿现成的9阶块，
+ * 免得每次缺页都为一个可有可无的大页付出压缩的延迟。
+ */
+static gfp_t thp_gfp_mask(struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_HUGEPAGE)
+        return GFP_TRANSHUGE;
+
+    return GFP_TRANSHUGE_LIGHT;
+}
+
+static void clear_huge_page(struct page *page)
+{
+    ulong i;
+
+    for (i = 0; i < HPAGE_PMD_NR; i++) {
+        clear_page(page_address(page + i));
+        cond_resched();
+    }
+}
+
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+                               ulong address, pmd_t *pmd, unsigned int flags)
+{
+    ulong haddr = address & HPAGE_PMD_MASK;
+    struct page *page;
+    pmd_t entry;
+
+    if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+        return VM_FAULT_FALLBACK;
+
+    page = alloc_pages_vma(thp_gfp_mask(vma) | __GFP_ACCOUNT, HPAGE_PMD_ORDER,
+                           vma, haddr);
+    if (unlikely(!page)) {
+        count_vm_event(THP_FAULT_FALLBACK);
+        return VM_FAULT_FALLBACK;
+    }
+
+    clear_huge_page(page);
+
+    entry = mk_huge_pmd(page, vm_get_page_prot(vma->vm_flags));
+    if (vma->vm_flags & VM_WRITE)
+        entry = pmd_mkwrite(pmd_mkdirty(entry));
+
+    spin_lock(&mm->page_table_lock);
+    if (unlikely(!pmd_none(*pmd))) {
+        spin_unlock(&mm->page_table_lock);
+        __free_pages(page, HPAGE_PMD_ORDER);
+        return 0;
+    }
+
+    page_add_new_anon_rmap(page, vma, haddr);
+    lru_cache_add(page);
+    set_pmd(pmd, entry);
+    spin_unlock(&mm->page_table_lock);
+
+    count_vm_event(THP_FAULT_ALLOC);
+
+    return 0;
+}
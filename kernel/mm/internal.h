@@ -0,0 +1,142 @@
+#ifndef __MM_INTERNAL_H__
+#define __MM_INTERNAL_H__
+
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/numa.h"
+#include "../../include/vmstat.h"
+
+/* 伙伴分配器与压缩等mm内部模块共享的接口，不对mm以外开放 */
+
+struct compact_control {
+    struct list_head freepages;     /* 已隔离的空闲目标页 */
+    struct list_head migratepages;  /* 已隔离的待迁移页 */
+    ulong nr_freepages;             /* 空闲目标页数 */
+    ulong nr_migratepages;          /* 待迁移页数 */
+    ulong free_pfn;                 /* 空闲扫描器位置(向下) */
+    ulong migrate_pfn;              /* 迁移扫描器位置(向上) */
+    struct zone *zone;              /* 被压缩的区域 */
+    gfp_t gfp_mask;                 /* 触发压缩的分配标志 */
+    int order;                      /* 目标阶数，-1表示整区压缩 */
+    int migratetype;                /* 目标迁移类型 */
+    bool sync;                      /* 是否允许阻塞等待页锁 */
+    bool whole_zone;                /* 本轮从区域起点开始扫描 */
+};
+
+static inline ulong zone_end_pfn(const struct zone *zone)
+{
+    return zone->zone_start_pfn + zone->spanned_pages;
+}
+
+static inline ulong pageblock_start_pfn(ulong pfn)
+{
+    return pfn & ~(pageblock_nr_pages - 1);
+}
+
+static inline ulong pageblock_end_pfn(ulong pfn)
+{
+    return pageblock_start_pfn(pfn) + pageblock_nr_pages;
+}
+
+static inline enum lru_list page_lru(struct page *page)
+{
+    enum lru_list lru;
+
+    if (PageUnevictable(page))
+        return LRU_UNEVICTABLE;
+
+    lru = PageSwapBacked(page) ? LRU_INACTIVE_ANON : LRU_INACTIVE_FILE;
+    if (PageActive(page))
+        lru += LRU_ACTIVE;
+
+    return lru;
+}
+
+static inline bool is_file_lru(enum lru_list lru)
+{
+    return lru == LRU_INACTIVE_FILE || lru == LRU_ACTIVE_FILE;
+}
+
+static inline ulong hpage_nr_pages(struct page *page)
+{
+    return 1UL << compound_order(page);
+}
+
+/* 链表长度同时计入区域和节点的LRU统计，调用者已关中断 */
+static inline void update_lru_size(struct lruvec *lruvec, struct zone *zone,
+                                   enum lru_list lru, long nr_pages)
+{
+    lruvec->nr_pages[lru] += nr_pages;
+    __mod_zone_page_state(zone, NR_ZONE_LRU_BASE + lru, nr_pages);
+    __mod_node_page_state(zone->zone_pgdat, NR_LRU_BASE + lru, nr_pages);
+}
+
+/* LRU链表增删，调用者持zone->lru_lock */
+static inline void add_page_to_lru_list(struct page *page, struct lruvec *lruvec,
+                                        enum lru_list lru)
+{
+    list_add(&page->lru, &lruvec->lists[lru]);
+    update_lru_size(lruvec, page_zone(page), lru, hpage_nr_pages(page));
+}
+
+static inline void del_page_from_lru_list(struct page *page, struct lruvec *lruvec,
+                                          enum lru_list lru)
+{
+    list_del(&page->lru);
+    update_lru_size(lruvec, page_zone(page), lru, -hpage_nr_pages(page));
+}
+
+/* 一次分配在快慢路径间共享的参数 */
+struct alloc_context {
+    struct zonelist *zonelist;      /* 首选节点的区域列表 */
+    nodemask_t *nodemask;           /* 允许的节点，NULL表示不限 */
+    enum zone_type high_zoneidx;    /* 可用的最高区域 */
+    int migratetype;
+    struct zoneref *preferred_zoneref; /* 首选区域，NUMA命中统计以它为准 */
+};
+
+/* get_page_from_freelist的水位选择 */
+#define ALLOC_WMARK_MIN     WMARK_MIN
+#define ALLOC_WMARK_LOW     WMARK_LOW
+#define ALLOC_WMARK_HIGH    WMARK_HIGH
+#define ALLOC_WMARK_MASK    (ALLOC_WMARK_MIN | ALLOC_WMARK_LOW | ALLOC_WMARK_HIGH)
+
+/* 遍历所有已注册的区域 */
+#define for_each_zone(zone) \
+    for (zone = first_zone(); zone; zone = next_zone(zone))
+
+/* buddy.c */
+extern int get_order(ulong size);
+extern int init_zone(struct zone *zone, ulong start_pfn, ulong size,
+                     ulong present);
+extern void setup_per_zone_wmarks(void);
+extern void __free_pages_core(struct page *page, unsigned int order);
+extern bool zone_watermark_ok(struct zone *z, unsigned int order, ulong mark,
+                              int classzone_idx);
+extern bool zone_watermark_ok_safe(struct zone *z, unsigned int order, ulong mark,
+                                   int classzone_idx);
+extern struct zone *first_zone(void);
+extern struct zone *next_zone(struct zone *zone);
+extern struct page *alloc_pages_zone(struct zone *zone, gfp_t gfp_mask,
+                                     unsigned int order);
+extern void prep_new_page(struct page *page, unsigned int order, gfp_t gfp_flags);
+extern int get_pageblock_migratetype(struct page *page);
+extern ulong __isolate_free_page(struct page *page, unsigned int order);
+extern bool get_pageblock_skip(struct page *page);
+extern void set_pageblock_skip(struct page *page);
+extern void clear_pageblock_skip(struct page *page);
+
+/* page_zero.c */
+extern struct page *take_zeroed_page(struct zone *zone, int migratetype);
+extern ulong drain_zeroed_pages(struct zone *zone);
+
+/* memblock.c */
+extern ulong __free_pages_memory(ulong start, ulong end);
+
+/* mm_init.c */
+extern void memmap_init_zone(struct zone *zone);
+extern ulong deferred_pfn_limit(ulong pfn);
+extern bool deferred_grow_zone(struct zone *zone, unsigned int order);
+
+#endif /* __MM_INTERNAL_H__ */
@@ -0,0 +1,529 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/string.h"
+#include "../../include/bitops.h"
+#include "../../include/numa.h"
+#include "../../include/memblock.h"
+#include "internal.h"
+
+/*
+ * 两张表都按基址排好序且互不重叠，相邻且属于同一节点的区间随时合并。
+ * 表是静态数组，启动早期没有别的地方可以要内存，条目用完就报错。
+ */
+
+#define PHYS_ADDR_MAX       (~(phys_addr_t)0)
+
+static struct memblock_region memblock_memory_init_regions[INIT_MEMBLOCK_REGIONS];
+static struct memblock_region memblock_reserved_init_regions[INIT_MEMBLOCK_REGIONS];
+
+struct memblock memblock = {
+    .memory.regions     = memblock_memory_init_regions,
+    .memory.cnt         = 1,    /* 空表也有一个哑区间 */
+    .memory.max         = INIT_MEMBLOCK_REGIONS,
+    .memory.name        = "memory",
+
+    .reserved.regions   = memblock_reserved_init_regions,
+    .reserved.cnt       = 1,
+    .reserved.max       = INIT_MEMBLOCK_REGIONS,
+    .reserved.name      = "reserved",
+
+    .current_limit      = MEMBLOCK_LOW_LIMIT,
+};
+
+/* 防止base + size回绕 */
+static inline phys_addr_t memblock_cap_size(phys_addr_t base, phys_addr_t *size)
+{
+    return *size = MIN(*size, PHYS_ADDR_MAX - base);
+}
+
+static void memblock_remove_region(struct memblock_type *type, ulong r)
+{
+    type->total_size -= type->regions[r].size;
+    memmove(&type->regions[r], &type->regions[r + 1],
+            (type->cnt - (r + 1)) * sizeof(type->regions[r]));
+    type->cnt--;
+
+    if (type->cnt == 0) {
+        type->cnt = 1;
+        type->regions[0].base = 0;
+        type->regions[0].size = 0;
+        type->regions[0].nid = NUMA_NO_NODE;
+    }
+}
+
+static void memblock_merge_regions(struct memblock_type *type)
+{
+    ulong i = 0;
+
+    while (i < type->cnt - 1) {
+        struct memblock_region *this = &type->regions[i];
+        struct memblock_region *next = &type->regions[i + 1];
+
+        if (this->base + this->size != next->base || this->nid != next->nid) {
+            i++;
+            continue;
+        }
+
+        this->size += next->size;
+        memmove(next, next + 1, (type->cnt - (i + 2)) * sizeof(*next));
+        type->cnt--;
+    }
+}
+
+static int memblock_insert_region(struct memblock_type *type, ulong idx,
+                                  phys_addr_t base, phys_addr_t size, int nid)
+{
+    struct memblock_region *rgn = &type->regions[idx];
+
+    if (type->cnt >= type->max) {
+        printk("memblock: %s table full, dropping [%#llx-%#llx]\n",
+               type->name, base, base + size - 1);
+        return -ENOMEM;
+    }
+
+    memmove(rgn + 1, rgn, (type->cnt - idx) * sizeof(*rgn));
+    rgn->base = base;
+    rgn->size = size;
+    rgn->nid = nid;
+    type->cnt++;
+    type->total_size += size;
+
+    return 0;
+}
+
+/* 只插入与已有区间不重叠的部分，再合并相邻区间 */
+static int memblock_add_range(struct memblock_type *type, phys_addr_t base,
+                              phys_addr_t size, int nid)
+{
+    phys_addr_t end = base + memblock_cap_size(base, &size);
+    struct memblock_region *rgn;
+    ulong idx;
+    int ret = 0;
+
+    if (!size)
+        return 0;
+
+    if (type->regions[0].size == 0) {
+        type->regions[0].base = base;
+        type->regions[0].size = size;
+        type->regions[0].nid = nid;
+        type->total_size = size;
+        return 0;
+    }
+
+    for (idx = 0; idx < type->cnt; idx++) {
+        phys_addr_t rbase, rend;
+
+        rgn = &type->regions[idx];
+        rbase = rgn->base;
+        rend = rbase + rgn->size;
+
+        if (rbase >= end)
+            break;
+        if (rend <= base)
+            continue;
+
+        if (rbase > base) {
+            ret = memblock_insert_region(type, idx++, base, rbase - base, nid);
+            if (ret)
+                break;
+        }
+        base = MIN(rend, end);
+    }
+
+    if (!ret && base < end)
+        ret = memblock_insert_region(type, idx, base, end - base, nid);
+
+    memblock_merge_regions(type);
+    return ret;
+}
+
+/*
+ * 把[base, base + size)两端所在的区间切开，让它恰好由若干完整区间
+ * 组成，返回这些区间的下标范围[*start_rgn, *end_rgn)。
+ */
+static int memblock_isolate_range(struct memblock_type *type, phys_addr_t base,
+                                  phys_addr_t size, ulong *start_rgn,
+                                  ulong *end_rgn)
+{
+    phys_addr_t end = base + memblock_cap_size(base, &size);
+    struct memblock_region *rgn;
+    ulong idx;
+
+    *start_rgn = *end_rgn = 0;
+
+    if (!size)
+        return 0;
+
+    for (idx = 0; idx < type->cnt; idx++) {
+        phys_addr_t rbase, rend;
+
+        rgn = &type->regions[idx];
+        rbase = rgn->base;
+        rend = rbase + rgn->size;
+
+        if (rbase >= end)
+            break;
+        if (rend <= base)
+            continue;
+
+        if (rbase < base) {
+            /* 左端跨过base：切下左半，右半下一轮再看 */
+            rgn->base = base;
+            rgn->size -= base - rbase;
+            type->total_size -= base - rbase;
+            if (memblock_insert_region(type, idx, rbase, base - rbase, rgn->nid))
+                return -ENOMEM;
+        } else if (rend > end) {
+            /* 右端跨过end：切下左半，再处理一次这个左半 */
+            rgn->base = end;
+            rgn->size -= end - rbase;
+            type->total_size -= end - rbase;
+            if (memblock_insert_region(type, idx--, rbase, end - rbase, rgn->nid))
+                return -ENOMEM;
+        } else {
+            if (!*end_rgn)
+                *start_rgn = idx;
+            *end_rgn = idx + 1;
+        }
+    }
+
+    return 0;
+}
+
+static int memblock_remove_range(struct memblock_type *type,
+                                 phys_addr_t base, phys_addr_t size)
+{
+    ulong start_rgn, end_rgn;
+    int i, ret;
+
+    ret = memblock_isolate_range(type, base, size, &start_rgn, &end_rgn);
+    if (ret)
+        return ret;
+
+    for (i = end_rgn - 1; i >= (int)start_rgn; i--)
+        memblock_remove_region(type, i);
+
+    return 0;
+}
+
+int memblock_add_node(phys_addr_t base, phys_addr_t size, int nid)
+{
+    return memblock_add_range(&memblock.memory, base, size, nid);
+}
+
+int memblock_add(phys_addr_t base, phys_addr_t size)
+{
+    return memblock_add_range(&memblock.memory, base, size, NUMA_NO_NODE);
+}
+
+int memblock_remove(phys_addr_t base, phys_addr_t size)
+{
+    return memblock_remove_range(&memblock.memory, base, size);
+}
+
+int memblock_reserve(phys_addr_t base, phys_addr_t size)
+{
+    return memblock_add_range(&memblock.reserved, base, size, NUMA_NO_NODE);
+}
+
+int memblock_free(phys_addr_t base, phys_addr_t size)
+{
+    return memblock_remove_range(&memblock.reserved, base, size);
+}
+
+/* 节点信息来自SRAT，在区间表建好之后才知道，回头补到memory表上 */
+int memblock_set_node(phys_addr_t base, phys_addr_t size, int nid)
+{
+    struct memblock_type *type = &memblock.memory;
+    ulong start_rgn, end_rgn;
+    ulong i;
+    int ret;
+
+    ret = memblock_isolate_range(type, base, size, &start_rgn, &end_rgn);
+    if (ret)
+        return ret;
+
+    for (i = start_rgn; i < end_rgn; i++)
+        type->regions[i].nid = nid;
+
+    memblock_merge_regions(type);
+    return 0;
+}
+
+/*
+ * 同时走memory表和reserved表之间的空隙，输出两者的交集。*idx低32位
+ * 是memory下标，高32位是空隙下标；第k个空隙是reserved第k-1个区间
+ * 结束到第k个区间开始之间。
+ */
+void __next_free_mem_range(u64 *idx, int nid, phys_addr_t *out_start,
+                           phys_addr_t *out_end)
+{
+    struct memblock_type *type_a = &memblock.memory;
+    struct memblock_type *type_b = &memblock.reserved;
+    ulong idx_a = *idx & 0xffffffff;
+    ulong idx_b = *idx >> 32;
+
+    for (; idx_a < type_a->cnt; idx_a++) {
+        struct memblock_region *m = &type_a->regions[idx_a];
+        phys_addr_t m_start = m->base;
+        phys_addr_t m_end = m->base + m->size;
+
+        if (!m->size)
+            continue;
+        if (nid != NUMA_NO_NODE && nid != m->nid)
+            continue;
+
+        for (; idx_b < type_b->cnt + 1; idx_b++) {
+            struct memblock_region *r = &type_b->regions[idx_b];
+            phys_addr_t r_start = idx_b ? r[-1].base + r[-1].size : 0;
+            phys_addr_t r_end = idx_b < type_b->cnt ? r->base : PHYS_ADDR_MAX;
+
+            if (r_start >= m_end)
+                break;
+
+            if (m_start < r_end) {
+                *out_start = MAX(m_start, r_start);
+                *out_end = MIN(m_end, r_end);
+
+                /* 谁先结束谁前进 */
+                if (m_end <= r_end)
+                    idx_a++;
+                else
+                    idx_b++;
+                *idx = (u32)idx_a | (u64)idx_b << 32;
+                return;
+            }
+        }
+    }
+
+    *idx = MEMBLOCK_ITER_END;
+}
+
+/* 自顶向下找：低端内存留给只能用DMA/DMA32区域的分配 */
+static phys_addr_t memblock_find_in_range(phys_addr_t size, phys_addr_t align,
+                                          phys_addr_t start, phys_addr_t end,
+                                          int nid)
+{
+    phys_addr_t this_start, this_end, cand;
+    phys_addr_t found = 0;
+    u64 i;
+
+    for_each_free_mem_range(i, nid, &this_start, &this_end) {
+        this_start = MAX(this_start, start);
+        this_end = MIN(this_end, end);
+
+        if (this_end < size)
+            continue;
+
+        cand = (this_end - size) & ~(align - 1);
+        if (cand >= this_start && cand >= found)
+            found = cand;
+    }
+
+    return found;
+}
+
+phys_addr_t memblock_phys_alloc_range(phys_addr_t size, phys_addr_t align,
+                                      phys_addr_t start, phys_addr_t end, int nid)
+{
+    phys_addr_t found;
+
+    if (!align)
+        align = PAGE_SIZE;
+
+    /* 0号页已保留，0同时用作失败返回值 */
+    start = MAX(start, (phys_addr_t)PAGE_SIZE);
+    end = MIN(end, memblock.current_limit);
+
+    if (start >= end)
+        return 0;
+
+    found = memblock_find_in_range(size, align, start, end, nid);
+    if (!found || memblock_reserve(found, size))
+        return 0;
+
+    return found;
+}
+
+phys_addr_t memblock_phys_alloc(phys_addr_t size, phys_addr_t align)
+{
+    return memblock_phys_alloc_range(size, align, 0, PHYS_ADDR_MAX, NUMA_NO_NODE);
+}
+
+/* 优先从nid分配，节点上没有就退到任意节点；内容不清零 */
+void *memblock_alloc_try_nid_raw(phys_addr_t size, phys_addr_t align, int nid)
+{
+    phys_addr_t phys;
+
+    phys = memblock_phys_alloc_range(size, align, 0, PHYS_ADDR_MAX, nid);
+    if (!phys && nid != NUMA_NO_NODE)
+        phys = memblock_phys_alloc_range(size, align, 0, PHYS_ADDR_MAX,
+                                         NUMA_NO_NODE);
+    if (!phys)
+        return NULL;
+
+    return __va(phys);
+}
+
+void *memblock_alloc_try_nid(phys_addr_t size, phys_addr_t align, int nid)
+{
+    void *ptr = memblock_alloc_try_nid_raw(size, align, nid);
+
+    if (ptr)
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void *memblock_alloc_raw(phys_addr_t size, phys_addr_t align)
+{
+    return memblock_alloc_try_nid_raw(size, align, NUMA_NO_NODE);
+}
+
+void *memblock_alloc(phys_addr_t size, phys_addr_t align)
+{
+    return memblock_alloc_try_nid(size, align, NUMA_NO_NODE);
+}
+
+void *memblock_alloc_node(phys_addr_t size, phys_addr_t align, int nid)
+{
+    return memblock_alloc_try_nid(size, align, nid);
+}
+
+phys_addr_t memblock_start_of_DRAM(void)
+{
+    return memblock.memory.regions[0].base;
+}
+
+phys_addr_t memblock_end_of_DRAM(void)
+{
+    ulong idx = memblock.memory.cnt - 1;
+
+    return memblock.memory.regions[idx].base + memblock.memory.regions[idx].size;
+}
+
+phys_addr_t memblock_phys_mem_size(void)
+{
+    return memblock.memory.total_size;
+}
+
+phys_addr_t memblock_reserved_size(void)
+{
+    return memblock.reserved.total_size;
+}
+
+/* [start_pfn, end_pfn)中实际存在的页数，不含空洞 */
+ulong memblock_present_pages(ulong start_pfn, ulong end_pfn)
+{
+    struct memblock_region *reg;
+    ulong nr = 0;
+    ulong s, e;
+
+    for_each_memblock(memory, reg) {
+        s = MAX(memblock_region_memory_base_pfn(reg), start_pfn);
+        e = MIN(memblock_region_memory_end_pfn(reg), end_pfn);
+        if (s < e)
+            nr += e - s;
+    }
+
+    return nr;
+}
+
+bool memblock_is_memory(phys_addr_t addr)
+{
+    struct memblock_type *type = &memblock.memory;
+    ulong left = 0, right = type->cnt;
+
+    while (left < right) {
+        ulong mid = (left + right) / 2;
+        struct memblock_region *rgn = &type->regions[mid];
+
+        if (addr < rgn->base)
+            right = mid;
+        else if (addr >= rgn->base + rgn->size)
+            left = mid + 1;
+        else
+            return true;
+    }
+
+    return false;
+}
+
+void memblock_set_current_limit(phys_addr_t limit)
+{
+    memblock.current_limit = limit;
+}
+
+/*
+ * 以尽可能大的对齐块释放[start, end)：每块的阶同时受起点对齐和剩余
+ * 长度限制，最多MAX_ORDER - 1。一段连续内存只需要约
+ * 长度 / 4MB + 2 * MAX_ORDER 次释放，而不是逐页释放再逐级合并。
+ */
+ulong __free_pages_memory(ulong start, ulong end)
+{
+    ulong count = 0;
+    int order;
+
+    while (start < end) {
+        order = start ? MIN(MAX_ORDER - 1, (int)__ffs(start)) : MAX_ORDER - 1;
+
+        while (start + (1UL << order) > end)
+            order--;
+
+        __free_pages_core(pfn_to_page(start), order);
+
+        count += 1UL << order;
+        start += 1UL << order;
+    }
+
+    return count;
+}
+
+/*
+ * 伙伴系统的区域都建好后调用，把所有未保留的内存交出去。空闲区间
+ * 取自memory表的单个区间，不会跨节点；区域边界16MB和4GB都按最大阶
+ * 对齐，块也不会跨区域。推迟初始化的部分留给各节点的初始化线程。
+ */
+ulong memblock_free_all(void)
+{
+    phys_addr_t start, end;
+    ulong spfn, epfn;
+    ulong pages = 0;
+    u64 i;
+
+    for_each_free_mem_range(i, NUMA_NO_NODE, &start, &end) {
+        spfn = PFN_UP(start);
+        epfn = MIN(PFN_DOWN(end), deferred_pfn_limit(spfn));
+        pages += __free_pages_memory(spfn, epfn);
+    }
+
+    return pages;
+}
+
+static void memblock_dump(struct memblock_type *type)
+{
+    struct memblock_region *rgn;
+    ulong idx;
+
+    printk(" %s.cnt  = 0x%lx\n", type->name, type->cnt);
+
+    for (idx = 0; idx < type->cnt; idx++) {
+        rgn = &type->regions[idx];
+        if (!rgn->size)
+            continue;
+        printk(" %s[%#lx]\t[%#016llx-%#016llx], %#llx bytes on node %d\n",
+               type->name, idx, rgn->base, rgn->base + rgn->size - 1,
+               rgn->size, rgn->nid);
+    }
+}
+
+void memblock_dump_all(void)
+{
+    printk("MEMBLOCK configuration:\n");
+    printk(" memory size = %#llx reserved size = %#llx\n",
+           memblock.memory.total_size, memblock.reserved.total_size);
+
+    memblock_dump(&memblock.memory);
+    memblock_dump(&memblock.reserved);
+}
@@ -0,0 +1,578 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/slab.h"
+#include "../../include/swap.h"
+#include "../../include/smp.h"
+#include "../../include/memcontrol.h"
+#include "internal.h"
+
+#if CONFIG_MEMCG
+
+struct mem_cgroup root_mem_cgroup;
+
+/* 保护组的父子链表和dead标志，建组、删组和按id查组时拿 */
+static DEFINE_SPINLOCK(memcg_tree_lock);
+static int memcg_next_id = 1;
+
+/*
+ * 每CPU预扣额度：cached组在本CPU上还有nr_pages页已记账但没用掉。
+ * 只有所属CPU在关中断时才能动，cached持组的一个引用。
+ */
+struct memcg_stock_pcp {
+    struct mem_cgroup *cached;
+    unsigned int nr_pages;
+};
+
+static struct memcg_stock_pcp memcg_stock[NR_CPUS];
+
+static void page_counter_init(struct page_counter *counter,
+                              struct page_counter *parent)
+{
+    atomic_long_set(&counter->usage, 0);
+    counter->max = PAGE_COUNTER_MAX;
+    counter->watermark = 0;
+    counter->failcnt = 0;
+    counter->parent = parent;
+}
+
+/* 沿祖先逐级记账，任何一级超限就把已记的撤回，*fail指向超限的那一级 */
+static bool page_counter_try_charge(struct page_counter *counter, ulong nr_pages,
+                                    struct page_counter **fail)
+{
+    struct page_counter *c;
+    long new;
+
+    for (c = counter; c; c = c->parent) {
+        new = atomic_long_add_return(nr_pages, &c->usage);
+        if (new > (long)c->max) {
+            atomic_long_sub(nr_pages, &c->usage);
+            c->failcnt++;
+            *fail = c;
+            goto failed;
+        }
+        if (new > (long)c->watermark)
+            c->watermark = new;
+    }
+    return true;
+
+failed:
+    for (; counter != c; counter = counter->parent)
+        atomic_long_sub(nr_pages, &counter->usage);
+    return false;
+}
+
+/* 不检查上限，__GFP_NOFAIL和回收路径自己的分配用 */
+static void page_counter_charge(struct page_counter *counter, ulong nr_pages)
+{
+    struct page_counter *c;
+    long new;
+
+    for (c = counter; c; c = c->parent) {
+        new = atomic_long_add_return(nr_pages, &c->usage);
+        if (new > (long)c->watermark)
+            c->watermark = new;
+    }
+}
+
+static void page_counter_uncharge(struct page_counter *counter, ulong nr_pages)
+{
+    struct page_counter *c;
+
+    for (c = counter; c; c = c->parent)
+        atomic_long_sub(nr_pages, &c->usage);
+}
+
+static inline void memcg_event(struct mem_cgroup *memcg,
+                               enum memcg_event_item item, ulong nr)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    memcg->events_cpu[smp_processor_id()].events[item] += nr;
+    local_irq_restore(flags);
+}
+
+/* 组离上限还剩多少页，取各级祖先中最小的 */
+static ulong mem_cgroup_margin(struct mem_cgroup *memcg)
+{
+    ulong margin = PAGE_COUNTER_MAX;
+    ulong count, limit;
+
+    for (; memcg && !mem_cgroup_is_root(memcg); memcg = memcg->parent) {
+        count = page_counter_read(&memcg->memory);
+        limit = memcg->memory.max;
+        margin = MIN(margin, count < limit ? limit - count : 0);
+    }
+
+    return margin;
+}
+
+static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
+{
+    struct memcg_stock_pcp *stock;
+    bool ret = false;
+    ulong flags;
+
+    if (nr_pages > MEMCG_CHARGE_BATCH)
+        return false;
+
+    flags = local_irq_save();
+    stock = &memcg_stock[smp_processor_id()];
+    if (stock->cached == memcg && stock->nr_pages >= nr_pages) {
+        stock->nr_pages -= nr_pages;
+        ret = true;
+    }
+    local_irq_restore(flags);
+
+    return ret;
+}
+
+/* 把本CPU的额度还给组，放掉额度持的引用，调用者关中断 */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+    struct mem_cgroup *old = stock->cached;
+
+    if (!old)
+        return;
+
+    if (stock->nr_pages)
+        page_counter_uncharge(&old->memory, stock->nr_pages);
+
+    stock->cached = NULL;
+    stock->nr_pages = 0;
+
+    mem_cgroup_put(old);
+}
+
+/* 已记账的页还回本CPU额度，攒超过一批才真正撤账 */
+static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
+{
+    struct memcg_stock_pcp *stock;
+    ulong flags;
+
+    flags = local_irq_save();
+    stock = &memcg_stock[smp_processor_id()];
+    if (stock->cached != memcg) {
+        drain_stock(stock);
+        mem_cgroup_get(memcg);
+        stock->cached = memcg;
+    }
+    stock->nr_pages += nr_pages;
+
+    if (stock->nr_pages > MEMCG_CHARGE_BATCH)
+        drain_stock(stock);
+    local_irq_restore(flags);
+}
+
+/* 在每个CPU上执行，中断已关 */
+static void drain_local_stock(void *info)
+{
+    struct mem_cgroup *root = info;
+    struct memcg_stock_pcp *stock = &memcg_stock[smp_processor_id()];
+
+    if (stock->cached && mem_cgroup_is_descendant(stock->cached, root))
+        drain_stock(stock);
+}
+
+/*
+ * 收回所有CPU上属于root子树的额度。别的CPU直接改会和它的记账、撤账
+ * 冲突，要发IPI让每个CPU各自交回自己的额度，调用者不能关中断。
+ */
+static void drain_all_stock(struct mem_cgroup *root)
+{
+    on_each_cpu(drain_local_stock, root);
+}
+
+static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
+                      unsigned int nr_pages)
+{
+    unsigned int batch = MAX(MEMCG_CHARGE_BATCH, nr_pages);
+    int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+    struct page_counter *counter;
+    struct mem_cgroup *mem_over_limit;
+    ulong nr_reclaimed;
+
+retry:
+    if (consume_stock(memcg, nr_pages))
+        return 0;
+
+    if (page_counter_try_charge(&memcg->memory, batch, &counter))
+        goto done_restock;
+
+    /* 整批记不下时先只记本次需要的，贴着上限也还能分到 */
+    if (batch > nr_pages) {
+        batch = nr_pages;
+        goto retry;
+    }
+
+    mem_over_limit = container_of(counter, struct mem_cgroup, memory);
+    memcg_event(mem_over_limit, MEMCG_MAX, 1);
+
+    /* 回收路径上的分配不能因为超限失败，也不能再递归回收 */
+    if (current->flags & PF_MEMALLOC)
+        goto force;
+
+    if (!(gfp_mask & __GFP_DIRECT_RECLAIM))
+        goto nomem;
+
+    nr_reclaimed = try_to_free_mem_cgroup_pages(mem_over_limit, nr_pages, gfp_mask);
+    memcg_event(mem_over_limit, MEMCG_RECLAIM, nr_reclaimed);
+
+    if (mem_cgroup_margin(mem_over_limit) >= nr_pages)
+        goto retry;
+
+    /* 其它CPU手里可能还压着该组的额度 */
+    drain_all_stock(mem_over_limit);
+
+    if (gfp_mask & __GFP_NORETRY)
+        goto nomem;
+
+    if (nr_retries--)
+        goto retry;
+
+    if (gfp_mask & __GFP_NOFAIL)
+        goto force;
+
+nomem:
+    memcg_event(mem_over_limit, MEMCG_OOM, 1);
+    return -ENOMEM;
+
+force:
+    page_counter_charge(&memcg->memory, nr_pages);
+    return 0;
+
+done_restock:
+    if (batch > nr_pages)
+        refill_stock(memcg, batch - nr_pages);
+    return 0;
+}
+
+static struct mem_cgroup *get_mem_cgroup_from_current(void)
+{
+    struct mem_cgroup *memcg = current->mem_cgroup;
+
+    /* 内核线程的分配不记在任何组上 */
+    if (!memcg || (current->flags & PF_KTHREAD))
+        return &root_mem_cgroup;
+
+    return memcg;
+}
+
+/* 新分配的页记到当前进程的组上，超限且回收不动时返回-ENOMEM */
+int __memcg_charge_page(struct page *page, gfp_t gfp_mask, unsigned int order)
+{
+    struct mem_cgroup *memcg = get_mem_cgroup_from_current();
+    unsigned int nr_pages = 1 << order;
+    int ret;
+
+    if (mem_cgroup_is_root(memcg))
+        return 0;
+
+    ret = try_charge(memcg, gfp_mask, nr_pages);
+    if (ret)
+        return ret;
+
+    /* 记着账的页持组的一个引用，组要等页都撤了账才能释放 */
+    mem_cgroup_get(memcg);
+    page->mem_cgroup = memcg;
+    memcg_event(memcg, MEMCG_PGPGIN, nr_pages);
+
+    return 0;
+}
+
+/* 页面释放时撤账，先还到本CPU额度里 */
+void __memcg_uncharge_page(struct page *page, unsigned int order)
+{
+    struct mem_cgroup *memcg = page->mem_cgroup;
+    unsigned int nr_pages = 1 << order;
+
+    page->mem_cgroup = NULL;
+
+    refill_stock(memcg, nr_pages);
+    memcg_event(memcg, MEMCG_PGPGOUT, nr_pages);
+    mem_cgroup_put(memcg);
+}
+
+bool mem_cgroup_is_descendant(struct mem_cgroup *memcg, struct mem_cgroup *root)
+{
+    if (!root || mem_cgroup_is_root(root))
+        return true;
+
+    for (; memcg; memcg = memcg->parent) {
+        if (memcg == root)
+            return true;
+    }
+
+    return false;
+}
+
+struct mem_cgroup *mem_cgroup_create(struct mem_cgroup *parent)
+{
+    struct mem_cgroup *memcg;
+    ulong flags;
+
+    if (!parent)
+        parent = &root_mem_cgroup;
+
+    memcg = kzalloc(sizeof(*memcg), GFP_KERNEL);
+    if (!memcg)
+        return ERR_PTR(-ENOMEM);
+
+    /* 根组不记账，子组的计数链在根下面断开 */
+    page_counter_init(&memcg->memory,
+                      mem_cgroup_is_root(parent) ? NULL : &parent->memory);
+    atomic_set(&memcg->refcnt, 1);
+    INIT_LIST_HEAD(&memcg->children);
+
+    mem_cgroup_get(parent);
+    memcg->parent = parent;
+
+    spin_lock_irqsave(&memcg_tree_lock, &flags);
+    memcg->id = memcg_next_id++;
+    list_add_tail(&memcg->sibling, &parent->children);
+    spin_unlock_irqrestore(&memcg_tree_lock, flags);
+
+    return memcg;
+}
+
+void mem_cgroup_get(struct mem_cgroup *memcg)
+{
+    if (memcg && !mem_cgroup_is_root(memcg))
+        atomic_inc(&memcg->refcnt);
+}
+
+/*
+ * 最后一个引用放掉时把组从树上摘下并释放。记着账的页和CPU额度都持
+ * 引用，走到这里时组上应该已经没有账了；万一还剩，连同祖先各级一起
+ * 撤掉，不能让父组一直背着。页释放时也会调到这里，不能睡眠。
+ */
+void mem_cgroup_put(struct mem_cgroup *memcg)
+{
+    struct mem_cgroup *parent;
+    ulong flags, usage;
+
+    if (!memcg || mem_cgroup_is_root(memcg))
+        return;
+
+    if (!atomic_dec_and_test(&memcg->refcnt))
+        return;
+
+    parent = memcg->parent;
+
+    spin_lock_irqsave(&memcg_tree_lock, &flags);
+    list_del(&memcg->sibling);
+    spin_unlock_irqrestore(&memcg_tree_lock, flags);
+
+    usage = page_counter_read(&memcg->memory);
+    if (usage)
+        page_counter_uncharge(&memcg->memory, usage);
+    kfree(memcg);
+
+    mem_cgroup_put(parent);
+}
+
+/* 当前进程换组，已记的账留在原组，之后的分配记到新组 */
+long mem_cgroup_attach_current(struct mem_cgroup *memcg)
+{
+    struct mem_cgroup *old;
+
+    if (!memcg)
+        return -EINVAL;
+
+    mem_cgroup_get(memcg);
+
+    task_lock(current);
+    old = current->mem_cgroup;
+    current->mem_cgroup = mem_cgroup_is_root(memcg) ? NULL : memcg;
+    task_unlock(current);
+
+    if (mem_cgroup_is_root(memcg))
+        mem_cgroup_put(memcg);
+    mem_cgroup_put(old);
+
+    return 0;
+}
+
+/* 调低上限时先组内回收到新上限以下，回收不动返回-EBUSY，上限不变 */
+int mem_cgroup_set_max(struct mem_cgroup *memcg, ulong nr_pages)
+{
+    int nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
+    ulong usage;
+
+    if (!memcg || mem_cgroup_is_root(memcg))
+        return -EINVAL;
+
+    if (nr_pages > PAGE_COUNTER_MAX)
+        nr_pages = PAGE_COUNTER_MAX;
+
+    for (;;) {
+        drain_all_stock(memcg);
+
+        usage = page_counter_read(&memcg->memory);
+        if (usage <= nr_pages)
+            break;
+
+        if (!nr_retries--)
+            return -EBUSY;
+
+        memcg_event(memcg, MEMCG_RECLAIM,
+                    try_to_free_mem_cgroup_pages(memcg, usage - nr_pages,
+                                                 GFP_KERNEL));
+    }
+
+    memcg->memory.max = nr_pages;
+
+    return 0;
+}
+
+/* id为0是根组，删掉的组查不到。找到时带一个引用返回 */
+static struct mem_cgroup *__mem_cgroup_find(struct mem_cgroup *parent, int id)
+{
+    struct mem_cgroup *memcg, *found;
+
+    list_for_each_entry(memcg, &parent->children, sibling) {
+        if (memcg->id == id)
+            return memcg;
+        found = __mem_cgroup_find(memcg, id);
+        if (found)
+            return found;
+    }
+
+    return NULL;
+}
+
+static struct mem_cgroup *mem_cgroup_get_by_id(int id)
+{
+    struct mem_cgroup *memcg;
+    ulong flags;
+
+    if (id == 0)
+        return &root_mem_cgroup;
+
+    spin_lock_irqsave(&memcg_tree_lock, &flags);
+    memcg = __mem_cgroup_find(&root_mem_cgroup, id);
+    /* 最后一个引用放掉之后、摘下之前，组还挂在树上 */
+    if (memcg && (memcg->dead || !atomic_inc_not_zero(&memcg->refcnt)))
+        memcg = NULL;
+    spin_unlock_irqrestore(&memcg_tree_lock, flags);
+
+    return memcg;
+}
+
+/* 删组：放掉建组时的引用，组里的进程和页还在时结构体留到它们走完 */
+static int mem_cgroup_destroy(struct mem_cgroup *memcg)
+{
+    bool dead;
+    ulong flags;
+
+    spin_lock_irqsave(&memcg_tree_lock, &flags);
+    dead = memcg->dead;
+    memcg->dead = true;
+    spin_unlock_irqrestore(&memcg_tree_lock, flags);
+
+    if (dead)
+        return -ENOENT;
+
+    mem_cgroup_put(memcg);
+    return 0;
+}
+
+/*
+ * 用户态接口，组用id指定，0是根组。
+ * MEMCG_CTL_CREATE在id下建子组，返回新组的id；MEMCG_CTL_DESTROY删组；
+ * MEMCG_CTL_ATTACH把当前进程移进组；MEMCG_CTL_SET_MAX把上限设为arg页。
+ */
+long sys_memcg_ctl(int cmd, int id, ulong arg)
+{
+    struct mem_cgroup *memcg, *child;
+    long ret;
+
+    if (id < 0)
+        return -EINVAL;
+
+    memcg = mem_cgroup_get_by_id(id);
+    if (!memcg)
+        return -ENOENT;
+
+    switch (cmd) {
+    case MEMCG_CTL_CREATE:
+        child = mem_cgroup_create(memcg);
+        ret = IS_ERR(child) ? PTR_ERR(child) : child->id;
+        break;
+    case MEMCG_CTL_DESTROY:
+        ret = mem_cgroup_is_root(memcg) ? -EINVAL : mem_cgroup_destroy(memcg);
+        break;
+    case MEMCG_CTL_ATTACH:
+        ret = mem_cgroup_attach_current(memcg);
+        break;
+    case MEMCG_CTL_SET_MAX:
+        ret = mem_cgroup_set_max(memcg, arg);
+        break;
+    default:
+        ret = -EINVAL;
+        break;
+    }
+
+    mem_cgroup_put(memcg);
+    return ret;
+}
+
+/* 用量含各CPU额度里还没用掉的部分，根组不记账恒为0 */
+ulong mem_cgroup_usage(struct mem_cgroup *memcg)
+{
+    if (!memcg || mem_cgroup_is_root(memcg))
+        return 0;
+
+    return page_counter_read(&memcg->memory);
+}
+
+ulong mem_cgroup_events(struct mem_cgroup *memcg, enum memcg_event_item item)
+{
+    ulong sum = 0;
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        sum += memcg->events_cpu[cpu].events[item];
+
+    return sum;
+}
+
+void mem_cgroup_print_info(struct mem_cgroup *memcg)
+{
+    if (!memcg || mem_cgroup_is_root(memcg))
+        return;
+
+    printk("memcg %d: usage %lu max %lu watermark %lu failcnt %lu\n",
+           memcg->id, page_counter_read(&memcg->memory), memcg->memory.max,
+           memcg->memory.watermark, memcg->memory.failcnt);
+    printk("  pgpgin %lu pgpgout %lu max %lu reclaim %lu oom %lu\n",
+           mem_cgroup_events(memcg, MEMCG_PGPGIN),
+           mem_cgroup_events(memcg, MEMCG_PGPGOUT),
+           mem_cgroup_events(memcg, MEMCG_MAX),
+           mem_cgroup_events(memcg, MEMCG_RECLAIM),
+           mem_cgroup_events(memcg, MEMCG_OOM));
+}
+
+void mem_cgroup_init(void)
+{
+    page_counter_init(&root_mem_cgroup.memory, NULL);
+    atomic_set(&root_mem_cgroup.refcnt, 1);
+    root_mem_cgroup.id = 0;
+    root_mem_cgroup.parent = NULL;
+    INIT_LIST_HEAD(&root_mem_cgroup.children);
+    INIT_LIST_HEAD(&root_mem_cgroup.sibling);
+
+    printk("memcg: per-cpu charge batch %u pages\n", MEMCG_CHARGE_BATCH);
+}
+
+#else
+
+long sys_memcg_ctl(int cmd, int id, ulong arg)
+{
+    return -ENOSYS;
+}
+
+#endif /* CONFIG_MEMCG */
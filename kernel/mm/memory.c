@@ -0,0 +1,340 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/gfp.h"
+#include "../../include/pgtable.h"
+#include "../../include/huge_mm.h"
+#include "../../include/mempolicy.h"
+#include "../../include/swap.h"
+#include "../../include/rmap.h"
+#include "../../include/vmalloc.h"
+#include "internal.h"
+
+struct mm_struct init_mm;
+
+/* 缺页错误码 */
+#define PF_PROT     (1UL << 0)  /* 保护违例(否则为页不存在) */
+#define PF_WRITE    (1UL << 1)  /* 写访问 */
+#define PF_USER     (1UL << 2)  /* 用户态访问 */
+
+pgprot_t vm_get_page_prot(ulong vm_flags)
+{
+    pgprot_t prot;
+
+    prot.pgprot = _PAGE_PRESENT | _PAGE_USER | _PAGE_ACCESSED;
+    if (vm_flags & VM_WRITE)
+        prot.pgprot |= _PAGE_RW;
+    if (!(vm_flags & VM_EXEC))
+        prot.pgprot |= _PAGE_NX;
+
+    return prot;
+}
+
+/* 查找第一个vm_end大于addr的VMA */
+struct vm_area_struct *find_vma(struct mm_struct *mm, ulong addr)
+{
+    struct rb_node *node = mm->mm_rb.rb_node;
+    struct vm_area_struct *vma = NULL;
+    struct vm_area_struct *tmp;
+
+    while (node) {
+        tmp = rb_entry(node, struct vm_area_struct, vm_rb);
+        if (tmp->vm_end > addr) {
+            vma = tmp;
+            if (tmp->vm_start <= addr)
+                break;
+            node = node->rb_left;
+        } else {
+            node = node->rb_right;
+        }
+    }
+
+    return vma;
+}
+
+/* 页表页来自预清零池，缺页路径上不必再清 */
+static void *alloc_pgtable_page(void)
+{
+    struct page *page;
+
+    page = alloc_pages(GFP_KERNEL_ACCOUNT | __GFP_ZERO, 0);
+    if (!page)
+        return NULL;
+
+    return page_address(page);
+}
+
+pud_t *pud_alloc(struct mm_struct *mm, pgd_t *pgd, ulong address)
+{
+    void *new;
+
+    if (pgd_none(*pgd)) {
+        new = alloc_pgtable_page();
+        if (!new)
+            return NULL;
+
+        spin_lock(&mm->page_table_lock);
+        if (pgd_none(*pgd)) {
+            set_pgd(pgd, __pgd(__pa(new) | _PAGE_TABLE));
+            new = NULL;
+        }
+        spin_unlock(&mm->page_table_lock);
+
+        if (new)
+            free_page((ulong)new);
+    }
+
+    return pud_offset(pgd, address);
+}
+
+pmd_t *pmd_alloc(struct mm_struct *mm, pud_t *pud, ulong address)
+{
+    void *new;
+
+    if (pud_none(*pud)) {
+        new = alloc_pgtable_page();
+        if (!new)
+            return NULL;
+
+        spin_lock(&mm->page_table_lock);
+        if (pud_none(*pud)) {
+            set_pud(pud, __pud(__pa(new) | _PAGE_TABLE));
+            new = NULL;
+        }
+        spin_unlock(&mm->page_table_lock);
+
+        if (new)
+            free_page((ulong)new);
+    }
+
+    return pmd_offset(pud, address);
+}
+
+pte_t *pte_alloc(struct mm_struct *mm, pmd_t *pmd, ulong address)
+{
+    void *new;
+
+    if (pmd_none(*pmd)) {
+        new = alloc_pgtable_page();
+        if (!new)
+            return NULL;
+
+        spin_lock(&mm->page_table_lock);
+        if (pmd_none(*pmd)) {
+            set_pmd(pmd, __pmd(__pa(new) | _PAGE_TABLE));
+            new = NULL;
+        }
+        spin_unlock(&mm->page_table_lock);
+
+        if (new)
+            free_page((ulong)new);
+    }
+
+    return pte_offset(pmd, address);
+}
+
+static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+                             ulong address, pmd_t *pmd)
+{
+    struct page *page;
+    pte_t *pte;
+    pte_t entry;
+
+    pte = pte_alloc(mm, pmd, address);
+    if (!pte)
+        return VM_FAULT_OOM;
+
+    page = alloc_pages_vma(GFP_HIGHUSER_MOVABLE | __GFP_ACCOUNT | __GFP_ZERO, 0,
+                           vma, address);
+    if (!page)
+        return VM_FAULT_OOM;
+
+    entry = pfn_pte(page_to_pfn(page), vm_get_page_prot(vma->vm_flags));
+    if (vma->vm_flags & VM_WRITE)
+        entry = pte_mkwrite(pte_mkdirty(entry));
+
+    spin_lock(&mm->page_table_lock);
+    if (!pte_none(*pte)) {
+        spin_unlock(&mm->page_table_lock);
+        __free_pages(page, 0);
+        return 0;
+    }
+
+    page_add_new_anon_rmap(page, vma, address);
+    lru_cache_add(page);
+    set_pte(pte, entry);
+    spin_unlock(&mm->page_table_lock);
+
+    return 0;
+}
+
+/*
+ * 页表项里是交换槽位：从交换缓存或zswap/交换设备把页找回来重新映射。
+ * 映射好后槽位少一个引用；交换区偏满或这次是写，就顺手把页移出交换
+ * 缓存，省下槽位，页被写过后槽位里的副本反正也作废了。
+ */
+static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
+                        ulong address, pte_t *pte, pte_t orig_pte,
+                        unsigned int flags)
+{
+    swp_entry_t entry = pte_to_swp_entry(orig_pte);
+    struct page *page;
+    pte_t new_pte;
+    int ret = 0;
+
+    /* 页正被压缩搬走，等搬完再重新缺页 */
+    if (is_migration_entry(entry)) {
+        migration_entry_wait(mm, pte);
+        return 0;
+    }
+
+    page = lookup_swap_cache(entry);
+    if (!page) {
+        page = read_swap_cache_async(entry, GFP_HIGHUSER_MOVABLE | __GFP_ACCOUNT,
+                                     vma, address);
+        if (!page) {
+            /* 其它线程已经换入并改了页表项就不算失败 */
+            if (pte_val(*pte) == pte_val(orig_pte))
+                return VM_FAULT_OOM;
+            return 0;
+        }
+    }
+
+    lock_page(page);
+
+    spin_lock(&mm->page_table_lock);
+    if (pte_val(*pte) != pte_val(orig_pte))
+        goto out_unlock;
+
+    if (!PageUptodate(page)) {
+        ret = VM_FAULT_SIGBUS;
+        goto out_unlock;
+    }
+
+    new_pte = pfn_pte(page_to_pfn(page), vm_get_page_prot(vma->vm_flags));
+    if ((flags & FAULT_FLAG_WRITE) && (vma->vm_flags & VM_WRITE))
+        new_pte = pte_mkwrite(pte_mkdirty(new_pte));
+
+    get_page(page);
+    page_add_anon_rmap(page, vma, address);
+    set_pte(pte, new_pte);
+    spin_unlock(&mm->page_table_lock);
+
+    swap_free(entry);
+    if (vm_swap_full() || (flags & FAULT_FLAG_WRITE))
+        try_to_free_swap(page);
+
+    unlock_page(page);
+    put_page(page);
+
+    return 0;
+
+out_unlock:
+    spin_unlock(&mm->page_table_lock);
+    unlock_page(page);
+    put_page(page);
+
+    return ret;
+}
+
+int handle_mm_fault(struct vm_area_struct *vma, ulong address, unsigned int flags)
+{
+    struct mm_struct *mm = vma->vm_mm;
+    pgd_t *pgd;
+    pud_t *pud;
+    pmd_t *pmd;
+    pte_t *pte;
+    int ret;
+
+    pgd = pgd_offset(mm, address);
+    pud = pud_alloc(mm, pgd, address);
+    if (!pud)
+        return VM_FAULT_OOM;
+
+    pmd = pmd_alloc(mm, pud, address);
+    if (!pmd)
+        return VM_FAULT_OOM;
+
+    /* PMD为空且区域合适时先尝试整块2MB映射 */
+    if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+        ret = do_huge_pmd_anonymous_page(mm, vma, address, pmd, flags);
+        if (!(ret & VM_FAULT_FALLBACK))
+            return ret;
+    }
+
+    /* 其它CPU已经装好了大页 */
+    if (pmd_trans_huge(*pmd))
+        return 0;
+
+    pte = pte_alloc(mm, pmd, address);
+    if (!pte)
+        return VM_FAULT_OOM;
+
+    if (is_swap_pte(*pte))
+        return do_swap_page(mm, vma, address, pte, *pte, flags);
+
+    if (!pte_none(*pte))
+        return 0;
+
+    if (!vma_is_anonymous(vma))
+        return VM_FAULT_SIGBUS;
+
+    return do_anonymous_page(mm, vma, address, pmd);
+}
+
+void do_page_fault(ulong address, ulong error_code)
+{
+    struct task_struct *tsk = current;
+    struct mm_struct *mm = tsk->mm;
+    struct vm_area_struct *vma;
+    unsigned int flags = 0;
+    int fault;
+
+    /* vmalloc区的映射不会按需建立，内核访问到未映射处只能是bug */
+    if (!(error_code & PF_USER) && is_vmalloc_addr((void *)address)) {
+        if (tsk->stack && address < (ulong)tsk->stack &&
+            address >= (ulong)tsk->stack - PAGE_SIZE)
+            panic("kernel stack overflow, pid %d, address 0x%lx\n",
+                  tsk->pid, address);
+        panic("unable to handle kernel paging request at 0x%lx\n", address);
+    }
+
+    if (!mm) {
+        panic("kernel page fault at 0x%lx, error code 0x%lx\n",
+              address, error_code);
+    }
+
+    vma = find_vma(mm, address);
+    if (!vma || vma->vm_start > address)
+        goto bad_area;
+
+    if (error_code & PF_WRITE) {
+        if (!(vma->vm_flags & VM_WRITE))
+            goto bad_area;
+        flags |= FAULT_FLAG_WRITE;
+    } else if (!(vma->vm_flags & (VM_READ | VM_EXEC))) {
+        goto bad_area;
+    }
+
+    if (error_code & PF_USER)
+        flags |= FAULT_FLAG_USER;
+
+    fault = handle_mm_fault(vma, address, flags);
+    if (fault & VM_FAULT_OOM) {
+        printk("Out of memory: killing pid %d\n", tsk->pid);
+        force_sig(SIGKILL, tsk);
+        return;
+    }
+    if (fault & (VM_FAULT_SIGBUS | VM_FAULT_SIGSEGV)) {
+        force_sig(fault & VM_FAULT_SIGBUS ? SIGBUS : SIGSEGV, tsk);
+        return;
+    }
+
+    return;
+
+bad_area:
+    printk("segfault at 0x%lx, pid %d, error code 0x%lx\n",
+           address, tsk->pid, error_code);
+    force_sig(SIGSEGV, tsk);
+}
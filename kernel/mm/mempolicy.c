@@ -0,0 +1,243 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/sched.h"
+#include "../../include/gfp.h"
+#include "../../include/slab.h"
+#include "../../include/numa.h"
+#include "../../include/mempolicy.h"
+#include "internal.h"
+
+/*
+ * NUMA内存策略。查找顺序是VMA策略、任务策略、系统默认(本地节点)。
+ * 交错策略按任务的il_next逐页轮转；对VMA则按页在区域内的偏移取模，
+ * 同一地址重复缺页会落到同一个节点上。
+ */
+
+static struct mempolicy default_policy = {
+    .refcnt = ATOMIC_INIT(1),
+    .mode = MPOL_LOCAL,
+};
+
+struct mempolicy *get_task_policy(struct task_struct *p)
+{
+    if (p->mempolicy)
+        return p->mempolicy;
+
+    return &default_policy;
+}
+
+static struct mempolicy *get_vma_policy(struct vm_area_struct *vma)
+{
+    if (vma && vma->vm_policy)
+        return vma->vm_policy;
+
+    return get_task_policy(current);
+}
+
+/* 首选节点：PREFERRED取策略里的节点，其余从nd(通常是本地节点)开始 */
+int policy_node(gfp_t gfp, struct mempolicy *pol, int nd)
+{
+    if (pol->mode == MPOL_PREFERRED)
+        return pol->v.preferred_node;
+
+    return nd;
+}
+
+/* 只有BIND限制可用节点；__GFP_THISNODE已经限定了节点，不再叠加 */
+nodemask_t *policy_nodemask(gfp_t gfp, struct mempolicy *pol)
+{
+    if (pol->mode == MPOL_BIND && !(gfp & __GFP_THISNODE))
+        return &pol->v.nodes;
+
+    return NULL;
+}
+
+static int interleave_nodes(struct mempolicy *pol)
+{
+    struct task_struct *me = current;
+    int nid = me->il_next;
+
+    /* 策略换过之后il_next可能已经不在集合里 */
+    if (nid >= MAX_NUMNODES || !node_isset(nid, &pol->v.nodes))
+        nid = first_node(&pol->v.nodes);
+
+    me->il_next = next_node_in(nid, &pol->v.nodes);
+
+    return nid;
+}
+
+/* 取集合中第n个节点(按weight取模) */
+static int offset_il_node(struct mempolicy *pol, ulong n)
+{
+    int weight = nodes_weight(&pol->v.nodes);
+    int target, nid;
+
+    if (!weight)
+        return numa_node_id();
+
+    target = n % weight;
+    nid = first_node(&pol->v.nodes);
+    while (target--)
+        nid = next_node(nid, &pol->v.nodes);
+
+    return nid;
+}
+
+static int interleave_nid(struct mempolicy *pol, struct vm_area_struct *vma,
+                          ulong addr, int shift)
+{
+    ulong off;
+
+    off = vma->vm_pgoff >> (shift - PAGE_SHIFT);
+    off += (addr - vma->vm_start) >> shift;
+
+    return offset_il_node(pol, off);
+}
+
+static struct page *alloc_page_interleave(gfp_t gfp, unsigned int order, int nid)
+{
+    struct page *page;
+
+    page = __alloc_pages_nodemask(gfp, order, nid, NULL);
+    if (page && page_to_nid(page) == nid)
+        inc_numa_state(page_zone(page), NUMA_INTERLEAVE_HIT);
+
+    return page;
+}
+
+struct page *alloc_pages(gfp_t gfp_mask, unsigned int order)
+{
+    struct mempolicy *pol = &default_policy;
+
+    /* 中断上下文里的current和这次分配无关，不用它的策略 */
+    if (!in_interrupt() && !(gfp_mask & __GFP_THISNODE))
+        pol = get_task_policy(current);
+
+    if (pol->mode == MPOL_INTERLEAVE)
+        return alloc_page_interleave(gfp_mask, order, interleave_nodes(pol));
+
+    return __alloc_pages_nodemask(gfp_mask, order,
+                                  policy_node(gfp_mask, pol, numa_node_id()),
+                                  policy_nodemask(gfp_mask, pol));
+}
+
+/* 用户页分配：按缺页地址所在VMA的策略选节点 */
+struct page *alloc_pages_vma(gfp_t gfp, unsigned int order,
+                             struct vm_area_struct *vma, ulong addr)
+{
+    struct mempolicy *pol = get_vma_policy(vma);
+
+    if (pol->mode == MPOL_INTERLEAVE)
+        return alloc_page_interleave(gfp, order,
+                                     interleave_nid(pol, vma, addr, PAGE_SHIFT + order));
+
+    return __alloc_pages_nodemask(gfp, order,
+                                  policy_node(gfp, pol, numa_node_id()),
+                                  policy_nodemask(gfp, pol));
+}
+
+struct mempolicy *mpol_new(unsigned short mode, const nodemask_t *nodes)
+{
+    struct mempolicy *pol;
+    int nid;
+
+    if (mode == MPOL_DEFAULT)
+        return NULL;
+
+    if (mode >= MPOL_MAX)
+        return ERR_PTR(-EINVAL);
+
+    /* 集合里的节点必须都在线 */
+    if (nodes) {
+        for_each_node_mask(nid, *nodes) {
+            if (!node_online(nid))
+                return ERR_PTR(-EINVAL);
+        }
+    }
+
+    if ((mode == MPOL_BIND || mode == MPOL_INTERLEAVE) &&
+        (!nodes || nodes_empty(nodes)))
+        return ERR_PTR(-EINVAL);
+
+    pol = kmalloc(sizeof(*pol), GFP_KERNEL);
+    if (!pol)
+        return ERR_PTR(-ENOMEM);
+
+    atomic_set(&pol->refcnt, 1);
+    pol->mode = mode;
+
+    switch (mode) {
+    case MPOL_PREFERRED:
+        /* 空集合等同于本地分配 */
+        if (!nodes || nodes_empty(nodes))
+            pol->mode = MPOL_LOCAL;
+        else
+            pol->v.preferred_node = first_node(nodes);
+        break;
+    case MPOL_BIND:
+    case MPOL_INTERLEAVE:
+        pol->v.nodes = *nodes;
+        break;
+    default:
+        break;
+    }
+
+    return pol;
+}
+
+void mpol_get(struct mempolicy *pol)
+{
+    if (pol)
+        atomic_inc(&pol->refcnt);
+}
+
+void mpol_put(struct mempolicy *pol)
+{
+    if (!pol || pol == &default_policy)
+        return;
+
+    if (atomic_dec_and_test(&pol->refcnt))
+        kfree(pol);
+}
+
+long do_set_mempolicy(unsigned short mode, const nodemask_t *nodes)
+{
+    struct mempolicy *new, *old;
+
+    new = mpol_new(mode, nodes);
+    if (IS_ERR(new))
+        return PTR_ERR(new);
+
+    task_lock(current);
+    old = current->mempolicy;
+    current->mempolicy = new;
+    if (new && new->mode == MPOL_INTERLEAVE)
+        current->il_next = first_node(&new->v.nodes);
+    task_unlock(current);
+
+    mpol_put(old);
+
+    return 0;
+}
+
+long sys_set_mempolicy(int mode, const ulong __user *nmask, ulong maxnode)
+{
+    nodemask_t nodes;
+    ulong nbits = MIN(maxnode, (ulong)MAX_NUMNODES);
+    int nid;
+
+    if (mode < 0)
+        return -EINVAL;
+
+    nodes_clear(&nodes);
+    if (nmask && nbits) {
+        if (copy_from_user(nodes.bits, nmask,
+                           BITS_TO_LONGS(nbits) * sizeof(ulong)))
+            return -EFAULT;
+        /* 按字复制会多带进maxnode之后的位 */
+        for (nid = nbits; nid < MAX_NUMNODES; nid++)
+            node_clear(nid, &nodes);
+    }
+
+    return do_set_mempolicy(mode, nmask ? &nodes : NULL);
+}
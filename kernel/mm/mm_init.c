@@ -0,0 +1,613 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/string.h"
+#include "../../include/pgtable.h"
+#include "../../include/numa.h"
+#include "../../include/memblock.h"
+#include "../../include/multiboot2.h"
+#include "../../include/vmstat.h"
+#include "../../include/sched.h"
+#include "internal.h"
+
+/*
+ * 启动时的内存初始化：从multiboot2内存映射建立memblock，补全直接映射，
+ * 分配mem_map；区域建好后再把空闲内存整块交给伙伴系统。
+ */
+
+/* 直接映射要覆盖的物理区间：可用内存以外还有ACPI表所在的区间 */
+#define MAX_DIRECT_MAP_RANGES   64
+
+struct direct_map_range {
+    phys_addr_t start;
+    phys_addr_t end;
+};
+
+struct page *mem_map;
+ulong max_pfn;
+
+extern char __kernel_start[], __kernel_end[];
+
+static struct direct_map_range direct_map_ranges[MAX_DIRECT_MAP_RANGES];
+static int nr_direct_map_ranges;
+
+static const char *mmap_type_name(u32 type)
+{
+    switch (type) {
+    case MULTIBOOT_MEMORY_AVAILABLE:
+        return "usable";
+    case MULTIBOOT_MEMORY_ACPI_RECLAIMABLE:
+        return "ACPI data";
+    case MULTIBOOT_MEMORY_NVS:
+        return "ACPI NVS";
+    case MULTIBOOT_MEMORY_BADRAM:
+        return "unusable";
+    default:
+        return "reserved";
+    }
+}
+
+static void add_direct_map_range(phys_addr_t start, phys_addr_t end)
+{
+    if (nr_direct_map_ranges >= MAX_DIRECT_MAP_RANGES) {
+        printk("mm: too many ranges to map, ignoring [mem %#llx-%#llx]\n",
+               start, end - 1);
+        return;
+    }
+
+    direct_map_ranges[nr_direct_map_ranges].start = start;
+    direct_map_ranges[nr_direct_map_ranges].end = end;
+    nr_direct_map_ranges++;
+}
+
+static void parse_mmap_tag(struct multiboot_tag_mmap *tag)
+{
+    struct multiboot_mmap_entry *entry;
+    u8 *p = (u8 *)tag->entries;
+    u8 *end = (u8 *)tag + tag->size;
+    phys_addr_t start, stop;
+
+    for (; p + sizeof(*entry) <= end; p += tag->entry_size) {
+        entry = (struct multiboot_mmap_entry *)p;
+        if (!entry->len)
+            continue;
+
+        printk("BIOS-provided: [mem %#018llx-%#018llx] %s\n",
+               entry->addr, entry->addr + entry->len - 1,
+               mmap_type_name(entry->type));
+
+        switch (entry->type) {
+        case MULTIBOOT_MEMORY_AVAILABLE:
+            /* 不足一页的头尾不要 */
+            start = ALIGN_UP(entry->addr, PAGE_SIZE);
+            stop = (entry->addr + entry->len) & PAGE_MASK;
+            if (start < stop)
+                memblock_add(start, stop - start);
+            add_direct_map_range(entry->addr, entry->addr + entry->len);
+            break;
+        case MULTIBOOT_MEMORY_ACPI_RECLAIMABLE:
+        case MULTIBOOT_MEMORY_NVS:
+            add_direct_map_range(entry->addr, entry->addr + entry->len);
+            break;
+        }
+    }
+}
+
+/* 信息结构由引导器放在低端内存，启动页表映射的1GB以内 */
+static int parse_multiboot_info(u32 magic, ulong mbi_phys)
+{
+    struct multiboot_info *mbi;
+    struct multiboot_tag *tag;
+    bool have_mmap = false;
+
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC) {
+        printk("mm: bad multiboot2 magic %#x\n", magic);
+        return -EINVAL;
+    }
+
+    mbi = __va(mbi_phys);
+    for (tag = (struct multiboot_tag *)(mbi + 1);
+         tag->type != MULTIBOOT_TAG_TYPE_END;
+         tag = multiboot_next_tag(tag)) {
+        if (tag->type == MULTIBOOT_TAG_TYPE_MMAP) {
+            parse_mmap_tag((struct multiboot_tag_mmap *)tag);
+            have_mmap = true;
+        }
+    }
+
+    if (!have_mmap) {
+        printk("mm: no memory map from boot loader\n");
+        return -EINVAL;
+    }
+
+    memblock_reserve(mbi_phys, mbi->total_size);
+
+    return 0;
+}
+
+static bool cpu_has_gbpages(void)
+{
+    u32 eax, ebx, ecx, edx;
+
+    asm volatile("cpuid"
+                 : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                 : "0" (0x80000001), "2" (0));
+
+    return edx & (1U << 26);
+}
+
+/* 页表页来自memblock，此时只能落在已映射的低端1GB里 */
+static void *alloc_low_pgt_page(void)
+{
+    phys_addr_t phys = memblock_phys_alloc(PAGE_SIZE, PAGE_SIZE);
+
+    if (!phys)
+        panic("mm: out of memory for direct mapping page tables\n");
+
+    memset(__va(phys), 0, PAGE_SIZE);
+    return __va(phys);
+}
+
+/*
+ * 启动页表里低端恒等映射和高端直接映射共用同一张PDPT。直接映射要扩展
+ * 到全部内存，先给它换一张自己的PDPT，免得恒等映射也跟着变大。
+ */
+static void split_direct_map_pgd(void)
+{
+    pgd_t *ident = pgd_offset(&init_mm, 0);
+    pgd_t *pgd = pgd_offset(&init_mm, (ulong)__va(0));
+    pud_t *pud;
+
+    if (pgd_val(*pgd) != pgd_val(*ident))
+        return;
+
+    pud = alloc_low_pgt_page();
+    memcpy(pud, pud_offset(ident, 0), PAGE_SIZE);
+    set_pgd(pgd, __pgd(__pa(pud) | _PAGE_TABLE));
+}
+
+static void map_direct_range(phys_addr_t start, phys_addr_t end, bool gbpages,
+                             pgprot_t prot)
+{
+    ulong addr = (ulong)__va(start & PMD_MASK);
+    ulong vend = (ulong)__va(ALIGN_UP(end, PMD_SIZE));
+    pgd_t *pgd;
+    pud_t *pud;
+    pmd_t *pmd;
+
+    while (addr < vend) {
+        pgd = pgd_offset(&init_mm, addr);
+        if (pgd_none(*pgd))
+            set_pgd(pgd, __pgd(__pa(alloc_low_pgt_page()) | _PAGE_TABLE));
+
+        pud = pud_offset(pgd, addr);
+        if (pud_none(*pud) && gbpages &&
+            IS_ALIGNED(addr, PUD_SIZE) && addr + PUD_SIZE <= vend) {
+            set_pud(pud, __pud(__pa(addr) | prot.pgprot | _PAGE_PSE));
+            addr += PUD_SIZE;
+            continue;
+        }
+        if (pud_none(*pud))
+            set_pud(pud, __pud(__pa(alloc_low_pgt_page()) | _PAGE_TABLE));
+        else if (pud_val(*pud) & _PAGE_PSE) {
+            addr = (addr & PUD_MASK) + PUD_SIZE;
+            continue;
+        }
+
+        pmd = pmd_offset(pud, addr);
+        if (pmd_none(*pmd))
+            set_pmd(pmd, __pmd(__pa(addr) | prot.pgprot | _PAGE_PSE));
+        addr += PMD_SIZE;
+    }
+}
+
+/*
+ * 启动页表只映射了前1GB。把所有内存和ACPI区间都映射进直接映射区，
+ * 优先用1GB页，其次2MB页，之后memblock才能在整个内存里分配。
+ */
+static void init_mem_mapping(void)
+{
+    bool gbpages = cpu_has_gbpages();
+    int i;
+
+    init_mm.pgd = read_cr3() & PTE_PFN_MASK;
+    spin_lock_init(&init_mm.page_table_lock);
+
+    split_direct_map_pgd();
+
+    for (i = 0; i < nr_direct_map_ranges; i++)
+        map_direct_range(direct_map_ranges[i].start, direct_map_ranges[i].end,
+                         gbpages, PAGE_KERNEL);
+
+    flush_tlb_all();
+
+    memblock_set_current_limit(memblock_end_of_DRAM());
+
+    printk("mm: direct mapping up to %#llx with %s pages\n",
+           memblock_end_of_DRAM(), gbpages ? "1G" : "2M");
+}
+
+/*
+ * 把设备寄存器窗口(如本地APIC)按不缓存的2MB页放进直接映射，之后用
+ * __va访问。窗口所在的2MB里不能有内存，否则会和已有的映射冲突。
+ */
+void map_direct_mmio(phys_addr_t start, phys_addr_t end)
+{
+    map_direct_range(start, end, false, PAGE_KERNEL_NOCACHE);
+    flush_tlb_all();
+}
+
+static void alloc_mem_map(void)
+{
+    ulong size;
+
+    max_pfn = PFN_DOWN(memblock_end_of_DRAM());
+    size = ALIGN_UP(max_pfn * sizeof(struct page), PAGE_SIZE);
+
+    /* 不清零：每个struct page在初始化时整个写一遍，推迟的部分更不该在这里付代价 */
+    mem_map = memblock_alloc_raw(size, PAGE_SIZE);
+    if (!mem_map)
+        panic("mm: failed to allocate %lu bytes for mem_map\n", size);
+
+    printk("mm: mem_map for %lu pages, %lu KB\n", max_pfn, size >> 10);
+}
+
+/* 由内核入口带着引导器交来的魔数和信息结构调用，此时只有启动页表 */
+void mm_init(u32 magic, ulong mbi_phys)
+{
+    if (parse_multiboot_info(magic, mbi_phys))
+        panic("mm: cannot determine physical memory layout\n");
+
+    /* 0号页留给BIOS数据区，低1MB里还有EBDA和ROM，一并保留 */
+    memblock_reserve(0, 1UL << 20);
+    memblock_reserve((phys_addr_t)__kernel_start,
+                     (phys_addr_t)(__kernel_end - __kernel_start));
+
+    init_mem_mapping();
+    alloc_mem_map();
+
+    memblock_dump_all();
+}
+
+/*
+ * struct page所在的内存不清零，每个字段都要在这里写好。区域内的页
+ * 先一律标成保留页，能用的页由释放路径清掉保留标志交给伙伴系统。
+ */
+static void __init_single_page(struct page *page, ulong pfn, struct zone *zone)
+{
+    memset(page, 0, sizeof(*page));
+    INIT_LIST_HEAD(&page->lru);
+    page_mapcount_reset(page);
+    set_page_count(page, 1);
+    set_page_links(page, zone_idx(zone), zone->zone_pgdat->node_id);
+}
+
+static void init_reserved_range(ulong spfn, ulong epfn, struct zone *zone)
+{
+    struct page *page;
+    ulong pfn;
+
+    for (pfn = spfn; pfn < epfn; pfn++) {
+        page = pfn_to_page(pfn);
+        __init_single_page(page, pfn, zone);
+        page->flags |= 1UL << PG_reserved;
+    }
+}
+
+#if CONFIG_DEFERRED_STRUCT_PAGE_INIT
+
+/*
+ * 每个节点最后一个区域只同步初始化开头这么多页，其余的交给节点的
+ * 初始化线程，或在分配不到内存时按DEFERRED_GROW_PAGES就地扩展。
+ * 低端区域小且有地址限制的分配只能用它们，总是全部同步初始化。
+ */
+#define DEFERRED_INIT_PAGES     (1UL << (30 - PAGE_SHIFT))
+#define DEFERRED_GROW_PAGES     (1UL << (27 - PAGE_SHIFT))
+
+/* 推迟的起点按最大阶对齐，释放的块不会跨过它 */
+#define MAX_ORDER_NR_PAGES      (1UL << (MAX_ORDER - 1))
+
+static atomic_t pgdat_init_n_undone;
+
+static inline ulong pgdat_end_pfn(struct pglist_data *pgdat)
+{
+    return pgdat->node_start_pfn + pgdat->node_spanned_pages;
+}
+
+static bool defer_init(struct zone *zone, ulong pfn, ulong end_pfn)
+{
+    struct pglist_data *pgdat = zone->zone_pgdat;
+
+    if (end_pfn < pgdat_end_pfn(pgdat))
+        return false;
+
+    if (pfn - zone->zone_start_pfn < DEFERRED_INIT_PAGES ||
+        !IS_ALIGNED(pfn, MAX_ORDER_NR_PAGES))
+        return false;
+
+    pgdat->first_deferred_pfn = pfn;
+    return true;
+}
+
+static struct pglist_data *early_pfn_pgdat(ulong pfn)
+{
+    struct pglist_data *pgdat;
+    int nid;
+
+    for_each_online_node(nid) {
+        pgdat = NODE_DATA(nid);
+        if (pgdat && pfn >= pgdat->node_start_pfn && pfn < pgdat_end_pfn(pgdat))
+            return pgdat;
+    }
+
+    return NULL;
+}
+
+/* pfn所在节点推迟初始化的起点；节点没有推迟的部分时返回max_pfn */
+ulong deferred_pfn_limit(ulong pfn)
+{
+    struct pglist_data *pgdat = early_pfn_pgdat(pfn);
+
+    if (!pgdat || !pgdat->first_deferred_pfn)
+        return max_pfn;
+
+    return pgdat->first_deferred_pfn;
+}
+
+/*
+ * 推迟部分里的空洞不会被释放，初始化线程也只看空闲区间，
+ * 现在就初始化成保留页，按pfn扫描的代码才不会碰到垃圾。
+ */
+static void init_unavailable_range(ulong spfn, ulong epfn, struct zone *zone)
+{
+    struct memblock_region *reg;
+    ulong cursor = spfn;
+    ulong start, end;
+
+    for_each_memblock(memory, reg) {
+        start = memblock_region_memory_base_pfn(reg);
+        end = memblock_region_memory_end_pfn(reg);
+
+        if (end <= cursor)
+            continue;
+        if (start >= epfn)
+            break;
+
+        if (start > cursor)
+            init_reserved_range(cursor, start, zone);
+        cursor = MAX(cursor, end);
+    }
+
+    if (cursor < epfn)
+        init_reserved_range(cursor, epfn, zone);
+}
+
+/*
+ * 推迟部分里已被memblock占用的页(mem_map自己、页表等)也要在交出
+ * 内存之前初始化好，否则它们的struct page会一直是垃圾。
+ */
+static void memmap_init_reserved_pages(void)
+{
+    struct memblock_region *reg;
+    struct pglist_data *pgdat;
+    ulong pfn, spfn, epfn;
+
+    for_each_memblock(reserved, reg) {
+        spfn = PFN_DOWN(reg->base);
+        epfn = MIN(PFN_UP(reg->base + reg->size), max_pfn);
+
+        for (pfn = spfn; pfn < epfn; pfn++) {
+            pgdat = early_pfn_pgdat(pfn);
+            if (!pgdat || !pgdat->first_deferred_pfn ||
+                pfn < pgdat->first_deferred_pfn)
+                continue;
+            init_reserved_range(pfn, pfn + 1,
+                                &pgdat->node_zones[pgdat->nr_zones - 1]);
+        }
+    }
+}
+
+/* 初始化[spfn, epfn)中的空闲页并整块释放，返回释放的页数 */
+static ulong deferred_init_range(struct zone *zone, ulong spfn, ulong epfn)
+{
+    phys_addr_t start, end;
+    ulong s, e, pfn;
+    ulong nr = 0;
+    u64 i;
+
+    for_each_free_mem_range(i, zone->zone_pgdat->node_id, &start, &end) {
+        s = MAX(PFN_UP(start), spfn);
+        e = MIN(PFN_DOWN(end), epfn);
+        if (s >= e)
+            continue;
+
+        for (pfn = s; pfn < e; pfn++)
+            __init_single_page(pfn_to_page(pfn), pfn, zone);
+
+        nr += __free_pages_memory(s, e);
+    }
+
+    return nr;
+}
+
+/*
+ * 从first_deferred_pfn起按最大阶块推进，直到释放出至少nr_pages页
+ * 或区域初始化完。调用者持有node_size_lock。
+ */
+static ulong deferred_init_chunk(struct pglist_data *pgdat, struct zone *zone,
+                                 ulong nr_pages)
+{
+    ulong spfn = pgdat->first_deferred_pfn;
+    ulong end_pfn = zone_end_pfn(zone);
+    ulong epfn, nr = 0;
+
+    while (spfn < end_pfn && nr < nr_pages) {
+        epfn = MIN(spfn + MAX_ORDER_NR_PAGES, end_pfn);
+        nr += deferred_init_range(zone, spfn, epfn);
+        spfn = epfn;
+    }
+
+    WRITE_ONCE(pgdat->first_deferred_pfn, spfn < end_pfn ? spfn : 0);
+
+    return nr;
+}
+
+/*
+ * 分配路径上区域低于水位、但还有没初始化的内存时调用：就地初始化一段
+ * 再重试，不必等初始化线程。返回true表示区域里多了可用的页。
+ */
+bool deferred_grow_zone(struct zone *zone, unsigned int order)
+{
+    struct pglist_data *pgdat = zone->zone_pgdat;
+    ulong first = READ_ONCE(pgdat->first_deferred_pfn);
+    ulong nr_pages = MAX(1UL << order, DEFERRED_GROW_PAGES);
+    ulong flags, nr;
+
+    if (!first || first < zone->zone_start_pfn || first >= zone_end_pfn(zone))
+        return false;
+
+    spin_lock_irqsave(&pgdat->node_size_lock, &flags);
+
+    /* 初始化线程可能已经做完 */
+    if (!pgdat->first_deferred_pfn) {
+        spin_unlock_irqrestore(&pgdat->node_size_lock, flags);
+        return true;
+    }
+
+    nr = deferred_init_chunk(pgdat, zone, nr_pages);
+
+    spin_unlock_irqrestore(&pgdat->node_size_lock, flags);
+
+    return nr != 0;
+}
+
+/*
+ * 每个节点一个线程，各节点并行把剩下的struct page初始化并交给
+ * 伙伴系统。每段之后放开锁，按需扩展和中断都不会被挡太久。最后一个
+ * 完成的线程按完整的managed_pages重算水位和统计阈值。
+ */
+static int deferred_init_memmap(void *data)
+{
+    struct pglist_data *pgdat = data;
+    struct zone *zone = &pgdat->node_zones[pgdat->nr_zones - 1];
+    u64 start = get_jiffies_64();
+    ulong nr = 0;
+    ulong flags;
+
+    spin_lock_irqsave(&pgdat->node_size_lock, &flags);
+    while (pgdat->first_deferred_pfn) {
+        nr += deferred_init_chunk(pgdat, zone, DEFERRED_GROW_PAGES);
+
+        spin_unlock_irqrestore(&pgdat->node_size_lock, flags);
+        cond_resched();
+        spin_lock_irqsave(&pgdat->node_size_lock, &flags);
+    }
+    spin_unlock_irqrestore(&pgdat->node_size_lock, flags);
+
+    printk("node %d deferred pages initialised: %lu pages in %llums\n",
+           pgdat->node_id, nr, (get_jiffies_64() - start) * 1000 / HZ);
+
+    if (atomic_dec_and_test(&pgdat_init_n_undone)) {
+        setup_per_zone_wmarks();
+        refresh_zone_stat_thresholds();
+    }
+
+    return 0;
+}
+
+/* 调度器起来之后调用，启动各节点的初始化线程，不等它们结束 */
+void page_alloc_init_late(void)
+{
+    struct pglist_data *pgdat;
+    struct task_struct *task;
+    int nid;
+
+    atomic_set(&pgdat_init_n_undone, 1);
+
+    for_each_online_node(nid) {
+        pgdat = NODE_DATA(nid);
+        if (!pgdat || !pgdat->first_deferred_pfn)
+            continue;
+
+        atomic_inc(&pgdat_init_n_undone);
+        task = kthread_run(deferred_init_memmap, pgdat, "pgdatinit%d", nid);
+        if (IS_ERR(task)) {
+            printk("node %d: failed to start pgdatinit, initialising inline\n",
+                   nid);
+            deferred_init_memmap(pgdat);
+        }
+    }
+
+    /* 去掉自己持有的那一份，没有线程时在这里收尾 */
+    if (atomic_dec_and_test(&pgdat_init_n_undone)) {
+        setup_per_zone_wmarks();
+        refresh_zone_stat_thresholds();
+    }
+}
+
+#else
+
+static inline bool defer_init(struct zone *zone, ulong pfn, ulong end_pfn)
+{
+    return false;
+}
+
+static inline void init_unavailable_range(ulong spfn, ulong epfn,
+                                          struct zone *zone)
+{
+}
+
+static inline void memmap_init_reserved_pages(void)
+{
+}
+
+ulong deferred_pfn_limit(ulong pfn)
+{
+    return max_pfn;
+}
+
+bool deferred_grow_zone(struct zone *zone, unsigned int order)
+{
+    return false;
+}
+
+void page_alloc_init_late(void)
+{
+}
+
+#endif /* CONFIG_DEFERRED_STRUCT_PAGE_INIT */
+
+/*
+ * 区域内的struct page只有开头一段在这里初始化，后面的推迟到
+ * 调度器起来之后；空洞总是立即初始化。
+ */
+void memmap_init_zone(struct zone *zone)
+{
+    ulong end_pfn = zone_end_pfn(zone);
+    ulong pfn;
+
+    for (pfn = zone->zone_start_pfn; pfn < end_pfn; pfn++) {
+        if (defer_init(zone, pfn, end_pfn))
+            break;
+        init_reserved_range(pfn, pfn + 1, zone);
+    }
+
+    if (pfn < end_pfn)
+        init_unavailable_range(pfn, end_pfn, zone);
+}
+
+/* 区域和区域列表都建好之后调用 */
+void mem_init(void)
+{
+    ulong freed, total;
+
+    memmap_init_reserved_pages();
+
+    freed = memblock_free_all();
+    total = PFN_DOWN(memblock_phys_mem_size());
+
+    setup_per_zone_wmarks();
+
+    printk("Memory: %luK/%luK available at boot (%luK reserved or deferred)\n",
+           freed << (PAGE_SHIFT - 10), total << (PAGE_SHIFT - 10),
+           (total - freed) << (PAGE_SHIFT - 10));
+}
@@ -0,0 +1,333 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/string.h"
+#include "../../include/acpi.h"
+#include "../../include/numa.h"
+#include "../../include/memblock.h"
+#include "internal.h"
+
+/*
+ * 节点发现与区域列表。节点的内存范围和CPU归属来自ACPI SRAT，距离来自
+ * SLIT；固件没有提供时退化为单节点。每个节点的区域列表按距离从近到远
+ * 排列，分配时先用本节点，水位不够再依次退到更远的节点。
+ */
+
+#define NR_NODE_MEMBLKS     (MAX_NUMNODES * 2)
+#define MAX_LOCAL_APIC      32768
+
+struct numa_memblk {
+    u64 start;
+    u64 end;
+    int nid;
+};
+
+nodemask_t node_online_map;
+int cpu_to_node_map[NR_CPUS];
+u8 numa_distance[MAX_NUMNODES][MAX_NUMNODES];
+
+static struct numa_memblk numa_memblks[NR_NODE_MEMBLKS];
+static int nr_numa_memblks;
+
+static s16 apicid_to_node[MAX_LOCAL_APIC];
+
+static struct pglist_data node_pgdat[MAX_NUMNODES];
+
+/* 各区域的上界，节点的范围按它切成DMA/DMA32/Normal */
+static const ulong zone_max_pfn[ZONE_NORMAL + 1] = {
+    [ZONE_DMA]      = MAX_DMA_PFN,
+    [ZONE_DMA32]    = MAX_DMA32_PFN,
+    [ZONE_NORMAL]   = ~0UL,
+};
+
+static const char * const zone_names[ZONE_NORMAL + 1] = {
+    [ZONE_DMA]      = "DMA",
+    [ZONE_DMA32]    = "DMA32",
+    [ZONE_NORMAL]   = "Normal",
+};
+
+int numa_add_memblk(int nid, u64 start, u64 end)
+{
+    struct numa_memblk *blk;
+
+    if (nid < 0 || nid >= MAX_NUMNODES || start >= end)
+        return -EINVAL;
+
+    if (nr_numa_memblks >= NR_NODE_MEMBLKS) {
+        printk("NUMA: too many memblks, ignoring [mem %#llx-%#llx]\n",
+               start, end - 1);
+        return -ENOMEM;
+    }
+
+    blk = &numa_memblks[nr_numa_memblks++];
+    blk->start = start;
+    blk->end = end;
+    blk->nid = nid;
+
+    printk("NUMA: node %d [mem %#llx-%#llx]\n", nid, start, end - 1);
+
+    return 0;
+}
+
+void numa_set_distance(int from, int to, int distance)
+{
+    if (from < 0 || from >= MAX_NUMNODES || to < 0 || to >= MAX_NUMNODES)
+        return;
+
+    /* 本节点距离必须是最小的LOCAL_DISTANCE，否则排序会出错 */
+    if ((from == to && distance != LOCAL_DISTANCE) ||
+        (from != to && distance <= LOCAL_DISTANCE) || distance > 255) {
+        printk("NUMA: invalid distance %d for node %d -> %d\n",
+               distance, from, to);
+        return;
+    }
+
+    numa_distance[from][to] = distance;
+}
+
+void set_apicid_to_node(int apicid, int node)
+{
+    if (apicid < 0 || apicid >= MAX_LOCAL_APIC)
+        return;
+
+    apicid_to_node[apicid] = node;
+}
+
+static void numa_reset_distance(void)
+{
+    int i, j;
+
+    for (i = 0; i < MAX_NUMNODES; i++) {
+        for (j = 0; j < MAX_NUMNODES; j++)
+            numa_distance[i][j] = (i == j) ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+    }
+}
+
+static int boot_cpu_apicid(void)
+{
+    u32 eax, ebx, ecx, edx;
+
+    asm volatile("cpuid"
+                 : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                 : "0" (1), "2" (0));
+
+    return ebx >> 24;
+}
+
+static void setup_node_data(int nid)
+{
+    struct pglist_data *pgdat = &node_pgdat[nid];
+    struct zone *zone;
+    ulong start_pfn = ~0UL;
+    ulong end_pfn = 0;
+    ulong present = 0;
+    ulong spfn, epfn;
+    ulong zone_start = 0;
+    int i, j;
+
+    memset(pgdat, 0, sizeof(*pgdat));
+    pgdat->node_id = nid;
+
+    for (i = 0; i < nr_numa_memblks; i++) {
+        if (numa_memblks[i].nid != nid)
+            continue;
+
+        /* SRAT可能列出尚未插上的热插拔内存，mem_map只覆盖到max_pfn */
+        spfn = PFN_UP(numa_memblks[i].start);
+        epfn = MIN(PFN_DOWN(numa_memblks[i].end), max_pfn);
+        if (spfn >= epfn)
+            continue;
+        start_pfn = MIN(start_pfn, spfn);
+        end_pfn = MAX(end_pfn, epfn);
+    }
+
+    if (start_pfn < end_pfn)
+        present = memblock_present_pages(start_pfn, end_pfn);
+
+    init_waitqueue_head(&pgdat->kswapd_wait);
+    init_waitqueue_head(&pgdat->pfmemalloc_wait);
+    init_waitqueue_head(&pgdat->kcompactd_wait);
+    spin_lock_init(&pgdat->node_size_lock);
+
+    for (i = 0; i < MAX_NR_ZONES; i++)
+        pgdat->node_zones[i].zone_pgdat = pgdat;
+
+    node_data[nid] = pgdat;
+
+    /* 只有CPU没有内存的节点：区域为空，分配全部退到最近的节点 */
+    if (!present) {
+        printk("NUMA: node %d has no memory\n", nid);
+        return;
+    }
+
+    pgdat->node_start_pfn = start_pfn;
+    pgdat->node_spanned_pages = end_pfn - start_pfn;
+    pgdat->node_present_pages = present;
+    pgdat->node_mem_map = pfn_to_page(start_pfn);
+
+    for (j = ZONE_DMA; j <= ZONE_NORMAL; j++) {
+        spfn = MAX(start_pfn, zone_start);
+        epfn = MIN(end_pfn, zone_max_pfn[j]);
+        zone_start = zone_max_pfn[j];
+
+        if (spfn >= epfn)
+            continue;
+
+        present = memblock_present_pages(spfn, epfn);
+        if (!present)
+            continue;
+
+        zone = &pgdat->node_zones[j];
+        zone->name = zone_names[j];
+        if (init_zone(zone, spfn, epfn - spfn, present)) {
+            printk("NUMA: failed to set up zone %s for node %d\n",
+                   zone_names[j], nid);
+            continue;
+        }
+        memmap_init_zone(zone);
+        pgdat->nr_zones = j + 1;
+
+        printk("  node %d %-6s [mem %#llx-%#llx] %lu pages\n", nid,
+               zone_names[j], PFN_PHYS(spfn), PFN_PHYS(epfn) - 1, present);
+    }
+}
+
+void numa_init(void)
+{
+    int i, nid, cpu;
+
+    nodes_clear(&node_online_map);
+    nr_numa_memblks = 0;
+    for (i = 0; i < MAX_LOCAL_APIC; i++)
+        apicid_to_node[i] = NUMA_NO_NODE;
+    numa_reset_distance();
+
+    if (acpi_numa_init() < 0) {
+        printk("NUMA: no SRAT found, faking a single node\n");
+        nr_numa_memblks = 0;
+        for (i = 0; i < MAX_LOCAL_APIC; i++)
+            apicid_to_node[i] = NUMA_NO_NODE;
+        numa_reset_distance();
+        numa_add_memblk(0, memblock_start_of_DRAM(), memblock_end_of_DRAM());
+    }
+
+    /* 把节点号补到memblock上，之后按节点分配和释放内存 */
+    for (i = 0; i < nr_numa_memblks; i++)
+        memblock_set_node(numa_memblks[i].start,
+                          numa_memblks[i].end - numa_memblks[i].start,
+                          numa_memblks[i].nid);
+
+    for (i = 0; i < nr_numa_memblks; i++)
+        node_set(numa_memblks[i].nid, &node_online_map);
+    for (i = 0; i < MAX_LOCAL_APIC; i++) {
+        if (apicid_to_node[i] != NUMA_NO_NODE)
+            node_set(apicid_to_node[i], &node_online_map);
+    }
+    if (nodes_empty(&node_online_map))
+        node_set(0, &node_online_map);
+
+    for_each_online_node(nid)
+        setup_node_data(nid);
+
+    /* 其它CPU在启动时按各自的APIC ID再设置 */
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        cpu_to_node_map[cpu] = first_node(&node_online_map);
+
+    nid = apicid_to_node[boot_cpu_apicid()];
+    if (nid != NUMA_NO_NODE)
+        cpu_to_node_map[smp_processor_id()] = nid;
+}
+
+/* AP启动前按它的APIC ID定下所在节点，SRAT里没有它时归到第一个节点 */
+void numa_add_cpu(int cpu, int apicid)
+{
+    int nid = NUMA_NO_NODE;
+
+    if (apicid >= 0 && apicid < MAX_LOCAL_APIC)
+        nid = apicid_to_node[apicid];
+    if (nid == NUMA_NO_NODE || !node_isset(nid, &node_online_map))
+        nid = first_node(&node_online_map);
+
+    cpu_to_node_map[cpu] = nid;
+}
+
+/* 在未使用的节点中找离node最近的一个，node自身总是第一个 */
+static int find_next_best_node(int node, nodemask_t *used)
+{
+    int n, best = NUMA_NO_NODE;
+    int min = 256;
+
+    if (!node_isset(node, used)) {
+        node_set(node, used);
+        return node;
+    }
+
+    for_each_online_node(n) {
+        if (node_isset(n, used))
+            continue;
+
+        if (node_distance(node, n) < min) {
+            min = node_distance(node, n);
+            best = n;
+        }
+    }
+
+    if (best != NUMA_NO_NODE)
+        node_set(best, used);
+
+    return best;
+}
+
+/* 同一节点内从高区域往低区域退，DMA这类稀缺区域放到最后 */
+static int build_zonerefs_node(struct pglist_data *pgdat, struct zoneref *zonerefs)
+{
+    struct zone *zone;
+    int zone_type = MAX_NR_ZONES;
+    int nr = 0;
+
+    while (zone_type--) {
+        zone = &pgdat->node_zones[zone_type];
+        if (zone->present_pages) {
+            zonerefs[nr].zone = zone;
+            zonerefs[nr].zone_idx = zone_type;
+            nr++;
+        }
+    }
+
+    return nr;
+}
+
+static void build_zonelists(struct pglist_data *pgdat)
+{
+    struct zoneref *zonerefs;
+    nodemask_t used;
+    int local = pgdat->node_id;
+    int node, nr = 0;
+
+    nodes_clear(&used);
+
+    printk("Fallback order for node %d:", local);
+    zonerefs = pgdat->node_zonelists[ZONELIST_FALLBACK]._zonerefs;
+    while ((node = find_next_best_node(local, &used)) != NUMA_NO_NODE) {
+        nr += build_zonerefs_node(NODE_DATA(node), zonerefs + nr);
+        printk(" %d", node);
+    }
+    printk("\n");
+    zonerefs[nr].zone = NULL;
+    zonerefs[nr].zone_idx = 0;
+
+    zonerefs = pgdat->node_zonelists[ZONELIST_NOFALLBACK]._zonerefs;
+    nr = build_zonerefs_node(pgdat, zonerefs);
+    zonerefs[nr].zone = NULL;
+    zonerefs[nr].zone_idx = 0;
+}
+
+void build_all_zonelists(void)
+{
+    int nid;
+
+    for_each_online_node(nid)
+        build_zonelists(NODE_DATA(nid));
+
+    printk("Built %d zonelists\n", nodes_weight(&node_online_map));
+}
@@ -0,0 +1,98 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/swap.h"
+#include "../../include/vmstat.h"
+#include "internal.h"
+
+/*
+ * 交换页的读写。写出先试zswap，压缩存进内存就算写完；zswap不收时才
+ * 写到交换设备。读入按同样顺序查找。设备读写是同步的，返回时页已
+ * 写完或读好。
+ */
+
+static inline sector_t swap_page_sector(pgoff_t offset)
+{
+    return (sector_t)offset << (PAGE_SHIFT - 9);
+}
+
+/*
+ * 调用者持页锁，页在交换缓存里且已标脏。写完解锁；写不出去时页保持
+ * 脏，仍在交换缓存里，返回负数，回收路径会把它留着。
+ */
+int swap_writepage(struct page *page)
+{
+    swp_entry_t entry = page_swap_entry(page);
+    struct swap_info_struct *si = swp_swap_info(entry);
+    int ret;
+
+    VM_BUG_ON_PAGE(!PageSwapCache(page), page);
+
+    if (!clear_page_dirty_for_io(page)) {
+        unlock_page(page);
+        return 0;
+    }
+
+    SetPageWriteback(page);
+    unlock_page(page);
+
+    if (!zswap_store(swp_type(entry), swp_offset(entry), page)) {
+        ret = 0;
+        goto out;
+    }
+
+    if (!si->bdev) {
+        ret = -ENOSPC;
+        goto out;
+    }
+
+    ret = bdev_write_page(si->bdev, swap_page_sector(swp_offset(entry)), page);
+    if (!ret)
+        count_vm_event(PSWPOUT);
+
+out:
+    if (ret) {
+        SetPageDirty(page);
+        SetPageError(page);
+    }
+    end_page_writeback(page);
+
+    return ret;
+}
+
+/* 调用者持页锁，读完置PG_uptodate并解锁 */
+int swap_readpage(struct page *page)
+{
+    swp_entry_t entry = page_swap_entry(page);
+    struct swap_info_struct *si = swp_swap_info(entry);
+    int ret;
+
+    VM_BUG_ON_PAGE(!PageSwapCache(page), page);
+    VM_BUG_ON_PAGE(!PageLocked(page), page);
+
+    if (!zswap_load(swp_type(entry), swp_offset(entry), page)) {
+        ret = 0;
+        goto out;
+    }
+
+    if (!si->bdev) {
+        ret = -EIO;
+        goto out;
+    }
+
+    ret = bdev_read_page(si->bdev, swap_page_sector(swp_offset(entry)), page);
+    if (!ret)
+        count_vm_event(PSWPIN);
+
+out:
+    if (ret) {
+        SetPageError(page);
+        printk("swap: read error on swap %u offset %lu\n",
+               swp_type(entry), swp_offset(entry));
+    } else {
+        SetPageUptodate(page);
+    }
+    unlock_page(page);
+
+    return ret;
+}
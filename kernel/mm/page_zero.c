@@ -0,0 +1,200 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/gfp.h"
+#include "../../include/page.h"
+#include "internal.h"
+
+/*
+ * 预清零页池：kzerod在后台从伙伴系统取0阶页面清零，挂在zone->zero_list
+ * 上并打上PG_zeroed。__GFP_ZERO的0阶分配优先从池中取，缺页和页表分配
+ * 因此不必在自己的路径上清页。池中页面是从伙伴系统分配出来的，不计入
+ * NR_FREE_PAGES；补池受zone_can_refill限制，分配失败时池会被
+ * drain_zeroed_pages还给伙伴系统。
+ *
+ * 只为不可移动(页表等)和可移动(匿名页)两种类型建池。
+ */
+
+#define ZERO_POOL_LOW       64      /* 低于此数唤醒kzerod */
+#define ZERO_POOL_HIGH      256     /* kzerod补到此数为止 */
+
+static wait_queue_head_t kzerod_wait;
+static struct task_struct *kzerod_task;
+
+static const gfp_t zero_pool_gfp[MIGRATE_PCPTYPES] = {
+    [MIGRATE_UNMOVABLE]   = __GFP_NOWARN,
+    [MIGRATE_MOVABLE]     = __GFP_MOVABLE | __GFP_NOWARN,
+    [MIGRATE_RECLAIMABLE] = 0,
+};
+
+static inline bool zero_pool_type(int migratetype)
+{
+    return migratetype < MIGRATE_PCPTYPES && zero_pool_gfp[migratetype];
+}
+
+/* 补池不能把区域压到高水位以下，否则等于替kswapd制造压力 */
+static bool zone_can_refill(struct zone *zone)
+{
+    return zone_page_state(zone, NR_FREE_PAGES) >
+           zone->watermark[WMARK_HIGH] + ZERO_POOL_HIGH;
+}
+
+static bool zone_needs_zeroing(struct zone *zone)
+{
+    int mt;
+
+    if (!zone->present_pages || !zone_can_refill(zone))
+        return false;
+
+    for (mt = 0; mt < MIGRATE_PCPTYPES; mt++) {
+        if (zero_pool_type(mt) && zone->nr_zeroed[mt] < ZERO_POOL_LOW)
+            return true;
+    }
+
+    return false;
+}
+
+struct page *take_zeroed_page(struct zone *zone, int migratetype)
+{
+    struct page *page = NULL;
+    ulong flags;
+    ulong left;
+
+    if (!zero_pool_type(migratetype))
+        return NULL;
+
+    if (list_empty(&zone->zero_list[migratetype]))
+        goto wakeup;
+
+    spin_lock_irqsave(&zone->zero_lock, &flags);
+    if (!list_empty(&zone->zero_list[migratetype])) {
+        page = list_first_entry(&zone->zero_list[migratetype], struct page, lru);
+        list_del(&page->lru);
+        zone->nr_zeroed[migratetype]--;
+    }
+    left = zone->nr_zeroed[migratetype];
+    spin_unlock_irqrestore(&zone->zero_lock, flags);
+
+    if (left >= ZERO_POOL_LOW)
+        return page;
+
+wakeup:
+    if (waitqueue_active(&kzerod_wait) && zone_can_refill(zone))
+        wake_up_interruptible(&kzerod_wait);
+
+    return page;
+}
+
+ulong drain_zeroed_pages(struct zone *zone)
+{
+    struct list_head pages;
+    struct page *page;
+    ulong flags;
+    ulong nr = 0;
+    int mt;
+
+    INIT_LIST_HEAD(&pages);
+
+    spin_lock_irqsave(&zone->zero_lock, &flags);
+    for (mt = 0; mt < MIGRATE_PCPTYPES; mt++) {
+        while (!list_empty(&zone->zero_list[mt])) {
+            page = list_first_entry(&zone->zero_list[mt], struct page, lru);
+            list_move(&page->lru, &pages);
+        }
+        nr += zone->nr_zeroed[mt];
+        zone->nr_zeroed[mt] = 0;
+    }
+    spin_unlock_irqrestore(&zone->zero_lock, flags);
+
+    if (!nr)
+        return 0;
+
+    /* 池中页面持有分配时的引用，放掉后整批还给伙伴系统 */
+    list_for_each_entry(page, &pages, lru) {
+        ClearPageZeroed(page);
+        set_page_count(page, 0);
+        set_page_private(page, 0);
+    }
+    free_pages_list(&pages);
+
+    return nr;
+}
+
+static void refill_zone(struct zone *zone, int migratetype)
+{
+    struct page *page;
+    ulong flags;
+
+    while (zone->nr_zeroed[migratetype] < ZERO_POOL_HIGH) {
+        if (!zone_can_refill(zone) || kthread_should_stop())
+            break;
+
+        page = alloc_pages_zone(zone, zero_pool_gfp[migratetype], 0);
+        if (!page)
+            break;
+
+        /* 池中页面要等到被分配才访问，用非临时存储免得冲掉缓存 */
+        clear_page_nocache(page_address(page));
+        SetPageZeroed(page);
+
+        spin_lock_irqsave(&zone->zero_lock, &flags);
+        list_add_tail(&page->lru, &zone->zero_list[migratetype]);
+        zone->nr_zeroed[migratetype]++;
+        spin_unlock_irqrestore(&zone->zero_lock, flags);
+
+        cond_resched();
+    }
+}
+
+static bool kzerod_work_requested(void)
+{
+    struct zone *zone;
+
+    if (kthread_should_stop())
+        return true;
+
+    for_each_zone(zone) {
+        if (zone_needs_zeroing(zone))
+            return true;
+    }
+
+    return false;
+}
+
+static int kzerod(void *unused)
+{
+    struct zone *zone;
+    int mt;
+
+    /* 清页只是提前做掉的工作，不能和前台任务抢CPU */
+    set_user_nice(current, MAX_NICE);
+
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(kzerod_wait, kzerod_work_requested());
+
+        for_each_zone(zone) {
+            if (!zone->present_pages)
+                continue;
+
+            for (mt = 0; mt < MIGRATE_PCPTYPES; mt++) {
+                if (zero_pool_type(mt))
+                    refill_zone(zone, mt);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void kzerod_init(void)
+{
+    init_waitqueue_head(&kzerod_wait);
+
+    kzerod_task = kthread_run(kzerod, NULL, "kzerod");
+    if (IS_ERR(kzerod_task)) {
+        printk("kzerod: failed to start\n");
+        kzerod_task = NULL;
+    }
+}
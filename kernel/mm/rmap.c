@@ -0,0 +1,269 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/pgtable.h"
+#include "../../include/swap.h"
+#include "../../include/rmap.h"
+#include "internal.h"
+
+/*
+ * 反向映射：回收时从页找到映射它的页表项。匿名页只有一个映射，
+ * mapping记VMA，index记虚拟页号，见rmap.h。映射它的页表项持页的
+ * 一个引用，_mapcount在mm->page_table_lock下增减。
+ */
+
+static inline ulong page_anon_address(struct page *page)
+{
+    return page->index << PAGE_SHIFT;
+}
+
+static void __page_set_anon_rmap(struct page *page, struct vm_area_struct *vma,
+                                 ulong address)
+{
+    page->mapping = (struct address_space *)((ulong)vma | PAGE_MAPPING_ANON);
+    page->index = address >> PAGE_SHIFT;
+}
+
+/* 缺页新分配的匿名页，还没有别人能看到它 */
+void page_add_new_anon_rmap(struct page *page, struct vm_area_struct *vma,
+                            ulong address)
+{
+    SetPageSwapBacked(page);
+    atomic_set(&page->_mapcount, 0);
+    __page_set_anon_rmap(page, vma, address);
+}
+
+/* 换入的页重新映射。页可能在交换缓存里留过，mapping要重新记 */
+void page_add_anon_rmap(struct page *page, struct vm_area_struct *vma,
+                        ulong address)
+{
+    if (atomic_inc_and_test(&page->_mapcount))
+        __page_set_anon_rmap(page, vma, address);
+}
+
+/*
+ * 映射拆掉了。mapping留着，页还在交换缓存里时PageAnon仍然成立，
+ * 释放时由伙伴系统清掉。
+ */
+void page_remove_rmap(struct page *page)
+{
+    atomic_dec(&page->_mapcount);
+}
+
+/* address处的页表项，页表还没建好时返回NULL */
+static pte_t *anon_pte_offset(struct mm_struct *mm, ulong address)
+{
+    pgd_t *pgd;
+    pud_t *pud;
+    pmd_t *pmd;
+
+    pgd = pgd_offset(mm, address);
+    if (pgd_none(*pgd))
+        return NULL;
+
+    pud = pud_offset(pgd, address);
+    if (pud_none(*pud))
+        return NULL;
+
+    /* 大页PMD不会被拆，这里不处理 */
+    pmd = pmd_offset(pud, address);
+    if (pmd_none(*pmd) || pmd_trans_huge(*pmd))
+        return NULL;
+
+    return pte_offset(pmd, address);
+}
+
+/* address处映射page的页表项，找到时持mm->page_table_lock返回 */
+static pte_t *page_check_address(struct page *page, struct mm_struct *mm,
+                                 ulong address)
+{
+    pte_t *pte;
+
+    pte = anon_pte_offset(mm, address);
+    if (!pte)
+        return NULL;
+
+    spin_lock(&mm->page_table_lock);
+    if (pte_present(*pte) && pte_page(*pte) == page)
+        return pte;
+    spin_unlock(&mm->page_table_lock);
+
+    return NULL;
+}
+
+/*
+ * 映射该页的页表项里有几个被访问过，顺带清掉访问位，下一轮扫描看的
+ * 就是这期间的访问。被访问过的VMA标志记到vm_flags里。
+ */
+int page_referenced(struct page *page, int is_locked,
+                    struct mem_cgroup *memcg, ulong *vm_flags)
+{
+    struct vm_area_struct *vma;
+    struct mm_struct *mm;
+    pte_t *pte;
+    int referenced = 0;
+
+    *vm_flags = 0;
+
+    if (!page_mapped(page) || !PageAnon(page))
+        return 0;
+
+    vma = page_anon_vma(page);
+    mm = vma->vm_mm;
+
+    pte = page_check_address(page, mm, page_anon_address(page));
+    if (!pte)
+        return 0;
+
+    if (ptep_test_and_clear_young(pte)) {
+        referenced++;
+        *vm_flags |= vma->vm_flags;
+    }
+
+    spin_unlock(&mm->page_table_lock);
+
+    return referenced;
+}
+
+/*
+ * 拆掉匿名页的映射。回收时页表项换成交换槽位，以后缺页由do_swap_page
+ * 换回，页必须已经在交换缓存里，否则内容就丢了；迁移时换成记着页框号
+ * 的迁移项，由remove_migration_ptes换成新页。调用者持页锁。
+ */
+static int try_to_unmap_anon(struct page *page, enum ttu_flags flags)
+{
+    struct vm_area_struct *vma = page_anon_vma(page);
+    struct mm_struct *mm = vma->vm_mm;
+    ulong address = page_anon_address(page);
+    swp_entry_t entry;
+    pte_t *pte;
+    pte_t pteval;
+    int ret = SWAP_SUCCESS;
+
+    if (!(flags & TTU_MIGRATION) && !PageSwapCache(page))
+        return SWAP_FAIL;
+
+    pte = page_check_address(page, mm, address);
+    if (!pte)
+        return SWAP_AGAIN;
+
+    /* 页表项里的槽位也要算一个引用 */
+    if (!(flags & TTU_MIGRATION)) {
+        entry = page_swap_entry(page);
+        if (swap_duplicate(entry) < 0) {
+            ret = SWAP_FAIL;
+            goto out_unlock;
+        }
+    }
+
+    /* 先清掉再冲TLB，之后别的CPU再写就会缺页，脏位只可能在pteval里 */
+    pteval = ptep_get_and_clear(pte);
+    flush_tlb_page(vma, address);
+
+    if (pte_val(pteval) & _PAGE_DIRTY)
+        SetPageDirty(page);
+
+    if (flags & TTU_MIGRATION)
+        entry = make_migration_entry(page, pte_val(pteval) & _PAGE_RW);
+    set_pte(pte, swp_entry_to_pte(entry));
+
+    page_remove_rmap(page);
+    put_page(page);
+
+out_unlock:
+    spin_unlock(&mm->page_table_lock);
+    return ret;
+}
+
+/* 调用者持页锁；文件页没有反向映射，拆不掉 */
+int try_to_unmap(struct page *page, enum ttu_flags flags)
+{
+    VM_BUG_ON_PAGE(!PageLocked(page), page);
+
+    if (!page_mapped(page))
+        return SWAP_SUCCESS;
+
+    if (!PageAnon(page) || PageCompound(page))
+        return SWAP_FAIL;
+
+    return try_to_unmap_anon(page, flags);
+}
+
+/*
+ * 迁移结束或放弃时调用：old的迁移项换回指向new的页表项，new可以就是
+ * old。new的mapping和index已经从old抄过来。调用者持old的页锁。
+ */
+void remove_migration_ptes(struct page *old, struct page *new)
+{
+    struct vm_area_struct *vma = page_anon_vma(new);
+    struct mm_struct *mm;
+    ulong address;
+    swp_entry_t entry;
+    pte_t *ptep;
+    pte_t pte;
+
+    if (!vma)
+        return;
+
+    mm = vma->vm_mm;
+    address = page_anon_address(new);
+
+    ptep = anon_pte_offset(mm, address);
+    if (!ptep)
+        return;
+
+    spin_lock(&mm->page_table_lock);
+
+    pte = *ptep;
+    if (!is_swap_pte(pte))
+        goto out_unlock;
+
+    entry = pte_to_swp_entry(pte);
+    if (!is_migration_entry(entry) || migration_entry_to_page(entry) != old)
+        goto out_unlock;
+
+    pte = pfn_pte(page_to_pfn(new), vm_get_page_prot(vma->vm_flags));
+    if (is_write_migration_entry(entry))
+        pte = pte_mkwrite(pte);
+
+    get_page(new);
+    page_add_anon_rmap(new, vma, address);
+    set_pte(ptep, pte);
+
+out_unlock:
+    spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * 缺页碰到迁移项：等迁移的一方放开页锁再返回，由缺页重试。页的引用数
+ * 被冻结时拿不到引用，迁移马上就结束，直接重试。
+ */
+void migration_entry_wait(struct mm_struct *mm, pte_t *ptep)
+{
+    swp_entry_t entry;
+    struct page *page;
+    pte_t pte;
+
+    spin_lock(&mm->page_table_lock);
+
+    pte = *ptep;
+    if (!is_swap_pte(pte))
+        goto out_unlock;
+
+    entry = pte_to_swp_entry(pte);
+    if (!is_migration_entry(entry))
+        goto out_unlock;
+
+    page = migration_entry_to_page(entry);
+    if (!get_page_unless_zero(page))
+        goto out_unlock;
+
+    spin_unlock(&mm->page_table_lock);
+
+    wait_on_page_locked(page);
+    put_page(page);
+    return;
+
+out_unlock:
+    spin_unlock(&mm->page_table_lock);
+}
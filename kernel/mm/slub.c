@@ -0,0 +1,702 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/bitops.h"
+#include "../../include/slab.h"
+#include "../../include/string.h"
+#include "../../include/numa.h"
+#include "../../include/smp.h"
+#include "internal.h"
+
+/*
+ * SLUB风格的对象分配器。
+ *
+ * 每个CPU持有一个冻结的slab，对象从kmem_cache_cpu::freelist无锁地分配和
+ * 释放(只需关中断)。本CPU的链表用完后先收回其它CPU释放到该slab的对象，
+ * 再从节点的部分空闲链表中取slab，最后才向伙伴系统要新页。
+ *
+ * slab元数据直接放在struct page中：freelist/slab_cache/s_mem以及
+ * inuse/objects/frozen计数，非冻结slab的这些字段由list_lock保护。
+ */
+
+static struct list_head slab_caches;
+static spinlock_t slab_lock;
+
+/* kmem_cache结构本身也从slab分配，第一个缓存静态分配用于自举 */
+static struct kmem_cache kmem_cache_boot;
+static struct kmem_cache *kmem_cache;
+
+struct kmem_cache *kmalloc_caches[KMALLOC_SHIFT_HIGH + 1];
+
+static const char *kmalloc_names[KMALLOC_SHIFT_HIGH + 1] = {
+    [1] = "kmalloc-96",
+    [2] = "kmalloc-192",
+    [3] = "kmalloc-8",
+    [4] = "kmalloc-16",
+    [5] = "kmalloc-32",
+    [6] = "kmalloc-64",
+    [7] = "kmalloc-128",
+    [8] = "kmalloc-256",
+    [9] = "kmalloc-512",
+    [10] = "kmalloc-1024",
+    [11] = "kmalloc-2048",
+    [12] = "kmalloc-4096",
+    [13] = "kmalloc-8192",
+};
+
+static inline void *get_freepointer(struct kmem_cache *s, void *object)
+{
+    return *(void **)((char *)object + s->offset);
+}
+
+static inline void set_freepointer(struct kmem_cache *s, void *object, void *fp)
+{
+    *(void **)((char *)object + s->offset) = fp;
+}
+
+static inline struct kmem_cache_cpu *this_cpu_slab(struct kmem_cache *s)
+{
+    return &s->cpu_slab[smp_processor_id()];
+}
+
+static inline struct kmem_cache_node *get_node(struct kmem_cache *s, int node)
+{
+    return &s->node[node];
+}
+
+static inline struct page *virt_to_head_page(const void *x)
+{
+    return compound_head(virt_to_page(x));
+}
+
+static int kmalloc_index(size_t size)
+{
+    if (size <= KMALLOC_MIN_SIZE)
+        return KMALLOC_SHIFT_LOW;
+
+    if (size > 64 && size <= 96)
+        return 1;
+    if (size > 128 && size <= 192)
+        return 2;
+
+    return fls(size - 1);
+}
+
+static ulong calculate_alignment(ulong flags, ulong align, ulong size)
+{
+    ulong ralign;
+
+    /* 小对象不必独占一整条缓存行，两个对象能放进一行时就减半 */
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        ralign = L1_CACHE_BYTES;
+        while (size <= ralign / 2)
+            ralign /= 2;
+        align = MAX(align, ralign);
+    }
+
+    if (align < ARCH_KMALLOC_MINALIGN)
+        align = ARCH_KMALLOC_MINALIGN;
+
+    return ALIGN_UP(align, sizeof(void *));
+}
+
+/* 选择slab阶数：尾部浪费不超过1/16，并尽量放下至少4个对象 */
+static int calculate_order(ulong size)
+{
+    ulong slab_size;
+    int order;
+
+    for (order = get_order(size); order <= SLUB_MAX_ORDER; order++) {
+        slab_size = PAGE_SIZE << order;
+
+        if (slab_size / size < 4 && order < SLUB_MAX_ORDER)
+            continue;
+
+        if ((slab_size % size) * 16 <= slab_size)
+            return order;
+    }
+
+    return MAX(get_order(size), SLUB_MAX_ORDER);
+}
+
+static int calculate_sizes(struct kmem_cache *s)
+{
+    ulong size = ALIGN_UP((ulong)s->object_size, sizeof(void *));
+
+    /* 有构造函数时对象内容在空闲时也要保持，空闲指针放到对象之后 */
+    if (s->ctor) {
+        s->offset = size;
+        size += sizeof(void *);
+    } else {
+        s->offset = 0;
+    }
+
+    size = ALIGN_UP(size, (ulong)s->align);
+    s->size = size;
+
+    s->order = calculate_order(size);
+    s->objects = (PAGE_SIZE << s->order) / size;
+
+    s->allocflags = 0;
+    if (s->order)
+        s->allocflags |= __GFP_COMP;
+
+    return s->objects > 0;
+}
+
+static int kmem_cache_open(struct kmem_cache *s, const char *name, size_t size,
+                           size_t align, ulong flags, void (*ctor)(void *))
+{
+    int cpu, node;
+
+    s->name = name;
+    s->flags = flags;
+    s->object_size = size;
+    s->align = calculate_alignment(flags, align, size);
+    s->ctor = ctor;
+
+    if (!calculate_sizes(s))
+        return -EINVAL;
+
+    /* 对象越大，空slab回收给伙伴系统的代价越高，保留的部分链表越长 */
+    s->min_partial = CLAMP(fls(s->size) / 2, 5, 10);
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        s->cpu_slab[cpu].freelist = NULL;
+        s->cpu_slab[cpu].page = NULL;
+    }
+
+    for (node = 0; node < MAX_NUMNODES; node++) {
+        struct kmem_cache_node *n = get_node(s, node);
+
+        spin_lock_init(&n->list_lock);
+        n->nr_partial = 0;
+        INIT_LIST_HEAD(&n->partial);
+    }
+
+    return 0;
+}
+
+static struct page *new_slab(struct kmem_cache *s, gfp_t flags)
+{
+    struct page *page;
+    void *start, *p, *next;
+    int i;
+
+    page = alloc_pages((flags & ~__GFP_ZERO) | s->allocflags, s->order);
+    if (!page)
+        return NULL;
+
+    SetPageSlab(page);
+    page->slab_cache = s;
+    page->objects = s->objects;
+    page->inuse = 0;
+    page->frozen = 0;
+
+    start = page_address(page);
+    page->s_mem = start;
+
+    for (i = 0, p = start; i < s->objects - 1; i++, p = next) {
+        next = (char *)p + s->size;
+        if (s->ctor)
+            s->ctor(p);
+        set_freepointer(s, p, next);
+    }
+    if (s->ctor)
+        s->ctor(p);
+    set_freepointer(s, p, NULL);
+
+    page->freelist = start;
+
+    mod_zone_page_state(page_zone(page), NR_SLAB_UNRECLAIMABLE, 1 << s->order);
+
+    return page;
+}
+
+static void discard_slab(struct kmem_cache *s, struct page *page)
+{
+    /* slab字段与mapping/_mapcount重叠，还给伙伴系统前要复原 */
+    ClearPageSlab(page);
+    page->s_mem = NULL;
+    page->slab_cache = NULL;
+    page->freelist = NULL;
+    page_mapcount_reset(page);
+
+    mod_zone_page_state(page_zone(page), NR_SLAB_UNRECLAIMABLE, -(1 << s->order));
+
+    __free_pages(page, s->order);
+}
+
+static void add_partial(struct kmem_cache_node *n, struct page *page, int tail)
+{
+    if (tail)
+        list_add_tail(&page->list, &n->partial);
+    else
+        list_add(&page->list, &n->partial);
+    n->nr_partial++;
+}
+
+static void remove_partial(struct kmem_cache_node *n, struct page *page)
+{
+    list_del(&page->list);
+    n->nr_partial--;
+}
+
+/* 冻结slab并取走它的空闲链表，调用者持有list_lock */
+static void *acquire_slab(struct kmem_cache_node *n, struct page *page)
+{
+    void *freelist = page->freelist;
+
+    remove_partial(n, page);
+    page->freelist = NULL;
+    page->inuse = page->objects;
+    page->frozen = 1;
+
+    return freelist;
+}
+
+static void *get_partial_node(struct kmem_cache_node *n, struct kmem_cache_cpu *c)
+{
+    struct page *page;
+    void *freelist = NULL;
+
+    if (!n->nr_partial)
+        return NULL;
+
+    spin_lock(&n->list_lock);
+    if (!list_empty(&n->partial)) {
+        page = list_first_entry(&n->partial, struct page, list);
+        freelist = acquire_slab(n, page);
+        c->page = page;
+    }
+    spin_unlock(&n->list_lock);
+
+    return freelist;
+}
+
+static void *get_partial(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+    int local = numa_node_id();
+    int node;
+    void *freelist;
+
+    freelist = get_partial_node(get_node(s, local), c);
+    if (freelist)
+        return freelist;
+
+    for (node = 0; node < MAX_NUMNODES; node++) {
+        if (node == local)
+            continue;
+        freelist = get_partial_node(get_node(s, node), c);
+        if (freelist)
+            return freelist;
+    }
+
+    return NULL;
+}
+
+/*
+ * 收回其它CPU释放到本CPU冻结slab上的对象。没有的话slab已满，解冻后
+ * 不挂在任何链表上，等到有对象释放时再由__slab_free放回部分链表。
+ */
+static void *get_freelist(struct kmem_cache *s, struct page *page)
+{
+    struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+    void *freelist;
+
+    spin_lock(&n->list_lock);
+    freelist = page->freelist;
+    page->freelist = NULL;
+    if (freelist)
+        page->inuse = page->objects;
+    else
+        page->frozen = 0;
+    spin_unlock(&n->list_lock);
+
+    return freelist;
+}
+
+/* 把本CPU的slab和剩余空闲对象还给节点，调用者关中断 */
+static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+    struct page *page = c->page;
+    struct kmem_cache_node *n;
+    void *freelist = c->freelist;
+    void *next;
+
+    c->page = NULL;
+    c->freelist = NULL;
+
+    if (!page)
+        return;
+
+    n = get_node(s, page_to_nid(page));
+    spin_lock(&n->list_lock);
+
+    while (freelist) {
+        next = get_freepointer(s, freelist);
+        set_freepointer(s, freelist, page->freelist);
+        page->freelist = freelist;
+        page->inuse--;
+        freelist = next;
+    }
+
+    page->frozen = 0;
+
+    if (!page->inuse && n->nr_partial >= s->min_partial) {
+        spin_unlock(&n->list_lock);
+        discard_slab(s, page);
+        return;
+    }
+
+    if (page->freelist)
+        add_partial(n, page, 1);
+
+    spin_unlock(&n->list_lock);
+}
+
+static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags)
+{
+    struct kmem_cache_cpu *c = this_cpu_slab(s);
+    struct page *page;
+    void *freelist;
+
+    if (c->page) {
+        freelist = get_freelist(s, c->page);
+        if (freelist)
+            goto load_freelist;
+        c->page = NULL;
+    }
+
+    freelist = get_partial(s, c);
+    if (freelist)
+        goto load_freelist;
+
+    /* 伙伴分配可能进入直接压缩而睡眠，这段时间打开中断 */
+    if (gfpflags & __GFP_DIRECT_RECLAIM)
+        local_irq_enable();
+
+    page = new_slab(s, gfpflags);
+
+    if (gfpflags & __GFP_DIRECT_RECLAIM)
+        local_irq_disable();
+
+    if (!page)
+        return NULL;
+
+    /* 开中断期间本CPU可能已经装上了别的slab */
+    c = this_cpu_slab(s);
+    if (c->page)
+        deactivate_slab(s, c);
+
+    freelist = page->freelist;
+    page->freelist = NULL;
+    page->inuse = page->objects;
+    page->frozen = 1;
+    c->page = page;
+
+load_freelist:
+    c->freelist = get_freepointer(s, freelist);
+    return freelist;
+}
+
+static void *slab_alloc(struct kmem_cache *s, gfp_t gfpflags)
+{
+    struct kmem_cache_cpu *c;
+    void *object;
+    ulong flags;
+
+    flags = local_irq_save();
+
+    c = this_cpu_slab(s);
+    object = c->freelist;
+    if (likely(object))
+        c->freelist = get_freepointer(s, object);
+    else
+        object = __slab_alloc(s, gfpflags);
+
+    local_irq_restore(flags);
+
+    if (unlikely(gfpflags & __GFP_ZERO) && object)
+        memset(object, 0, s->object_size);
+
+    return object;
+}
+
+static void __slab_free(struct kmem_cache *s, struct page *page, void *x)
+{
+    struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+    bool was_full;
+
+    spin_lock(&n->list_lock);
+
+    was_full = page->freelist == NULL;
+    set_freepointer(s, x, page->freelist);
+    page->freelist = x;
+    page->inuse--;
+
+    /* 冻结的slab归某个CPU所有，由它在get_freelist时收回 */
+    if (page->frozen) {
+        spin_unlock(&n->list_lock);
+        return;
+    }
+
+    if (!page->inuse && n->nr_partial >= s->min_partial) {
+        if (!was_full)
+            remove_partial(n, page);
+        spin_unlock(&n->list_lock);
+        discard_slab(s, page);
+        return;
+    }
+
+    if (was_full)
+        add_partial(n, page, 1);
+
+    spin_unlock(&n->list_lock);
+}
+
+static void slab_free(struct kmem_cache *s, struct page *page, void *x)
+{
+    struct kmem_cache_cpu *c;
+    ulong flags;
+
+    flags = local_irq_save();
+
+    c = this_cpu_slab(s);
+    if (likely(page == c->page)) {
+        set_freepointer(s, x, c->freelist);
+        c->freelist = x;
+    } else {
+        __slab_free(s, page, x);
+    }
+
+    local_irq_restore(flags);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *s, gfp_t flags)
+{
+    return slab_alloc(s, flags);
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *s, gfp_t flags)
+{
+    return slab_alloc(s, flags | __GFP_ZERO);
+}
+
+void kmem_cache_free(struct kmem_cache *s, void *x)
+{
+    struct page *page;
+
+    if (!x)
+        return;
+
+    page = virt_to_head_page(x);
+    if (unlikely(!PageSlab(page) || page->slab_cache != s)) {
+        printk("kmem_cache_free: %s: object %p not from this cache\n",
+               s->name, x);
+        return;
+    }
+
+    slab_free(s, page, x);
+}
+
+/* 在每个CPU上执行，中断已关 */
+static void flush_cpu_slab(void *info)
+{
+    struct kmem_cache *s = info;
+
+    deactivate_slab(s, this_cpu_slab(s));
+}
+
+/*
+ * cpu_slab只有所属CPU在关中断时才能动，别的CPU直接摘会和它的快速
+ * 路径冲突，所以要发IPI让每个CPU各自交回自己的slab
+ */
+static void flush_cpu_slabs(struct kmem_cache *s)
+{
+    on_each_cpu(flush_cpu_slab, s);
+}
+
+/* 释放所有空slab，返回仍有对象在用的slab数 */
+static int free_partial(struct kmem_cache *s)
+{
+    struct kmem_cache_node *n;
+    struct page *page;
+    struct list_head *pos, *next;
+    struct list_head discard;
+    int node, busy = 0;
+
+    INIT_LIST_HEAD(&discard);
+
+    for (node = 0; node < MAX_NUMNODES; node++) {
+        n = get_node(s, node);
+
+        spin_lock(&n->list_lock);
+        for (pos = n->partial.next; pos != &n->partial; pos = next) {
+            next = pos->next;
+            page = list_entry(pos, struct page, list);
+            if (!page->inuse) {
+                remove_partial(n, page);
+                list_add(&page->list, &discard);
+            } else {
+                busy++;
+            }
+        }
+        spin_unlock(&n->list_lock);
+    }
+
+    while (!list_empty(&discard)) {
+        page = list_first_entry(&discard, struct page, list);
+        list_del(&page->list);
+        discard_slab(s, page);
+    }
+
+    return busy;
+}
+
+int kmem_cache_shrink(struct kmem_cache *s)
+{
+    flush_cpu_slabs(s);
+    free_partial(s);
+
+    return 0;
+}
+
+void kmem_cache_destroy(struct kmem_cache *s)
+{
+    if (!s)
+        return;
+
+    flush_cpu_slabs(s);
+    if (free_partial(s)) {
+        printk("kmem_cache_destroy %s: slab still has objects\n", s->name);
+        return;
+    }
+
+    spin_lock(&slab_lock);
+    list_del(&s->list);
+    spin_unlock(&slab_lock);
+
+    kmem_cache_free(kmem_cache, s);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     ulong flags, void (*ctor)(void *))
+{
+    struct kmem_cache *s;
+
+    s = kmem_cache_zalloc(kmem_cache, GFP_KERNEL);
+    if (!s)
+        goto out;
+
+    if (kmem_cache_open(s, name, size, align, flags, ctor)) {
+        kmem_cache_free(kmem_cache, s);
+        s = NULL;
+        goto out;
+    }
+
+    spin_lock(&slab_lock);
+    list_add_tail(&s->list, &slab_caches);
+    spin_unlock(&slab_lock);
+
+out:
+    if (!s && (flags & SLAB_PANIC))
+        panic("kmem_cache_create: failed to create slab '%s'\n", name);
+
+    return s;
+}
+
+static void create_kmalloc_cache(int index, size_t size)
+{
+    kmalloc_caches[index] = kmem_cache_create(kmalloc_names[index], size,
+                                              ARCH_KMALLOC_MINALIGN, SLAB_PANIC, NULL);
+}
+
+void kmem_cache_init(void)
+{
+    int i;
+
+    INIT_LIST_HEAD(&slab_caches);
+    spin_lock_init(&slab_lock);
+
+    kmem_cache = &kmem_cache_boot;
+    kmem_cache_open(kmem_cache, "kmem_cache", sizeof(struct kmem_cache), 0,
+                    SLAB_HWCACHE_ALIGN, NULL);
+    list_add(&kmem_cache->list, &slab_caches);
+
+    for (i = KMALLOC_SHIFT_LOW; i <= KMALLOC_SHIFT_HIGH; i++) {
+        create_kmalloc_cache(i, 1UL << i);
+
+        if (i == 6)
+            create_kmalloc_cache(1, 96);
+        if (i == 7)
+            create_kmalloc_cache(2, 192);
+    }
+
+    printk("SLUB: kmalloc caches %lu-%lu bytes\n",
+           KMALLOC_MIN_SIZE, KMALLOC_MAX_CACHE_SIZE);
+}
+
+static void *kmalloc_large(size_t size, gfp_t flags)
+{
+    struct page *page;
+
+    page = alloc_pages(flags | __GFP_COMP, get_order(size));
+    if (!page)
+        return NULL;
+
+    return page_address(page);
+}
+
+void *kmalloc(size_t size, gfp_t flags)
+{
+    struct kmem_cache *s;
+
+    if (unlikely(size > KMALLOC_MAX_CACHE_SIZE))
+        return kmalloc_large(size, flags);
+
+    if (unlikely(!size))
+        return NULL;
+
+    s = kmalloc_caches[kmalloc_index(size)];
+    if (unlikely(!s))
+        return NULL;
+
+    return slab_alloc(s, flags);
+}
+
+void *kzalloc(size_t size, gfp_t flags)
+{
+    return kmalloc(size, flags | __GFP_ZERO);
+}
+
+void kfree(const void *x)
+{
+    struct page *page;
+
+    if (!x)
+        return;
+
+    page = virt_to_head_page(x);
+    if (unlikely(!PageSlab(page))) {
+        __free_pages(page, compound_order(page));
+        return;
+    }
+
+    slab_free(page->slab_cache, page, (void *)x);
+}
+
+size_t ksize(const void *x)
+{
+    struct page *page;
+
+    if (!x)
+        return 0;
+
+    page = virt_to_head_page(x);
+    if (unlikely(!PageSlab(page)))
+        return PAGE_SIZE << compound_order(page);
+
+    return page->slab_cache->object_size;
+}
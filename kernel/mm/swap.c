@@ -0,0 +1,136 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/gfp.h"
+#include "../../include/swap.h"
+#include "internal.h"
+
+/*
+ * LRU维护。新页先进每CPU的pagevec，攒满后一次持锁加入LRU，缺页密集时
+ * 不必每页都抢zone->lru_lock。pagevec里的页各持一个引用，加入LRU后
+ * 批量放掉。
+ */
+
+atomic_long_t nr_swap_pages;
+
+static struct pagevec lru_add_pvec[NR_CPUS];
+
+static void __pagevec_lru_add(struct pagevec *pvec)
+{
+    struct zone *zone = NULL;
+    struct zone *pagezone;
+    struct page *page;
+    ulong flags = 0;
+    unsigned int i;
+
+    for (i = 0; i < pvec->nr; i++) {
+        page = pvec->pages[i];
+        pagezone = page_zone(page);
+
+        /* 同一区域的页通常挨在一起，换区域时才换锁 */
+        if (pagezone != zone) {
+            if (zone)
+                spin_unlock_irqrestore(&zone->lru_lock, flags);
+            zone = pagezone;
+            spin_lock_irqsave(&zone->lru_lock, &flags);
+        }
+
+        SetPageLRU(page);
+        add_page_to_lru_list(page, &zone->lruvec, page_lru(page));
+    }
+    if (zone)
+        spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+    release_pages(pvec->pages, pvec->nr);
+    pvec->nr = 0;
+}
+
+void lru_cache_add(struct page *page)
+{
+    struct pagevec *pvec;
+    ulong flags;
+
+    get_page(page);
+
+    flags = local_irq_save();
+    pvec = &lru_add_pvec[smp_processor_id()];
+    pvec->pages[pvec->nr++] = page;
+    if (pvec->nr == PAGEVEC_SIZE || PageCompound(page))
+        __pagevec_lru_add(pvec);
+    local_irq_restore(flags);
+}
+
+void lru_add_drain(void)
+{
+    struct pagevec *pvec;
+    ulong flags;
+
+    flags = local_irq_save();
+    pvec = &lru_add_pvec[smp_processor_id()];
+    if (pvec->nr)
+        __pagevec_lru_add(pvec);
+    local_irq_restore(flags);
+}
+
+/* 把隔离出来的页放回LRU，并放掉隔离时拿的引用 */
+void putback_lru_page(struct page *page)
+{
+    struct zone *zone = page_zone(page);
+    ulong flags;
+
+    spin_lock_irqsave(&zone->lru_lock, &flags);
+    SetPageLRU(page);
+    add_page_to_lru_list(page, &zone->lruvec, page_lru(page));
+    spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+    put_page(page);
+}
+
+/* 成功时页已离开LRU并多了一个引用，返回0 */
+int isolate_lru_page(struct page *page)
+{
+    struct zone *zone = page_zone(page);
+    ulong flags;
+    int ret = -EBUSY;
+
+    spin_lock_irqsave(&zone->lru_lock, &flags);
+    if (PageLRU(page) && get_page_unless_zero(page)) {
+        ClearPageLRU(page);
+        del_page_from_lru_list(page, &zone->lruvec, page_lru(page));
+        ret = 0;
+    }
+    spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+    return ret;
+}
+
+static void activate_page(struct page *page)
+{
+    struct zone *zone = page_zone(page);
+    ulong flags;
+
+    spin_lock_irqsave(&zone->lru_lock, &flags);
+    if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+        del_page_from_lru_list(page, &zone->lruvec, page_lru(page));
+        SetPageActive(page);
+        add_page_to_lru_list(page, &zone->lruvec, page_lru(page));
+    }
+    spin_unlock_irqrestore(&zone->lru_lock, flags);
+}
+
+/*
+ * 不活跃页第一次被访问只打上PG_referenced，第二次才提到活跃链表，
+ * 只访问过一次的页(如顺序读)不会把真正常用的页挤出活跃链表。
+ */
+void mark_page_accessed(struct page *page)
+{
+    page = compound_head(page);
+
+    if (!PageActive(page) && !PageUnevictable(page) && PageReferenced(page)) {
+        activate_page(page);
+        ClearPageReferenced(page);
+    } else if (!PageReferenced(page)) {
+        SetPageReferenced(page);
+    }
+}
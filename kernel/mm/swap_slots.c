@@ -0,0 +1,85 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/swap.h"
+#include "internal.h"
+
+/*
+ * 每CPU槽位缓存。换出时每页都要一个槽位，逐个去抢swap_lock和si->lock
+ * 在多核上会成为瓶颈，所以每个CPU一次批发SWAP_SLOTS_CACHE_SIZE个槽位，
+ * 用完再批发；放掉的槽位也先攒在本CPU的归还缓存里，满了一起交还。
+ *
+ * 分配和归还分成两组缓存，刚放掉的槽位不会马上被再分出去，避免
+ * zswap里还没失效的旧数据和新写入交错。
+ */
+
+struct swap_slots_cache {
+    int nr;                         /* slots里还剩几个 */
+    int cur;                        /* 下一个要用的下标 */
+    swp_entry_t slots[SWAP_SLOTS_CACHE_SIZE];
+    int n_ret;
+    swp_entry_t slots_ret[SWAP_SLOTS_CACHE_SIZE];
+};
+
+static struct swap_slots_cache swp_slots[NR_CPUS];
+
+swp_entry_t get_swap_page(void)
+{
+    struct swap_slots_cache *cache;
+    swp_entry_t entry;
+    ulong flags;
+
+    entry.val = 0;
+
+    flags = local_irq_save();
+    cache = &swp_slots[smp_processor_id()];
+    if (!cache->nr) {
+        cache->cur = 0;
+        cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+    }
+    if (cache->nr) {
+        entry = cache->slots[cache->cur];
+        cache->slots[cache->cur++].val = 0;
+        cache->nr--;
+    }
+    local_irq_restore(flags);
+
+    return entry;
+}
+
+/* 槽位已没有任何引用，先攒着，满一批再交还 */
+void free_swap_slot(swp_entry_t entry)
+{
+    struct swap_slots_cache *cache;
+    ulong flags;
+
+    flags = local_irq_save();
+    cache = &swp_slots[smp_processor_id()];
+    if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+        swapcache_free_entries(cache->slots_ret, cache->n_ret);
+        cache->n_ret = 0;
+    }
+    cache->slots_ret[cache->n_ret++] = entry;
+    local_irq_restore(flags);
+}
+
+/* 把本CPU缓存的槽位全部交还，空闲槽位不足时调用 */
+void drain_swap_slots_cache(void)
+{
+    struct swap_slots_cache *cache;
+    ulong flags;
+
+    flags = local_irq_save();
+    cache = &swp_slots[smp_processor_id()];
+    if (cache->nr) {
+        /* 没用过的槽位只有SWAP_HAS_CACHE标记，和归还的槽位一样处理 */
+        swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+        cache->nr = 0;
+        cache->cur = 0;
+    }
+    if (cache->n_ret) {
+        swapcache_free_entries(cache->slots_ret, cache->n_ret);
+        cache->n_ret = 0;
+    }
+    local_irq_restore(flags);
+}
@@ -0,0 +1,193 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/gfp.h"
+#include "../../include/swap.h"
+#include "../../include/mempolicy.h"
+#include "../../include/vmstat.h"
+#include "internal.h"
+
+/*
+ * 交换缓存。换出途中和刚换入的匿名页以槽位偏移为索引挂在所在交换区
+ * 的swapper_spaces[type]上，页设PG_swapcache，private记着槽位。
+ * 换出时页表项已改成槽位、页还没写完，这时再缺页要能找回同一页；
+ * 多个进程共享的换出页换入时也要共用同一页，都靠这张表。
+ *
+ * 交换缓存持有页的一个引用，以及槽位的SWAP_HAS_CACHE标记。
+ */
+
+struct address_space swapper_spaces[MAX_SWAPFILES];
+
+void swap_cache_init(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_SWAPFILES; i++) {
+        INIT_RADIX_TREE(&swapper_spaces[i].page_tree, GFP_ATOMIC);
+        spin_lock_init(&swapper_spaces[i].tree_lock);
+        swapper_spaces[i].nrpages = 0;
+    }
+}
+
+/* 调用者持页锁，且已拿到槽位的SWAP_HAS_CACHE */
+int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
+{
+    struct address_space *address_space = swap_address_space(entry);
+    ulong flags;
+    int error;
+
+    VM_BUG_ON_PAGE(!PageLocked(page), page);
+    VM_BUG_ON_PAGE(PageSwapCache(page), page);
+
+    error = radix_tree_preload(gfp_mask);
+    if (error)
+        return error;
+
+    get_page(page);
+    SetPageSwapCache(page);
+    set_page_private(page, entry.val);
+
+    spin_lock_irqsave(&address_space->tree_lock, &flags);
+    error = radix_tree_insert(&address_space->page_tree, swp_offset(entry), page);
+    if (!error) {
+        address_space->nrpages++;
+        __inc_node_page_state(page, NR_FILE_PAGES);
+    }
+    spin_unlock_irqrestore(&address_space->tree_lock, flags);
+    radix_tree_preload_end();
+
+    if (error) {
+        set_page_private(page, 0);
+        ClearPageSwapCache(page);
+        put_page(page);
+    }
+
+    return error;
+}
+
+/* 调用者持页锁和tree_lock，页的缓存引用由调用者放掉 */
+void __delete_from_swap_cache(struct page *page)
+{
+    swp_entry_t entry = page_swap_entry(page);
+    struct address_space *address_space = swap_address_space(entry);
+
+    VM_BUG_ON_PAGE(!PageLocked(page), page);
+    VM_BUG_ON_PAGE(!PageSwapCache(page), page);
+    VM_BUG_ON_PAGE(PageWriteback(page), page);
+
+    radix_tree_delete(&address_space->page_tree, swp_offset(entry));
+    set_page_private(page, 0);
+    ClearPageSwapCache(page);
+    address_space->nrpages--;
+    __dec_node_page_state(page, NR_FILE_PAGES);
+}
+
+/* 移出交换缓存并放掉槽位的缓存标记和页的缓存引用 */
+void delete_from_swap_cache(struct page *page)
+{
+    swp_entry_t entry = page_swap_entry(page);
+    struct address_space *address_space = swap_address_space(entry);
+    ulong flags;
+
+    spin_lock_irqsave(&address_space->tree_lock, &flags);
+    __delete_from_swap_cache(page);
+    spin_unlock_irqrestore(&address_space->tree_lock, flags);
+
+    swapcache_free(entry);
+    put_page(page);
+}
+
+/*
+ * 给要换出的匿名页分配槽位并放进交换缓存，页标脏，之后由回收路径写出。
+ * 调用者持页锁，成功返回1。
+ */
+int add_to_swap(struct page *page)
+{
+    swp_entry_t entry;
+
+    VM_BUG_ON_PAGE(!PageLocked(page), page);
+
+    entry = get_swap_page();
+    if (!entry.val)
+        return 0;
+
+    /* 回收路径上不能为树节点再进入回收 */
+    if (add_to_swap_cache(page, entry, __GFP_HIGH | __GFP_NOMEMALLOC | __GFP_NOWARN)) {
+        swapcache_free(entry);
+        return 0;
+    }
+
+    /* 内存里这份就是最新内容，换出途中缺页可直接映射 */
+    SetPageUptodate(page);
+    SetPageDirty(page);
+
+    return 1;
+}
+
+/* 找到的页多一个引用，找不到返回NULL */
+struct page *lookup_swap_cache(swp_entry_t entry)
+{
+    struct address_space *address_space = swap_address_space(entry);
+    struct page *page;
+    ulong flags;
+
+    spin_lock_irqsave(&address_space->tree_lock, &flags);
+    page = radix_tree_lookup(&address_space->page_tree, swp_offset(entry));
+    if (page)
+        get_page(page);
+    spin_unlock_irqrestore(&address_space->tree_lock, flags);
+
+    return page;
+}
+
+/*
+ * 换入：先查交换缓存，没有就分一页、抢到槽位的缓存标记后放进交换缓存
+ * 再读入。抢标记失败说明别人正在换入同一槽位，回头再查缓存即可。
+ * 返回的页多一个引用，已经读好、未加锁。
+ */
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+                                   struct vm_area_struct *vma, ulong addr)
+{
+    struct page *found_page, *new_page = NULL;
+    int err;
+
+    for (;;) {
+        found_page = lookup_swap_cache(entry);
+        if (found_page)
+            break;
+
+        if (!new_page) {
+            new_page = alloc_pages_vma(gfp_mask, 0, vma, addr);
+            if (!new_page)
+                break;
+        }
+
+        err = swapcache_prepare(entry);
+        if (err == -EEXIST) {
+            cond_resched();
+            continue;
+        }
+        if (err)
+            break;
+
+        SetPageLocked(new_page);
+        SetPageSwapBacked(new_page);
+        if (add_to_swap_cache(new_page, entry, gfp_mask & GFP_KERNEL)) {
+            ClearPageLocked(new_page);
+            swapcache_free(entry);
+            continue;
+        }
+
+        /* 读完swap_readpage负责解锁 */
+        lru_cache_add(new_page);
+        swap_readpage(new_page);
+        wait_on_page_locked(new_page);
+        return new_page;
+    }
+
+    if (new_page)
+        put_page(new_page);
+
+    return found_page;
+}
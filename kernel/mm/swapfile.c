@@ -0,0 +1,391 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/gfp.h"
+#include "../../include/slab.h"
+#include "../../include/vmalloc.h"
+#include "../../include/swap.h"
+#include "internal.h"
+
+/*
+ * 交换区与槽位分配。每个交换区一张swap_map，一个槽位一个字节：低位
+ * 是指向该槽位的页表项个数，SWAP_HAS_CACHE表示页还在交换缓存里。
+ * 两者都为0时槽位空闲。
+ *
+ * 分配从cluster_next往后线性找，连续换出的页落在相邻槽位上，写设备时
+ * 接近顺序写。大部分分配走每CPU槽位缓存(swap_slots.c)，这里一次批发
+ * 一批，swap_lock和si->lock只在批发和批量归还时拿。
+ */
+
+struct swap_info_struct *swap_info[MAX_SWAPFILES];
+long total_swap_pages;
+static int nr_swapfiles;
+
+/* 保护swap_info[]和nr_swapfiles */
+static DEFINE_SPINLOCK(swap_lock);
+
+struct swap_info_struct *swp_swap_info(swp_entry_t entry)
+{
+    unsigned int type = swp_type(entry);
+
+    if (type >= (unsigned int)nr_swapfiles)
+        return NULL;
+
+    return swap_info[type];
+}
+
+/* 取槽位所在交换区并加锁，槽位非法返回NULL */
+static struct swap_info_struct *swap_info_get(swp_entry_t entry)
+{
+    struct swap_info_struct *si;
+
+    if (!entry.val)
+        return NULL;
+
+    si = swp_swap_info(entry);
+    if (!si || !(si->flags & SWP_USED))
+        goto bad;
+    if (swp_offset(entry) >= si->max)
+        goto bad;
+
+    spin_lock(&si->lock);
+    return si;
+
+bad:
+    printk("swap: bad swap entry %08lx\n", entry.val);
+    return NULL;
+}
+
+/* 在si里找至多n个空闲槽位，调用者持si->lock */
+static int scan_swap_map_slots(struct swap_info_struct *si, int n,
+                               swp_entry_t *slots)
+{
+    unsigned int offset, scanned = 0;
+    int nr = 0;
+
+    if (!si->highest_bit || !(si->flags & SWP_WRITEOK))
+        return 0;
+
+    offset = si->cluster_next;
+    if (offset < si->lowest_bit || offset > si->highest_bit)
+        offset = si->lowest_bit;
+
+    while (nr < n && si->inuse_pages < si->pages &&
+           scanned <= si->highest_bit - si->lowest_bit) {
+        if (!si->swap_map[offset]) {
+            /* 先标成在缓存里，调用者随即把页放进交换缓存 */
+            si->swap_map[offset] = SWAP_HAS_CACHE;
+            si->inuse_pages++;
+            slots[nr++] = swp_entry(si->type, offset);
+
+            if (offset == si->lowest_bit)
+                si->lowest_bit++;
+            if (offset == si->highest_bit)
+                si->highest_bit--;
+        }
+
+        if (++offset > si->highest_bit)
+            offset = si->lowest_bit;
+        scanned++;
+    }
+
+    /* 交换区满了，lowest/highest失去意义，重置成空范围 */
+    if (si->inuse_pages == si->pages) {
+        si->lowest_bit = si->max;
+        si->highest_bit = 0;
+    }
+
+    si->cluster_next = offset;
+
+    return nr;
+}
+
+/* 按优先级从高到低在各交换区批量分配槽位，返回分到的个数 */
+int get_swap_pages(int n, swp_entry_t *slots)
+{
+    struct swap_info_struct *si, *best;
+    int nr = 0;
+    int type, i;
+
+    if (get_nr_swap_pages() <= 0)
+        return 0;
+
+    spin_lock(&swap_lock);
+    while (nr < n) {
+        best = NULL;
+        for (type = 0; type < nr_swapfiles; type++) {
+            si = swap_info[type];
+            if (!si || !(si->flags & SWP_WRITEOK) ||
+                si->inuse_pages == si->pages)
+                continue;
+            if (!best || si->prio > best->prio)
+                best = si;
+        }
+        if (!best)
+            break;
+
+        spin_lock(&best->lock);
+        i = scan_swap_map_slots(best, n - nr, slots + nr);
+        spin_unlock(&best->lock);
+        if (!i)
+            break;
+        nr += i;
+    }
+    spin_unlock(&swap_lock);
+
+    atomic_long_sub(nr, &nr_swap_pages);
+
+    return nr;
+}
+
+/* 引用和缓存标志都没了，槽位交还，调用者持si->lock */
+static void swap_entry_free(struct swap_info_struct *si, pgoff_t offset)
+{
+    si->swap_map[offset] = 0;
+    si->inuse_pages--;
+
+    if (offset < si->lowest_bit)
+        si->lowest_bit = offset;
+    if (offset > si->highest_bit)
+        si->highest_bit = offset;
+
+    zswap_invalidate(si->type, offset);
+    atomic_long_inc(&nr_swap_pages);
+}
+
+/* 减掉usage(一个页表引用或SWAP_HAS_CACHE)，返回剩下的计数 */
+static unsigned char __swap_entry_put(struct swap_info_struct *si,
+                                      swp_entry_t entry, unsigned char usage)
+{
+    pgoff_t offset = swp_offset(entry);
+    unsigned char count = si->swap_map[offset];
+    unsigned char has_cache = count & SWAP_HAS_CACHE;
+
+    count &= ~SWAP_HAS_CACHE;
+
+    if (usage == SWAP_HAS_CACHE) {
+        VM_BUG_ON(!has_cache);
+        has_cache = 0;
+    } else if (count) {
+        count--;
+    }
+
+    usage = count | has_cache;
+    si->swap_map[offset] = usage;
+
+    return usage;
+}
+
+/*
+ * 槽位最后一个引用放掉时不立即交还，而是挂进本CPU的归还缓存，
+ * 攒够一批再由swapcache_free_entries一次持锁处理。
+ */
+void swap_free(swp_entry_t entry)
+{
+    struct swap_info_struct *si = swap_info_get(entry);
+
+    if (!si)
+        return;
+
+    if (!__swap_entry_put(si, entry, 1)) {
+        si->swap_map[swp_offset(entry)] = SWAP_HAS_CACHE;
+        spin_unlock(&si->lock);
+        free_swap_slot(entry);
+        return;
+    }
+    spin_unlock(&si->lock);
+}
+
+/* 页离开交换缓存 */
+void swapcache_free(swp_entry_t entry)
+{
+    struct swap_info_struct *si = swap_info_get(entry);
+
+    if (!si)
+        return;
+
+    if (!__swap_entry_put(si, entry, SWAP_HAS_CACHE)) {
+        si->swap_map[swp_offset(entry)] = SWAP_HAS_CACHE;
+        spin_unlock(&si->lock);
+        free_swap_slot(entry);
+        return;
+    }
+    spin_unlock(&si->lock);
+}
+
+/* 批量交还槽位，槽位缓存满了时调用；槽位此时只剩SWAP_HAS_CACHE标记 */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+    struct swap_info_struct *si, *prev = NULL;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        si = swp_swap_info(entries[i]);
+        if (si != prev) {
+            if (prev)
+                spin_unlock(&prev->lock);
+            spin_lock(&si->lock);
+            prev = si;
+        }
+        swap_entry_free(si, swp_offset(entries[i]));
+    }
+    if (prev)
+        spin_unlock(&prev->lock);
+}
+
+/* 复制映射(fork)时给槽位多记一个页表引用 */
+int swap_duplicate(swp_entry_t entry)
+{
+    struct swap_info_struct *si = swap_info_get(entry);
+    pgoff_t offset;
+    unsigned char count;
+    int err = 0;
+
+    if (!si)
+        return -EINVAL;
+
+    offset = swp_offset(entry);
+    count = si->swap_map[offset] & ~SWAP_HAS_CACHE;
+    if (count >= SWAP_MAP_MAX || si->swap_map[offset] == SWAP_MAP_BAD)
+        err = -ENOMEM;
+    else if (!si->swap_map[offset])
+        err = -ENOENT;
+    else
+        si->swap_map[offset]++;
+
+    spin_unlock(&si->lock);
+
+    return err;
+}
+
+/*
+ * 换入前抢占槽位的交换缓存标志：成功返回0，页已在缓存里(别人正在
+ * 换入)返回-EEXIST，槽位已被释放返回-ENOENT。
+ */
+int swapcache_prepare(swp_entry_t entry)
+{
+    struct swap_info_struct *si = swap_info_get(entry);
+    pgoff_t offset;
+    int err = 0;
+
+    if (!si)
+        return -EINVAL;
+
+    offset = swp_offset(entry);
+    if (si->swap_map[offset] & SWAP_HAS_CACHE)
+        err = -EEXIST;
+    else if (!si->swap_map[offset])
+        err = -ENOENT;
+    else
+        si->swap_map[offset] |= SWAP_HAS_CACHE;
+
+    spin_unlock(&si->lock);
+
+    return err;
+}
+
+/* 交换缓存页所在槽位还有几个页表引用 */
+int page_swapcount(struct page *page)
+{
+    swp_entry_t entry = page_swap_entry(page);
+    struct swap_info_struct *si = swap_info_get(entry);
+    int count;
+
+    if (!si)
+        return 0;
+
+    count = si->swap_map[swp_offset(entry)] & ~SWAP_HAS_CACHE;
+    spin_unlock(&si->lock);
+
+    return count;
+}
+
+/*
+ * 页已在内存里又没有页表项指着槽位，槽位里的副本就没用了，把页移出
+ * 交换缓存放掉槽位。调用者持页锁，成功返回1。
+ */
+int try_to_free_swap(struct page *page)
+{
+    VM_BUG_ON_PAGE(!PageLocked(page), page);
+
+    if (!PageSwapCache(page))
+        return 0;
+    if (PageWriteback(page))
+        return 0;
+    if (page_swapcount(page))
+        return 0;
+
+    delete_from_swap_cache(page);
+    SetPageDirty(page);
+
+    return 1;
+}
+
+/*
+ * 启用一个交换区。bdev为NULL时只有zswap一层，压不下的页留在内存里；
+ * 槽位数仍限制能换出多少页。
+ */
+int swapon(struct block_device *bdev, unsigned int nr_pages, int prio)
+{
+    struct swap_info_struct *si;
+    int type;
+
+    if (nr_pages <= SWAP_HEADER_PAGES)
+        return -EINVAL;
+
+    si = kzalloc(sizeof(*si), GFP_KERNEL);
+    if (!si)
+        return -ENOMEM;
+
+    si->swap_map = vzalloc(nr_pages);
+    if (!si->swap_map) {
+        kfree(si);
+        return -ENOMEM;
+    }
+
+    spin_lock_init(&si->lock);
+    si->bdev = bdev;
+    si->prio = prio;
+    si->max = nr_pages;
+    si->pages = nr_pages - SWAP_HEADER_PAGES;
+    si->swap_map[0] = SWAP_MAP_BAD;
+    si->lowest_bit = SWAP_HEADER_PAGES;
+    si->highest_bit = nr_pages - 1;
+    si->cluster_next = SWAP_HEADER_PAGES;
+
+    spin_lock(&swap_lock);
+    for (type = 0; type < nr_swapfiles; type++) {
+        if (!swap_info[type])
+            break;
+    }
+    if (type >= MAX_SWAPFILES) {
+        spin_unlock(&swap_lock);
+        vfree(si->swap_map);
+        kfree(si);
+        return -EBUSY;
+    }
+
+    si->type = type;
+    swap_info[type] = si;
+    if (type == nr_swapfiles)
+        nr_swapfiles++;
+
+    zswap_swapon(type);
+
+    si->flags = SWP_USED | SWP_WRITEOK;
+    total_swap_pages += si->pages;
+    atomic_long_add(si->pages, &nr_swap_pages);
+    spin_unlock(&swap_lock);
+
+    printk("swap: adding %u pages on swap %d, priority %d%s\n",
+           si->pages, type, prio, bdev ? "" : " (zswap only)");
+
+    return 0;
+}
+
+void si_swapinfo(struct sysinfo *val)
+{
+    val->freeswap = get_nr_swap_pages();
+    val->totalswap = total_swap_pages;
+}
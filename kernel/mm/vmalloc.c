@@ -0,0 +1,1301 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/bitops.h"
+#include "../../include/gfp.h"
+#include "../../include/slab.h"
+#include "../../include/pgtable.h"
+#include "../../include/numa.h"
+#include "../../include/vmalloc.h"
+#include "internal.h"
+
+/*
+ * 虚拟连续内存。VMALLOC_START..VMALLOC_END和MODULES_VADDR..MODULES_END
+ * 中的空闲虚拟地址放在一棵按地址排序的红黑树里，每个节点额外记录子树中
+ * 最大的空闲块，找能放下size的最低地址时整棵放不下的子树直接跳过。
+ *
+ * 释放时只拆页表不冲TLB，区域先挂到清理链表上，攒够lazy_max_pages后
+ * 一次冲掉所有区域覆盖的范围再还给空闲树。在此之前地址不会被重用，
+ * 旧的TLB项也就无害。
+ *
+ * 几页的小映射(vm_map_ram)从每CPU的vmap块里顺序切，不碰全局树和锁。
+ */
+
+/* 至多这么多页的vm_map_ram走每CPU块 */
+#define VMAP_MAX_ALLOC          BITS_PER_LONG
+
+/* 每个vmap块的页数，块按自身大小对齐 */
+#define VMAP_BBMAP_BITS         1024
+#define VMAP_BLOCK_SIZE         (VMAP_BBMAP_BITS * PAGE_SIZE)
+
+struct vmap_block_queue {
+    spinlock_t lock;
+    struct list_head free;          /* 还有剩余空间的块 */
+    struct list_head full;          /* 分完了、还有页没释放的块 */
+};
+
+struct vmap_block {
+    spinlock_t lock;
+    struct vmap_area *va;
+    ulong free;                     /* 尚未分出去的页数 */
+    ulong dirty;                    /* 已释放的页数 */
+    ulong dirty_min, dirty_max;     /* 已释放但可能还在TLB里的页偏移范围 */
+    struct list_head free_list;     /* 挂在所属CPU队列的free或full上 */
+    int cpu;
+};
+
+static struct vmap_block_queue vmap_block_queue[NR_CPUS];
+
+/* 已分配的区域，按地址查找vfree的目标 */
+static spinlock_t vmap_area_lock;
+static struct rb_root vmap_area_root;
+static struct list_head vmap_area_list;
+
+/* 空闲区域，增强红黑树 */
+static spinlock_t free_vmap_area_lock;
+static struct rb_root free_vmap_area_root;
+static struct list_head free_vmap_area_list;
+
+/* 已拆页表、等待冲TLB的区域 */
+static spinlock_t purge_vmap_area_lock;
+static struct list_head purge_vmap_area_list;
+static atomic_long_t vmap_lazy_nr;
+
+static struct kmem_cache *vmap_area_cachep;
+
+static inline ulong va_size(struct vmap_area *va)
+{
+    return va->va_end - va->va_start;
+}
+
+static inline ulong get_subtree_max_size(struct rb_node *node)
+{
+    struct vmap_area *va;
+
+    if (!node)
+        return 0;
+
+    va = rb_entry(node, struct vmap_area, rb_node);
+    return va->subtree_max_size;
+}
+
+static inline ulong compute_subtree_max_size(struct vmap_area *va)
+{
+    ulong max = va_size(va);
+
+    max = MAX(max, get_subtree_max_size(va->rb_node.rb_left));
+    max = MAX(max, get_subtree_max_size(va->rb_node.rb_right));
+
+    return max;
+}
+
+/* 向上更新子树最大值，某个祖先的值不变时更上面的也不会变 */
+static void free_vmap_area_rb_propagate(struct rb_node *rb, struct rb_node *stop)
+{
+    struct vmap_area *va;
+    ulong max;
+
+    while (rb != stop) {
+        va = rb_entry(rb, struct vmap_area, rb_node);
+        max = compute_subtree_max_size(va);
+        if (va->subtree_max_size == max)
+            break;
+        va->subtree_max_size = max;
+        rb = rb_parent(&va->rb_node);
+    }
+}
+
+static void free_vmap_area_rb_copy(struct rb_node *rb_old, struct rb_node *rb_new)
+{
+    struct vmap_area *old = rb_entry(rb_old, struct vmap_area, rb_node);
+    struct vmap_area *new = rb_entry(rb_new, struct vmap_area, rb_node);
+
+    new->subtree_max_size = old->subtree_max_size;
+}
+
+static void free_vmap_area_rb_rotate(struct rb_node *rb_old, struct rb_node *rb_new)
+{
+    struct vmap_area *old = rb_entry(rb_old, struct vmap_area, rb_node);
+    struct vmap_area *new = rb_entry(rb_new, struct vmap_area, rb_node);
+
+    new->subtree_max_size = old->subtree_max_size;
+    old->subtree_max_size = compute_subtree_max_size(old);
+}
+
+static const struct rb_augment_callbacks free_vmap_area_rb_augment_cb = {
+    .propagate = free_vmap_area_rb_propagate,
+    .copy = free_vmap_area_rb_copy,
+    .rotate = free_vmap_area_rb_rotate,
+};
+
+static inline void augment_tree_propagate_from(struct vmap_area *va)
+{
+    free_vmap_area_rb_propagate(&va->rb_node, NULL);
+}
+
+/* 找va在树中的插入位置，与已有区域重叠时返回NULL */
+static struct rb_node **find_va_links(struct vmap_area *va, struct rb_root *root,
+                                      struct rb_node **parent)
+{
+    struct rb_node **link = &root->rb_node;
+    struct vmap_area *tmp;
+
+    *parent = NULL;
+    while (*link) {
+        tmp = rb_entry(*link, struct vmap_area, rb_node);
+        *parent = *link;
+
+        if (va->va_end <= tmp->va_start)
+            link = &(*link)->rb_left;
+        else if (va->va_start >= tmp->va_end)
+            link = &(*link)->rb_right;
+        else
+            return NULL;
+    }
+
+    return link;
+}
+
+/* 插入位置在parent右边时，链表中的下一个就是parent的后继，否则是parent本身 */
+static inline struct list_head *get_va_next_sibling(struct rb_node *parent,
+                                                    struct rb_node **link,
+                                                    struct list_head *head)
+{
+    struct list_head *list;
+
+    if (!parent)
+        return head;
+
+    list = &rb_entry(parent, struct vmap_area, rb_node)->list;
+    return &parent->rb_right == link ? list->next : list;
+}
+
+static void link_va(struct vmap_area *va, struct rb_root *root,
+                    struct rb_node *parent, struct rb_node **link,
+                    struct list_head *head)
+{
+    struct list_head *next = get_va_next_sibling(parent, link, head);
+
+    rb_link_node(&va->rb_node, parent, link);
+    if (root == &free_vmap_area_root) {
+        rb_insert_augmented(&va->rb_node, root, &free_vmap_area_rb_augment_cb);
+        va->subtree_max_size = 0;
+    } else {
+        rb_insert_color(&va->rb_node, root);
+    }
+
+    list_add_tail(&va->list, next);
+}
+
+static void unlink_va(struct vmap_area *va, struct rb_root *root)
+{
+    if (root == &free_vmap_area_root)
+        rb_erase_augmented(&va->rb_node, root, &free_vmap_area_rb_augment_cb);
+    else
+        rb_erase(&va->rb_node, root);
+
+    list_del(&va->list);
+    RB_CLEAR_NODE(&va->rb_node);
+}
+
+static int insert_vmap_area(struct vmap_area *va, struct rb_root *root,
+                            struct list_head *head)
+{
+    struct rb_node **link;
+    struct rb_node *parent;
+
+    link = find_va_links(va, root, &parent);
+    if (!link)
+        return -EINVAL;
+
+    link_va(va, root, parent, link, head);
+    if (root == &free_vmap_area_root)
+        augment_tree_propagate_from(va);
+
+    return 0;
+}
+
+/*
+ * 把va放回空闲树，与地址上紧挨着的前后空闲区合并，树里始终是
+ * 最大的连续空闲段，不会因反复分配释放而碎成小节点。
+ */
+static struct vmap_area *merge_or_add_vmap_area(struct vmap_area *va,
+                                                struct rb_root *root,
+                                                struct list_head *head)
+{
+    struct vmap_area *sibling;
+    struct list_head *next;
+    struct rb_node **link;
+    struct rb_node *parent;
+    bool merged = false;
+
+    link = find_va_links(va, root, &parent);
+    if (!link) {
+        printk("vmalloc: freeing overlapping area 0x%lx-0x%lx\n",
+               va->va_start, va->va_end);
+        return NULL;
+    }
+
+    next = get_va_next_sibling(parent, link, head);
+
+    /* 与后一个空闲区相接 */
+    if (next != head) {
+        sibling = list_entry(next, struct vmap_area, list);
+        if (sibling->va_start == va->va_end) {
+            sibling->va_start = va->va_start;
+            kmem_cache_free(vmap_area_cachep, va);
+            va = sibling;
+            merged = true;
+        }
+    }
+
+    /* 与前一个空闲区相接 */
+    if (next->prev != head) {
+        sibling = list_entry(next->prev, struct vmap_area, list);
+        if (sibling->va_end == va->va_start) {
+            if (merged)
+                unlink_va(va, root);
+            sibling->va_end = va->va_end;
+            kmem_cache_free(vmap_area_cachep, va);
+            va = sibling;
+            merged = true;
+        }
+    }
+
+    if (!merged)
+        link_va(va, root, parent, link, head);
+
+    augment_tree_propagate_from(va);
+
+    return va;
+}
+
+static inline bool is_within_this_va(struct vmap_area *va, ulong size,
+                                     ulong align, ulong vstart)
+{
+    ulong nva_start_addr;
+
+    if (va->va_start > vstart)
+        nva_start_addr = ALIGN_UP(va->va_start, align);
+    else
+        nva_start_addr = ALIGN_UP(vstart, align);
+
+    /* 对齐后越界或回绕 */
+    if (nva_start_addr + size < nva_start_addr || nva_start_addr < vstart)
+        return false;
+
+    return nva_start_addr + size <= va->va_end;
+}
+
+/*
+ * 在vstart之上找能放下size的最低空闲区。左子树里有足够大的块就往左，
+ * 否则看当前节点，再否则往右；右边也没有时回溯到第一个右子树够大的祖先。
+ * 为保证对齐后仍放得下，按size + align - 1找。
+ */
+static struct vmap_area *find_vmap_lowest_match(ulong size, ulong align,
+                                                ulong vstart)
+{
+    struct rb_node *node = free_vmap_area_root.rb_node;
+    ulong length = size + align - 1;
+    struct vmap_area *va;
+
+    while (node) {
+        va = rb_entry(node, struct vmap_area, rb_node);
+
+        if (get_subtree_max_size(node->rb_left) >= length &&
+            vstart < va->va_start) {
+            node = node->rb_left;
+            continue;
+        }
+
+        if (is_within_this_va(va, size, align, vstart))
+            return va;
+
+        if (get_subtree_max_size(node->rb_right) >= length) {
+            node = node->rb_right;
+            continue;
+        }
+
+        while ((node = rb_parent(node))) {
+            va = rb_entry(node, struct vmap_area, rb_node);
+            if (is_within_this_va(va, size, align, vstart))
+                return va;
+
+            if (get_subtree_max_size(node->rb_right) >= length &&
+                vstart <= va->va_start) {
+                node = node->rb_right;
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+enum fit_type {
+    NOTHING_FIT,
+    FL_FIT_TYPE,    /* 正好用完整个空闲区 */
+    LE_FIT_TYPE,    /* 用掉左端 */
+    RE_FIT_TYPE,    /* 用掉右端 */
+    NE_FIT_TYPE     /* 用掉中间，空闲区一分为二 */
+};
+
+static enum fit_type classify_va_fit_type(struct vmap_area *va,
+                                          ulong nva_start_addr, ulong size)
+{
+    if (nva_start_addr < va->va_start ||
+        nva_start_addr + size > va->va_end)
+        return NOTHING_FIT;
+
+    if (va->va_start == nva_start_addr) {
+        if (va->va_end == nva_start_addr + size)
+            return FL_FIT_TYPE;
+        return LE_FIT_TYPE;
+    }
+
+    if (va->va_end == nva_start_addr + size)
+        return RE_FIT_TYPE;
+
+    return NE_FIT_TYPE;
+}
+
+/* 从空闲区va中切走[nva_start_addr, +size)，*pva是调用者预先分配的节点 */
+static int adjust_va_to_fit_type(struct vmap_area *va, ulong nva_start_addr,
+                                 ulong size, enum fit_type type,
+                                 struct vmap_area **pva)
+{
+    struct vmap_area *lva = NULL;
+
+    switch (type) {
+    case FL_FIT_TYPE:
+        unlink_va(va, &free_vmap_area_root);
+        kmem_cache_free(vmap_area_cachep, va);
+        return 0;
+
+    case LE_FIT_TYPE:
+        va->va_start += size;
+        break;
+
+    case RE_FIT_TYPE:
+        va->va_end = nva_start_addr;
+        break;
+
+    case NE_FIT_TYPE:
+        /* 持自旋锁不能分配，用预分配的节点 */
+        lva = *pva;
+        if (!lva)
+            return -ENOMEM;
+        *pva = NULL;
+
+        lva->va_start = va->va_start;
+        lva->va_end = nva_start_addr;
+        va->va_start = nva_start_addr + size;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+
+    augment_tree_propagate_from(va);
+
+    if (lva)
+        insert_vmap_area(lva, &free_vmap_area_root, &free_vmap_area_list);
+
+    return 0;
+}
+
+/* 调用者持free_vmap_area_lock，失败返回vend */
+static ulong __alloc_vmap_area(ulong size, ulong align, ulong vstart,
+                               ulong vend, struct vmap_area **pva)
+{
+    struct vmap_area *va;
+    ulong nva_start_addr;
+    enum fit_type type;
+
+    va = find_vmap_lowest_match(size, align, vstart);
+    if (unlikely(!va))
+        return vend;
+
+    if (va->va_start > vstart)
+        nva_start_addr = ALIGN_UP(va->va_start, align);
+    else
+        nva_start_addr = ALIGN_UP(vstart, align);
+
+    if (nva_start_addr + size > vend)
+        return vend;
+
+    type = classify_va_fit_type(va, nva_start_addr, size);
+    if (type == NOTHING_FIT)
+        return vend;
+
+    if (adjust_va_to_fit_type(va, nva_start_addr, size, type, pva))
+        return vend;
+
+    return nva_start_addr;
+}
+
+static void purge_vmap_area_lazy(void);
+
+static struct vmap_area *alloc_vmap_area(ulong size, ulong align,
+                                         ulong vstart, ulong vend,
+                                         gfp_t gfp_mask)
+{
+    struct vmap_area *va, *pva;
+    bool purged = false;
+    ulong addr;
+
+    if (!size || (size & ~PAGE_MASK) || !is_power_of_2(align))
+        return NULL;
+
+    va = kmem_cache_alloc(vmap_area_cachep, gfp_mask);
+    if (unlikely(!va))
+        return NULL;
+
+retry:
+    /* 空闲区可能要一分为二，先在锁外备好一个节点 */
+    pva = kmem_cache_alloc(vmap_area_cachep, gfp_mask);
+
+    spin_lock(&free_vmap_area_lock);
+    addr = __alloc_vmap_area(size, align, vstart, vend, &pva);
+    spin_unlock(&free_vmap_area_lock);
+
+    if (pva)
+        kmem_cache_free(vmap_area_cachep, pva);
+
+    if (unlikely(addr == vend)) {
+        /* 延迟释放的区域还压着地址，冲掉TLB还回来再试一次 */
+        if (!purged) {
+            purge_vmap_area_lazy();
+            purged = true;
+            goto retry;
+        }
+
+        printk("vmap allocation for size %lu failed\n", size);
+        kmem_cache_free(vmap_area_cachep, va);
+        return NULL;
+    }
+
+    va->va_start = addr;
+    va->va_end = addr + size;
+    va->flags = 0;
+    va->vm = NULL;
+
+    spin_lock(&vmap_area_lock);
+    insert_vmap_area(va, &vmap_area_root, &vmap_area_list);
+    spin_unlock(&vmap_area_lock);
+
+    return va;
+}
+
+static struct vmap_area *__find_vmap_area(ulong addr)
+{
+    struct rb_node *n = vmap_area_root.rb_node;
+    struct vmap_area *va;
+
+    while (n) {
+        va = rb_entry(n, struct vmap_area, rb_node);
+        if (addr < va->va_start)
+            n = n->rb_left;
+        else if (addr >= va->va_end)
+            n = n->rb_right;
+        else
+            return va;
+    }
+
+    return NULL;
+}
+
+static struct vmap_area *find_vmap_area(ulong addr)
+{
+    struct vmap_area *va;
+
+    spin_lock(&vmap_area_lock);
+    va = __find_vmap_area(addr);
+    spin_unlock(&vmap_area_lock);
+
+    return va;
+}
+
+/* 攒到这么多页才冲一次TLB，CPU越多冲一次越贵，攒得越多 */
+static ulong lazy_max_pages(void)
+{
+    return fls(NR_CPUS) * ((32UL << 20) >> PAGE_SHIFT);
+}
+
+/*
+ * 把清理链表上的区域一次冲TLB后还给空闲树。[start, end)是调用者另外
+ * 需要冲的范围(vmap块里释放过的页)，没有区域可清时返回false，由调用者
+ * 自己冲。
+ */
+static bool __purge_vmap_area_lazy(ulong start, ulong end)
+{
+    struct list_head local_purge_list;
+    struct vmap_area *va;
+    ulong nr;
+
+    INIT_LIST_HEAD(&local_purge_list);
+
+    spin_lock(&purge_vmap_area_lock);
+    list_splice_init(&purge_vmap_area_list, &local_purge_list);
+    spin_unlock(&purge_vmap_area_lock);
+
+    if (list_empty(&local_purge_list))
+        return false;
+
+    list_for_each_entry(va, &local_purge_list, list) {
+        start = MIN(start, va->va_start);
+        end = MAX(end, va->va_end);
+    }
+
+    flush_tlb_kernel_range(start, end);
+
+    spin_lock(&free_vmap_area_lock);
+    while (!list_empty(&local_purge_list)) {
+        va = list_first_entry(&local_purge_list, struct vmap_area, list);
+        list_del(&va->list);
+
+        nr = va_size(va) >> PAGE_SHIFT;
+        merge_or_add_vmap_area(va, &free_vmap_area_root, &free_vmap_area_list);
+        atomic_long_sub(nr, &vmap_lazy_nr);
+    }
+    spin_unlock(&free_vmap_area_lock);
+
+    return true;
+}
+
+static void purge_vmap_area_lazy(void)
+{
+    __purge_vmap_area_lazy(~0UL, 0);
+}
+
+/* 页表已拆，TLB留待批量清理 */
+static void free_vmap_area_noflush(struct vmap_area *va)
+{
+    ulong nr_lazy;
+
+    spin_lock(&vmap_area_lock);
+    unlink_va(va, &vmap_area_root);
+    spin_unlock(&vmap_area_lock);
+
+    nr_lazy = atomic_long_add_return(va_size(va) >> PAGE_SHIFT, &vmap_lazy_nr);
+
+    spin_lock(&purge_vmap_area_lock);
+    list_add_tail(&va->list, &purge_vmap_area_list);
+    spin_unlock(&purge_vmap_area_lock);
+
+    if (unlikely(nr_lazy > lazy_max_pages()))
+        purge_vmap_area_lazy();
+}
+
+static int vmap_pte_range(pmd_t *pmd, ulong addr, ulong end, pgprot_t prot,
+                          struct page **pages, int *nr)
+{
+    struct page *page;
+    pte_t *pte;
+
+    pte = pte_alloc(&init_mm, pmd, addr);
+    if (!pte)
+        return -ENOMEM;
+
+    do {
+        page = pages[*nr];
+        if (!pte_none(*pte))
+            return -EBUSY;
+        if (!page)
+            return -ENOMEM;
+
+        set_pte(pte, pfn_pte(page_to_pfn(page), prot));
+        (*nr)++;
+    } while (pte++, addr += PAGE_SIZE, addr != end);
+
+    return 0;
+}
+
+static int vmap_pmd_range(pud_t *pud, ulong addr, ulong end, pgprot_t prot,
+                          struct page **pages, int *nr)
+{
+    pmd_t *pmd;
+    ulong next;
+    int err;
+
+    pmd = pmd_alloc(&init_mm, pud, addr);
+    if (!pmd)
+        return -ENOMEM;
+
+    do {
+        next = pmd_addr_end(addr, end);
+        err = vmap_pte_range(pmd, addr, next, prot, pages, nr);
+        if (err)
+            return err;
+    } while (pmd++, addr = next, addr != end);
+
+    return 0;
+}
+
+static int vmap_pud_range(pgd_t *pgd, ulong addr, ulong end, pgprot_t prot,
+                          struct page **pages, int *nr)
+{
+    pud_t *pud;
+    ulong next;
+    int err;
+
+    pud = pud_alloc(&init_mm, pgd, addr);
+    if (!pud)
+        return -ENOMEM;
+
+    do {
+        next = pud_addr_end(addr, end);
+        err = vmap_pmd_range(pud, addr, next, prot, pages, nr);
+        if (err)
+            return err;
+    } while (pud++, addr = next, addr != end);
+
+    return 0;
+}
+
+/* 把pages依次映射到[addr, end)，新建映射不需要冲TLB */
+static int vmap_pages_range(ulong addr, ulong end, pgprot_t prot,
+                            struct page **pages)
+{
+    pgd_t *pgd;
+    ulong next;
+    int nr = 0;
+    int err;
+
+    pgd = pgd_offset(&init_mm, addr);
+    do {
+        next = pgd_addr_end(addr, end);
+        err = vmap_pud_range(pgd, addr, next, prot, pages, &nr);
+        if (err)
+            return err;
+    } while (pgd++, addr = next, addr != end);
+
+    return nr;
+}
+
+static void vunmap_pte_range(pmd_t *pmd, ulong addr, ulong end)
+{
+    pte_t *pte = pte_offset(pmd, addr);
+
+    do {
+        pte_clear(pte);
+    } while (pte++, addr += PAGE_SIZE, addr != end);
+}
+
+static void vunmap_pmd_range(pud_t *pud, ulong addr, ulong end)
+{
+    pmd_t *pmd = pmd_offset(pud, addr);
+    ulong next;
+
+    do {
+        next = pmd_addr_end(addr, end);
+        if (pmd_none(*pmd))
+            continue;
+        vunmap_pte_range(pmd, addr, next);
+    } while (pmd++, addr = next, addr != end);
+}
+
+static void vunmap_pud_range(pgd_t *pgd, ulong addr, ulong end)
+{
+    pud_t *pud = pud_offset(pgd, addr);
+    ulong next;
+
+    do {
+        next = pud_addr_end(addr, end);
+        if (pud_none(*pud))
+            continue;
+        vunmap_pmd_range(pud, addr, next);
+    } while (pud++, addr = next, addr != end);
+}
+
+/* 只拆页表项，页表页留着给后续映射用，TLB由调用者负责 */
+static void vunmap_range_noflush(ulong addr, ulong end)
+{
+    pgd_t *pgd = pgd_offset(&init_mm, addr);
+    ulong next;
+
+    do {
+        next = pgd_addr_end(addr, end);
+        if (pgd_none(*pgd))
+            continue;
+        vunmap_pud_range(pgd, addr, next);
+    } while (pgd++, addr = next, addr != end);
+}
+
+static inline ulong vmap_block_vaddr(ulong va_start, ulong pages_off)
+{
+    return va_start + (pages_off << PAGE_SHIFT);
+}
+
+/* 新建一个块挂到本CPU队列上，并从中分出第一段 */
+static ulong new_vmap_block(unsigned int order, gfp_t gfp_mask)
+{
+    struct vmap_block_queue *vbq;
+    struct vmap_block *vb;
+    struct vmap_area *va;
+
+    vb = kmalloc(sizeof(struct vmap_block), gfp_mask);
+    if (unlikely(!vb))
+        return 0;
+
+    va = alloc_vmap_area(VMAP_BLOCK_SIZE, VMAP_BLOCK_SIZE,
+                         VMALLOC_START, VMALLOC_END, gfp_mask);
+    if (!va) {
+        kfree(vb);
+        return 0;
+    }
+
+    spin_lock_init(&vb->lock);
+    vb->va = va;
+    vb->free = VMAP_BBMAP_BITS - (1UL << order);
+    vb->dirty = 0;
+    vb->dirty_min = VMAP_BBMAP_BITS;
+    vb->dirty_max = 0;
+    INIT_LIST_HEAD(&vb->free_list);
+
+    spin_lock(&vmap_area_lock);
+    va->flags = VMAP_BLOCK;
+    va->vb = vb;
+    spin_unlock(&vmap_area_lock);
+
+    vb->cpu = smp_processor_id();
+    vbq = &vmap_block_queue[vb->cpu];
+    spin_lock(&vbq->lock);
+    list_add_tail(&vb->free_list, &vbq->free);
+    spin_unlock(&vbq->lock);
+
+    return va->va_start;
+}
+
+static void free_vmap_block(struct vmap_block *vb)
+{
+    struct vmap_block_queue *vbq = &vmap_block_queue[vb->cpu];
+
+    spin_lock(&vbq->lock);
+    if (!list_empty(&vb->free_list))
+        list_del_init(&vb->free_list);
+    spin_unlock(&vbq->lock);
+
+    free_vmap_area_noflush(vb->va);
+    kfree(vb);
+}
+
+/*
+ * 块内只顺序分配，不重用中间释放的空洞。分出去的页都释放了就整块还回
+ * 去，剩下的尾巴太小、谁也用不上的块也不会留着。
+ */
+static ulong vb_alloc(ulong size, gfp_t gfp_mask)
+{
+    struct vmap_block_queue *vbq;
+    struct vmap_block *vb;
+    unsigned int order = get_order(size);
+    ulong vaddr = 0;
+    ulong pages_off;
+
+    vbq = &vmap_block_queue[smp_processor_id()];
+
+    spin_lock(&vbq->lock);
+    list_for_each_entry(vb, &vbq->free, free_list) {
+        spin_lock(&vb->lock);
+        if (vb->free < (1UL << order)) {
+            spin_unlock(&vb->lock);
+            continue;
+        }
+
+        pages_off = VMAP_BBMAP_BITS - vb->free;
+        vaddr = vmap_block_vaddr(vb->va->va_start, pages_off);
+        vb->free -= 1UL << order;
+        if (vb->free == 0)
+            list_move_tail(&vb->free_list, &vbq->full);
+
+        spin_unlock(&vb->lock);
+        break;
+    }
+    spin_unlock(&vbq->lock);
+
+    if (!vaddr)
+        vaddr = new_vmap_block(order, gfp_mask);
+
+    return vaddr;
+}
+
+static void vb_free(ulong addr, ulong size)
+{
+    struct vmap_area *va;
+    struct vmap_block *vb;
+    unsigned int order = get_order(size);
+    ulong offset;
+
+    va = find_vmap_area(addr);
+    if (!va || !(va->flags & VMAP_BLOCK)) {
+        printk("vm_unmap_ram: bad address 0x%lx\n", addr);
+        return;
+    }
+    vb = va->vb;
+
+    vunmap_range_noflush(addr, addr + size);
+
+    offset = (addr & (VMAP_BLOCK_SIZE - 1)) >> PAGE_SHIFT;
+
+    spin_lock(&vb->lock);
+    vb->dirty_min = MIN(vb->dirty_min, offset);
+    vb->dirty_max = MAX(vb->dirty_max, offset + (1UL << order));
+    vb->dirty += 1UL << order;
+
+    /* 没有还在用的页了；free清零，摘下之前vb_alloc不会再从它分 */
+    if (vb->free + vb->dirty == VMAP_BBMAP_BITS) {
+        vb->free = 0;
+        spin_unlock(&vb->lock);
+        free_vmap_block(vb);
+        return;
+    }
+    spin_unlock(&vb->lock);
+}
+
+/*
+ * 冲掉所有已拆但可能还在TLB里的映射，包括vmap块里零散释放的页。
+ * 要改变页的映射属性、或把页交给别人前调用，保证没有旧别名残留。
+ */
+/* 收集一条块链表上还没冲过的已释放范围，调用者持vbq->lock */
+static bool vb_collect_dirty(struct list_head *head, ulong *start, ulong *end)
+{
+    struct vmap_block *vb;
+    bool flush = false;
+
+    list_for_each_entry(vb, head, free_list) {
+        spin_lock(&vb->lock);
+        if (vb->dirty_min < vb->dirty_max) {
+            *start = MIN(*start, vmap_block_vaddr(vb->va->va_start, vb->dirty_min));
+            *end = MAX(*end, vmap_block_vaddr(vb->va->va_start, vb->dirty_max));
+            vb->dirty_min = VMAP_BBMAP_BITS;
+            vb->dirty_max = 0;
+            flush = true;
+        }
+        spin_unlock(&vb->lock);
+    }
+
+    return flush;
+}
+
+void vm_unmap_aliases(void)
+{
+    struct vmap_block_queue *vbq;
+    ulong start = ~0UL, end = 0;
+    bool flush = false;
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        vbq = &vmap_block_queue[cpu];
+
+        /* 分完了的块不在free上，但里面释放的页一样可能还在TLB里 */
+        spin_lock(&vbq->lock);
+        flush |= vb_collect_dirty(&vbq->free, &start, &end);
+        flush |= vb_collect_dirty(&vbq->full, &start, &end);
+        spin_unlock(&vbq->lock);
+    }
+
+    if (!__purge_vmap_area_lazy(start, end) && flush)
+        flush_tlb_kernel_range(start, end);
+}
+
+void *vm_map_ram(struct page **pages, unsigned int count, int node)
+{
+    ulong size = (ulong)count << PAGE_SHIFT;
+    struct vmap_area *va;
+    ulong addr;
+
+    if (!count)
+        return NULL;
+
+    if (count <= VMAP_MAX_ALLOC) {
+        addr = vb_alloc(size, GFP_KERNEL);
+        if (!addr)
+            return NULL;
+    } else {
+        va = alloc_vmap_area(size, PAGE_SIZE, VMALLOC_START, VMALLOC_END,
+                             GFP_KERNEL);
+        if (!va)
+            return NULL;
+        va->flags = VMAP_RAM;
+        addr = va->va_start;
+    }
+
+    if (vmap_pages_range(addr, addr + size, PAGE_KERNEL, pages) < 0) {
+        vm_unmap_ram((void *)addr, count);
+        return NULL;
+    }
+
+    return (void *)addr;
+}
+
+void vm_unmap_ram(const void *mem, unsigned int count)
+{
+    ulong size = (ulong)count << PAGE_SHIFT;
+    ulong addr = (ulong)mem;
+    struct vmap_area *va;
+
+    if (!addr || addr < VMALLOC_START || addr + size > VMALLOC_END ||
+        (addr & ~PAGE_MASK))
+        return;
+
+    if (count <= VMAP_MAX_ALLOC) {
+        vb_free(addr, size);
+        return;
+    }
+
+    va = find_vmap_area(addr);
+    if (!va || !(va->flags & VMAP_RAM)) {
+        printk("vm_unmap_ram: bad address 0x%lx\n", addr);
+        return;
+    }
+
+    vunmap_range_noflush(va->va_start, va->va_end);
+    free_vmap_area_noflush(va);
+}
+
+static struct vm_struct *__get_vm_area_node(ulong size, ulong align,
+                                            ulong flags, ulong start,
+                                            ulong end, gfp_t gfp_mask)
+{
+    struct vm_struct *area;
+    struct vmap_area *va;
+
+    size = ALIGN_UP(size, PAGE_SIZE);
+    if (unlikely(!size))
+        return NULL;
+
+    area = kzalloc(sizeof(struct vm_struct), gfp_mask);
+    if (unlikely(!area))
+        return NULL;
+
+    if (!(flags & VM_NO_GUARD))
+        size += VMALLOC_GUARD_SIZE;
+
+    va = alloc_vmap_area(size, align, start, end, gfp_mask);
+    if (!va) {
+        kfree(area);
+        return NULL;
+    }
+
+    spin_lock(&vmap_area_lock);
+    area->addr = (void *)va->va_start;
+    area->size = va_size(va);
+    area->flags = flags;
+    va->vm = area;
+    spin_unlock(&vmap_area_lock);
+
+    return area;
+}
+
+struct vm_struct *get_vm_area(ulong size, ulong flags)
+{
+    return __get_vm_area_node(size, PAGE_SIZE, flags, VMALLOC_START,
+                              VMALLOC_END, GFP_KERNEL);
+}
+
+struct vm_struct *find_vm_area(const void *addr)
+{
+    struct vmap_area *va;
+
+    va = find_vmap_area((ulong)addr);
+    if (!va || (va->flags & (VMAP_RAM | VMAP_BLOCK)))
+        return NULL;
+
+    return va->vm;
+}
+
+static struct vm_struct *remove_vm_area(const void *addr)
+{
+    struct vmap_area *va;
+    struct vm_struct *vm;
+
+    spin_lock(&vmap_area_lock);
+    va = __find_vmap_area((ulong)addr);
+    if (!va || (va->flags & (VMAP_RAM | VMAP_BLOCK)) || !va->vm) {
+        spin_unlock(&vmap_area_lock);
+        return NULL;
+    }
+    vm = va->vm;
+    va->vm = NULL;
+    spin_unlock(&vmap_area_lock);
+
+    vunmap_range_noflush(va->va_start, va->va_end);
+    free_vmap_area_noflush(va);
+
+    return vm;
+}
+
+bool is_vmalloc_addr(const void *addr)
+{
+    ulong a = (ulong)addr;
+
+    return a >= VMALLOC_START && a < VMALLOC_END;
+}
+
+static void __vunmap(const void *addr, bool deallocate_pages)
+{
+    struct vm_struct *area;
+    unsigned int i;
+
+    if (!addr)
+        return;
+
+    if ((ulong)addr & ~PAGE_MASK) {
+        printk("Trying to vfree() bad address (%p)\n", addr);
+        return;
+    }
+
+    area = remove_vm_area(addr);
+    if (unlikely(!area)) {
+        printk("Trying to vfree() nonexistent vm area (%p)\n", addr);
+        return;
+    }
+
+    if (deallocate_pages) {
+        for (i = 0; i < area->nr_pages; i++)
+            __free_pages(area->pages[i], 0);
+
+        if (is_vmalloc_addr(area->pages))
+            vfree(area->pages);
+        else
+            kfree(area->pages);
+    }
+
+    kfree(area);
+}
+
+void vfree(const void *addr)
+{
+    __vunmap(addr, true);
+}
+
+void vunmap(const void *addr)
+{
+    __vunmap(addr, false);
+}
+
+void *vmap(struct page **pages, unsigned int count, ulong flags, pgprot_t prot)
+{
+    struct vm_struct *area;
+    ulong addr;
+    ulong size = (ulong)count << PAGE_SHIFT;
+
+    area = get_vm_area(size, flags | VM_MAP);
+    if (!area)
+        return NULL;
+
+    addr = (ulong)area->addr;
+    if (vmap_pages_range(addr, addr + size, prot, pages) < 0) {
+        vunmap(area->addr);
+        return NULL;
+    }
+
+    return area->addr;
+}
+
+/*
+ * 分配物理页并映射到area。物理页不要求连续，没有指定节点时整批从
+ * 伙伴系统取，一次持锁拿够，不必逐页走分配快路径。
+ */
+static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
+                                 pgprot_t prot, int node)
+{
+    unsigned int nr_pages = get_vm_area_size(area) >> PAGE_SHIFT;
+    ulong array_size = (ulong)nr_pages * sizeof(struct page *);
+    ulong addr = (ulong)area->addr;
+    struct page **pages;
+    struct page *page;
+    int got;
+
+    /* 页指针数组本身超过一页时也用vmalloc，免得为它要高阶连续页 */
+    if (array_size > PAGE_SIZE)
+        pages = __vmalloc_node_range(array_size, 1, VMALLOC_START, VMALLOC_END,
+                                     gfp_mask | __GFP_ZERO, PAGE_KERNEL, 0, node);
+    else
+        pages = kzalloc(array_size, gfp_mask);
+
+    if (!pages) {
+        remove_vm_area(area->addr);
+        kfree(area);
+        return NULL;
+    }
+
+    area->pages = pages;
+    area->nr_pages = 0;
+
+    if (node == NUMA_NO_NODE) {
+        while (area->nr_pages < nr_pages) {
+            got = alloc_pages_bulk(gfp_mask, nr_pages - area->nr_pages,
+                                   pages + area->nr_pages);
+            if (!got)
+                break;
+            area->nr_pages += got;
+        }
+    } else {
+        while (area->nr_pages < nr_pages) {
+            page = alloc_pages_node(node, gfp_mask, 0);
+            if (unlikely(!page))
+                break;
+            pages[area->nr_pages++] = page;
+        }
+    }
+
+    if (area->nr_pages != nr_pages) {
+        printk("vmalloc: allocation failure, allocated %u of %u pages\n",
+               area->nr_pages, nr_pages);
+        goto fail;
+    }
+
+    if (vmap_pages_range(addr, addr + get_vm_area_size(area), prot, pages) < 0)
+        goto fail;
+
+    return area->addr;
+
+fail:
+    vfree(area->addr);
+    return NULL;
+}
+
+void *__vmalloc_node_range(ulong size, ulong align, ulong start, ulong end,
+                           gfp_t gfp_mask, pgprot_t prot, ulong vm_flags,
+                           int node)
+{
+    struct vm_struct *area;
+
+    size = ALIGN_UP(size, PAGE_SIZE);
+    if (!size)
+        return NULL;
+
+    area = __get_vm_area_node(size, align, VM_ALLOC | vm_flags, start, end,
+                              gfp_mask);
+    if (!area) {
+        printk("vmalloc: allocation failure: %lu bytes\n", size);
+        return NULL;
+    }
+
+    return __vmalloc_area_node(area, gfp_mask, prot, node);
+}
+
+void *vmalloc(ulong size)
+{
+    return __vmalloc_node_range(size, 1, VMALLOC_START, VMALLOC_END,
+                                GFP_KERNEL, PAGE_KERNEL, 0, NUMA_NO_NODE);
+}
+
+void *vzalloc(ulong size)
+{
+    return __vmalloc_node_range(size, 1, VMALLOC_START, VMALLOC_END,
+                                GFP_KERNEL | __GFP_ZERO, PAGE_KERNEL, 0,
+                                NUMA_NO_NODE);
+}
+
+void *vmalloc_node(ulong size, int node)
+{
+    return __vmalloc_node_range(size, 1, VMALLOC_START, VMALLOC_END,
+                                GFP_KERNEL, PAGE_KERNEL, 0, node);
+}
+
+/* 模块代码放在MODULES_VADDR，与内核镜像同处最高2GB，可用32位相对跳转 */
+void *module_alloc(ulong size)
+{
+    return __vmalloc_node_range(size, 1, MODULES_VADDR, MODULES_END,
+                                GFP_KERNEL, PAGE_KERNEL_EXEC, 0, NUMA_NO_NODE);
+}
+
+void module_memfree(void *addr)
+{
+    vfree(addr);
+}
+
+struct page *vmalloc_to_page(const void *vmalloc_addr)
+{
+    ulong addr = (ulong)vmalloc_addr;
+    pgd_t *pgd;
+    pud_t *pud;
+    pmd_t *pmd;
+    pte_t *pte;
+
+    pgd = pgd_offset(&init_mm, addr);
+    if (pgd_none(*pgd))
+        return NULL;
+
+    pud = pud_offset(pgd, addr);
+    if (pud_none(*pud))
+        return NULL;
+
+    pmd = pmd_offset(pud, addr);
+    if (pmd_none(*pmd))
+        return NULL;
+
+    pte = pte_offset(pmd, addr);
+    if (!pte_present(*pte))
+        return NULL;
+
+    return pte_page(*pte);
+}
+
+static void vmap_init_free_space(ulong start, ulong end)
+{
+    struct vmap_area *va;
+
+    va = kmem_cache_alloc(vmap_area_cachep, GFP_KERNEL);
+    if (!va)
+        panic("vmalloc: cannot allocate free space descriptor\n");
+
+    va->va_start = start;
+    va->va_end = end;
+    va->flags = 0;
+    insert_vmap_area(va, &free_vmap_area_root, &free_vmap_area_list);
+}
+
+/*
+ * 每个进程的页表都复制内核那一半的顶级表项。vmalloc区和模块区的
+ * 顶级表项在这里一次建好，之后的映射只改下级页表，所有进程自动可见，
+ * 不需要在缺页时同步。
+ */
+static void preallocate_vmalloc_pages(ulong start, ulong end)
+{
+    ulong addr;
+
+    for (addr = start; addr - 1 < end - 1; addr = pgd_addr_end(addr, end)) {
+        if (!pud_alloc(&init_mm, pgd_offset(&init_mm, addr), addr))
+            panic("vmalloc: failed to preallocate page tables\n");
+    }
+}
+
+void vmalloc_init(void)
+{
+    int cpu;
+
+    vmap_area_cachep = kmem_cache_create("vmap_area", sizeof(struct vmap_area),
+                                         0, SLAB_PANIC, NULL);
+
+    init_mm.pgd = read_cr3() & PTE_PFN_MASK;
+    spin_lock_init(&init_mm.page_table_lock);
+
+    spin_lock_init(&vmap_area_lock);
+    spin_lock_init(&free_vmap_area_lock);
+    spin_lock_init(&purge_vmap_area_lock);
+    vmap_area_root.rb_node = NULL;
+    free_vmap_area_root.rb_node = NULL;
+    INIT_LIST_HEAD(&vmap_area_list);
+    INIT_LIST_HEAD(&free_vmap_area_list);
+    INIT_LIST_HEAD(&purge_vmap_area_list);
+    atomic_long_set(&vmap_lazy_nr, 0);
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        spin_lock_init(&vmap_block_queue[cpu].lock);
+        INIT_LIST_HEAD(&vmap_block_queue[cpu].free);
+        INIT_LIST_HEAD(&vmap_block_queue[cpu].full);
+    }
+
+    preallocate_vmalloc_pages(VMALLOC_START, VMALLOC_END);
+    preallocate_vmalloc_pages(MODULES_VADDR, MODULES_END);
+
+    vmap_init_free_space(VMALLOC_START, VMALLOC_END);
+    vmap_init_free_space(MODULES_VADDR, MODULES_END);
+
+    printk("vmalloc: %lu MB vmalloc space, %lu MB module space\n",
+           (VMALLOC_END - VMALLOC_START) >> 20, (MODULES_END - MODULES_VADDR) >> 20);
+}
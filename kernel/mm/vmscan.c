@@ -0,0 +1,630 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/list.h"
+#include "../../include/spinlock.h"
+#include "../../include/sched.h"
+#include "../../include/gfp.h"
+#include "../../include/swap.h"
+#include "../../include/rmap.h"
+#include "../../include/compaction.h"
+#include "../../include/numa.h"
+#include "../../include/memcontrol.h"
+#include "internal.h"
+
+/*
+ * 页面回收。每个节点一个kswapd：分配时发现区域低于低水位就唤醒它，
+ * 它从LRU尾部回收直到区域回到高水位，分配者大多不必自己回收。
+ *
+ * 活跃链表老化：尾部的页先降到不活跃链表(可执行的文件页除外)；
+ * 不活跃链表上的页被访问过一次只记PG_referenced并放回，再次被访问
+ * 才提回活跃链表，否则回收。
+ */
+
+struct scan_control {
+    ulong nr_to_reclaim;    /* 本次回收目标 */
+    ulong nr_scanned;       /* 已扫描的页数 */
+    ulong nr_reclaimed;     /* 已回收的页数 */
+    gfp_t gfp_mask;
+    int order;
+    int priority;           /* 每次扫描LRU长度的1/2^priority */
+    bool may_unmap;         /* 能否解除映射 */
+    bool may_swap;          /* 能否回收匿名页 */
+
+    /* 组内回收时只回收记在该组子树上的页，NULL为全局回收 */
+    struct mem_cgroup *target_mem_cgroup;
+};
+
+static bool inactive_list_is_low(struct lruvec *lruvec, bool file)
+{
+    enum lru_list inactive = file ? LRU_INACTIVE_FILE : LRU_INACTIVE_ANON;
+
+    return lruvec->nr_pages[inactive] < lruvec->nr_pages[inactive + LRU_ACTIVE];
+}
+
+/*
+ * 从lru尾部隔离至多nr_to_scan个页到dst，调用者持lru_lock。
+ * 组内回收时别的组的页原地跳过，不打乱它们在LRU上的次序。
+ */
+static ulong isolate_lru_pages(ulong nr_to_scan, struct lruvec *lruvec,
+                               struct list_head *dst, ulong *nr_scanned,
+                               enum lru_list lru, struct scan_control *sc)
+{
+    struct list_head *src = &lruvec->lists[lru];
+    struct list_head *pos, *prev;
+    struct page *page;
+    ulong nr_taken = 0;
+    ulong scan;
+
+    for (scan = 0, pos = src->prev; scan < nr_to_scan && pos != src;
+         scan++, pos = prev) {
+        prev = pos->prev;
+        page = list_entry(pos, struct page, lru);
+
+        if (!mem_cgroup_is_descendant(page->mem_cgroup, sc->target_mem_cgroup))
+            continue;
+
+        /* 正在被释放的页留给释放者，挪到头部免得反复撞上 */
+        if (!get_page_unless_zero(page)) {
+            list_move(&page->lru, src);
+            continue;
+        }
+
+        ClearPageLRU(page);
+        del_page_from_lru_list(page, lruvec, lru);
+        list_add(&page->lru, dst);
+        nr_taken += hpage_nr_pages(page);
+    }
+
+    *nr_scanned = scan;
+    return nr_taken;
+}
+
+/* 把list上的页放回各自的LRU，放掉隔离引用，最后一个引用的页直接释放 */
+static void putback_lru_pages(struct zone *zone, struct lruvec *lruvec,
+                              struct list_head *list)
+{
+    struct list_head pages_to_free;
+    struct page *page;
+    enum lru_list lru;
+    ulong flags;
+
+    INIT_LIST_HEAD(&pages_to_free);
+
+    spin_lock_irqsave(&zone->lru_lock, &flags);
+    while (!list_empty(list)) {
+        page = list_first_entry(list, struct page, lru);
+        list_del(&page->lru);
+
+        lru = page_lru(page);
+        SetPageLRU(page);
+        add_page_to_lru_list(page, lruvec, lru);
+
+        if (put_page_testzero(page)) {
+            ClearPageLRU(page);
+            ClearPageActive(page);
+            del_page_from_lru_list(page, lruvec, lru);
+            set_page_private(page, compound_order(page));
+            list_add(&page->lru, &pages_to_free);
+        }
+    }
+    spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+    free_pages_list(&pages_to_free);
+}
+
+static void shrink_active_list(ulong nr_to_scan, struct lruvec *lruvec,
+                               struct scan_control *sc, enum lru_list lru)
+{
+    struct zone *zone = container_of(lruvec, struct zone, lruvec);
+    struct list_head l_hold;
+    struct page *page;
+    ulong nr_scanned;
+    ulong vm_flags;
+    ulong flags;
+
+    INIT_LIST_HEAD(&l_hold);
+
+    lru_add_drain();
+
+    spin_lock_irqsave(&zone->lru_lock, &flags);
+    isolate_lru_pages(nr_to_scan, lruvec, &l_hold, &nr_scanned, lru, sc);
+    spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+    sc->nr_scanned += nr_scanned;
+
+    list_for_each_entry(page, &l_hold, lru) {
+        /* 代码段容易被大量流式读写挤出去，被访问过就留在活跃链表 */
+        if (page_referenced(page, 0, NULL, &vm_flags) &&
+            (vm_flags & VM_EXEC) && !PageSwapBacked(page))
+            continue;
+
+        ClearPageActive(page);
+    }
+
+    putback_lru_pages(zone, lruvec, &l_hold);
+}
+
+/*
+ * 把干净、没人引用的交换缓存页移出交换缓存，放掉缓存的那个引用。
+ * 只剩隔离引用和缓存引用时才能移，别人刚查到这页就留着。
+ */
+static int remove_swap_mapping(struct page *page)
+{
+    swp_entry_t entry = page_swap_entry(page);
+    struct address_space *address_space = swap_address_space(entry);
+    ulong flags;
+
+    spin_lock_irqsave(&address_space->tree_lock, &flags);
+    if (page_count(page) != 2 || PageDirty(page)) {
+        spin_unlock_irqrestore(&address_space->tree_lock, flags);
+        return 0;
+    }
+    __delete_from_swap_cache(page);
+    spin_unlock_irqrestore(&address_space->tree_lock, flags);
+
+    swapcache_free(entry);
+    put_page(page);
+
+    return 1;
+}
+
+/* 回收page_list上的页，回收不了的留在page_list上 */
+static ulong shrink_page_list(struct list_head *page_list, struct scan_control *sc)
+{
+    struct list_head ret_pages;
+    struct list_head free_pages;
+    struct address_space *mapping;
+    struct page *page;
+    ulong nr_reclaimed = 0;
+    ulong vm_flags;
+    int referenced_ptes;
+    bool referenced_page;
+    int ret;
+
+    INIT_LIST_HEAD(&ret_pages);
+    INIT_LIST_HEAD(&free_pages);
+
+    while (!list_empty(page_list)) {
+        page = list_last_entry(page_list, struct page, lru);
+        list_del(&page->lru);
+
+        if (!trylock_page(page))
+            goto keep;
+
+        if (PageWriteback(page))
+            goto keep_locked;
+
+        referenced_ptes = page_referenced(page, 1, NULL, &vm_flags);
+        referenced_page = PageReferenced(page);
+        ClearPageReferenced(page);
+
+        if (referenced_ptes) {
+            SetPageReferenced(page);
+            /* 两次扫描之间都被访问过，或被多个映射共享，才提回活跃链表 */
+            if (referenced_page || referenced_ptes > 1 || (vm_flags & VM_EXEC))
+                goto activate_locked;
+            goto keep_locked;
+        }
+
+        /* 交换缓存和槽位都按单页管理，透明大页既不能整个换出也不拆分 */
+        if (PageCompound(page))
+            goto activate_locked;
+
+        /* 匿名页先放进交换缓存，分不到槽位就留在内存里 */
+        if (PageAnon(page) && !PageSwapCache(page)) {
+            if (!sc->may_swap || !add_to_swap(page))
+                goto activate_locked;
+        }
+
+        if (page_mapped(page)) {
+            if (!sc->may_unmap)
+                goto keep_locked;
+            try_to_unmap(page, TTU_UNMAP);
+            if (page_mapped(page))
+                goto activate_locked;
+        }
+
+        /*
+         * 文件脏页要等回写，这里不发起I/O；交换缓存页在这里同步写出，
+         * 多半是压进zswap。写出时页会被解锁，写完重新加锁再往下走。
+         */
+        if (PageDirty(page)) {
+            if (!PageSwapCache(page))
+                goto keep_locked;
+
+            ret = swap_writepage(page);
+            if (!trylock_page(page))
+                goto keep;
+            if (ret)
+                goto activate_locked;
+            if (PageDirty(page) || PageWriteback(page))
+                goto keep_locked;
+        }
+
+        if (PageSwapCache(page)) {
+            if (!remove_swap_mapping(page))
+                goto keep_locked;
+        } else {
+            mapping = page_mapping(page);
+            if (!mapping || !remove_mapping(mapping, page))
+                goto keep_locked;
+        }
+
+        unlock_page(page);
+
+        /* 页缓存的引用已随remove_mapping放掉，只剩隔离引用 */
+        if (put_page_testzero(page)) {
+            nr_reclaimed += hpage_nr_pages(page);
+            set_page_private(page, compound_order(page));
+            list_add(&page->lru, &free_pages);
+        }
+        continue;
+
+activate_locked:
+        SetPageActive(page);
+keep_locked:
+        unlock_page(page);
+keep:
+        list_add(&page->lru, &ret_pages);
+    }
+
+    free_pages_list(&free_pages);
+    list_splice(&ret_pages, page_list);
+
+    return nr_reclaimed;
+}
+
+static ulong shrink_inactive_list(ulong nr_to_scan, struct lruvec *lruvec,
+                                  struct scan_control *sc, enum lru_list lru)
+{
+    struct zone *zone = container_of(lruvec, struct zone, lruvec);
+    struct list_head page_list;
+    ulong nr_scanned;
+    ulong nr_taken;
+    ulong nr_reclaimed;
+    ulong flags;
+
+    INIT_LIST_HEAD(&page_list);
+
+    lru_add_drain();
+
+    spin_lock_irqsave(&zone->lru_lock, &flags);
+    nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &page_list, &nr_scanned,
+                                 lru, sc);
+    __mod_node_page_state(zone->zone_pgdat, NR_ISOLATED_ANON + is_file_lru(lru),
+                          nr_taken);
+    if (current->flags & PF_KSWAPD)
+        __count_vm_events(PGSCAN_KSWAPD, nr_scanned);
+    else
+        __count_vm_events(PGSCAN_DIRECT, nr_scanned);
+    spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+    sc->nr_scanned += nr_scanned;
+    if (!nr_taken)
+        return 0;
+
+    nr_reclaimed = shrink_page_list(&page_list, sc);
+    if (current->flags & PF_KSWAPD)
+        count_vm_events(PGSTEAL_KSWAPD, nr_reclaimed);
+    else
+        count_vm_events(PGSTEAL_DIRECT, nr_reclaimed);
+
+    putback_lru_pages(zone, lruvec, &page_list);
+    mod_node_page_state(zone->zone_pgdat, NR_ISOLATED_ANON + is_file_lru(lru),
+                        -(long)nr_taken);
+
+    return nr_reclaimed;
+}
+
+static ulong shrink_list(enum lru_list lru, ulong nr_to_scan,
+                         struct lruvec *lruvec, struct scan_control *sc)
+{
+    if (lru == LRU_ACTIVE_ANON || lru == LRU_ACTIVE_FILE) {
+        /* 不活跃链表不够长时才老化活跃链表 */
+        if (inactive_list_is_low(lruvec, is_file_lru(lru)))
+            shrink_active_list(nr_to_scan, lruvec, sc, lru);
+        return 0;
+    }
+
+    return shrink_inactive_list(nr_to_scan, lruvec, sc, lru);
+}
+
+static void shrink_zone(struct zone *zone, struct scan_control *sc)
+{
+    struct lruvec *lruvec = &zone->lruvec;
+    ulong nr[NR_LRU_LISTS];
+    ulong nr_to_scan;
+    bool scan_anon = sc->may_swap && get_nr_swap_pages() > 0;
+    enum lru_list lru;
+
+    for (lru = LRU_INACTIVE_ANON; lru <= LRU_ACTIVE_FILE; lru++) {
+        if (!is_file_lru(lru) && !scan_anon)
+            nr[lru] = 0;
+        else
+            nr[lru] = lruvec->nr_pages[lru] >> sc->priority;
+    }
+
+    while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_FILE] ||
+           nr[LRU_INACTIVE_FILE]) {
+        for (lru = LRU_INACTIVE_ANON; lru <= LRU_ACTIVE_FILE; lru++) {
+            if (!nr[lru])
+                continue;
+
+            nr_to_scan = MIN(nr[lru], SWAP_CLUSTER_MAX);
+            nr[lru] -= nr_to_scan;
+            sc->nr_reclaimed += shrink_list(lru, nr_to_scan, lruvec, sc);
+        }
+
+        if (sc->nr_reclaimed >= sc->nr_to_reclaim)
+            break;
+    }
+
+    /* 活跃链表过长时，即使本轮没轮到也要老化一批 */
+    if (scan_anon && inactive_list_is_low(lruvec, false))
+        shrink_active_list(SWAP_CLUSTER_MAX, lruvec, sc, LRU_ACTIVE_ANON);
+}
+
+static bool zone_balanced(struct zone *zone, int order, int classzone_idx)
+{
+    return zone_watermark_ok_safe(zone, order, zone->watermark[WMARK_HIGH],
+                                  classzone_idx);
+}
+
+/* classzone_idx及以下有一个区域回到高水位就够了；没有区域时也算平衡 */
+static bool pgdat_balanced(struct pglist_data *pgdat, int order, int classzone_idx)
+{
+    struct zone *zone;
+    bool populated = false;
+    int i;
+
+    for (i = 0; i <= classzone_idx && i < MAX_NR_ZONES; i++) {
+        zone = pgdat->node_zones + i;
+        if (!zone->present_pages)
+            continue;
+
+        populated = true;
+        if (zone_balanced(zone, order, classzone_idx))
+            return true;
+    }
+
+    return !populated;
+}
+
+static void balance_pgdat(struct pglist_data *pgdat, int order, int classzone_idx)
+{
+    struct scan_control sc;
+    struct zone *zone;
+    ulong nr_reclaimed = 0;
+    int i;
+
+    sc.gfp_mask = GFP_KERNEL;
+    sc.order = order;
+    sc.priority = DEF_PRIORITY;
+    sc.may_unmap = true;
+    sc.may_swap = true;
+    sc.target_mem_cgroup = NULL;
+
+    do {
+        if (pgdat_balanced(pgdat, sc.order, classzone_idx))
+            break;
+
+        /*
+         * 高阶请求回收到0阶已平衡就停，剩下的交给kcompactd拼成大块，
+         * 一直回收下去只会白白清空页缓存
+         */
+        if (sc.order && pgdat_balanced(pgdat, 0, classzone_idx)) {
+            sc.order = 0;
+            break;
+        }
+
+        sc.nr_scanned = 0;
+        sc.nr_reclaimed = 0;
+
+        /* 从高区域往低区域回收，低端区域留给只能用它们的分配 */
+        for (i = classzone_idx; i >= 0; i--) {
+            zone = pgdat->node_zones + i;
+            if (!zone->present_pages)
+                continue;
+            if (zone_balanced(zone, sc.order, classzone_idx))
+                continue;
+
+            sc.nr_to_reclaim = MAX(zone->watermark[WMARK_HIGH], SWAP_CLUSTER_MAX);
+            shrink_zone(zone, &sc);
+        }
+
+        nr_reclaimed += sc.nr_reclaimed;
+
+        if (kthread_should_stop())
+            break;
+
+        /* 没回收够才加大扫描力度 */
+        if (sc.nr_reclaimed < sc.nr_to_reclaim)
+            sc.priority--;
+    } while (sc.priority >= 1);
+
+    if (!nr_reclaimed && !pgdat_balanced(pgdat, 0, classzone_idx))
+        pgdat->kswapd_failures++;
+    else
+        pgdat->kswapd_failures = 0;
+}
+
+static bool kswapd_work_requested(struct pglist_data *pgdat)
+{
+    if (kthread_should_stop())
+        return true;
+
+    if (pgdat->kswapd_failures >= MAX_RECLAIM_RETRIES)
+        return false;
+
+    return !pgdat_balanced(pgdat, pgdat->kswapd_order,
+                           pgdat->kswapd_classzone_idx);
+}
+
+static int kswapd(void *p)
+{
+    struct pglist_data *pgdat = p;
+    int order, classzone_idx;
+
+    /* 回收路径上的分配可以动用最低水位以下的保留 */
+    current->flags |= PF_MEMALLOC | PF_KSWAPD;
+
+    pgdat->kswapd_order = 0;
+    pgdat->kswapd_classzone_idx = 0;
+
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(pgdat->kswapd_wait,
+                                 kswapd_work_requested(pgdat));
+        if (kthread_should_stop())
+            break;
+
+        order = pgdat->kswapd_order;
+        classzone_idx = pgdat->kswapd_classzone_idx;
+        pgdat->kswapd_order = 0;
+        pgdat->kswapd_classzone_idx = 0;
+
+        balance_pgdat(pgdat, order, classzone_idx);
+
+        if (order)
+            wakeup_kcompactd(pgdat, order, classzone_idx);
+    }
+
+    current->flags &= ~(PF_MEMALLOC | PF_KSWAPD);
+
+    return 0;
+}
+
+void wakeup_kswapd(struct zone *zone, int order, enum zone_type classzone_idx)
+{
+    struct pglist_data *pgdat = zone->zone_pgdat;
+
+    if (!zone->present_pages || !pgdat->kswapd)
+        return;
+
+    if (pgdat->kswapd_order < order)
+        pgdat->kswapd_order = order;
+    if (pgdat->kswapd_classzone_idx < (int)classzone_idx)
+        pgdat->kswapd_classzone_idx = classzone_idx;
+
+    if (!waitqueue_active(&pgdat->kswapd_wait))
+        return;
+
+    /* 节点已经回收不动了，等直接回收有了进展再说 */
+    if (pgdat->kswapd_failures >= MAX_RECLAIM_RETRIES)
+        return;
+
+    if (pgdat_balanced(pgdat, order, classzone_idx))
+        return;
+
+    wake_up_interruptible(&pgdat->kswapd_wait);
+}
+
+/* 直接回收：kswapd跟不上时由分配者自己回收一小批 */
+ulong try_to_free_pages(struct zonelist *zonelist, int order, gfp_t gfp_mask,
+                        nodemask_t *nodemask)
+{
+    struct scan_control sc;
+    struct zoneref *z;
+    struct zone *zone;
+    ulong reclaimed;
+
+    sc.nr_to_reclaim = SWAP_CLUSTER_MAX;
+    sc.nr_scanned = 0;
+    sc.nr_reclaimed = 0;
+    sc.gfp_mask = gfp_mask;
+    sc.order = order;
+    sc.priority = DEF_PRIORITY;
+    sc.may_unmap = true;
+    sc.may_swap = true;
+    sc.target_mem_cgroup = NULL;
+
+    /* 回收中的分配不能再递归进入回收 */
+    current->flags |= PF_MEMALLOC;
+
+    do {
+        for_each_zone_zonelist_nodemask(zone, z, zonelist, gfp_zone(gfp_mask),
+                                        nodemask) {
+            if (!zone->present_pages)
+                continue;
+
+            reclaimed = sc.nr_reclaimed;
+            shrink_zone(zone, &sc);
+            if (sc.nr_reclaimed > reclaimed)
+                zone->zone_pgdat->kswapd_failures = 0;
+
+            if (sc.nr_reclaimed >= sc.nr_to_reclaim)
+                break;
+        }
+    } while (sc.nr_reclaimed < sc.nr_to_reclaim && --sc.priority >= 0);
+
+    current->flags &= ~PF_MEMALLOC;
+
+    return sc.nr_reclaimed;
+}
+
+#if CONFIG_MEMCG
+/*
+ * 组内回收：组超限时由记账者调用，在所有区域的LRU上只回收记在该组
+ * 子树上的页。不看区域水位，回收够nr_pages(至少一批)就停。
+ */
+ulong try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg, ulong nr_pages,
+                                   gfp_t gfp_mask)
+{
+    struct scan_control sc;
+    struct zone *zone;
+    ulong noreclaim_flag;
+
+    sc.nr_to_reclaim = MAX(nr_pages, SWAP_CLUSTER_MAX);
+    sc.nr_scanned = 0;
+    sc.nr_reclaimed = 0;
+    sc.gfp_mask = gfp_mask;
+    sc.order = 0;
+    sc.priority = DEF_PRIORITY;
+    sc.may_unmap = true;
+    sc.may_swap = true;
+    sc.target_mem_cgroup = memcg;
+
+    /* 调用者可能本来就在回收路径上，结束时恢复原来的标志 */
+    noreclaim_flag = current->flags & PF_MEMALLOC;
+    current->flags |= PF_MEMALLOC;
+
+    do {
+        for_each_zone(zone) {
+            if (!zone->present_pages)
+                continue;
+
+            shrink_zone(zone, &sc);
+            if (sc.nr_reclaimed >= sc.nr_to_reclaim)
+                break;
+        }
+    } while (sc.nr_reclaimed < sc.nr_to_reclaim && --sc.priority >= 0);
+
+    current->flags = (current->flags & ~PF_MEMALLOC) | noreclaim_flag;
+
+    return sc.nr_reclaimed;
+}
+#endif
+
+int kswapd_run(int nid)
+{
+    struct pglist_data *pgdat = NODE_DATA(nid);
+
+    /* 没有内存的节点无需回收 */
+    if (!pgdat || pgdat->kswapd || !pgdat->node_present_pages)
+        return 0;
+
+    pgdat->kswapd = kthread_run(kswapd, pgdat, "kswapd%d", nid);
+    if (IS_ERR(pgdat->kswapd)) {
+        pgdat->kswapd = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+void kswapd_init(void)
+{
+    int nid;
+
+    for_each_online_node(nid)
+        kswapd_run(nid);
+}
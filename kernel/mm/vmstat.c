@@ -0,0 +1,356 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/bitops.h"
+#include "../../include/numa.h"
+#include "../../include/vmstat.h"
+#include "internal.h"
+
+/*
+ * 每CPU差值计数。分配释放路径上的统计更新只动本CPU的差值，差值越过
+ * stat_threshold才一次性折叠进区域/节点和全局的原子总数，其余的由
+ * 时钟中断每STAT_INTERVAL个节拍折叠一次。阈值随区域大小增长，大区域
+ * 上允许的误差大一些，换来更少的原子操作。
+ */
+
+/* 每CPU差值定期折叠的间隔(节拍) */
+#define STAT_INTERVAL           HZ
+
+/* s8差值能容纳的最大阈值 */
+#define MAX_STAT_THRESHOLD      125
+
+/* NUMA事件只增不减，差值用u16，攒到接近上限才折叠 */
+#define NUMA_STATS_THRESHOLD    (0xffff - 2)
+
+atomic_long_t vm_zone_stat[NR_VM_ZONE_STAT_ITEMS];
+atomic_long_t vm_numa_stat[NR_VM_NUMA_STAT_ITEMS];
+atomic_long_t vm_node_stat[NR_VM_NODE_STAT_ITEMS];
+
+struct vm_event_state vm_event_states[NR_CPUS];
+
+static ulong vmstat_ticks[NR_CPUS];
+
+static inline void zone_page_state_add(long x, struct zone *zone,
+                                       enum zone_stat_item item)
+{
+    atomic_long_add(x, &zone->vm_stat[item]);
+    atomic_long_add(x, &vm_zone_stat[item]);
+}
+
+static inline void node_page_state_add(long x, struct pglist_data *pgdat,
+                                       enum node_stat_item item)
+{
+    atomic_long_add(x, &pgdat->vm_stat[item]);
+    atomic_long_add(x, &vm_node_stat[item]);
+}
+
+static inline void zone_numa_state_add(long x, struct zone *zone,
+                                       enum numa_stat_item item)
+{
+    atomic_long_add(x, &zone->vm_numa_stat[item]);
+    atomic_long_add(x, &vm_numa_stat[item]);
+}
+
+/* 以下双下划线版本要求调用者已关中断，差值的读改写不能被本CPU打断 */
+void __mod_zone_page_state(struct zone *zone, enum zone_stat_item item,
+                           long delta)
+{
+    struct per_cpu_zonestat *pzstats =
+        &zone->per_cpu_zonestats[smp_processor_id()];
+    long x = delta + pzstats->vm_stat_diff[item];
+    long t = pzstats->stat_threshold;
+
+    if (unlikely(x > t || x < -t)) {
+        zone_page_state_add(x, zone, item);
+        x = 0;
+    }
+    pzstats->vm_stat_diff[item] = x;
+}
+
+/*
+ * 单步增减越过阈值时多折叠半个阈值，把差值留在反方向，连续同向的
+ * 更新要再走一个完整阈值才会再次碰原子总数。
+ */
+static void __inc_zone_state(struct zone *zone, enum zone_stat_item item)
+{
+    struct per_cpu_zonestat *pzstats =
+        &zone->per_cpu_zonestats[smp_processor_id()];
+    long v = pzstats->vm_stat_diff[item] + 1;
+    long t = pzstats->stat_threshold;
+
+    if (unlikely(v > t)) {
+        long overstep = t >> 1;
+
+        zone_page_state_add(v + overstep, zone, item);
+        v = -overstep;
+    }
+    pzstats->vm_stat_diff[item] = v;
+}
+
+static void __dec_zone_state(struct zone *zone, enum zone_stat_item item)
+{
+    struct per_cpu_zonestat *pzstats =
+        &zone->per_cpu_zonestats[smp_processor_id()];
+    long v = pzstats->vm_stat_diff[item] - 1;
+    long t = pzstats->stat_threshold;
+
+    if (unlikely(v < -t)) {
+        long overstep = t >> 1;
+
+        zone_page_state_add(v - overstep, zone, item);
+        v = overstep;
+    }
+    pzstats->vm_stat_diff[item] = v;
+}
+
+void __inc_zone_page_state(struct page *page, enum zone_stat_item item)
+{
+    __inc_zone_state(page_zone(page), item);
+}
+
+void __dec_zone_page_state(struct page *page, enum zone_stat_item item)
+{
+    __dec_zone_state(page_zone(page), item);
+}
+
+void mod_zone_page_state(struct zone *zone, enum zone_stat_item item,
+                         long delta)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    __mod_zone_page_state(zone, item, delta);
+    local_irq_restore(flags);
+}
+
+void inc_zone_page_state(struct page *page, enum zone_stat_item item)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    __inc_zone_state(page_zone(page), item);
+    local_irq_restore(flags);
+}
+
+void dec_zone_page_state(struct page *page, enum zone_stat_item item)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    __dec_zone_state(page_zone(page), item);
+    local_irq_restore(flags);
+}
+
+void __mod_node_page_state(struct pglist_data *pgdat,
+                           enum node_stat_item item, long delta)
+{
+    struct per_cpu_nodestat *pcp =
+        &pgdat->per_cpu_nodestats[smp_processor_id()];
+    long x = delta + pcp->vm_node_stat_diff[item];
+    long t = pcp->stat_threshold;
+
+    if (unlikely(x > t || x < -t)) {
+        node_page_state_add(x, pgdat, item);
+        x = 0;
+    }
+    pcp->vm_node_stat_diff[item] = x;
+}
+
+void __inc_node_page_state(struct page *page, enum node_stat_item item)
+{
+    __mod_node_page_state(NODE_DATA(page_to_nid(page)), item, 1);
+}
+
+void __dec_node_page_state(struct page *page, enum node_stat_item item)
+{
+    __mod_node_page_state(NODE_DATA(page_to_nid(page)), item, -1);
+}
+
+void mod_node_page_state(struct pglist_data *pgdat,
+                         enum node_stat_item item, long delta)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    __mod_node_page_state(pgdat, item, delta);
+    local_irq_restore(flags);
+}
+
+void __inc_numa_state(struct zone *zone, enum numa_stat_item item)
+{
+    struct per_cpu_zonestat *pzstats =
+        &zone->per_cpu_zonestats[smp_processor_id()];
+    ulong v = pzstats->vm_numa_stat_diff[item] + 1;
+
+    if (unlikely(v > NUMA_STATS_THRESHOLD)) {
+        zone_numa_state_add(v, zone, item);
+        v = 0;
+    }
+    pzstats->vm_numa_stat_diff[item] = v;
+}
+
+void inc_numa_state(struct zone *zone, enum numa_stat_item item)
+{
+    ulong flags;
+
+    flags = local_irq_save();
+    __inc_numa_state(zone, item);
+    local_irq_restore(flags);
+}
+
+/* 全局总数加上所有区域所有CPU的差值，供需要准确数字的sysinfo等使用 */
+ulong global_zone_page_state_snapshot(enum zone_stat_item item)
+{
+    struct zone *zone;
+    long x = atomic_long_read(&vm_zone_stat[item]);
+    int cpu;
+
+    for_each_zone(zone) {
+        for (cpu = 0; cpu < NR_CPUS; cpu++)
+            x += zone->per_cpu_zonestats[cpu].vm_stat_diff[item];
+    }
+
+    return x < 0 ? 0 : x;
+}
+
+void all_vm_events(ulong *ret)
+{
+    int cpu, i;
+
+    for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
+        ret[i] = 0;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
+            ret[i] += vm_event_states[cpu].event[i];
+    }
+}
+
+/*
+ * 把cpu上的差值全部折叠进总数。对本CPU调用时需关中断；对其它CPU调用
+ * 只能在它不再更新统计时(如下线后)进行。
+ */
+void refresh_cpu_vm_stats(int cpu)
+{
+    struct per_cpu_zonestat *pzstats;
+    struct per_cpu_nodestat *pcp;
+    struct zone *zone;
+    long v;
+    int nid, i;
+
+    for_each_zone(zone) {
+        pzstats = &zone->per_cpu_zonestats[cpu];
+
+        for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++) {
+            v = pzstats->vm_stat_diff[i];
+            if (v) {
+                pzstats->vm_stat_diff[i] = 0;
+                zone_page_state_add(v, zone, i);
+            }
+        }
+
+        for (i = 0; i < NR_VM_NUMA_STAT_ITEMS; i++) {
+            v = pzstats->vm_numa_stat_diff[i];
+            if (v) {
+                pzstats->vm_numa_stat_diff[i] = 0;
+                zone_numa_state_add(v, zone, i);
+            }
+        }
+    }
+
+    for_each_online_node(nid) {
+        if (!NODE_DATA(nid))
+            continue;
+        pcp = &NODE_DATA(nid)->per_cpu_nodestats[cpu];
+
+        for (i = 0; i < NR_VM_NODE_STAT_ITEMS; i++) {
+            v = pcp->vm_node_stat_diff[i];
+            if (v) {
+                pcp->vm_node_stat_diff[i] = 0;
+                node_page_state_add(v, NODE_DATA(nid), i);
+            }
+        }
+    }
+}
+
+/*
+ * 阈值随CPU数和区域大小对数增长：每128MB内存加一档，最大125。
+ * CPU越多、内存越大，总数的误差越能容忍，争用也越值得避免。
+ */
+static int calculate_normal_threshold(struct zone *zone)
+{
+    int threshold;
+    int mem;
+
+    mem = zone->managed_pages >> (27 - PAGE_SHIFT);
+    threshold = 2 * fls(NR_CPUS) * (1 + fls(mem));
+
+    return MIN(threshold, MAX_STAT_THRESHOLD);
+}
+
+/*
+ * 重新计算各区域的阈值，并据此设置percpu_drift_mark：所有CPU的差值
+ * 加起来可能超过低水位与最低水位之差时，空闲页一旦低于该标记，水位
+ * 判断就必须改用快照值，否则可能在总数还显示充足时把区域耗空。
+ */
+void refresh_zone_stat_thresholds(void)
+{
+    struct pglist_data *pgdat;
+    struct zone *zone;
+    ulong max_drift, tolerate_drift;
+    int threshold;
+    int nid, cpu;
+
+    for_each_online_node(nid) {
+        pgdat = NODE_DATA(nid);
+        if (!pgdat)
+            continue;
+        for (cpu = 0; cpu < NR_CPUS; cpu++)
+            pgdat->per_cpu_nodestats[cpu].stat_threshold = 0;
+    }
+
+    for_each_zone(zone) {
+        pgdat = zone->zone_pgdat;
+        threshold = calculate_normal_threshold(zone);
+
+        for (cpu = 0; cpu < NR_CPUS; cpu++) {
+            zone->per_cpu_zonestats[cpu].stat_threshold = threshold;
+
+            /* 节点统计取节点内各区域阈值的最大值 */
+            if (pgdat && pgdat->per_cpu_nodestats[cpu].stat_threshold < threshold)
+                pgdat->per_cpu_nodestats[cpu].stat_threshold = threshold;
+        }
+
+        tolerate_drift = zone->watermark[WMARK_LOW] - zone->watermark[WMARK_MIN];
+        max_drift = NR_CPUS * threshold;
+        if (max_drift > tolerate_drift)
+            zone->percpu_drift_mark = zone->watermark[WMARK_HIGH] + max_drift;
+        else
+            zone->percpu_drift_mark = 0;
+    }
+}
+
+/* 时钟中断中调用，已关中断 */
+void vmstat_tick(void)
+{
+    int cpu = smp_processor_id();
+
+    if (++vmstat_ticks[cpu] < STAT_INTERVAL)
+        return;
+
+    vmstat_ticks[cpu] = 0;
+    refresh_cpu_vm_stats(cpu);
+}
+
+/* 区域都注册完之后调用；之前阈值为0，每次更新都直接进总数 */
+void vmstat_init(void)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++)
+        vmstat_ticks[cpu] = 0;
+
+    refresh_zone_stat_thresholds();
+
+    printk("vmstat: per-cpu counters enabled\n");
+}
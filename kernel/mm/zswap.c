@@ -0,0 +1,480 @@
+#include "../../include/mm.h"
+#include "../../include/types.h"
+#include "../../include/spinlock.h"
+#include "../../include/string.h"
+#include "../../include/slab.h"
+#include "../../include/swap.h"
+#include "../../include/vmstat.h"
+#include "internal.h"
+
+#if CONFIG_ZSWAP
+
+/*
+ * zswap：交换的第一层，换出页压缩后留在内存里。冷的匿名页通常压得
+ * 很小(大量是零页或重复数据)，换入只要解压，不用等设备I/O；压缩池
+ * 超过总内存的一定比例或压缩率太差时不收，交给下一层的交换设备。
+ *
+ * 每个交换区一棵按槽位偏移排序的红黑树，槽位交还时条目随之失效。
+ *
+ * 压缩用LZ77一类的字节流格式(与LZ4块格式相同)：每个序列一个标记字节，
+ * 高4位是字面量长度、低4位是匹配长度减4，取满15时后跟扩展长度字节；
+ * 然后是字面量和2字节的回溯距离。最后一个序列只有字面量。
+ */
+
+#define ZSWAP_MAX_POOL_PERCENT  20
+
+/* 开机挂上的纯zswap交换区的槽位数 */
+#define ZSWAP_SWAP_PAGES        65536
+
+/* 压完超过这个大小就不值得存了 */
+#define ZSWAP_MAX_COMPRESSED    (PAGE_SIZE - PAGE_SIZE / 8)
+
+#define LZ_MIN_MATCH            4
+#define LZ_HASH_BITS            12
+#define LZ_MAX_OFFSET           0xffff
+
+struct zswap_entry {
+    struct rb_node rbnode;
+    pgoff_t offset;
+    unsigned int length;            /* 压缩后长度，0表示整页同一个值 */
+    union {
+        void *data;
+        ulong value;
+    };
+};
+
+struct zswap_tree {
+    struct rb_root rbroot;
+    spinlock_t lock;
+};
+
+static struct zswap_tree zswap_trees[MAX_SWAPFILES];
+
+/* 每CPU压缩工作区：输出缓冲和匹配哈希表 */
+struct zswap_workmem {
+    u8 *dstmem;
+    u16 *hashtab;
+};
+
+static struct zswap_workmem zswap_workmem[NR_CPUS];
+
+static bool zswap_enabled;
+static atomic_long_t zswap_pool_total_size;    /* 压缩数据总字节数 */
+static atomic_long_t zswap_stored_pages;
+static atomic_long_t zswap_same_filled_pages;
+static ulong zswap_reject_compress_poor;
+static ulong zswap_reject_alloc_fail;
+static ulong zswap_pool_limit_hit;
+
+static inline u32 lz_read32(const u8 *p)
+{
+    u32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 lz_hash(u32 seq)
+{
+    return (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static u8 *lz_put_len(u8 *op, unsigned int len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/* 一个序列最坏要占的字节数 */
+static inline unsigned int lz_seq_bound(unsigned int lit, unsigned int mlen)
+{
+    return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+/* 压缩src，放不进dst_cap字节返回-ENOSPC，否则返回压缩后长度 */
+static int lz_compress(const u8 *src, unsigned int src_len, u8 *dst,
+                       unsigned int dst_cap, u16 *htab)
+{
+    const u8 *ip = src, *anchor = src;
+    const u8 *end = src + src_len;
+    const u8 *mflimit = end - LZ_MIN_MATCH;
+    const u8 *ref, *mp, *rp;
+    u8 *op = dst, *oend = dst + dst_cap;
+    unsigned int lit, mlen, off;
+    u8 *token;
+    u32 seq, h;
+
+    memset(htab, 0, sizeof(u16) << LZ_HASH_BITS);
+
+    while (ip <= mflimit) {
+        seq = lz_read32(ip);
+        h = lz_hash(seq);
+        ref = src + htab[h];
+        htab[h] = ip - src;
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        mp = ip + LZ_MIN_MATCH;
+        rp = ref + LZ_MIN_MATCH;
+        while (mp < end && *mp == *rp) {
+            mp++;
+            rp++;
+        }
+
+        lit = ip - anchor;
+        mlen = mp - ip - LZ_MIN_MATCH;
+        off = ip - ref;
+        if (lz_seq_bound(lit, mlen) > (unsigned int)(oend - op))
+            return -ENOSPC;
+
+        token = op++;
+        *token = (MIN(lit, 15U) << 4) | MIN(mlen, 15U);
+        if (lit >= 15)
+            op = lz_put_len(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op++ = off & 0xff;
+        *op++ = off >> 8;
+        if (mlen >= 15)
+            op = lz_put_len(op, mlen - 15);
+
+        ip = anchor = mp;
+    }
+
+    lit = end - anchor;
+    if (lz_seq_bound(lit, 0) > (unsigned int)(oend - op))
+        return -ENOSPC;
+
+    *op++ = MIN(lit, 15U) << 4;
+    if (lit >= 15)
+        op = lz_put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return op - dst;
+}
+
+static int lz_get_len(const u8 **ip, const u8 *iend, unsigned int *len)
+{
+    u8 b;
+
+    do {
+        if (*ip >= iend)
+            return -EINVAL;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+/* 解压必须正好填满dst_len字节，数据损坏返回-EINVAL */
+static int lz_decompress(const u8 *src, unsigned int src_len, u8 *dst,
+                         unsigned int dst_len)
+{
+    const u8 *ip = src, *iend = src + src_len;
+    u8 *op = dst, *oend = dst + dst_len;
+    const u8 *ref;
+    unsigned int lit, mlen, off;
+    u8 token;
+
+    for (;;) {
+        if (ip >= iend)
+            return -EINVAL;
+        token = *ip++;
+
+        lit = token >> 4;
+        if (lit == 15 && lz_get_len(&ip, iend, &lit))
+            return -EINVAL;
+        if (lit > (unsigned int)(iend - ip) || lit > (unsigned int)(oend - op))
+            return -EINVAL;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -EINVAL;
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!off || off > (unsigned int)(op - dst))
+            return -EINVAL;
+
+        mlen = token & 15;
+        if (mlen == 15 && lz_get_len(&ip, iend, &mlen))
+            return -EINVAL;
+        mlen += LZ_MIN_MATCH;
+        if (mlen > (unsigned int)(oend - op))
+            return -EINVAL;
+
+        /* 距离可能小于长度(重复串)，只能逐字节复制 */
+        ref = op - off;
+        while (mlen--)
+            *op++ = *ref++;
+    }
+
+    return op == oend ? 0 : -EINVAL;
+}
+
+/* 整页是同一个字长的值(多数是零页)时只记这个值 */
+static bool zswap_is_page_same_filled(const ulong *data, ulong *value)
+{
+    unsigned int i;
+
+    for (i = 1; i < PAGE_SIZE / sizeof(ulong); i++) {
+        if (data[i] != data[0])
+            return false;
+    }
+    *value = data[0];
+    return true;
+}
+
+static void zswap_fill_page(ulong *data, ulong value)
+{
+    unsigned int i;
+
+    for (i = 0; i < PAGE_SIZE / sizeof(ulong); i++)
+        data[i] = value;
+}
+
+static bool zswap_is_full(void)
+{
+    struct zone *zone;
+    ulong total = 0;
+
+    for_each_zone(zone)
+        total += zone->managed_pages;
+
+    return atomic_long_read(&zswap_pool_total_size) >
+           (long)(total * ZSWAP_MAX_POOL_PERCENT / 100 * PAGE_SIZE);
+}
+
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+    struct rb_node *node = root->rb_node;
+    struct zswap_entry *entry;
+
+    while (node) {
+        entry = rb_entry(node, struct zswap_entry, rbnode);
+        if (offset < entry->offset)
+            node = node->rb_left;
+        else if (offset > entry->offset)
+            node = node->rb_right;
+        else
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* 同偏移已有条目时返回旧条目，不插入 */
+static struct zswap_entry *zswap_rb_insert(struct rb_root *root,
+                                           struct zswap_entry *entry)
+{
+    struct rb_node **link = &root->rb_node, *parent = NULL;
+    struct zswap_entry *this;
+
+    while (*link) {
+        parent = *link;
+        this = rb_entry(parent, struct zswap_entry, rbnode);
+        if (entry->offset < this->offset)
+            link = &parent->rb_left;
+        else if (entry->offset > this->offset)
+            link = &parent->rb_right;
+        else
+            return this;
+    }
+
+    rb_link_node(&entry->rbnode, parent, link);
+    rb_insert_color(&entry->rbnode, root);
+
+    return NULL;
+}
+
+static void zswap_entry_free(struct zswap_entry *entry)
+{
+    if (entry->length) {
+        atomic_long_sub(entry->length, &zswap_pool_total_size);
+        kfree(entry->data);
+    } else {
+        atomic_long_dec(&zswap_same_filled_pages);
+    }
+    atomic_long_dec(&zswap_stored_pages);
+    kfree(entry);
+}
+
+/*
+ * 页压缩后存进对应交换区的树，成功返回0，不收时返回负数。不收时槽位
+ * 里以前存的内容也作废，否则换入会读回那份旧的，而不是设备上的新内容。
+ */
+int zswap_store(unsigned int type, pgoff_t offset, struct page *page)
+{
+    struct zswap_tree *tree = &zswap_trees[type];
+    struct zswap_workmem *wmem;
+    struct zswap_entry *entry, *dup;
+    gfp_t gfp = __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM;
+    void *src = page_address(page);
+    ulong value, flags;
+    int len, ret;
+
+    if (!zswap_enabled)
+        return -ENODEV;
+
+    entry = kmalloc(sizeof(*entry), gfp);
+    if (!entry) {
+        zswap_reject_alloc_fail++;
+        ret = -ENOMEM;
+        goto reject;
+    }
+    entry->offset = offset;
+
+    if (zswap_is_page_same_filled(src, &value)) {
+        entry->length = 0;
+        entry->value = value;
+        atomic_long_inc(&zswap_same_filled_pages);
+        goto insert;
+    }
+
+    if (zswap_is_full()) {
+        zswap_pool_limit_hit++;
+        ret = -ENOMEM;
+        goto free_entry;
+    }
+
+    flags = local_irq_save();
+    wmem = &zswap_workmem[smp_processor_id()];
+    len = lz_compress(src, PAGE_SIZE, wmem->dstmem, ZSWAP_MAX_COMPRESSED,
+                      wmem->hashtab);
+    if (len < 0) {
+        local_irq_restore(flags);
+        zswap_reject_compress_poor++;
+        ret = -ENOSPC;
+        goto free_entry;
+    }
+
+    entry->data = kmalloc(len, gfp);
+    if (!entry->data) {
+        local_irq_restore(flags);
+        zswap_reject_alloc_fail++;
+        ret = -ENOMEM;
+        goto free_entry;
+    }
+    memcpy(entry->data, wmem->dstmem, len);
+    local_irq_restore(flags);
+
+    entry->length = len;
+    atomic_long_add(len, &zswap_pool_total_size);
+
+insert:
+    atomic_long_inc(&zswap_stored_pages);
+
+    spin_lock(&tree->lock);
+    /* 同一槽位重写(页换出后又被改脏)，旧内容作废 */
+    while ((dup = zswap_rb_insert(&tree->rbroot, entry)) != NULL) {
+        rb_erase(&dup->rbnode, &tree->rbroot);
+        zswap_entry_free(dup);
+    }
+    spin_unlock(&tree->lock);
+
+    count_vm_event(ZSWPOUT);
+
+    return 0;
+
+free_entry:
+    kfree(entry);
+reject:
+    zswap_invalidate(type, offset);
+    return ret;
+}
+
+/* 槽位在zswap里就解压到page，成功返回0；不在返回-ENOENT */
+int zswap_load(unsigned int type, pgoff_t offset, struct page *page)
+{
+    struct zswap_tree *tree = &zswap_trees[type];
+    struct zswap_entry *entry;
+    void *dst = page_address(page);
+    int ret = 0;
+
+    if (!zswap_enabled)
+        return -ENOENT;
+
+    spin_lock(&tree->lock);
+    entry = zswap_rb_search(&tree->rbroot, offset);
+    if (!entry) {
+        spin_unlock(&tree->lock);
+        return -ENOENT;
+    }
+
+    if (!entry->length)
+        zswap_fill_page(dst, entry->value);
+    else
+        ret = lz_decompress(entry->data, entry->length, dst, PAGE_SIZE);
+    spin_unlock(&tree->lock);
+
+    if (ret) {
+        printk("zswap: corrupt entry on swap %u offset %lu\n", type, offset);
+        return ret;
+    }
+
+    count_vm_event(ZSWPIN);
+
+    return 0;
+}
+
+/* 槽位交还时丢掉对应的压缩数据 */
+void zswap_invalidate(unsigned int type, pgoff_t offset)
+{
+    struct zswap_tree *tree = &zswap_trees[type];
+    struct zswap_entry *entry;
+
+    spin_lock(&tree->lock);
+    entry = zswap_rb_search(&tree->rbroot, offset);
+    if (entry) {
+        rb_erase(&entry->rbnode, &tree->rbroot);
+        zswap_entry_free(entry);
+    }
+    spin_unlock(&tree->lock);
+}
+
+void zswap_swapon(unsigned int type)
+{
+    zswap_trees[type].rbroot = RB_ROOT;
+}
+
+void zswap_init(void)
+{
+    int cpu, type;
+
+    for (type = 0; type < MAX_SWAPFILES; type++) {
+        zswap_trees[type].rbroot = RB_ROOT;
+        spin_lock_init(&zswap_trees[type].lock);
+    }
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        zswap_workmem[cpu].dstmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+        zswap_workmem[cpu].hashtab = kmalloc(sizeof(u16) << LZ_HASH_BITS,
+                                             GFP_KERNEL);
+        if (!zswap_workmem[cpu].dstmem || !zswap_workmem[cpu].hashtab) {
+            printk("zswap: can't allocate compression buffers, disabled\n");
+            return;
+        }
+    }
+
+    zswap_enabled = true;
+    printk("zswap: enabled, pool limit %d%% of RAM\n", ZSWAP_MAX_POOL_PERCENT);
+
+    /* 还没有块设备驱动，先挂一个只有zswap一层的交换区，匿名页才能换出 */
+    if (swapon(NULL, ZSWAP_SWAP_PAGES, 0))
+        printk("zswap: can't add swap area\n");
+}
+
+#endif /* CONFIG_ZSWAP */
@@ -9,10 +9,21 @@ QEMU_OPTS="-cpu qemu64 \
 
 DEBUG_OPTS="-s -S"
 
+# 两节点NUMA：每节点1个CPU、128M内存，远端距离20
+NUMA_OPTS="-smp 2 \
+           -object memory-backend-ram,id=mem0,size=128M \
+           -object memory-backend-ram,id=mem1,size=128M \
+           -numa node,nodeid=0,cpus=0,memdev=mem0 \
+           -numa node,nodeid=1,cpus=1,memdev=mem1 \
+           -numa dist,src=0,dst=1,val=20"
+
 case "$1" in
     "debug")
         qemu-system-x86_64 $QEMU_OPTS $DEBUG_OPTS -kernel out/kernel.elf
         ;;
+    "numa")
+        qemu-system-x86_64 $QEMU_OPTS $NUMA_OPTS -kernel out/kernel.elf
+        ;;
     "iso")
         qemu-system-x86_64 $QEMU_OPTS -cdrom out/os.iso
         ;;
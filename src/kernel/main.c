@@ -3,13 +3,26 @@
 #include "../../include/mm.h"
 #include "../../include/list.h"
 #include "../../include/spinlock.h"
+#include "../../include/gfp.h"
+#include "../../include/page.h"
+#include "../../include/string.h"
+#include "../../include/compaction.h"
+#include "../../include/slab.h"
+#include "../../include/pgtable.h"
+#include "../../include/numa.h"
+#include "../../include/swap.h"
+#include "../../include/vmstat.h"
+#include "../../include/vmalloc.h"
+#include "../../include/memblock.h"
+#include "../../include/memcontrol.h"
+#include "../../include/smp.h"
+#include "../../include/apic.h"
 
 #define KERNEL_VERSION "0.1.0"
 #define KERNEL_NAME "MicroKernel"
 
 static bool kernel_initialized = false;
 static struct task_struct *init_task = NULL;
-static struct mm_struct *init_mm = NULL;
 
 typedef long (*syscall_fn_t)(unsigned long, unsigned long, unsigned long,
                              unsigned long, unsigned long, unsigned long);
@@ -115,8 +128,10 @@ typedef long (*syscall_fn_t)(unsigned long, unsigned long, unsigned long,
 #define __NR_getrusage  98
 #define __NR_sysinfo    99
 #define __NR_times      100
+#define __NR_set_mempolicy   238
+#define __NR_memcg_ctl       239
 
-#define NR_syscalls     101
+#define NR_syscalls     240
 
 extern long sys_read(unsigned int fd, char __user *buf, size_t count);
 extern long sys_write(unsigned int fd, const char __user *buf, size_t count);
@@ -142,6 +157,9 @@ extern long sys_mmap(unsigned long addr, unsigned long len,
 extern long sys_munmap(unsigned long addr, size_t len);
 extern long sys_sysinfo(struct sysinfo __user *info);
 extern long sys_uname(struct utsname __user *name);
+extern long sys_set_mempolicy(int mode, const unsigned long __user *nmask,
+                              unsigned long maxnode);
+extern long sys_memcg_ctl(int cmd, int id, unsigned long arg);
 
 /* 系统调用表 */
 static const syscall_fn_t sys_call_table[NR_syscalls] = {
@@ -163,6 +181,8 @@ static const syscall_fn_t sys_call_table[NR_syscalls] = {
     [__NR_munmap]       = (syscall_fn_t)sys_munmap,
     [__NR_sysinfo]      = (syscall_fn_t)sys_sysinfo,
     [__NR_uname]        = (syscall_fn_t)sys_uname,
+    [__NR_set_mempolicy] = (syscall_fn_t)sys_set_mempolicy,
+    [__NR_memcg_ctl]    = (syscall_fn_t)sys_memcg_ctl,
 };
 
 int printk(const char *fmt, ...)
@@ -275,7 +295,7 @@ static struct task_struct *create_init_process(void)
     task->normal_prio = DEFAULT_PRIO;
     task->policy = SCHED_NORMAL;
 
-    task->cpus_allowed = (1UL << NR_CPUS) - 1;
+    task->cpus_allowed = CPU_MASK_ALL;
     task->nr_cpus_allowed = NR_CPUS;
 
     task->real_parent = task;
@@ -290,14 +310,37 @@ static struct task_struct *create_init_process(void)
     return task;
 }
 
-static void kernel_init(void)
+static void kernel_init(u32 magic, ulong mbi_phys)
 {
+    /* 自旋锁和每CPU数据都要用CPU号，GS基址必须最先设好 */
+    smp_setup_boot_cpu();
+    idt_setup();
+
     printk("Initializing %s %s\n", KERNEL_NAME, KERNEL_VERSION);
 
-    mm_init();
+    init_page_ops();
+
+    mm_init(magic, mbi_phys);
+    lapic_init();
     buddy_init();
+    numa_init();
+    build_all_zonelists();
+    mem_init();
+    vmstat_init();
+    kmem_cache_init();
+    mem_cgroup_init();
+    vmalloc_init();
+    swap_cache_init();
+    zswap_init();
 
     sched_init();
+    smp_init();
+    sched_init_domains();
+
+    kcompactd_init();
+    kswapd_init();
+    kzerod_init();
+    page_alloc_init_late();
 
     ipc_init();
 
@@ -309,20 +352,17 @@ static void kernel_init(void)
 
     init_task = create_init_process();
 
-    set_current(init_task);
-
     wake_up_new_task(init_task);
 
     kernel_initialized = true;
 }
 
-void kernel_main(void)
+void kernel_main(u32 magic, ulong mbi_phys)
 {
-    kernel_init();
-
-    schedule();
+    kernel_init(magic, mbi_phys);
 
-    panic("OOOOOOOO!!!!!! shit");
+    /* 启动栈从sched_init起就是BSP的空闲进程，和AP一样进空闲循环 */
+    cpu_startup_entry();
 }
 
 long do_syscall(unsigned long syscall_nr, unsigned long arg0,
@@ -518,6 +558,8 @@ void timer_interrupt(void)
 
     scheduler_tick();
 
+    vmstat_tick();
+
     run_timer_softirq();
 }
 
@@ -534,27 +576,27 @@ void handle_page_fault(unsigned long error_code)
 
     asm volatile("movq %%cr2, %0" : "=r" (address));
 
-    printk("Page fault at address 0x%lx, error code: 0x%lx\n",
-           address, error_code);
-
     do_page_fault(address, error_code);
 }
 
+volatile u64 jiffies;
+
 u64 get_jiffies_64(void)
 {
-    static u64 jiffies = 0;
-    return jiffies++;
+    return jiffies;
 }
 
 void update_jiffies(void)
 {
-    static u64 jiffies = 0;
     jiffies++;
 }
 
 u32 smp_processor_id(void)
 {
-    return 0;
+    u32 cpu;
+
+    asm volatile("movl %%gs:%c1, %0" : "=r" (cpu) : "i" (PCPU_CPU_NUMBER));
+    return cpu;
 }
 
 void cpu_relax(void)
@@ -589,15 +631,6 @@ void local_bh_enable(void)
 {
 }
 
-void *kmalloc(size_t size, gfp_t flags)
-{
-    return NULL;
-}
-
-void kfree(void *ptr)
-{
-}
-
 int strcmp(const char *s1, const char *s2)
 {
     while (*s1 && *s2 && *s1 == *s2) {
@@ -623,25 +656,136 @@ size_t strlen(const char *s)
     return len;
 }
 
+/* 允许非对齐访问的字类型，x86_64上非对齐读写只是稍慢 */
+typedef ulong __attribute__((__aligned__(1), may_alias)) ulong_unaligned;
+
+/* 头尾按字节处理到8字节对齐，中间整字写 */
 void *memset(void *s, int c, size_t n)
 {
     unsigned char *p = s;
+    ulong *w;
+    ulong word;
+
+    while (n && ((ulong)p & (sizeof(ulong) - 1))) {
+        *p++ = c;
+        n--;
+    }
+
+    if (n >= sizeof(ulong)) {
+        word = (unsigned char)c;
+        word |= word << 8;
+        word |= word << 16;
+        word |= word << 32;
+
+        w = (ulong *)p;
+        for (; n >= sizeof(ulong); n -= sizeof(ulong))
+            *w++ = word;
+        p = (unsigned char *)w;
+    }
+
     while (n--)
         *p++ = c;
+
     return s;
 }
 
+/* 按目标地址对齐，源地址可以不对齐 */
 void *memcpy(void *dest, const void *src, size_t n)
 {
     unsigned char *d = dest;
     const unsigned char *s = src;
+
+    while (n && ((ulong)d & (sizeof(ulong) - 1))) {
+        *d++ = *s++;
+        n--;
+    }
+
+    for (; n >= sizeof(ulong); n -= sizeof(ulong)) {
+        *(ulong *)d = *(const ulong_unaligned *)s;
+        d += sizeof(ulong);
+        s += sizeof(ulong);
+    }
+
     while (n--)
         *d++ = *s++;
+
     return dest;
 }
 
-void start_kernel(void)
+void *memmove(void *dest, const void *src, size_t n)
+{
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+
+    /* 目标在源之前或不重叠时，正向复制是安全的 */
+    if (d <= s || d >= s + n)
+        return memcpy(dest, src, n);
+
+    d += n;
+    s += n;
+
+    while (n && ((ulong)d & (sizeof(ulong) - 1))) {
+        *--d = *--s;
+        n--;
+    }
+
+    for (; n >= sizeof(ulong); n -= sizeof(ulong)) {
+        d -= sizeof(ulong);
+        s -= sizeof(ulong);
+        *(ulong *)d = *(const ulong_unaligned *)s;
+    }
+
+    while (n--)
+        *--d = *--s;
+
+    return dest;
+}
+
+int memcmp(const void *s1, const void *s2, size_t n)
+{
+    const u8 *a = s1;
+    const u8 *b = s2;
+
+    for (; n; n--, a++, b++) {
+        if (*a != *b)
+            return *a - *b;
+    }
+
+    return 0;
+}
+
+#define X86_FEATURE_ERMS    (1U << 9)   /* CPUID.(EAX=7,ECX=0):EBX */
+
+static inline void cpuid_count(u32 op, u32 count, u32 *eax, u32 *ebx,
+                               u32 *ecx, u32 *edx)
+{
+    asm volatile("cpuid"
+                 : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                 : "0" (op), "2" (count));
+}
+
+void (*clear_page_fn)(void *page) = clear_page_rep;
+void (*copy_page_fn)(void *to, void *from) = copy_page_rep;
+
+/* 支持ERMS的CPU上 rep stosb/movsb 比按8字节的版本更快 */
+void init_page_ops(void)
+{
+    u32 eax, ebx, ecx, edx;
+
+    cpuid_count(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 7)
+        return;
+
+    cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+    if (ebx & X86_FEATURE_ERMS) {
+        clear_page_fn = clear_page_erms;
+        copy_page_fn = copy_page_erms;
+        printk("Using ERMS for page clear/copy\n");
+    }
+}
+
+void start_kernel(u32 magic, ulong mbi_phys)
 {
     /* 这是内核的真正入口点 */
-    kernel_main();
+    kernel_main(magic, mbi_phys);
 }